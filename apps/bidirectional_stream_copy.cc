@@ -2,14 +2,125 @@
 
 #include "byte_stream.hh"
 #include "eventloop.hh"
+#include "exception.hh"
+#include "zerocopy_sender.hh"
 
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <fcntl.h>
 #include <iostream>
+#include <optional>
+#include <sys/stat.h>
 #include <unistd.h>
 
 using namespace std;
+using namespace std::chrono_literals;
 
-void bidirectional_stream_copy( Socket& socket, string_view peer_name )
+namespace {
+// A pipe through which splice(2) moves bytes from one fd to another without copying them into user space
+class SplicePipe
+{
+  FileDescriptor _read_end;
+  FileDescriptor _write_end;
+  size_t _capacity;
+  size_t _buffered {};
+  bool _refused {}; // the last splice into the pipe moved nothing for lack of room
+
+  static pair<FileDescriptor, FileDescriptor> make_pipe()
+  {
+    array<int, 2> fds {};
+    CheckSystemCall( "pipe2", ::pipe2( fds.data(), O_NONBLOCK | O_CLOEXEC ) );
+    return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+  }
+
+  explicit SplicePipe( pair<FileDescriptor, FileDescriptor>&& ends, const size_t capacity )
+    : _read_end( move( ends.first ) ), _write_end( move( ends.second ) ), _capacity( capacity )
+  {
+    // Growing the pipe fails (EPERM) for an unprivileged user if `capacity` is above /proc/sys/fs/pipe-max-size,
+    // and the pipe then keeps its default size (64 KiB). That is still worth splicing through, so a failure is not
+    // an error: the size the pipe actually has, as F_GETPIPE_SZ reports it, is the capacity from then on.
+    const int requested = static_cast<int>( _capacity );
+    static_cast<void>( ::fcntl( _write_end.fd_num(), F_SETPIPE_SZ, requested ) ); // NOLINT(*-vararg)
+    const int actual = ::fcntl( _write_end.fd_num(), F_GETPIPE_SZ );             // NOLINT(*-vararg)
+    _capacity = min( _capacity, static_cast<size_t>( CheckSystemCall( "fcntl", actual ) ) );
+  }
+
+public:
+  //! \param[in] capacity is the most the pipe will hold (less if the kernel will not grow it that far)
+  explicit SplicePipe( size_t capacity ) : SplicePipe( make_pipe(), capacity ) {}
+
+  bool empty() const { return _buffered == 0; }
+  bool full() const { return _buffered >= _capacity or _refused; }
+
+  // splice from `source` into the pipe
+  void fill( FileDescriptor& source )
+  {
+    const size_t moved = source.splice( _write_end, _capacity - _buffered );
+    _buffered += moved;
+    // The pipe's capacity is in pages, and a splice from a socket may take a page for a few bytes, so the pipe
+    // can fill up before _capacity bytes: it is full if it took nothing from a source with more to give.
+    _refused = moved == 0 and not source.eof() and not empty();
+  }
+
+  // splice from the pipe into `destination`
+  void drain( FileDescriptor& destination )
+  {
+    const size_t moved = _read_end.splice( destination, _buffered );
+    _buffered -= moved;
+    _refused = _refused and moved == 0;
+  }
+
+  // read whatever is in the pipe into `writer`, to carry on by copying
+  void spill( Writer& writer )
+  {
+    while ( not empty() ) {
+      string data;
+      data.resize( _buffered );
+      _read_end.read( data );
+      _buffered -= data.size();
+      writer.push( move( data ) );
+    }
+  }
+};
+
+// splice(2) can be tried from pipes, sockets and regular files; other fds (e.g., terminals) are copied
+bool spliceable_from( const FileDescriptor& fd )
+{
+  struct stat info {};
+  CheckSystemCall( "fstat", ::fstat( fd.fd_num(), &info ) );
+  return S_ISFIFO( info.st_mode ) or S_ISSOCK( info.st_mode ) or S_ISREG( info.st_mode );
+}
+
+// ... and into the same, except a file opened with O_APPEND (e.g., by the shell's >>), which splice refuses
+bool spliceable_into( const FileDescriptor& fd )
+{
+  const int flags = CheckSystemCall( "fcntl", ::fcntl( fd.fd_num(), F_GETFL ) ); // NOLINT(*-vararg)
+  return spliceable_from( fd ) and not( flags & O_APPEND ); // NOLINT(*-signed-bitwise)
+}
+
+// Run a splice, or if the kernel cannot splice these fds after all, move what is in the pipe to `stream` and
+// carry on by copying through it (the caller then copies at once, in place of the splice)
+template<class F>
+void splice_or_fall_back( optional<SplicePipe>& pipe, F&& splice, const bool source_done, Writer& stream )
+{
+  try {
+    splice();
+  } catch ( const unix_error& e ) {
+    if ( e.error_code() != EINVAL ) {
+      throw;
+    }
+    cerr << "DEBUG: Cannot splice (" << e.what() << "), copying instead.\n";
+    pipe->spill( stream );
+    pipe.reset();
+    if ( source_done ) {
+      stream.close();
+    }
+  }
+}
+
+// With a ZeroCopySender, the outbound stream's chunks are handed over to it instead of being copied to the socket
+void copy_streams( Socket& socket, string_view peer_name, ZeroCopySender* zerocopy )
 {
   constexpr size_t buffer_size = 1048576;
 
@@ -25,12 +136,36 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
   _input.set_blocking( false );
   _output.set_blocking( false );
 
+  // Where both ends of a direction are kernel fds that support it, relay through a pipe with splice(2) instead
+  // of through the ByteStream (which that direction then uses only if splicing turns out to fail). Zero-copy
+  // sends need the bytes in user space, so they rule out splicing outbound.
+  optional<SplicePipe> _outbound_pipe;
+  optional<SplicePipe> _inbound_pipe;
+  bool _outbound_source_done { false }; // stdin is finished (while splicing, in place of closing _outbound)
+  bool _inbound_source_done { false };  // the socket is finished (likewise)
+  if ( not zerocopy and spliceable_from( _input ) and spliceable_into( socket ) ) {
+    _outbound_pipe.emplace( buffer_size );
+  }
+  if ( spliceable_from( socket ) and spliceable_into( _output ) ) {
+    _inbound_pipe.emplace( buffer_size );
+  }
+
   // rule 1: read from stdin into outbound byte stream
   _eventloop.add_rule(
     "read from stdin into outbound byte stream",
     _input,
     Direction::In,
     [&] {
+      if ( _outbound_pipe ) {
+        const auto splice = [&] {
+          _outbound_pipe->fill( _input );
+          _outbound_source_done = _input.eof();
+        };
+        splice_or_fall_back( _outbound_pipe, splice, _outbound_source_done, _outbound.writer() );
+        if ( _outbound_pipe ) {
+          return;
+        }
+      }
       string data;
       data.resize( _outbound.writer().available_capacity() );
       _input.read( data );
@@ -40,33 +175,83 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
       }
     },
     [&] {
+      if ( _outbound_pipe ) {
+        return !_outbound.has_error() and !_inbound.has_error() and !_outbound_pipe->full()
+               and !_outbound_source_done;
+      }
       return !_outbound.has_error() and !_inbound.has_error() and ( _outbound.writer().available_capacity() > 0 )
              and !_outbound.writer().is_closed();
     },
-    [&] { _outbound.writer().close(); },
+    [&] {
+      _outbound_source_done = true;
+      if ( not _outbound_pipe ) {
+        _outbound.writer().close();
+      }
+    },
     [&] {
       cerr << "DEBUG: Outbound stream had error from source.\n";
       _outbound.set_error();
       _inbound.set_error();
     } );
 
+  // Once the outbound stream is finished, keep the loop going until the kernel has released the zero-copy buffers
+  // (the error-queue handler reaps them as the peer acknowledges the last bytes), so that the sender is not
+  // destroyed while holding them. The timer reaps too, in case no rule watches the socket any more; after ten
+  // seconds it gives up, and leaves what is still held to the sender's destructor.
+  optional<EventLoop::RuleHandle> _zerocopy_drain;
+  const auto drain_zerocopy = [&] {
+    if ( not zerocopy or zerocopy->buffers_held() == 0 ) {
+      return;
+    }
+    const auto deadline = chrono::steady_clock::now() + 10s;
+    _zerocopy_drain = _eventloop.add_periodic_timer( "reap zero-copy completions", 50ms, [&, deadline] {
+      zerocopy->reap();
+      if ( zerocopy->buffers_held() == 0 or chrono::steady_clock::now() >= deadline ) {
+        _zerocopy_drain->cancel();
+      }
+    } );
+  };
+
   // rule 2: read from outbound byte stream into socket
   _eventloop.add_rule(
     "read from outbound byte stream into socket",
     socket,
     Direction::Out,
     [&] {
-      if ( _outbound.reader().bytes_buffered() ) {
+      if ( _outbound_pipe ) {
+        const auto splice = [&] { _outbound_pipe->drain( socket ); };
+        splice_or_fall_back( _outbound_pipe, splice, _outbound_source_done, _outbound.writer() );
+        if ( _outbound_pipe ) {
+          if ( _outbound_pipe->empty() and _outbound_source_done ) {
+            socket.shutdown( SHUT_WR );
+            _outbound_shutdown = true;
+            cerr << "DEBUG: Outbound stream to " << peer_name << " finished (spliced).\n";
+          }
+          return;
+        }
+      }
+      if ( zerocopy ) {
+        zerocopy->reap();
+        if ( zerocopy->bytes_unsent() == 0 and _outbound.reader().bytes_buffered() ) {
+          zerocopy->push( _outbound.reader().pop_chunk() );
+        }
+        zerocopy->send();
+      } else if ( _outbound.reader().bytes_buffered() ) {
         _outbound.reader().pop( socket.write( _outbound.reader().peek() ) );
       }
-      if ( _outbound.reader().is_finished() ) {
+      if ( _outbound.reader().is_finished() and not( zerocopy and zerocopy->bytes_unsent() ) ) {
         socket.shutdown( SHUT_WR );
         _outbound_shutdown = true;
         cerr << "DEBUG: Outbound stream to " << peer_name << " finished.\n";
+        drain_zerocopy();
       }
     },
     [&] {
-      return _outbound.reader().bytes_buffered() or ( _outbound.reader().is_finished() and not _outbound_shutdown );
+      if ( _outbound_pipe ) {
+        return !_outbound_pipe->empty() or ( _outbound_source_done and not _outbound_shutdown );
+      }
+      return _outbound.reader().bytes_buffered() or ( zerocopy and zerocopy->bytes_unsent() )
+             or ( _outbound.reader().is_finished() and not _outbound_shutdown );
     },
     [&] { _outbound.writer().close(); },
     [&] {
@@ -81,6 +266,16 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
     socket,
     Direction::In,
     [&] {
+      if ( _inbound_pipe ) {
+        const auto splice = [&] {
+          _inbound_pipe->fill( socket );
+          _inbound_source_done = socket.eof();
+        };
+        splice_or_fall_back( _inbound_pipe, splice, _inbound_source_done, _inbound.writer() );
+        if ( _inbound_pipe ) {
+          return;
+        }
+      }
       string data;
       data.resize( _inbound.writer().available_capacity() );
       socket.read( data );
@@ -90,10 +285,19 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
       }
     },
     [&] {
+      if ( _inbound_pipe ) {
+        return !_inbound.has_error() and !_outbound.has_error() and !_inbound_pipe->full()
+               and !_inbound_source_done;
+      }
       return !_inbound.has_error() and !_outbound.has_error() and ( _inbound.writer().available_capacity() > 0 )
              and !_inbound.writer().is_closed();
     },
-    [&] { _inbound.writer().close(); },
+    [&] {
+      _inbound_source_done = true;
+      if ( not _inbound_pipe ) {
+        _inbound.writer().close();
+      }
+    },
     [&] {
       cerr << "DEBUG: Inbound stream had error from source.\n";
       _outbound.set_error();
@@ -106,6 +310,18 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
     _output,
     Direction::Out,
     [&] {
+      if ( _inbound_pipe ) {
+        const auto splice = [&] { _inbound_pipe->drain( _output ); };
+        splice_or_fall_back( _inbound_pipe, splice, _inbound_source_done, _inbound.writer() );
+        if ( _inbound_pipe ) {
+          if ( _inbound_pipe->empty() and _inbound_source_done ) {
+            _output.close();
+            _inbound_shutdown = true;
+            cerr << "DEBUG: Inbound stream from " << peer_name << " finished (spliced).\n";
+          }
+          return;
+        }
+      }
       if ( _inbound.reader().bytes_buffered() ) {
         _inbound.reader().pop( _output.write( _inbound.reader().peek() ) );
       }
@@ -117,6 +333,9 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
       }
     },
     [&] {
+      if ( _inbound_pipe ) {
+        return !_inbound_pipe->empty() or ( _inbound_source_done and not _inbound_shutdown );
+      }
       return _inbound.reader().bytes_buffered() or ( _inbound.reader().is_finished() and not _inbound_shutdown );
     },
     [&] { _inbound.writer().close(); },
@@ -126,6 +345,11 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
       _inbound.set_error();
     } );
 
+  // completions of zero-copy writes, which release the chunks
+  if ( zerocopy ) {
+    _eventloop.set_error_queue_handler( socket, [&] { zerocopy->reap(); } );
+  }
+
   // loop until completion
   while ( true ) {
     if ( EventLoop::Result::Exit == _eventloop.wait_next_event( -1 ) ) {
@@ -133,3 +357,24 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
     }
   }
 }
+} // namespace
+
+void bidirectional_stream_copy( Socket& socket, string_view peer_name )
+{
+  copy_streams( socket, peer_name, nullptr );
+}
+
+void bidirectional_stream_copy( TCPSocket& socket, string_view peer_name, const bool zerocopy )
+{
+  if ( not zerocopy ) {
+    copy_streams( socket, peer_name, nullptr );
+    return;
+  }
+
+  // copy_streams() returns once the kernel has released the sender's buffers (or has held them for ten seconds
+  // past the end of the outbound stream), so the sender is normally destroyed holding none.
+  ZeroCopySender sender { socket };
+  copy_streams( socket, peer_name, &sender );
+  cerr << "DEBUG: " << sender.zerocopy_writes() << " zero-copy writes (" << sender.copied_writes()
+       << " copied by the kernel), " << sender.plain_writes() << " plain writes.\n";
+}
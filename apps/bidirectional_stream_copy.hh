@@ -4,3 +4,6 @@
 
 //! Copy socket input/output to stdin/stdout until finished
 void bidirectional_stream_copy( Socket& socket, std::string_view peer_name );
+
+//! As above, optionally sending large writes to the socket with MSG_ZEROCOPY (see ZeroCopySender)
+void bidirectional_stream_copy( TCPSocket& socket, std::string_view peer_name, bool zerocopy );
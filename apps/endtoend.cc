@@ -6,6 +6,7 @@
 #include "tcp_minnow_socket_impl.hh"
 #include "tcp_over_ip.hh"
 
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
 #include <thread>
@@ -65,17 +66,17 @@ string summary( const EthernetFrame& frame )
   return out;
 }
 
-optional<EthernetFrame> maybe_receive_frame( FileDescriptor& fd )
+// Room for the largest frame the old three-part read could take in
+constexpr size_t kFrameBufferSize = EthernetHeader::LENGTH + IPv4Header::LENGTH + 16384;
+
+// The frame is parsed straight out of a pooled buffer, which goes back to `pool` once the frame has copied out
+// its payload
+optional<EthernetFrame> maybe_receive_frame( FileDescriptor& fd, BufferPool& pool )
 {
-  vector<string> strs( 3 );
-  strs.at( 0 ).resize( EthernetHeader::LENGTH );
-  strs.at( 1 ).resize( IPv4Header::LENGTH );
-  fd.read( strs );
+  const PooledBuffer buffer = fd.read( pool );
 
   EthernetFrame frame;
-  vector<string> buffers;
-  ranges::transform( strs, back_inserter( buffers ), identity() );
-  if ( not parse( frame, buffers ) ) {
+  if ( not parse( frame, buffer.view() ) ) {
     return {};
   }
 
@@ -103,6 +104,7 @@ private:
   };
 
   shared_ptr<Sender> sender_ = make_shared<Sender>();
+  shared_ptr<BufferPool> _receive_buffers = make_shared<BufferPool>( kFrameBufferSize, 16 );
   NetworkInterface _interface;
   Address _next_hop;
 
@@ -114,7 +116,7 @@ public:
 
   optional<TCPMessage> read()
   {
-    auto frame_opt = maybe_receive_frame( sender_->sockets.first );
+    auto frame_opt = maybe_receive_frame( sender_->sockets.first, *_receive_buffers );
     if ( not frame_opt ) {
       return {};
     }
@@ -132,8 +134,13 @@ public:
     _interface.datagrams_received().pop();
     return unwrap_tcp_in_ip( dgram );
   }
-  void write( const TCPMessage& msg ) { _interface.send_datagram( wrap_tcp_in_ip( msg ), _next_hop ); }
+  void write( const TCPMessage& msg )
+  {
+    segment_tcp_in_ip( msg,
+                       [&]( const InternetDatagram& dgram ) { _interface.send_datagram( dgram, _next_hop ); } );
+  }
   void tick( const size_t ms_since_last_tick ) { _interface.tick( ms_since_last_tick ); }
+  optional<uint64_t> ms_until_deadline() const { return _interface.ms_until_deadline(); }
   NetworkInterface& interface() { return _interface; }
 
   FileDescriptor& fd() { return sender_->sockets.first; }
@@ -233,15 +240,16 @@ void program_body( bool is_client, const string& bounce_host, const string& boun
   TCPSocketEndToEnd sock = is_client ? TCPSocketEndToEnd { Address { "192.168.0.50" }, Address { "192.168.0.1" } }
                                      : TCPSocketEndToEnd { Address { "172.16.0.100" }, Address { "172.16.0.1" } };
 
-  atomic<bool> exit_flag {};
+  EventLoop event_loop;
+  bool network_done = false; // only touched on the network thread, by a task posted to its loop
 
   /* set up the network */
   thread network_thread( [&]() {
     try {
-      EventLoop event_loop;
+      BufferPool frame_buffers { kFrameBufferSize, 16 }; // for frames arriving at the router
       // Frames from host to router
       event_loop.add_rule( "frames from host to router", sock.adapter().frame_fd(), Direction::In, [&] {
-        auto frame_opt = maybe_receive_frame( sock.adapter().frame_fd() );
+        auto frame_opt = maybe_receive_frame( sock.adapter().frame_fd(), frame_buffers );
         if ( not frame_opt ) {
           return;
         }
@@ -268,44 +276,63 @@ void program_body( bool is_client, const string& bounce_host, const string& boun
         },
         [&] { return not router_to_host->frames.empty(); } );
 
-      // Frames from router to Internet
+      // Frames from router to Internet, up to a batch per sendmmsg
+      vector<vector<string>> outgoing_frames;
+      vector<DatagramSocket::OutgoingDatagram> outgoing_datagrams;
       event_loop.add_rule(
         "frames from router to Internet",
         internet_socket,
         Direction::Out,
         [&] {
           auto& f = router_to_internet;
-          if ( debug ) {
-            cerr << "     Router->Internet: " << summary( f->frames.front() ) << "\n";
+          outgoing_frames.clear();
+          outgoing_datagrams.clear();
+          while ( not f->frames.empty() and outgoing_frames.size() < DatagramSocket::kMaxBatch ) {
+            if ( debug ) {
+              cerr << "     Router->Internet: " << summary( f->frames.front() ) << "\n";
+            }
+            outgoing_frames.push_back( serialize( f->frames.front() ) );
+            f->frames.pop();
           }
-          internet_socket.write( serialize( f->frames.front() ) );
-          f->frames.pop();
+          for ( const auto& frame : outgoing_frames ) {
+            outgoing_datagrams.push_back( { { frame.begin(), frame.end() } } );
+          }
+          internet_socket.send_batch( outgoing_datagrams );
         },
         [&] { return not router_to_internet->frames.empty(); } );
 
-      // Frames from Internet to router
+      // Frames from Internet to router, up to a batch per recvmmsg
+      vector<DatagramSocket::ReceivedDatagram> incoming_datagrams;
       event_loop.add_rule( "frames from Internet to router", internet_socket, Direction::In, [&] {
-        auto frame_opt = maybe_receive_frame( internet_socket );
-        if ( not frame_opt ) {
-          return;
-        }
-        EthernetFrame frame = move( frame_opt.value() );
-        if ( debug ) {
-          cerr << "     Internet->router: " << summary( frame ) << "\n";
+        incoming_datagrams.clear();
+        internet_socket.recv_batch( frame_buffers, incoming_datagrams, DatagramSocket::kMaxBatch );
+        for ( const auto& datagram : incoming_datagrams ) {
+          EthernetFrame frame;
+          if ( not parse( frame, datagram.payload.view() ) ) {
+            continue;
+          }
+          if ( debug ) {
+            cerr << "     Internet->router: " << summary( frame ) << "\n";
+          }
+          router.interface( internet_side )->recv_frame( frame );
         }
-        router.interface( internet_side )->recv_frame( frame );
+        incoming_datagrams.clear(); // return the buffers to the pool
         router.route();
       } );
 
-      while ( true ) {
-        if ( EventLoop::Result::Exit == event_loop.wait_next_event( 10 ) ) {
-          cerr << "Exiting...\n";
-          return;
-        }
-        router.interface( host_side )->tick( 10 );
-        router.interface( internet_side )->tick( 10 );
+      // Time passing on the router's interfaces
+      auto last_tick = chrono::steady_clock::now();
+      event_loop.add_periodic_timer( "tick router interfaces", chrono::milliseconds { 10 }, [&] {
+        const auto now = chrono::steady_clock::now();
+        const auto elapsed = chrono::duration_cast<chrono::milliseconds>( now - last_tick );
+        last_tick += elapsed;
+        router.interface( host_side )->tick( elapsed.count() );
+        router.interface( internet_side )->tick( elapsed.count() );
+      } );
 
-        if ( exit_flag ) {
+      while ( not network_done ) {
+        if ( EventLoop::Result::Exit == event_loop.wait_next_event( -1 ) ) {
+          cerr << "Exiting...\n";
           return;
         }
       }
@@ -329,7 +356,7 @@ void program_body( bool is_client, const string& bounce_host, const string& boun
   }
 
   cerr << "Exiting... ";
-  exit_flag = true;
+  event_loop.post( [&] { network_done = true; } );
   network_thread.join();
   cerr << "done.\n";
 }
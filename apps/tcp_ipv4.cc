@@ -1,18 +1,24 @@
 #include "bidirectional_stream_copy.hh"
 #include "tcp_config.hh"
 #include "tcp_minnow_socket.hh"
+#include "tcp_stack.hh"
 #include "tun.hh"
 
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <optional>
 #include <random>
 #include <span>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <tuple>
 
 using namespace std;
+using namespace std::chrono_literals;
 
 constexpr const char* TUN_DFLT = "tun144";
 constexpr const char* LOCAL_ADDRESS_DFLT = "169.254.144.9";
@@ -33,10 +39,20 @@ void show_usage( const char* argv0, const char* msg )
        << "   -w <winsz>      Use a window of <winsz> bytes                   " << TCPConfig::MAX_PAYLOAD_SIZE
        << "\n\n"
 
+       << "   -W <maxsz>      Auto-tune buffers up to <maxsz> bytes           (fixed buffers)\n"
+       << "                   (the receive buffer to at most 65535)\n\n"
+
+       << "   -T              Send up to 64 KiB per segment, cut up by the    (off)\n"
+       << "                   adapter (segmentation offload)\n\n"
+
        << "   -t <tmout>      Set rt_timeout to tmout                         " << TCPConfig::TIMEOUT_DFLT << "\n\n"
 
        << "   -d <tundev>     Connect to tun <tundev>                         " << TUN_DFLT << "\n\n"
 
+       << "   -U              Carry the connection on a TCPStack that reads   (off)\n"
+       << "                   and writes the tun through io_uring (not with\n"
+       << "                   -T, -Lu or -Ld)\n\n"
+
        << "   -Lu <loss>      Set uplink loss to <rate> (float in 0..1)       (no loss)\n"
        << "   -Ld <loss>      Set downlink loss to <rate> (float in 0..1)     (no loss)\n\n"
 
@@ -56,7 +72,7 @@ void check_argc( const span<char*>& args, size_t curr, const char* err )
   }
 }
 
-tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char*>& args )
+tuple<TCPConfig, FdAdapterConfig, bool, const char*, bool> get_config( const span<char*>& args )
 {
   TCPConfig c_fsm {};
   c_fsm.isn = Wrap32 { random_device()() };
@@ -66,6 +82,7 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
 
   size_t curr = 1;
   bool listen = false;
+  bool io_uring = false;
   const size_t argc = args.size();
 
   string source_address = LOCAL_ADDRESS_DFLT;
@@ -91,6 +108,15 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
       c_fsm.recv_capacity = strtol( args[curr + 1], nullptr, 0 );
       curr += 2;
 
+    } else if ( strncmp( "-W", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -W requires one argument." );
+      c_fsm.recv_capacity_max = c_fsm.send_capacity_max = strtol( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-T", args[curr], 3 ) == 0 ) {
+      c_fsm.max_payload_size = TCPConfig::MAX_OFFLOAD_SIZE;
+      curr += 1;
+
     } else if ( strncmp( "-t", args[curr], 3 ) == 0 ) {
       check_argc( args, curr, "ERROR: -t requires one argument." );
       c_fsm.rt_timeout = strtol( args[curr + 1], nullptr, 0 );
@@ -101,6 +127,10 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
       tundev = args[curr + 1];
       curr += 2;
 
+    } else if ( strncmp( "-U", args[curr], 3 ) == 0 ) {
+      io_uring = true;
+      curr += 1;
+
     } else if ( strncmp( "-Lu", args[curr], 3 ) == 0 ) {
       check_argc( args, curr, "ERROR: -Lu requires one argument." );
       const float lossrate = strtof( args[curr + 1], nullptr );
@@ -127,6 +157,13 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
     }
   }
 
+  if ( io_uring
+       and ( c_fsm.max_payload_size != TCPConfig::MAX_PAYLOAD_SIZE or c_filt.loss_rate_up != 0
+             or c_filt.loss_rate_dn != 0 ) ) {
+    show_usage( args[0], "ERROR: -U cannot be combined with -T, -Lu or -Ld." );
+    exit( 1 );
+  }
+
   // parse positional command-line arguments
   if ( listen ) {
     c_filt.source = { "0", args[curr + 1] };
@@ -139,7 +176,34 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
     c_filt.source = { source_address, source_port };
   }
 
-  return make_tuple( c_fsm, c_filt, listen, tundev );
+  return make_tuple( c_fsm, c_filt, listen, tundev, io_uring );
+}
+
+// Carry the connection on a TCPStack, which reads and writes the tun through io_uring
+void run_on_tcp_stack( TunFD&& tun, const TCPConfig& c_fsm, const FdAdapterConfig& c_filt, bool listen )
+{
+  TCPStack stack { move( tun ), TCPStack::DeviceIO::IOUring };
+
+  optional<LocalStreamSocket> socket;
+  Address peer_address = c_filt.destination;
+  if ( listen ) {
+    TCPListener listener = stack.listen( c_fsm, c_filt.source, 1 );
+    optional<AcceptedConnection> connection = listener.accept();
+    if ( not connection.has_value() ) {
+      throw runtime_error( "TCPStack shut down before a connection arrived" );
+    }
+    socket.emplace( move( connection->socket ) );
+    peer_address = connection->peer_address;
+  } else {
+    socket.emplace( stack.connect( c_fsm, c_filt.source, c_filt.destination ) );
+  }
+
+  bidirectional_stream_copy( socket.value(), peer_address.to_string() );
+
+  // let the connection finish closing (including lingering) before the stack abandons it
+  while ( stack.connection_count() > 0 ) {
+    this_thread::sleep_for( 10ms );
+  }
 }
 } // namespace
 
@@ -157,7 +221,12 @@ int main( int argc, char** argv )
       return EXIT_FAILURE;
     }
 
-    auto [c_fsm, c_filt, listen, tun_dev_name] = get_config( args );
+    auto [c_fsm, c_filt, listen, tun_dev_name, io_uring] = get_config( args );
+    if ( io_uring ) {
+      run_on_tcp_stack( TunFD( tun_dev_name == nullptr ? TUN_DFLT : tun_dev_name ), c_fsm, c_filt, listen );
+      return EXIT_SUCCESS;
+    }
+
     LossyTCPOverIPv4MinnowSocket tcp_socket( LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>(
       TCPOverIPv4OverTunFdAdapter( TunFD( tun_dev_name == nullptr ? TUN_DFLT : tun_dev_name ) ) ) );
 
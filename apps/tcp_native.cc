@@ -9,7 +9,8 @@ using namespace std;
 
 void show_usage( const char* argv0 )
 {
-  cerr << "Usage: " << argv0 << " [-l] <host> <port>\n\n"
+  cerr << "Usage: " << argv0 << " [-z] [-l] <host> <port>\n\n"
+       << "  -z sends large writes with MSG_ZEROCOPY\n"
        << "  -l specifies listen mode; <host>:<port> is the listening address." << endl;
 }
 
@@ -21,11 +22,18 @@ int main( int argc, char** argv )
     }
 
     auto args = span( argv, argc );
+    const char* const program = args[0];
+
+    const bool zerocopy = argc > 1 and strncmp( "-z", args[1], 3 ) == 0;
+    if ( zerocopy ) {
+      args = args.subspan( 1 );
+      argc--;
+    }
 
     bool server_mode = false;
     // NOLINTNEXTLINE(bugprone-assignment-*)
     if ( argc < 3 || ( ( server_mode = ( strncmp( "-l", args[1], 3 ) == 0 ) ) && argc < 4 ) ) {
-      show_usage( args[0] );
+      show_usage( program );
       return EXIT_FAILURE;
     }
 
@@ -49,7 +57,7 @@ int main( int argc, char** argv )
       return connecting_socket;
     }();
 
-    bidirectional_stream_copy( socket, socket.peer_address().to_string() );
+    bidirectional_stream_copy( socket, socket.peer_address().to_string(), zerocopy );
   } catch ( const exception& e ) {
     cerr << "Exception: " << e.what() << endl;
     return EXIT_FAILURE;
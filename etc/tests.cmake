@@ -54,8 +54,36 @@ ttest(send_ack)
 ttest(send_close)
 ttest(send_extra)
 
+ttest(peer_delayed_ack)
+ttest(peer_prediction)
+ttest(peer_autotune)
+
 ttest(net_interface)
 
+ttest(tcp_over_ip_offload)
+ttest(connection_table)
+ttest(tcp_stack)
+ttest(spsc_ring)
+ttest(file_descriptor)
+ttest(buffer_pool)
+ttest(datagram_batch)
+ttest(zerocopy_sender)
+ttest(eventfd)
+ttest(eventloop_epoll)
+ttest(eventloop_dispatch)
+ttest(eventloop_timers)
+ttest(eventloop_post)
+ttest(mpsc_queue)
+ttest(work_stealing_deque)
+ttest(executor)
+ttest(coroutine)
+ttest(eventloop_busy_poll)
+ttest(eventloop_instrumentation)
+ttest(sharded_tcp_stack)
+ttest(tcp_direct_socket)
+ttest(timing_wheel)
+ttest(io_uring)
+
 ttest(router)
 
 add_custom_target (check0 COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --stop-on-failure --timeout 12 -R 'webget|^byte_stream_')
@@ -90,3 +118,5 @@ set_tests_properties(${compile_name_opt} PROPERTIES FIXTURES_SETUP compile_opt)
 
 stest(byte_stream_speed_test)
 stest(reassembler_speed_test)
+stest(eventloop_speed_test)
+stest(datagram_speed_test)
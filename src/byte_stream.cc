@@ -4,6 +4,12 @@ using namespace std;
 
 ByteStream::ByteStream( uint64_t capacity ) : capacity_( capacity ) {}
 
+void ByteStream::set_capacity( uint64_t capacity )
+{
+  // 已经在缓冲区中的字节不能丢弃，因此缩小时最多缩到 total_buffered_
+  capacity_ = max( capacity, total_buffered_ );
+}
+
 bool Writer::is_closed() const
 {
   return closed_;
@@ -71,6 +77,20 @@ void Reader::pop( uint64_t len )
   }
 }
 
+string Reader::pop_chunk()
+{
+  if ( stream_.empty() ) {
+    return {};
+  }
+  string chunk = move( stream_.front() );
+  stream_.pop();
+  chunk.erase( 0, removed_prefix_ ); // 仅当之前 pop() 过该字符串的一部分时才需移动数据
+  removed_prefix_ = 0;
+  total_buffered_ -= chunk.size();
+  total_popped_ += chunk.size();
+  return chunk;
+}
+
 uint64_t Reader::bytes_buffered() const
 {
   return total_buffered_;
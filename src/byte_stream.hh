@@ -33,6 +33,12 @@ public:
   // 检查流中是否发生错误的函数
   bool has_error() const { return error_; };
 
+  // 返回 ByteStream 的容量
+  uint64_t capacity() const { return capacity_; }
+
+  // 调整 ByteStream 的容量（用于缓冲区自动调优）；容量不会被缩小到当前已缓冲的字节数以下
+  void set_capacity( uint64_t capacity );
+
 protected:
   // ByteStream 的状态和数据存储
   uint64_t capacity_;                 // ByteStream 的容量
@@ -82,6 +88,9 @@ public:
   // 从缓冲区中移除 len 个字节
   void pop( uint64_t len );
 
+  // 移除并返回队列中的第一个字符串（即 peek() 所见的内容），调用者由此接管其内存而无需复制（例如用于零拷贝发送）
+  std::string pop_chunk();
+
   // 检查流是否已完成（关闭并且所有字节已被弹出）
   bool is_finished() const;
 
@@ -99,11 +99,34 @@ void NetworkInterface::recv_frame( const EthernetFrame& frame )
 void NetworkInterface::tick( const size_t ms_since_last_tick )
 {
   // Your code here.
-  erase_if( ARP_cache_, [&]( auto&& item ) noexcept -> bool {
-    return item.second.second.tick( ms_since_last_tick ).expired( ARP_ENTRY_TTL_ms );
-  } );
+  // libstdc++ 12's erase_if hands the predicate a const element, so the timers are advanced first
+  for ( auto& [ip, entry] : ARP_cache_ ) {
+    entry.second.tick( ms_since_last_tick );
+  }
+  for ( auto& [ip, timer] : waitting_timer_ ) {
+    timer.tick( ms_since_last_tick );
+  }
+
+  erase_if( ARP_cache_,
+            [&]( auto&& item ) noexcept -> bool { return item.second.second.expired( ARP_ENTRY_TTL_ms ); } );
+
+  erase_if( waitting_timer_,
+            [&]( auto&& item ) noexcept -> bool { return item.second.expired( ARP_RESPONSE_TTL_ms ); } );
+}
 
-  erase_if( waitting_timer_, [&]( auto&& item ) noexcept -> bool {
-    return item.second.tick( ms_since_last_tick ).expired( ARP_RESPONSE_TTL_ms );
-  } );
+optional<size_t> NetworkInterface::ms_until_deadline() const
+{
+  optional<size_t> deadline;
+  auto consider = [&]( const Timer& timer, const size_t TTL_ms ) {
+    const size_t left = timer.expired( TTL_ms ) ? 0 : TTL_ms - timer.elapsed();
+    deadline = min( deadline.value_or( left ), left );
+  };
+
+  for ( const auto& [ip, entry] : ARP_cache_ ) {
+    consider( entry.second, ARP_ENTRY_TTL_ms );
+  }
+  for ( const auto& [ip, timer] : waitting_timer_ ) {
+    consider( timer, ARP_RESPONSE_TTL_ms );
+  }
+  return deadline;
 }
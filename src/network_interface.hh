@@ -8,6 +8,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <optional>
 #include <queue>
 #include <unordered_map>
 #include <utility>
@@ -66,6 +67,10 @@ public:
   // Called periodically when time elapses
   void tick( size_t ms_since_last_tick );
 
+  // Milliseconds until an ARP cache entry or pending ARP request expires (empty if there is none), i.e. the
+  // longest the owner may wait before calling tick()
+  std::optional<size_t> ms_until_deadline() const;
+
   // Accessors
   const std::string& name() const { return name_; }
   const OutputPort& output() const { return *port_; }
@@ -99,6 +104,7 @@ private:
     size_t _ms {};
     constexpr Timer& tick( const size_t& ms_since_last_tick ) noexcept { return _ms += ms_since_last_tick, *this; }
     [[nodiscard]] constexpr bool expired( const size_t& TTL_ms ) const noexcept { return _ms >= TTL_ms; }
+    [[nodiscard]] constexpr size_t elapsed() const noexcept { return _ms; }
   };
 
   using AddressNumeric = decltype( ip_address_.ipv4_numeric() );
@@ -63,6 +63,16 @@ void Reassembler::insert( uint64_t first_index, string data, bool is_last_substr
     return;
   }
 
+  // 快速路径：没有暂存的乱序数据、数据段恰好从下一个待写入的位置开始且能完整放入时，直接写入字节流
+  if ( buffer_.empty() and first_index == writer().bytes_pushed()
+       and size( data ) <= writer().available_capacity() ) {
+    if ( not end_index_.has_value() and is_last_substring ) {
+      end_index_.emplace( first_index + size( data ) );
+    }
+    output_.writer().push( move( data ) );
+    return try_close();
+  }
+
   // Reassembler's internal storage: [unassembled_index, unacceptable_index)
   // 调整数据段以适应流的容量
   // 未经重组器整理的字节起始位置
@@ -113,6 +123,15 @@ void Reassembler::insert( uint64_t first_index, string data, bool is_last_substr
   return try_close();
 }
 
+void Reassembler::set_capacity( uint64_t capacity )
+{
+  // 缓冲区中最后一个子串的结束位置决定了容量的下限，否则已暂存的数据会超出窗口
+  const uint64_t pending_extent { buffer_.empty() ? 0
+                                                  : buffer_.rbegin()->first + size( buffer_.rbegin()->second )
+                                                      - writer().bytes_pushed() };
+  output_.set_capacity( max( capacity, output_.reader().bytes_buffered() + pending_extent ) );
+}
+
 uint64_t Reassembler::bytes_pending() const
 {
   return total_pending_;
@@ -46,6 +46,10 @@ public:
   // How many bytes are stored in the Reassembler itself?
   uint64_t bytes_pending() const;
 
+  // Resize the output stream (for buffer auto-tuning). Never shrinks below what is already buffered,
+  // including bytes stored in the Reassembler waiting for earlier gaps to be filled in.
+  void set_capacity( uint64_t capacity );
+
   // Access output stream reader
   Reader& reader() { return output_.reader(); }
   const Reader& reader() const { return output_.reader(); }
@@ -0,0 +1,185 @@
+#include "sharded_tcp_stack.hh"
+
+#include "exception.hh"
+#include "parser.hh"
+#include "tcp_over_ip.hh"
+
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+constexpr size_t MAX_RECEIVE_BURST = 64; // most datagrams read from the device per event
+constexpr size_t SHARD_QUEUE_SIZE = 4096;
+
+// CPUs this process may run on (a container or taskset can allow fewer, and other, CPUs than the machine has)
+vector<size_t> allowed_cpus()
+{
+  cpu_set_t cpus;
+  CPU_ZERO( &cpus );
+  CheckSystemCall( "sched_getaffinity", ::sched_getaffinity( 0, sizeof( cpus ), &cpus ) );
+  vector<size_t> ret;
+  for ( size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu ) {
+    if ( CPU_ISSET( cpu, &cpus ) ) {
+      ret.push_back( cpu );
+    }
+  }
+  return ret;
+}
+
+// Pinning only helps locality, so a thread that cannot be pinned carries on wherever the scheduler puts it
+void pin_to_cpu( thread& t, size_t cpu )
+{
+  cpu_set_t cpus;
+  CPU_ZERO( &cpus );
+  CPU_SET( cpu, &cpus );
+  if ( const int err = pthread_setaffinity_np( t.native_handle(), sizeof( cpus ), &cpus ) ) {
+    cerr << "Warning: ShardedTCPStack could not pin a thread to CPU " << cpu << ": "
+         << unix_error { "pthread_setaffinity_np", err }.what() << "\n";
+  }
+}
+} // namespace
+
+ShardedTCPStack::ShardedTCPStack( FileDescriptor&& ip_device, size_t shards, const bool pin_threads )
+  : _device( move( ip_device ) )
+{
+  const vector<size_t> cpus = allowed_cpus();
+  if ( shards == 0 ) {
+    shards = max<size_t>( cpus.size(), 1 );
+  }
+  _dispatch_counters = make_unique<DispatchCounters[]>( shards );
+
+  for ( size_t i = 0; i < shards; ++i ) {
+    auto inbound = make_unique<TCPStack::Inbound>( SHARD_QUEUE_SIZE );
+    _inbound.push_back( inbound.get() );
+    // each shard writes through its own descriptor for the device
+    FileDescriptor device { CheckSystemCall( "dup", ::dup( _device.fd_num() ) ) };
+    _shards.push_back( unique_ptr<TCPStack>( new TCPStack( move( device ), move( inbound ) ) ) );
+  }
+
+  _device.set_blocking( false );
+  _eventloop.add_rule( "steer datagrams to shards", _device, Direction::In, [&] { _dispatch(); } );
+  _eventloop.add_rule( "stop", _stop, Direction::In, [&] { _stop.drain(); } );
+
+  _dispatcher = thread( &ShardedTCPStack::_dispatch_main, this );
+
+  if ( pin_threads and not cpus.empty() ) {
+    // shards go round-robin over the allowed CPUs after the dispatcher's, never onto it (unless it is the only one)
+    pin_to_cpu( _dispatcher, cpus.front() );
+    for ( size_t i = 0; i < _shards.size(); ++i ) {
+      pin_to_cpu( _shards[i]->_thread, cpus.size() == 1 ? cpus.front() : cpus.at( 1 + i % ( cpus.size() - 1 ) ) );
+    }
+  }
+}
+
+ShardedTCPStack::~ShardedTCPStack()
+{
+  try {
+    _abort.store( true );
+    _stop.notify();
+    _dispatcher.join();
+  } catch ( const exception& e ) {
+    cerr << "Exception destructing ShardedTCPStack: " << e.what() << endl;
+  }
+}
+
+LocalStreamSocket ShardedTCPStack::connect( const TCPConfig& c_tcp, const Address& local, const Address& remote )
+{
+  return _shards.at( shard_for( FourTuple::of( local, remote ) ) )->connect( c_tcp, local, remote );
+}
+
+TCPListener ShardedTCPStack::listen( const TCPConfig& c_tcp, const Address& local, size_t backlog )
+{
+  // one set of queues, so the backlog is shared by all shards
+  auto queues = make_shared<TCPListener::Queues>( local, max<size_t>( backlog, 1 ) );
+  try {
+    for ( auto& shard : _shards ) {
+      shard->_listen( c_tcp, queues );
+    }
+  } catch ( const exception& ) {
+    // the shards that did register the listener drop it, as they would if it had been destroyed
+    const lock_guard lock { queues->mutex };
+    queues->closed = true;
+    throw;
+  }
+  return TCPListener { move( queues ) };
+}
+
+size_t ShardedTCPStack::connection_count() const
+{
+  size_t count = 0;
+  for ( const auto& shard : _shards ) {
+    count += shard->connection_count();
+  }
+  return count;
+}
+
+vector<ShardedTCPStack::ShardStats> ShardedTCPStack::stats() const
+{
+  vector<ShardStats> ret;
+  for ( size_t i = 0; i < _shards.size(); ++i ) {
+    ret.push_back( { _shards[i]->stats(),
+                     _dispatch_counters[i].steered.load( memory_order_relaxed ),
+                     _dispatch_counters[i].dropped.load( memory_order_relaxed ),
+                     _shards[i]->connection_count() } );
+  }
+  return ret;
+}
+
+void ShardedTCPStack::_dispatch_main()
+{
+  try {
+    while ( not _abort ) {
+      _eventloop.wait_next_event( -1 );
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception in ShardedTCPStack dispatcher: " << e.what() << "\n";
+    throw;
+  }
+}
+
+//! \details Each shard that was handed datagrams is woken up once per burst, not once per datagram.
+void ShardedTCPStack::_dispatch()
+{
+  vector<bool> woken( _shards.size() );
+  for ( size_t i = 0; i < MAX_RECEIVE_BURST; ++i ) {
+    const PooledBuffer buffer = _device.read( _receive_buffers );
+    if ( buffer.empty() ) {
+      break; // nothing more to read for now
+    }
+
+    // the datagram keeps its own copy of the payload, which is what goes to the shard's thread
+    InternetDatagram dgram;
+    if ( not parse( dgram, buffer.view() ) ) {
+      continue;
+    }
+
+    const auto tuple = TCPOverIPv4Adapter::peek_tuple( dgram );
+    if ( not tuple.has_value() ) {
+      continue;
+    }
+
+    const size_t shard = shard_for( tuple.value() );
+    DispatchCounters& counters = _dispatch_counters[shard];
+    if ( _inbound[shard]->ring.push( move( dgram ) ) ) {
+      counters.steered.store( counters.steered.load( memory_order_relaxed ) + 1, memory_order_relaxed );
+      woken[shard] = true;
+    } else {
+      counters.dropped.store( counters.dropped.load( memory_order_relaxed ) + 1, memory_order_relaxed );
+    }
+  }
+
+  for ( size_t shard = 0; shard < _shards.size(); ++shard ) {
+    if ( woken[shard] ) {
+      _inbound[shard]->ready.notify();
+    }
+  }
+}
@@ -0,0 +1,5 @@
+#include "tcp_direct_socket_impl.hh"
+
+//! Specializations of TCPDirectSocket for TCPOverIPv4OverTunFdAdapter and its lossy version
+template class TCPDirectSocket<TCPOverIPv4OverTunFdAdapter>;
+template class TCPDirectSocket<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>>;
@@ -38,6 +38,36 @@ void TCPReceiver::receive( TCPSenderMessage message )
   reassembler_.insert( stream_index, move( message.payload ), message.FIN );
 }
 
+void TCPReceiver::receive_batch( span<TCPSenderMessage> messages )
+{
+  // 软件 GRO：把序列号首尾相接的报文段合并成一个，一次性插入 Reassembler
+  auto run_begin { messages.begin() };
+  while ( run_begin != messages.end() ) {
+    // 找到当前这段连续报文的结尾：遇到 FIN/RST 之后、SYN/RST 之前或者序列号不连续时断开
+    auto run_end { next( run_begin ) };
+    size_t run_payload_size { run_begin->payload.size() };
+    Wrap32 next_seqno { run_begin->seqno + run_begin->sequence_length() };
+    for ( auto prev { run_begin }; run_end != messages.end(); prev = run_end++ ) {
+      if ( prev->FIN or prev->RST or run_end->SYN or run_end->RST or run_end->seqno != next_seqno ) {
+        break;
+      }
+      run_payload_size += run_end->payload.size();
+      next_seqno = next_seqno + run_end->sequence_length();
+    }
+
+    // 合并负载，只保留第一个报文段的 seqno/SYN 和最后一个报文段的 FIN
+    TCPSenderMessage merged { move( *run_begin ) };
+    merged.payload.reserve( run_payload_size );
+    for ( auto it { next( run_begin ) }; it != run_end; ++it ) {
+      merged.payload += it->payload;
+      merged.FIN = it->FIN;
+    }
+
+    receive( move( merged ) );
+    run_begin = run_end;
+  }
+}
+
 TCPReceiverMessage TCPReceiver::send() const
 {
   // 计算接收窗口的大小。由于接收窗口的最大值为 65535，因此若容量超过最大值，则取 UINT16_MAX，否则取实际容量。
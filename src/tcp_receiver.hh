@@ -4,6 +4,8 @@
 #include "tcp_receiver_message.hh"
 #include "tcp_sender_message.hh"
 
+#include <span>
+
 class TCPReceiver
 {
 public:
@@ -16,9 +18,19 @@ public:
    */
   void receive( TCPSenderMessage message );
 
+  /*
+   * Receive a burst of TCPSenderMessages that arrived together (e.g. in one read cycle). Runs of messages whose
+   * sequence numbers follow on from each other are merged, so each run costs one Reassembler insert and leaves
+   * one chunk in the ByteStream. The messages are consumed.
+   */
+  void receive_batch( std::span<TCPSenderMessage> messages );
+
   // The TCPReceiver sends TCPReceiverMessages to the peer's TCPSender.
   TCPReceiverMessage send() const;
 
+  // Resize the receive buffer, and so the advertised window (for buffer auto-tuning)
+  void set_capacity( uint64_t capacity ) { reassembler_.set_capacity( capacity ); }
+
   // Access the output (only Reader is accessible non-const)
   const Reassembler& reassembler() const { return reassembler_; }
   Reader& reader() { return reassembler_.reader(); }
@@ -38,7 +38,7 @@ void TCPSender::push( const TransmitFunction& transmit )
     const uint64_t remaining { ( window_size_ == 0 ? 1 : window_size_ ) - total_outstanding_ };
 
     // 确定最大可以发送的负载大小
-    const size_t len { min( TCPConfig::MAX_PAYLOAD_SIZE, remaining - msg.sequence_length() ) };
+    const size_t len { min( max_payload_size_, remaining - msg.sequence_length() ) };
 
     // 获取消息的负载部分
     auto&& payload { msg.payload };
@@ -70,6 +70,11 @@ void TCPSender::push( const TransmitFunction& transmit )
       timer_.start();
     }
 
+    // 如果当前没有进行中的 RTT 测量，则用这个报文段进行测量
+    if ( not rtt_probe_.has_value() ) {
+      rtt_probe_.emplace( next_abs_seqno_ + msg.sequence_length(), current_time_ms_ );
+    }
+
     // 更新下一个绝对序列号和未确认的字节数
     next_abs_seqno_ += msg.sequence_length();
     total_outstanding_ += msg.sequence_length();
@@ -115,6 +120,13 @@ void TCPSender::receive( const TCPReceiverMessage& msg )
     return;
   }
 
+  // 被测报文段已被确认：更新平滑 RTT（SRTT = 7/8 * SRTT + 1/8 * R）
+  if ( rtt_probe_.has_value() and recv_ack_abs_seqno >= rtt_probe_->end_abs_seqno ) {
+    const uint64_t sample { current_time_ms_ - rtt_probe_->sent_time_ms };
+    smoothed_rtt_ms_ = smoothed_rtt_ms_.has_value() ? ( 7 * smoothed_rtt_ms_.value() + sample ) / 8 : sample;
+    rtt_probe_.reset();
+  }
+
   bool has_acknowledgment { false };
 
   // 遍历未确认的消息队列，确认消息
@@ -153,6 +165,8 @@ void TCPSender::receive( const TCPReceiverMessage& msg )
 void TCPSender::tick( uint64_t ms_since_last_tick, const TransmitFunction& transmit )
 {
   // Your code here.
+  current_time_ms_ += ms_since_last_tick;
+
   // 让计时器前进指定的毫秒数，并检查它是否已过期
   if ( timer_.tick( ms_since_last_tick ).is_expired() ) {
     // 如果没有未确认的消息，直接返回
@@ -163,6 +177,9 @@ void TCPSender::tick( uint64_t ms_since_last_tick, const TransmitFunction& trans
     // 重新传输队列中的第一个未确认消息
     transmit( outstanding_message_.front() );
 
+    // 发生重传后，无法区分确认对应哪一次发送，放弃本次 RTT 测量
+    rtt_probe_.reset();
+
     // 如果窗口大小不为0，增加重传计数并执行指数退避
     if ( window_size_ != 0 ) {
       total_retransmission_ += 1;
@@ -1,11 +1,14 @@
 #pragma once
 
 #include "byte_stream.hh"
+#include "tcp_config.hh"
 #include "tcp_receiver_message.hh"
 #include "tcp_sender_message.hh"
 
+#include <algorithm>
 #include <cstdint>
 #include <functional>
+#include <optional>
 #include <queue>
 
 // 重传计时器类，用于管理TCP超时重传（RTO）
@@ -36,6 +39,15 @@ public:
   // 停止计时器并重置
   constexpr auto stop() noexcept -> void { is_active_ = false, reset(); }
 
+  // 距离计时器过期还有多少毫秒（计时器未激活时为空）
+  [[nodiscard]] constexpr auto ms_until_expiry() const noexcept -> std::optional<uint64_t>
+  {
+    if ( not is_active_ ) {
+      return std::nullopt;
+    }
+    return timer_ >= RTO_ms_ ? 0 : RTO_ms_ - timer_;
+  }
+
   // 每次时间流逝时更新计时器
   constexpr auto tick( uint64_t ms_since_last_tick ) noexcept -> RetransmissionTimer&
   {
@@ -53,9 +65,19 @@ private:
 class TCPSender
 {
 public:
-  /* Construct TCP sender with given default Retransmission Timeout and possible ISN */
-  TCPSender( ByteStream&& input, Wrap32 isn, uint64_t initial_RTO_ms )
-    : input_( std::move( input ) ), isn_( isn ), initial_RTO_ms_( initial_RTO_ms ), timer_( initial_RTO_ms )
+  /*
+   * Construct TCP sender with given default Retransmission Timeout and possible ISN. A max_payload_size above
+   * TCPConfig::MAX_PAYLOAD_SIZE produces "super-segments" that the datagram adapter must cut up before sending.
+   */
+  TCPSender( ByteStream&& input,
+             Wrap32 isn,
+             uint64_t initial_RTO_ms,
+             size_t max_payload_size = TCPConfig::MAX_PAYLOAD_SIZE )
+    : input_( std::move( input ) )
+    , isn_( isn )
+    , initial_RTO_ms_( initial_RTO_ms )
+    , max_payload_size_( std::clamp<size_t>( max_payload_size, 1, TCPConfig::MAX_OFFLOAD_SIZE ) )
+    , timer_( initial_RTO_ms )
   {}
 
   /* Generate an empty TCPSenderMessage */
@@ -83,11 +105,21 @@ public:
   // Access input stream reader, but const-only (can't read from outside)
   [[nodiscard]] const Reader& reader() const { return input_.reader(); }
 
+  // Resize the outbound stream (for buffer auto-tuning)
+  void set_capacity( uint64_t capacity ) { input_.set_capacity( capacity ); }
+
+  // Milliseconds until tick() would retransmit (empty if nothing is outstanding)
+  [[nodiscard]] std::optional<uint64_t> ms_until_deadline() const { return timer_.ms_until_expiry(); }
+
+  // Smoothed round-trip time estimate in milliseconds, if any segment has been acknowledged yet
+  [[nodiscard]] std::optional<uint64_t> rtt_estimate() const { return smoothed_rtt_ms_; }
+
 private:
   // 在构造函数中初始化的变量
   ByteStream input_;        // 输入字节流
   Wrap32 isn_;              // 初始序列号
   uint64_t initial_RTO_ms_; // 初始重传超时时间
+  size_t max_payload_size_; // 单个报文段的最大负载
 
   RetransmissionTimer timer_; // 重传计时器
 
@@ -101,4 +133,14 @@ private:
 
   uint64_t total_outstanding_ {};    // 总未确认的字节数
   uint64_t total_retransmission_ {}; // 总重传次数
+
+  // RTT 采样（Karn 算法：同一时刻只测量一个报文段，被重传过的报文段不参与采样）
+  struct RTTProbe
+  {
+    uint64_t end_abs_seqno; // 被测报文段之后的下一个绝对序列号
+    uint64_t sent_time_ms;  // 被测报文段的发送时间
+  };
+  uint64_t current_time_ms_ {};                // 自构造以来经过的时间
+  std::optional<RTTProbe> rtt_probe_ {};       // 正在进行的 RTT 测量
+  std::optional<uint64_t> smoothed_rtt_ms_ {}; // 平滑后的 RTT（RFC 6298 中的 SRTT）
 };
@@ -0,0 +1,616 @@
+#include "tcp_stack.hh"
+
+#include "exception.hh"
+#include "ipv4_header.hh"
+#include "parser.hh"
+#include "random.hh"
+#include "tcp_over_ip.hh"
+
+#include <array>
+#include <chrono>
+#include <climits>
+#include <exception>
+#include <future>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <utility>
+
+using namespace std;
+
+namespace {
+constexpr size_t MAX_RECEIVE_BURST = 64; // most datagrams read from the device per event
+
+uint64_t timestamp_ms()
+{
+  return chrono::duration_cast<chrono::milliseconds>( chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+// counters have a single writer (the stack thread), so a plain load and store is enough
+void bump( atomic<uint64_t>& counter )
+{
+  counter.store( counter.load( memory_order_relaxed ) + 1, memory_order_relaxed );
+}
+
+pair<LocalStreamSocket, LocalStreamSocket> local_stream_socket_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_STREAM, 0, fds.data() ) );
+  return { LocalStreamSocket { FileDescriptor { fds[0] } }, LocalStreamSocket { FileDescriptor { fds[1] } } };
+}
+} // namespace
+
+TCPStack::TCPStack( FileDescriptor&& ip_device, const DeviceIO io )
+  : TCPStack( move( ip_device ), io, nullptr, local_stream_socket_pair() )
+{}
+
+TCPStack::TCPStack( FileDescriptor&& ip_device, unique_ptr<Inbound> inbound )
+  : TCPStack( move( ip_device ), DeviceIO::Syscalls, move( inbound ), local_stream_socket_pair() )
+{}
+
+TCPStack::TCPStack( FileDescriptor&& ip_device,
+                    const DeviceIO io,
+                    unique_ptr<Inbound> inbound,
+                    pair<LocalStreamSocket, LocalStreamSocket> wakeup_pair )
+  : _device( move( ip_device ) )
+  , _inbound( move( inbound ) )
+  , _io_uring( io == DeviceIO::IOUring ? make_unique<IOUringDatagramDevice>( _device.duplicate() ) : nullptr )
+  , _timers( timestamp_ms() )
+  , _wakeup_sender( move( wakeup_pair.first ) )
+  , _wakeup_receiver( move( wakeup_pair.second ) )
+  , _isn_generator( get_random_engine() )
+{
+  if ( not _io_uring ) {
+    _device.set_blocking( false );
+  }
+  _wakeup_receiver.set_blocking( false );
+  _eventloop.set_dispatch( EventLoop::Dispatch::AllReady ); // connections' events are independent of each other
+
+  _push_category = _eventloop.add_category( "push bytes to TCPPeer" );
+  _pull_category = _eventloop.add_category( "read bytes from inbound stream" );
+
+  if ( _inbound ) {
+    _eventloop.add_rule( "receive TCP segments from the dispatcher", _inbound->ready, Direction::In, [&] {
+      _inbound->ready.drain();
+      _receive_steered();
+    } );
+  } else {
+    _eventloop.add_rule( "receive TCP segments from the network",
+                         _io_uring ? _io_uring->ready() : _device,
+                         Direction::In,
+                         [&] { _receive_datagrams(); } );
+  }
+
+  _eventloop.add_rule( "take new connections", _wakeup_receiver, Direction::In, [&] {
+    string discard;
+    _wakeup_receiver.read( discard );
+    _take_pending();
+  } );
+
+  _thread = thread( &TCPStack::_main, this );
+}
+
+TCPStack::~TCPStack()
+{
+  try {
+    _abort.store( true );
+    {
+      const lock_guard lock { _pending_mutex };
+      _wake_up();
+    }
+    _thread.join();
+
+    // wake up anyone still waiting in accept()
+    const lock_guard lock { _pending_mutex };
+    for ( auto& listening : _listeners ) {
+      const lock_guard queues_lock { listening.queues->mutex };
+      listening.queues->closed = true;
+      listening.queues->ready.notify_all();
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception destructing TCPStack: " << e.what() << endl;
+  }
+}
+
+LocalStreamSocket TCPStack::connect( const TCPConfig& c_tcp, const Address& local, const Address& remote )
+{
+  auto [app_end, stack_end] = local_stream_socket_pair();
+  const lock_guard lock { _pending_mutex };
+  _pending_connects.push_back( { c_tcp, FourTuple::of( local, remote ), move( stack_end ) } );
+  _wake_up();
+  return move( app_end );
+}
+
+TCPListener TCPStack::listen( const TCPConfig& c_tcp, const Address& local, size_t backlog )
+{
+  auto queues = make_shared<TCPListener::Queues>( local, max<size_t>( backlog, 1 ) );
+  _listen( c_tcp, queues );
+  return TCPListener { move( queues ) };
+}
+
+void TCPStack::_listen( const TCPConfig& c_tcp, shared_ptr<TCPListener::Queues> queues )
+{
+  const Address& local = queues->local_address;
+  const lock_guard lock { _pending_mutex };
+  erase_if( _listeners, []( const Listening& l ) {
+    const lock_guard queues_lock { l.queues->mutex };
+    return l.queues->closed;
+  } );
+  for ( const auto& listening : _listeners ) {
+    if ( listening.queues->local_address.port() == local.port()
+         and ( listening.queues->local_address.ipv4_numeric() == 0 or local.ipv4_numeric() == 0
+               or listening.queues->local_address.ipv4_numeric() == local.ipv4_numeric() ) ) {
+      throw runtime_error( "TCPStack::listen: already listening on " + local.to_string() );
+    }
+  }
+  _listeners.push_back( { c_tcp, move( queues ) } );
+}
+
+TCPStack::Stats TCPStack::stats() const
+{
+  return { _counters.segments_received.load( memory_order_relaxed ),
+           _counters.segments_unmatched.load( memory_order_relaxed ),
+           _counters.datagrams_sent.load( memory_order_relaxed ),
+           _counters.datagrams_dropped.load( memory_order_relaxed ),
+           _counters.connections_opened.load( memory_order_relaxed ) };
+}
+
+void TCPStack::set_instrumented( const bool instrumented )
+{
+  _eventloop.post( [this, instrumented] { _eventloop.set_instrumented( instrumented ); } );
+}
+
+EventLoop::Snapshot TCPStack::eventloop_snapshot()
+{
+  promise<EventLoop::Snapshot> snapshot;
+  _eventloop.post( [&] { snapshot.set_value( _eventloop.snapshot() ); } );
+  return snapshot.get_future().get();
+}
+
+//! \details At most one wakeup byte is ever unread, so the write cannot block (the caller holds _pending_mutex)
+void TCPStack::_wake_up()
+{
+  if ( not _wakeup_pending ) {
+    _wakeup_sender.write( "x" );
+    _wakeup_pending = true;
+  }
+}
+
+//! \details The loop has no periodic tick: it sleeps until the timing wheel's next event. After each event, it
+//! settles the connections the event touched, then fires the timers that have come due.
+void TCPStack::_main()
+{
+  try {
+    vector<Connection*> touched;
+    while ( not _abort ) {
+      int timeout = -1;
+      if ( const auto next = _timers.next_event() ) {
+        const uint64_t now = timestamp_ms();
+        timeout = next.value() > now ? static_cast<int>( min<uint64_t>( next.value() - now, INT_MAX ) ) : 0;
+      }
+      _eventloop.wait_next_event( timeout );
+
+      const uint64_t now = timestamp_ms();
+      swap( touched, _touched );
+      for ( Connection* c : touched ) {
+        c->touched = false;
+        _settle( *c, now );
+      }
+      touched.clear();
+
+      _timers.advance( now, [&]( Connection* c ) {
+        c->timer.reset();
+        _settle( *c, now );
+      } );
+
+      if ( _io_uring ) {
+        _io_uring->flush();
+        _count_failed_writes();
+      }
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception in TCPStack thread: " << e.what() << "\n";
+    throw;
+  }
+}
+
+void TCPStack::_take_pending()
+{
+  vector<PendingConnect> pending;
+  {
+    const lock_guard lock { _pending_mutex };
+    swap( pending, _pending_connects );
+    _wakeup_pending = false;
+  }
+
+  for ( auto& request : pending ) {
+    if ( Connection* c = _add_connection( request.config, request.tuple, move( request.socket ) ) ) {
+      _touch( *c );
+      c->peer.push( c->transmit ); // send the SYN
+    }
+  }
+}
+
+TCPStack::Connection* TCPStack::_add_connection( const TCPConfig& config,
+                                                 const FourTuple& tuple,
+                                                 LocalStreamSocket&& socket )
+{
+  auto transmit = [this, tuple]( const TCPMessage& msg ) {
+    TCPOverIPv4Adapter::segment_tcp_in_ip( tuple, msg, [&]( const auto& dgram ) { _write_datagram( dgram ); } );
+  };
+
+  auto [slot, inserted]
+    = _connections.emplace( tuple, make_unique<Connection>( tuple, TCPPeer { config }, move( socket ), transmit ) );
+  if ( not inserted ) {
+    // the new connection (and with it, the application's socket) is dropped, so the application sees EOF
+    cerr << "DEBUG: TCPStack: connection from " << tuple.local_address().to_string() << " to "
+         << tuple.remote_address().to_string() << " already exists\n";
+    return nullptr;
+  }
+  ++_connection_count;
+  bump( _counters.connections_opened );
+
+  Connection& c = **slot;
+  c.app.set_blocking( false );
+  c.clock = timestamp_ms();
+
+  // Rules are the same as TCPMinnowSocket's (2) and (3), with shared categories.
+  c.rules.push_back( _eventloop.add_rule(
+    _push_category,
+    c.app,
+    Direction::In,
+    [this, &c] {
+      _touch( c );
+      // _touch() ticks the peer, which may have shrunk the send buffer since the interest was checked (and an
+      // empty string would be read into at full size, then dropped by push)
+      const uint64_t capacity = c.peer.outbound_writer().available_capacity();
+      if ( capacity == 0 ) {
+        return;
+      }
+      string data;
+      data.resize( capacity );
+      c.app.read( data );
+      c.peer.outbound_writer().push( move( data ) );
+      if ( c.app.eof() ) {
+        c.peer.outbound_writer().close();
+        c.outbound_shutdown = true;
+      }
+      c.peer.push( c.transmit );
+    },
+    [&c] {
+      return c.peer.active() and not c.outbound_shutdown and c.peer.outbound_writer().available_capacity() > 0;
+    },
+    [this, &c] {
+      _touch( c );
+      c.peer.outbound_writer().close();
+      c.outbound_shutdown = true;
+    },
+    [this, &c] {
+      _touch( c );
+      c.peer.outbound_writer().set_error();
+    } ) );
+
+  c.rules.push_back( _eventloop.add_rule(
+    _pull_category,
+    c.app,
+    Direction::Out,
+    [this, &c] {
+      _touch( c );
+      Reader& inbound = c.peer.inbound_reader();
+      if ( inbound.bytes_buffered() ) {
+        inbound.pop( c.app.write( inbound.peek() ) );
+      }
+      if ( inbound.is_finished() or inbound.has_error() ) {
+        c.app.shutdown( SHUT_WR );
+        c.inbound_shutdown = true;
+      }
+    },
+    [&c] {
+      const Reader& inbound = c.peer.inbound_reader();
+      return inbound.bytes_buffered()
+             or ( ( inbound.is_finished() or inbound.has_error() ) and not c.inbound_shutdown );
+    },
+    [this, &c] {
+      _touch( c );
+      c.inbound_shutdown = true;
+    },
+    [this, &c] {
+      _touch( c );
+      c.peer.inbound_reader().set_error();
+    } ) );
+
+  // Both interests change only when the connection is touched or its timer fires, and so is settled.
+  for ( auto& rule : c.rules ) {
+    rule.set_interest_on_change();
+  }
+
+  return &c;
+}
+
+//! \details Called for a SYN that matches no connection. If a listener with room in its backlog wants it, the
+//! connection enters SYN-received state and answers with a SYN-ACK; otherwise the SYN is dropped. Every passive
+//! open draws its own initial sequence number, so that connections accepted by one listener do not share one.
+//! \returns whether a connection was opened
+bool TCPStack::_passive_open( const FourTuple& tuple, TCPMessage&& syn )
+{
+  optional<Listening> listening;
+  {
+    const lock_guard lock { _pending_mutex };
+    for ( const auto& l : _listeners ) {
+      if ( l.queues->matches( tuple ) ) {
+        listening = l;
+        break;
+      }
+    }
+  }
+  if ( not listening.has_value() ) {
+    return false;
+  }
+
+  {
+    const lock_guard lock { listening->queues->mutex };
+    if ( listening->queues->closed
+         or listening->queues->syn_received + listening->queues->established.size()
+              >= listening->queues->backlog ) {
+      return false;
+    }
+    ++listening->queues->syn_received;
+  }
+
+  TCPConfig config = listening->config;
+  config.isn = Wrap32 { static_cast<uint32_t>( _isn_generator() ) };
+
+  auto [app_end, stack_end] = local_stream_socket_pair();
+  Connection* c = _add_connection( config, tuple, move( stack_end ) );
+  c->listener = move( listening->queues );
+  c->unaccepted = move( app_end );
+
+  _touch( *c );
+  c->peer.receive( move( syn ), c->transmit ); // answers with the SYN-ACK
+  return true;
+}
+
+//! \details Once our SYN has been acknowledged, move the connection from the SYN-received queue to the
+//! established queue.
+void TCPStack::_finish_handshake( Connection& c )
+{
+  if ( not c.peer.has_ackno() or c.peer.sender().sequence_numbers_in_flight() > 0 ) {
+    return;
+  }
+
+  auto listener = move( c.listener );
+  const lock_guard lock { listener->mutex };
+  --listener->syn_received;
+  if ( listener->closed ) {
+    c.unaccepted.reset(); // nobody will accept it, so the connection sees EOF and closes
+    return;
+  }
+  listener->established.push_back( { move( c.unaccepted.value() ), c.tuple.remote_address() } );
+  c.unaccepted.reset();
+  listener->ready.notify_one();
+}
+
+void TCPStack::_receive_datagrams()
+{
+  if ( _io_uring ) {
+    _io_uring->receive( [&]( string_view datagram ) {
+      InternetDatagram dgram;
+      if ( parse( dgram, datagram ) ) {
+        _receive_datagram( dgram );
+      }
+    } );
+    return;
+  }
+
+  for ( size_t i = 0; i < MAX_RECEIVE_BURST; ++i ) {
+    const PooledBuffer buffer = _device.read( _receive_buffers );
+    if ( buffer.empty() ) {
+      return; // nothing more to read for now
+    }
+
+    // the datagram keeps its own copy of the payload, so the buffer goes back to the pool at once
+    InternetDatagram dgram;
+    if ( parse( dgram, buffer.view() ) ) {
+      _receive_datagram( dgram );
+    }
+  }
+}
+
+//! \details Takes at most one ring's worth, so a dispatcher that keeps refilling the ring cannot starve the rest of
+//! the loop (the eventfd stays readable in that case).
+void TCPStack::_receive_steered()
+{
+  for ( size_t i = 0; i < _inbound->ring.capacity(); ++i ) {
+    auto dgram = _inbound->ring.pop();
+    if ( not dgram.has_value() ) {
+      return;
+    }
+    _receive_datagram( dgram.value() );
+  }
+}
+
+void TCPStack::_receive_datagram( const InternetDatagram& dgram )
+{
+  auto demuxed = TCPOverIPv4Adapter::demux_tcp_in_ip( dgram );
+  if ( not demuxed.has_value() ) {
+    return;
+  }
+  bump( _counters.segments_received );
+
+  auto& [tuple, msg] = demuxed.value();
+  if ( auto* connection = _connections.find( tuple ) ) {
+    Connection& c = **connection;
+    _touch( c );
+    c.peer.receive( move( msg ), c.transmit );
+    if ( c.listener ) {
+      _finish_handshake( c );
+    }
+  } else if ( not msg.sender.SYN or msg.receiver.ackno.has_value() or msg.sender.RST
+              or not _passive_open( tuple, move( msg ) ) ) {
+    bump( _counters.segments_unmatched );
+  }
+}
+
+//! \details Called before each event on a connection. The peer's clock is brought up to date first, so the event
+//! sees the right time (e.g., for when lingering should end).
+void TCPStack::_touch( Connection& c )
+{
+  if ( not c.touched ) {
+    _catch_up( c, timestamp_ms() );
+    c.touched = true;
+    _touched.push_back( &c );
+  }
+}
+
+void TCPStack::_catch_up( Connection& c, uint64_t now )
+{
+  if ( c.peer.active() ) {
+    c.peer.tick( now > c.clock ? now - c.clock : 0, c.transmit );
+  }
+  c.clock = max( c.clock, now );
+}
+
+//! \details Called after events on a connection, and when its timer fires: ticks the peer, then either removes
+//! the connection or sets its timer for the peer's next deadline.
+void TCPStack::_settle( Connection& c, uint64_t now )
+{
+  _catch_up( c, now );
+
+  if ( c.listener and ( not c.peer.active()
+                        or c.peer.sender().consecutive_retransmissions() > TCPConfig::MAX_RETX_ATTEMPTS ) ) {
+    _remove( c.tuple ); // half-open connection that failed or timed out
+    return;
+  }
+  if ( not c.peer.active() and c.inbound_shutdown ) {
+    _remove( c.tuple );
+    return;
+  }
+  for ( auto& rule : c.rules ) {
+    rule.interest_changed();
+  }
+
+  const auto deadline = c.peer.active() ? c.peer.ms_until_deadline() : nullopt;
+  if ( not deadline.has_value() ) {
+    if ( c.timer.has_value() ) {
+      _timers.cancel( c.timer.value() );
+      c.timer.reset();
+    }
+    return;
+  }
+
+  const uint64_t expiry = now + deadline.value();
+  if ( c.timer.has_value() and c.timer_expiry == expiry ) {
+    return;
+  }
+  if ( not c.timer.has_value() or not _timers.reschedule( c.timer.value(), expiry ) ) {
+    c.timer = _timers.schedule( expiry, &c );
+  }
+  c.timer_expiry = expiry;
+}
+
+void TCPStack::_remove( const FourTuple& tuple )
+{
+  if ( auto* connection = _connections.find( tuple ) ) {
+    Connection& c = **connection;
+    for ( auto& rule : c.rules ) {
+      rule.cancel();
+    }
+    if ( c.timer.has_value() ) {
+      _timers.cancel( c.timer.value() );
+    }
+    if ( c.listener ) {
+      const lock_guard lock { c.listener->mutex };
+      --c.listener->syn_received;
+    }
+    c.app.shutdown( SHUT_RDWR );
+    _connections.erase( tuple );
+    --_connection_count;
+  }
+}
+
+//! \details A datagram queued on the IOUringDatagramDevice was counted as sent; if the kernel then failed its
+//! write (the device's queue was full), it is moved over to the dropped datagrams.
+void TCPStack::_count_failed_writes()
+{
+  const uint64_t failed = _io_uring->writes_failed() - _writes_failed_counted;
+  if ( failed > 0 ) {
+    _writes_failed_counted += failed;
+    _counters.datagrams_sent.store( _counters.datagrams_sent.load( memory_order_relaxed ) - failed,
+                                    memory_order_relaxed );
+    _counters.datagrams_dropped.store( _counters.datagrams_dropped.load( memory_order_relaxed ) + failed,
+                                       memory_order_relaxed );
+  }
+}
+
+void TCPStack::_write_datagram( const InternetDatagram& dgram )
+{
+  if ( _io_uring ) {
+    _io_uring->write( serialize( dgram ) ); // sent by the flush at the end of this pass of _main()
+  } else if ( _device.try_write( serialize( dgram ) ) == 0 ) {
+    bump( _counters.datagrams_dropped ); // as a full NIC queue would; TCP will retransmit
+    return;
+  }
+  bump( _counters.datagrams_sent );
+}
+
+bool TCPListener::Queues::matches( const FourTuple& tuple ) const
+{
+  return tuple.local_port == local_address.port()
+         and ( local_address.ipv4_numeric() == 0 or local_address.ipv4_numeric() == tuple.local_ip );
+}
+
+TCPListener::Queues& TCPListener::queues() const
+{
+  if ( not _queues ) {
+    throw runtime_error( "TCPListener: used after being moved from" );
+  }
+  return *_queues;
+}
+
+optional<AcceptedConnection> TCPListener::accept()
+{
+  Queues& queues = this->queues();
+  unique_lock lock { queues.mutex };
+  if ( _blocking ) {
+    queues.ready.wait( lock, [&] { return queues.closed or not queues.established.empty(); } );
+  }
+  if ( queues.established.empty() ) {
+    return nullopt;
+  }
+  AcceptedConnection connection = move( queues.established.front() );
+  queues.established.pop_front();
+  return connection;
+}
+
+size_t TCPListener::accept_queue_size() const
+{
+  const lock_guard lock { queues().mutex };
+  return queues().established.size();
+}
+
+void TCPListener::close()
+{
+  if ( _queues ) {
+    const lock_guard lock { _queues->mutex };
+    _queues->closed = true;
+    _queues->established.clear();
+    _queues->ready.notify_all();
+  }
+}
+
+TCPListener& TCPListener::operator=( TCPListener&& other ) noexcept
+{
+  if ( this != &other ) {
+    close();
+    _queues = move( other._queues );
+    _blocking = other._blocking;
+  }
+  return *this;
+}
+
+TCPListener::~TCPListener()
+{
+  close();
+}
@@ -0,0 +1,191 @@
+#include "buffer_pool.hh"
+#include "ethernet_frame.hh"
+#include "exception.hh"
+#include "file_descriptor.hh"
+#include "parser.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+pair<FileDescriptor, FileDescriptor> socket_pair( int type )
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, type | SOCK_CLOEXEC, 0, fds.data() ) );
+  return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+}
+
+string concatenate( const vector<string>& buffers )
+{
+  string out;
+  for ( const auto& x : buffers ) {
+    out += x;
+  }
+  return out;
+}
+
+// A buffer goes back to the pool when its last handle is dropped, and is the next one handed out; a new slab is
+// allocated only when every buffer is in use.
+void reuse_and_growth()
+{
+  BufferPool pool { 100, 4 };
+  test_should_be( pool.slabs(), size_t { 1 } );
+  test_should_be( pool.available(), size_t { 4 } );
+
+  PooledBuffer a = pool.get();
+  test_should_be( a.size(), size_t { 100 } );
+  test_should_be( a.capacity(), size_t { 100 } );
+  const char* const a_data = a.data();
+  {
+    const PooledBuffer copy = a; // NOLINT(*-unnecessary-copy-initialization)
+    a = PooledBuffer {};
+    test_should_be( pool.in_use(), size_t { 1 } ); // the copy still holds it
+    test_should_be( copy.data() == a_data, true );
+  }
+  test_should_be( pool.in_use(), size_t { 0 } );
+  test_should_be( pool.get().data() == a_data, true ); // most recently freed first
+
+  vector<PooledBuffer> held;
+  for ( size_t i = 0; i < 5; ++i ) {
+    held.push_back( pool.get() );
+  }
+  test_should_be( pool.slabs(), size_t { 2 } );
+  test_should_be( pool.in_use(), size_t { 5 } );
+  held.clear();
+  test_should_be( pool.in_use(), size_t { 0 } );
+  test_should_be( pool.available(), size_t { 8 } );
+}
+
+// Moving a handle leaves the source empty, and assigning over a handle releases what it held.
+void moves()
+{
+  BufferPool pool { 16, 2 };
+  PooledBuffer a = pool.get();
+  PooledBuffer b = pool.get();
+  test_should_be( pool.in_use(), size_t { 2 } );
+
+  b = move( a );
+  test_should_be( a.empty(), true ); // NOLINT(*-use-after-move)
+  test_should_be( a.data() == nullptr, true );
+  test_should_be( pool.in_use(), size_t { 1 } );
+
+  PooledBuffer c { move( b ) };
+  test_should_be( b.empty(), true ); // NOLINT(*-use-after-move)
+  test_should_be( pool.in_use(), size_t { 1 } );
+  c = PooledBuffer {};
+  test_should_be( pool.in_use(), size_t { 0 } );
+}
+
+// resize() sets the size within the capacity, and refuses to go beyond it.
+void resize()
+{
+  BufferPool pool { 8, 1 };
+  PooledBuffer a = pool.get();
+  a.resize( 3 );
+  test_should_be( a.size(), size_t { 3 } );
+  test_should_be( a.view().size(), size_t { 3 } );
+  bool threw = false;
+  try {
+    a.resize( 9 );
+  } catch ( const runtime_error& ) {
+    threw = true;
+  }
+  test_should_be( threw, true );
+  test_should_be( a.size(), size_t { 3 } );
+
+  PooledBuffer empty;
+  test_should_be( empty.capacity(), size_t { 0 } );
+  test_should_be( empty.view().empty(), true );
+}
+
+// FileDescriptor::read( BufferPool& ) reads one datagram per buffer, returns an empty buffer when a non-blocking
+// fd would block (or at EOF), and the batch form stops at the limit or when the fd runs dry.
+void read_into_the_pool()
+{
+  BufferPool pool { 2048, 4 };
+  auto [writer, reader] = socket_pair( SOCK_DGRAM );
+  reader.set_blocking( false );
+
+  test_should_be( reader.read( pool ).empty(), true );
+  test_should_be( reader.eof(), false );
+  test_should_be( pool.in_use(), size_t { 0 } );
+
+  for ( const string x : { "one", "two", "three", "four", "five" } ) {
+    writer.write( x );
+  }
+  vector<PooledBuffer> buffers;
+  test_should_be( reader.read( pool, buffers, 3 ), size_t { 3 } );
+  test_should_be( buffers.size(), size_t { 3 } );
+  test_should_be( buffers.at( 0 ).view() == "one", true );
+  test_should_be( buffers.at( 2 ).view() == "three", true );
+  test_should_be( reader.read( pool, buffers, 10 ), size_t { 2 } );
+  test_should_be( buffers.at( 4 ).view() == "five", true );
+  test_should_be( pool.in_use(), size_t { 5 } );
+  buffers.clear();
+  test_should_be( pool.in_use(), size_t { 0 } );
+
+  auto [stream_writer, stream_reader] = socket_pair( SOCK_STREAM );
+  stream_writer.close();
+  test_should_be( stream_reader.read( pool ).empty(), true );
+  test_should_be( stream_reader.eof(), true );
+}
+
+// A frame parsed straight out of a pooled buffer keeps its own copy of the payload, so the buffer can go back to
+// the pool (and be overwritten) at once.
+void parse_in_place()
+{
+  EthernetFrame frame;
+  frame.header.type = EthernetHeader::TYPE_IPv4;
+  frame.header.src = { 1, 2, 3, 4, 5, 6 };
+  frame.header.dst = ETHERNET_BROADCAST;
+  frame.payload = { "some ", "payload" };
+  const string wire = concatenate( serialize( frame ) );
+
+  BufferPool pool { 1500, 1 };
+  EthernetFrame parsed;
+  {
+    PooledBuffer buffer = pool.get();
+    wire.copy( buffer.data(), wire.size() );
+    buffer.resize( wire.size() );
+    test_should_be( parse( parsed, buffer.view() ), true );
+  }
+  PooledBuffer reused = pool.get();
+  string( reused.capacity(), 'z' ).copy( reused.data(), reused.capacity() );
+
+  test_should_be( parsed.header.type, EthernetHeader::TYPE_IPv4 );
+  test_should_be( parsed.header.src == frame.header.src, true );
+  test_should_be( concatenate( parsed.payload ) == "some payload", true );
+
+  // a truncated frame fails to parse
+  EthernetFrame truncated;
+  test_should_be( parse( truncated, string_view { wire }.substr( 0, EthernetHeader::LENGTH - 1 ) ), false );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    reuse_and_growth();
+    moves();
+    resize();
+    read_into_the_pool();
+    parse_in_place();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
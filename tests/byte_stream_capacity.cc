@@ -97,6 +97,30 @@ int main()
       test.execute( BytesBuffered { 1 } );
     }
 
+    {
+      ByteStreamTestHarness test { "grow and shrink capacity", 2 };
+
+      test.execute( Push { "cat" } );
+      test.execute( AvailableCapacity { 0 } );
+      test.execute( SetCapacity { 4 } );
+      test.execute( AvailableCapacity { 2 } );
+      test.execute( Push { "tle" } );
+      test.execute( BytesPushed { 4 } );
+      test.execute( BytesBuffered { 4 } );
+      test.execute( Peek { "catl" } );
+
+      // shrinking never discards bytes that are already buffered
+      test.execute( SetCapacity { 1 } );
+      test.execute( AvailableCapacity { 0 } );
+      test.execute( BytesBuffered { 4 } );
+      test.execute( Pop { 3 } );
+      test.execute( AvailableCapacity { 3 } );
+      test.execute( SetCapacity { 1 } );
+      test.execute( AvailableCapacity { 0 } );
+      test.execute( Push { "x" } );
+      test.execute( BytesPushed { 4 } );
+      test.execute( Peek { "l" } );
+    }
   } catch ( const exception& e ) {
     cerr << "Exception: " << e.what() << endl;
     return EXIT_FAILURE;
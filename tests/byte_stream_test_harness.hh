@@ -53,6 +53,32 @@ struct Pop : public Action<ByteStream>
   void execute( ByteStream& bs ) const override { bs.reader().pop( len_ ); }
 };
 
+struct PopChunk : public Expectation<ByteStream>
+{
+  std::string output_;
+
+  explicit PopChunk( std::string output ) : output_( move( output ) ) {}
+  std::string description() const override { return "pop_chunk() gives \"" + Printer::prettify( output_ ) + "\""; }
+
+  void execute( ByteStream& bs ) const override
+  {
+    const std::string got = bs.reader().pop_chunk();
+    if ( got != output_ ) {
+      throw ExpectationViolation { "Expected pop_chunk() to give \"" + Printer::prettify( output_ )
+                                   + "\", but got \"" + Printer::prettify( got ) + "\"" };
+    }
+  }
+};
+
+struct SetCapacity : public Action<ByteStream>
+{
+  uint64_t capacity_;
+
+  explicit SetCapacity( uint64_t capacity ) : capacity_( capacity ) {}
+  std::string description() const override { return "set_capacity( " + std::to_string( capacity_ ) + " )"; }
+  void execute( ByteStream& bs ) const override { bs.set_capacity( capacity_ ); }
+};
+
 /* expectations */
 
 struct Peek : public Expectation<ByteStream>
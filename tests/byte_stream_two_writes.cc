@@ -125,6 +125,24 @@ int main()
       test.execute( BytesBuffered { 0 } );
     }
 
+    {
+      ByteStreamTestHarness test { "pop whole chunks after a partial pop", 15 };
+
+      test.execute( Push { "cat" } );
+      test.execute( Push { "tac" } );
+      test.execute( Pop { 1 } );
+      test.execute( PopChunk { "at" } );
+      test.execute( BytesPopped { 3 } );
+      test.execute( BytesBuffered { 3 } );
+      test.execute( AvailableCapacity { 12 } );
+      test.execute( Close {} );
+      test.execute( IsFinished { false } );
+      test.execute( PopChunk { "tac" } );
+      test.execute( BytesPopped { 6 } );
+      test.execute( IsFinished { true } );
+      test.execute( PopChunk { "" } );
+    }
+
   } catch ( const exception& e ) {
     cerr << "Exception: " << e.what() << endl;
     return EXIT_FAILURE;
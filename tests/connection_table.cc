@@ -0,0 +1,226 @@
+#include "connection_table.hh"
+#include "random.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t SLOTS = 16; // a table of this capacity does not grow before it holds 11 entries
+
+FourTuple tuple_for( uint16_t remote_port )
+{
+  return { 0x0a000001, 0x0a000002, 80, remote_port };
+}
+
+string str( const FourTuple& key )
+{
+  return key.local_address().to_string() + " <-> " + key.remote_address().to_string();
+}
+
+// The first `n` keys (after `first_port`) whose probe for a SLOTS-slot table starts at `home`
+vector<FourTuple> keys_with_home( size_t home, size_t n, uint16_t first_port = 1 )
+{
+  vector<FourTuple> keys;
+  for ( uint16_t port = first_port; keys.size() < n; ++port ) {
+    if ( ( tuple_for( port ).hash() & ( SLOTS - 1 ) ) == home ) {
+      keys.push_back( tuple_for( port ) );
+    }
+  }
+  return keys;
+}
+
+void expect_value( const ConnectionTable<int>& table, const FourTuple& key, int value )
+{
+  const int* found = table.find( key );
+  if ( not found ) {
+    throw runtime_error( "lost " + str( key ) );
+  }
+  if ( *found != value ) {
+    throw runtime_error( str( key ) + " has value " + to_string( *found ) + ", not " + to_string( value ) );
+  }
+}
+
+void expect_absent( const ConnectionTable<int>& table, const FourTuple& key )
+{
+  if ( table.find( key ) ) {
+    throw runtime_error( "found " + str( key ) + ", which should be absent" );
+  }
+}
+
+void colliding_hashes()
+{
+  ConnectionTable<int> table { SLOTS };
+  const auto keys = keys_with_home( 3, 6 );
+  for ( size_t i = 0; i < keys.size(); ++i ) {
+    const auto [value, inserted] = table.emplace( keys[i], static_cast<int>( i ) );
+    test_should_be( inserted, true );
+    test_should_be( *value, static_cast<int>( i ) );
+  }
+  test_should_be( table.size(), keys.size() );
+  for ( size_t i = 0; i < keys.size(); ++i ) {
+    expect_value( table, keys[i], static_cast<int>( i ) );
+  }
+
+  // a key already present is not replaced
+  const auto [value, inserted] = table.emplace( keys[2], 100 );
+  test_should_be( inserted, false );
+  test_should_be( *value, 2 );
+  test_should_be( table.size(), keys.size() );
+
+  // a missing key with the same home is looked for past the whole run
+  expect_absent( table, keys_with_home( 3, 1, keys.back().remote_port + 1 ).front() );
+  test_should_be( table.erase( keys_with_home( 3, 1, keys.back().remote_port + 1 ).front() ), false );
+}
+
+void erase_in_probe_run()
+{
+  // Two runs that merge: keys homed at 5 fill slots 5 to 8, so the keys homed at 6 and 7 land at 9 and up.
+  ConnectionTable<int> table { SLOTS };
+  const auto at5 = keys_with_home( 5, 4 );
+  const auto at6 = keys_with_home( 6, 2 );
+  const auto at7 = keys_with_home( 7, 1 );
+  map<tuple<uint32_t, uint32_t, uint16_t, uint16_t>, int> expected;
+  int next_value = 0;
+  for ( const auto& group : { at5, at6, at7 } ) {
+    for ( const auto& key : group ) {
+      table.emplace( key, int { next_value } );
+      expected[{ key.local_ip, key.remote_ip, key.local_port, key.remote_port }] = next_value++;
+    }
+  }
+
+  const auto check = [&] {
+    test_should_be( table.size(), expected.size() );
+    for ( const auto& [k, v] : expected ) {
+      expect_value( table, { get<0>( k ), get<1>( k ), get<2>( k ), get<3>( k ) }, v );
+    }
+  };
+  check();
+
+  // Each erasure opens a hole in the middle of the run; later keys must still be found past it.
+  for ( const auto& key : { at5[1], at6[0], at5[0], at7[0], at5[3] } ) {
+    test_should_be( table.erase( key ), true );
+    test_should_be( table.erase( key ), false );
+    expect_absent( table, key );
+    expected.erase( { key.local_ip, key.remote_ip, key.local_port, key.remote_port } );
+    check();
+  }
+
+  // the freed slots are reused
+  table.emplace( at5[1], 42 );
+  expected[{ at5[1].local_ip, at5[1].remote_ip, at5[1].local_port, at5[1].remote_port }] = 42;
+  check();
+}
+
+void erase_across_wraparound()
+{
+  // keys homed at the last slot wrap around to the start of the array
+  ConnectionTable<int> table { SLOTS };
+  const auto at15 = keys_with_home( 15, 3 );
+  const auto at0 = keys_with_home( 0, 2 );
+  for ( size_t i = 0; i < at15.size(); ++i ) {
+    table.emplace( at15[i], static_cast<int>( i ) );
+  }
+  for ( size_t i = 0; i < at0.size(); ++i ) {
+    table.emplace( at0[i], static_cast<int>( 10 + i ) );
+  }
+
+  test_should_be( table.erase( at15[0] ), true );
+  expect_value( table, at15[1], 1 );
+  expect_value( table, at15[2], 2 );
+  expect_value( table, at0[0], 10 );
+  expect_value( table, at0[1], 11 );
+
+  test_should_be( table.erase( at0[0] ), true );
+  expect_value( table, at15[1], 1 );
+  expect_value( table, at15[2], 2 );
+  expect_value( table, at0[1], 11 );
+  test_should_be( table.size(), size_t { 3 } );
+}
+
+void growth()
+{
+  ConnectionTable<int> table { 2 };
+  constexpr uint16_t count = 5000;
+  for ( uint16_t port = 0; port < count; ++port ) {
+    test_should_be( table.emplace( tuple_for( port ), int { port } ).second, true );
+  }
+  test_should_be( table.size(), size_t { count } );
+  for ( uint16_t port = 0; port < count; ++port ) {
+    expect_value( table, tuple_for( port ), port );
+  }
+
+  for ( uint16_t port = 0; port < count; port += 2 ) {
+    test_should_be( table.erase( tuple_for( port ) ), true );
+  }
+  test_should_be( table.size(), size_t { count / 2 } );
+
+  size_t visited = 0;
+  table.for_each( [&]( const FourTuple& key, int value ) {
+    test_should_be( static_cast<int>( key.remote_port ), value );
+    test_should_be( key.remote_port % 2, 1 );
+    ++visited;
+  } );
+  test_should_be( visited, size_t { count / 2 } );
+
+  for ( uint16_t port = 0; port < count; ++port ) {
+    if ( port % 2 ) {
+      expect_value( table, tuple_for( port ), port );
+    } else {
+      expect_absent( table, tuple_for( port ) );
+    }
+  }
+}
+
+// Random inserts and erasures over few enough ports that runs merge and wrap, checked against std::map
+void random_operations()
+{
+  auto rd = get_random_engine();
+  ConnectionTable<int> table { 4 };
+  map<uint16_t, int> expected;
+  for ( int i = 0; i < 100000; ++i ) {
+    const auto port = static_cast<uint16_t>( rd() % 64 );
+    if ( rd() % 2 ) {
+      const bool inserted = table.emplace( tuple_for( port ), int { i } ).second;
+      test_should_be( inserted, expected.emplace( port, i ).second );
+    } else {
+      test_should_be( table.erase( tuple_for( port ) ), expected.erase( port ) == 1 );
+    }
+    test_should_be( table.size(), expected.size() );
+  }
+  for ( uint16_t port = 0; port < 64; ++port ) {
+    if ( expected.contains( port ) ) {
+      expect_value( table, tuple_for( port ), expected.at( port ) );
+    } else {
+      expect_absent( table, tuple_for( port ) );
+    }
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    colliding_hashes();
+    erase_in_probe_run();
+    erase_across_wraparound();
+    growth();
+    random_operations();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,251 @@
+#include "coroutine.hh"
+#include "eventloop.hh"
+#include "exception.hh"
+#include "socket.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+namespace {
+
+pair<LocalStreamSocket, LocalStreamSocket> socket_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds.data() ) );
+  return { LocalStreamSocket { FileDescriptor { fds[0] } }, LocalStreamSocket { FileDescriptor { fds[1] } } };
+}
+
+const char* name( EventLoop::Backend backend )
+{
+  return backend == EventLoop::Backend::Poll ? "poll: " : "epoll: ";
+}
+
+void run( EventLoop& loop )
+{
+  while ( loop.wait_next_event( -1 ) != EventLoop::Result::Exit ) {}
+}
+
+Task<string> read_all( AsyncIO& io, FileDescriptor& fd )
+{
+  string all;
+  string buffer;
+  while ( true ) {
+    buffer.clear(); // read as much as FileDescriptor::kReadBufferSize, not just what the last read got
+    co_await io.read( fd, buffer );
+    if ( fd.eof() ) {
+      co_return all;
+    }
+    all += buffer;
+  }
+}
+
+Task<> write_and_close( AsyncIO& io, FileDescriptor& fd, string data )
+{
+  co_await io.write( fd, data );
+  fd.close();
+}
+
+Task<> store( Task<string> task, string& result )
+{
+  result = co_await move( task );
+}
+
+Task<> echo( AsyncIO& io, LocalStreamSocket& server )
+{
+  string buffer;
+  while ( true ) {
+    buffer.clear();
+    co_await io.read( server, buffer );
+    if ( server.eof() ) {
+      server.close();
+      co_return;
+    }
+    co_await io.write( server, buffer );
+  }
+}
+
+Task<> request( AsyncIO& io, LocalStreamSocket& client, size_t i, string& reply )
+{
+  co_await io.sleep( milliseconds { i % 5 } );
+  co_await io.write( client, "request " + to_string( i ) );
+  client.shutdown( SHUT_WR );
+  reply = co_await read_all( io, client );
+}
+
+Task<> sleeper( AsyncIO& io, steady_clock::time_point start, int ms, vector<int>& order )
+{
+  co_await io.sleep( milliseconds { ms } );
+  if ( steady_clock::now() - start < milliseconds { ms } ) {
+    throw runtime_error( "woke up early" );
+  }
+  order.push_back( ms );
+}
+
+Task<> accept_and_read( AsyncIO& io, TCPSocket& listener, string& received )
+{
+  TCPSocket connection = co_await io.accept( listener );
+  received = co_await read_all( io, connection );
+}
+
+Task<> connect_and_write( AsyncIO& io, TCPSocket& client, Address address )
+{
+  co_await io.sleep( 10ms ); // the accept is suspended by now
+  client.connect( address );
+  co_await write_and_close( io, client, "hello" );
+}
+
+Task<int> thrower( AsyncIO& io )
+{
+  co_await io.sleep( 0ms );
+  throw out_of_range( "from the task" );
+}
+
+Task<> catcher( AsyncIO& io, bool& caught )
+{
+  try {
+    co_await thrower( io );
+  } catch ( const out_of_range& ) {
+    caught = true;
+  }
+}
+
+Task<> rethrower( AsyncIO& io )
+{
+  co_await thrower( io );
+}
+
+// A write far larger than the socket buffer suspends until the reader has made room, and the reader sees all of
+// it, then EOF.
+void write_more_than_fits( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  AsyncIO io { loop };
+  auto [a, b] = socket_pair();
+
+  string data( 4 << 20, '\0' );
+  for ( size_t i = 0; i < data.size(); ++i ) {
+    data[i] = static_cast<char>( i * 7 );
+  }
+
+  string received;
+  io.spawn( write_and_close( io, a, data ) );
+  io.spawn( store( read_all( io, b ), received ) );
+  run( loop );
+
+  test_should_be( received.size(), data.size() );
+  test_should_be( received == data, true );
+}
+
+// Many echo coroutines share the loop's thread, each on its own socket pair.
+void many_echoes( EventLoop::Backend backend )
+{
+  constexpr size_t flows = 200;
+  EventLoop loop { backend };
+  AsyncIO io { loop };
+
+  vector<pair<LocalStreamSocket, LocalStreamSocket>> pairs;
+  pairs.reserve( flows );
+  vector<string> replies( flows );
+  for ( size_t i = 0; i < flows; ++i ) {
+    pairs.push_back( socket_pair() );
+    auto& [client, server] = pairs.back();
+    io.spawn( echo( io, server ) );
+    io.spawn( request( io, client, i, replies[i] ) );
+  }
+  run( loop );
+
+  for ( size_t i = 0; i < flows; ++i ) {
+    test_should_be( replies[i] == "request " + to_string( i ), true );
+  }
+}
+
+// Sleeps resume in deadline order, no earlier than asked.
+void sleeps( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  AsyncIO io { loop };
+
+  const auto start = steady_clock::now();
+  vector<int> order;
+  for ( const int ms : { 30, 10, 20 } ) {
+    io.spawn( sleeper( io, start, ms, order ) );
+  }
+  run( loop );
+
+  test_should_be( ( order == vector<int> { 10, 20, 30 } ), true );
+}
+
+// accept() waits for a connection on a non-blocking listener.
+void accepts( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  AsyncIO io { loop };
+
+  TCPSocket listener;
+  listener.set_reuseaddr();
+  listener.bind( Address { "127.0.0.1", 0 } );
+  listener.listen();
+
+  string received;
+  io.spawn( accept_and_read( io, listener, received ) );
+  TCPSocket client;
+  io.spawn( connect_and_write( io, client, listener.local_address() ) );
+  run( loop );
+
+  test_should_be( received == "hello", true );
+}
+
+// An exception that escapes a spawned task comes out of wait_next_event; a task awaiting one that throws gets
+// the exception.
+void exceptions( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  AsyncIO io { loop };
+
+  bool caught = false;
+  io.spawn( catcher( io, caught ) );
+  io.spawn( rethrower( io ) );
+
+  bool propagated = false;
+  try {
+    run( loop );
+  } catch ( const out_of_range& ) {
+    propagated = true;
+  }
+  test_should_be( propagated, true );
+  run( loop );
+  test_should_be( caught, true );
+}
+
+} // namespace
+
+int main()
+{
+  for ( const auto backend : { EventLoop::Backend::Poll, EventLoop::Backend::Epoll } ) {
+    try {
+      write_more_than_fits( backend );
+      many_echoes( backend );
+      sleeps( backend );
+      accepts( backend );
+      exceptions( backend );
+    } catch ( const exception& e ) {
+      cerr << name( backend ) << e.what() << endl;
+      return 1;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
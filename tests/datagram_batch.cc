@@ -0,0 +1,218 @@
+#include "address.hh"
+#include "buffer_pool.hh"
+#include "exception.hh"
+#include "socket.hh"
+#include "test_should_be.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono_literals;
+
+namespace {
+
+UDPSocket bound_socket()
+{
+  UDPSocket socket;
+  socket.bind( Address { "127.0.0.1", 0 } );
+  return socket;
+}
+
+// Datagrams gathered from several pieces go to their own destinations, and arrive whole, in order, with their
+// source address.
+void gather_and_destinations()
+{
+  UDPSocket sender = bound_socket();
+  UDPSocket first = bound_socket();
+  UDPSocket second = bound_socket();
+  first.set_blocking( false );
+  second.set_blocking( false );
+
+  const vector<DatagramSocket::OutgoingDatagram> out {
+    { { "he", "llo" }, first.local_address() },
+    { { "to ", "the ", "second" }, second.local_address() },
+    { { "again" }, first.local_address() },
+  };
+  test_should_be( sender.send_batch( out ), size_t { 3 } );
+
+  BufferPool pool { 2048, 8 };
+  vector<DatagramSocket::ReceivedDatagram> in;
+  test_should_be( first.recv_batch( pool, in, 10 ), size_t { 2 } );
+  test_should_be( second.recv_batch( pool, in, 10 ), size_t { 1 } );
+  test_should_be( in.size(), size_t { 3 } );
+  test_should_be( in.at( 0 ).payload.view() == "hello", true );
+  test_should_be( in.at( 1 ).payload.view() == "again", true );
+  test_should_be( in.at( 2 ).payload.view() == "to the second", true );
+  for ( const auto& datagram : in ) {
+    test_should_be( datagram.source_address == sender.local_address(), true );
+    test_should_be( datagram.segment_size, uint16_t { 0 } );
+    test_should_be( datagram.segments().size(), size_t { 1 } );
+  }
+}
+
+// More than kMaxBatch datagrams take several calls each way; the limit is respected, and a non-blocking socket
+// with nothing waiting returns zero.
+void more_than_one_batch()
+{
+  constexpr size_t count = DatagramSocket::kMaxBatch * 2 + 10;
+  UDPSocket sender = bound_socket();
+  UDPSocket receiver = bound_socket();
+  receiver.set_blocking( false );
+  sender.connect( receiver.local_address() );
+
+  vector<string> payloads;
+  vector<DatagramSocket::OutgoingDatagram> out;
+  payloads.reserve( count );
+  for ( size_t i = 0; i < count; ++i ) {
+    payloads.push_back( "datagram " + to_string( i ) );
+  }
+  for ( const auto& payload : payloads ) {
+    out.push_back( { { payload } } ); // to the connected address
+  }
+  test_should_be( sender.send_batch( out ), count );
+
+  BufferPool pool { 256, 16 };
+  vector<DatagramSocket::ReceivedDatagram> in;
+  test_should_be( receiver.recv_batch( pool, in, 100 ), size_t { 100 } );
+  test_should_be( receiver.recv_batch( pool, in, 1000 ), count - 100 );
+  test_should_be( receiver.recv_batch( pool, in, 1000 ), size_t { 0 } );
+  test_should_be( in.size(), count );
+  for ( size_t i = 0; i < count; ++i ) {
+    if ( in[i].payload.view() != payloads[i] ) {
+      throw runtime_error( "datagram " + to_string( i ) + " arrived as \"" + string( in[i].payload.view() ) + "\"" );
+    }
+  }
+  test_should_be( pool.in_use(), count );
+  in.clear();
+  test_should_be( pool.in_use(), size_t { 0 } );
+}
+
+// On a blocking socket, recv_batch waits for the first datagram only, then takes what else is queued.
+void blocking_waits_for_one()
+{
+  UDPSocket sender = bound_socket();
+  UDPSocket receiver = bound_socket();
+  sender.connect( receiver.local_address() );
+
+  thread later { [&] {
+    this_thread::sleep_for( 20ms );
+    const vector<DatagramSocket::OutgoingDatagram> out { { { "one" } }, { { "two" } } };
+    sender.send_batch( out );
+  } };
+  BufferPool pool { 256, 4 };
+  vector<DatagramSocket::ReceivedDatagram> in;
+  const size_t received = receiver.recv_batch( pool, in, 10 );
+  later.join();
+
+  test_should_be( received >= 1 and received <= 2, true );
+  test_should_be( in.at( 0 ).payload.view() == "one", true );
+}
+
+// A datagram larger than the pool's buffers is an error, not a silent truncation.
+void oversized()
+{
+  UDPSocket sender = bound_socket();
+  UDPSocket receiver = bound_socket();
+  sender.connect( receiver.local_address() );
+  const string big( 300, 'x' );
+  const vector<DatagramSocket::OutgoingDatagram> out { { { big } } };
+  sender.send_batch( out );
+
+  BufferPool pool { 256, 1 };
+  vector<DatagramSocket::ReceivedDatagram> in;
+  bool threw = false;
+  try {
+    receiver.recv_batch( pool, in, 1 );
+  } catch ( const runtime_error& ) {
+    threw = true;
+  }
+  test_should_be( threw, true );
+}
+
+// segments() splits a coalesced payload at the segment size, the last segment taking what is left.
+void segments()
+{
+  BufferPool pool { 256, 1 };
+  DatagramSocket::ReceivedDatagram datagram { Address { "127.0.0.1", 0 }, pool.get(), 100 };
+  string( 250, 'x' ).copy( datagram.payload.data(), 250 );
+  datagram.payload.resize( 250 );
+
+  const auto pieces = datagram.segments();
+  test_should_be( pieces.size(), size_t { 3 } );
+  test_should_be( pieces.at( 0 ).size(), size_t { 100 } );
+  test_should_be( pieces.at( 2 ).size(), size_t { 50 } );
+  test_should_be( pieces.at( 1 ).data() == datagram.payload.data() + 100, true );
+}
+
+// A payload sent with a segment size arrives as separate datagrams, or (with GRO on) coalesced into receives
+// whose segments() are those datagrams.
+void segmented( bool gro )
+{
+  UDPSocket sender = bound_socket();
+  UDPSocket receiver = bound_socket();
+  receiver.set_blocking( false );
+  if ( gro ) {
+    receiver.set_gro( true );
+  }
+  sender.connect( receiver.local_address() );
+
+  string payload;
+  vector<string> expected;
+  for ( size_t i = 0; i < 10; ++i ) {
+    expected.push_back( string( i == 9 ? 50 : 100, static_cast<char>( 'a' + i ) ) );
+    payload += expected.back();
+  }
+  const vector<DatagramSocket::OutgoingDatagram> out { { { payload }, {}, 100 } };
+  test_should_be( sender.send_batch( out ), size_t { 1 } );
+
+  BufferPool pool { 65536, 4 };
+  vector<DatagramSocket::ReceivedDatagram> in;
+  const auto deadline = chrono::steady_clock::now() + 1s;
+  vector<string> received;
+  while ( received.size() < expected.size() and chrono::steady_clock::now() < deadline ) {
+    in.clear();
+    receiver.recv_batch( pool, in, DatagramSocket::kMaxBatch );
+    for ( const auto& datagram : in ) {
+      test_should_be( gro or datagram.segment_size == 0, true );
+      for ( const auto piece : datagram.segments() ) {
+        received.emplace_back( piece );
+      }
+    }
+  }
+  test_should_be( received == expected, true );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    gather_and_destinations();
+    more_than_one_batch();
+    blocking_waits_for_one();
+    oversized();
+    segments();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  try {
+    segmented( false );
+    segmented( true );
+  } catch ( const unix_error& e ) {
+    cout << "UDP GSO/GRO unavailable on this kernel (" << e.what() << "), skipping.\n";
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+#include "exception.hh"
+#include "socket.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+static constexpr size_t datagram_size = 1400;
+static constexpr size_t burst = 32; // datagrams in flight at once (burst * datagram_size fits in one GSO send)
+
+struct Path
+{
+  UDPSocket sender {};
+  UDPSocket receiver {};
+  BufferPool pool { 65536, burst };
+  vector<DatagramSocket::ReceivedDatagram> received {};
+
+  Path()
+  {
+    receiver.bind( Address { "127.0.0.1", 0 } );
+    sender.connect( receiver.local_address() );
+  }
+
+  // Receive until `count` datagrams of datagram_size have arrived, splitting coalesced receives
+  void receive_burst( const size_t count )
+  {
+    size_t datagrams = 0;
+    while ( datagrams < count ) {
+      received.clear();
+      receiver.recv_batch( pool, received, burst );
+      for ( const auto& d : received ) {
+        for ( const auto segment : d.segments() ) {
+          if ( segment.size() != datagram_size ) {
+            throw runtime_error( "received a datagram of " + to_string( segment.size() ) + " bytes" );
+          }
+          ++datagrams;
+        }
+      }
+    }
+    if ( datagrams != count ) {
+      throw runtime_error( "received " + to_string( datagrams ) + " datagrams, expected " + to_string( count ) );
+    }
+  }
+};
+
+// One datagram per send(2) and per recvfrom(2)
+void one_per_syscall( Path& path, const string& payload, const size_t total )
+{
+  string buffer;
+  Address source { "0.0.0.0" };
+  for ( size_t sent = 0; sent < total; sent += burst ) {
+    for ( size_t i = 0; i < burst; ++i ) {
+      path.sender.send( payload.substr( 0, datagram_size ) );
+    }
+    for ( size_t i = 0; i < burst; ++i ) {
+      path.receiver.recv( source, buffer );
+      if ( buffer.size() != datagram_size ) {
+        throw runtime_error( "received a datagram of " + to_string( buffer.size() ) + " bytes" );
+      }
+    }
+  }
+}
+
+// A burst per sendmmsg(2) and recvmmsg(2)
+void batched( Path& path, const string& payload, const size_t total )
+{
+  vector<DatagramSocket::OutgoingDatagram> datagrams( burst );
+  for ( auto& d : datagrams ) {
+    d.payload = { string_view { payload }.substr( 0, datagram_size ) };
+  }
+  for ( size_t sent = 0; sent < total; sent += burst ) {
+    path.sender.send_batch( datagrams );
+    path.receive_burst( burst );
+  }
+}
+
+// A burst per segmented send (UDP GSO), received coalesced (UDP GRO)
+void segmented( Path& path, const string& payload, const size_t total )
+{
+  path.receiver.set_gro( true );
+  const vector<DatagramSocket::OutgoingDatagram> datagrams {
+    { { payload }, {}, static_cast<uint16_t>( datagram_size ) } };
+  for ( size_t sent = 0; sent < total; sent += burst ) {
+    path.sender.send_batch( datagrams );
+    path.receive_burst( burst );
+  }
+}
+
+void speed_test( const string& name, const function<void( Path&, const string&, size_t )>& send_and_receive )
+{
+  const size_t total = 100000;
+  const string payload( datagram_size * burst, 'x' );
+
+  Path warm_up;
+  send_and_receive( warm_up, payload, total / 10 );
+
+  Path path;
+  const auto start = steady_clock::now();
+  send_and_receive( path, payload, total );
+  const double seconds = duration_cast<duration<double>>( steady_clock::now() - start ).count();
+  const double rate = static_cast<double>( total ) / seconds / 1e3;
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "UDP over loopback, " << name << ": " << fixed << setprecision( 0 ) << rate << " thousand "
+       << datagram_size << "-byte datagrams/s.\n";
+  debug_output << "      UDP loopback, " << setw( 20 ) << left << name + ":" << right << fixed << setprecision( 0 )
+               << setw( 6 ) << rate << " kdatagrams/s\n";
+}
+
+void program_body()
+{
+  speed_test( "one per syscall", one_per_syscall );
+  speed_test( "sendmmsg/recvmmsg", batched );
+  try {
+    speed_test( "GSO/GRO", segmented );
+  } catch ( const unix_error& e ) {
+    cout << "UDP GSO/GRO unavailable on this kernel (" << e.what() << "), skipping.\n";
+  }
+}
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
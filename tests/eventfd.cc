@@ -0,0 +1,79 @@
+#include "eventfd.hh"
+#include "eventloop.hh"
+#include "test_should_be.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono_literals;
+
+namespace {
+
+void counting()
+{
+  EventFD efd;
+  test_should_be( efd.drain(), uint64_t { 0 } ); // not readable: non-blocking, so no wait
+  efd.notify();
+  efd.notify( 3 );
+  efd.notify( 5 );
+  test_should_be( efd.drain(), uint64_t { 9 } );
+  test_should_be( efd.drain(), uint64_t { 0 } );
+}
+
+// A notification from another thread wakes up an EventLoop waiting with no timeout, once per drain.
+void wakes_an_eventloop()
+{
+  EventFD efd;
+  EventLoop loop;
+  uint64_t woken = 0;
+  uint64_t total = 0;
+  loop.add_rule( "eventfd", efd, Direction::In, [&] {
+    ++woken;
+    total += efd.drain();
+  } );
+
+  thread notifier { [&] {
+    this_thread::sleep_for( 20ms );
+    efd.notify( 2 );
+  } };
+  const auto start = chrono::steady_clock::now();
+  const auto result = loop.wait_next_event( -1 );
+  notifier.join();
+  if ( result != EventLoop::Result::Success ) {
+    throw runtime_error( "EventLoop did not report the eventfd" );
+  }
+  if ( chrono::steady_clock::now() - start > 5s ) {
+    throw runtime_error( "EventLoop took too long to notice the eventfd" );
+  }
+  test_should_be( woken, uint64_t { 1 } );
+  test_should_be( total, uint64_t { 2 } );
+
+  // once drained, it is not readable again until the next notify
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+  efd.notify();
+  efd.notify();
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+  test_should_be( woken, uint64_t { 2 } );
+  test_should_be( total, uint64_t { 4 } );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    counting();
+    wakes_an_eventloop();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
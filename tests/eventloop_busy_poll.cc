@@ -0,0 +1,136 @@
+#include "eventloop.hh"
+#include "exception.hh"
+#include "socket.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <utility>
+
+using namespace std;
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+namespace {
+
+pair<LocalStreamSocket, LocalStreamSocket> socket_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds.data() ) );
+  return { LocalStreamSocket { FileDescriptor { fds[0] } }, LocalStreamSocket { FileDescriptor { fds[1] } } };
+}
+
+const char* name( EventLoop::Backend backend )
+{
+  return backend == EventLoop::Backend::Poll ? "poll: " : "epoll: ";
+}
+
+// CPU time used by this thread
+nanoseconds cpu_time()
+{
+  timespec ts {};
+  CheckSystemCall( "clock_gettime", ::clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) );
+  return seconds { ts.tv_sec } + nanoseconds { ts.tv_nsec };
+}
+
+void expect_between( milliseconds elapsed, milliseconds low, milliseconds high, const string& what )
+{
+  if ( elapsed < low or elapsed > high ) {
+    throw runtime_error( what + " took " + to_string( elapsed.count() ) + " ms" );
+  }
+}
+
+// An fd that becomes ready while the loop spins is served, and the call returns at once.
+void ready_while_spinning( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  loop.set_busy_poll( 500ms );
+  test_should_be( loop.busy_poll() == 500ms, true );
+
+  auto [a, b] = socket_pair();
+  string received;
+  loop.add_rule( "read", b, Direction::In, [&] { b.read( received ); } );
+
+  steady_clock::time_point written_at;
+  thread writer { [&] {
+    this_thread::sleep_for( 20ms );
+    written_at = steady_clock::now();
+    a.write( "x" );
+  } };
+  const auto result = loop.wait_next_event( -1 );
+  const auto served_at = steady_clock::now();
+  writer.join();
+
+  test_should_be( result == EventLoop::Result::Success, true );
+  test_should_be( received == "x", true );
+  expect_between( duration_cast<milliseconds>( served_at - written_at ), 0ms, 100ms, "serving a write made mid-spin" );
+}
+
+// The spin never outlasts the caller's timeout.
+void timeout_shorter_than_budget( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  loop.set_busy_poll( 10s );
+  auto [idle, idle_peer] = socket_pair();
+  loop.add_rule( "idle", idle, Direction::In, [] { throw runtime_error( "the idle socket became readable" ); } );
+
+  const auto start = steady_clock::now();
+  test_should_be( loop.wait_next_event( 20 ) == EventLoop::Result::Timeout, true );
+  expect_between( duration_cast<milliseconds>( steady_clock::now() - start ), 20ms, 500ms, "a 20 ms wait" );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+}
+
+// Once the budget has passed with no event, the loop blocks (using next to no CPU) for the rest of the timeout.
+void blocks_after_the_budget( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  loop.set_busy_poll( 2ms );
+  auto [idle, idle_peer] = socket_pair();
+  loop.add_rule( "idle", idle, Direction::In, [] { throw runtime_error( "the idle socket became readable" ); } );
+
+  const auto start = steady_clock::now();
+  const auto cpu_start = cpu_time();
+  test_should_be( loop.wait_next_event( 200 ) == EventLoop::Result::Timeout, true );
+  const auto cpu = duration_cast<milliseconds>( cpu_time() - cpu_start );
+  expect_between( duration_cast<milliseconds>( steady_clock::now() - start ), 200ms, 1000ms, "a 200 ms wait" );
+  if ( cpu > 100ms ) {
+    throw runtime_error( "the loop kept spinning: " + to_string( cpu.count() ) + " ms of CPU in a 200 ms wait" );
+  }
+}
+
+// A loop with nothing to wait for exits at once, spin or no spin.
+void exits_without_spinning( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  loop.set_busy_poll( 10s );
+  const auto start = steady_clock::now();
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Exit, true );
+  expect_between( duration_cast<milliseconds>( steady_clock::now() - start ), 0ms, 500ms, "exiting" );
+}
+
+} // namespace
+
+int main()
+{
+  for ( const auto backend : { EventLoop::Backend::Poll, EventLoop::Backend::Epoll } ) {
+    try {
+      ready_while_spinning( backend );
+      timeout_shorter_than_budget( backend );
+      blocks_after_the_budget( backend );
+      exits_without_spinning( backend );
+    } catch ( const exception& e ) {
+      cerr << name( backend ) << e.what() << endl;
+      return 1;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,220 @@
+#include "eventloop.hh"
+#include "exception.hh"
+#include "socket.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+pair<LocalStreamSocket, LocalStreamSocket> socket_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds.data() ) );
+  return { LocalStreamSocket { FileDescriptor { fds[0] } }, LocalStreamSocket { FileDescriptor { fds[1] } } };
+}
+
+string read_some( FileDescriptor& fd, size_t size )
+{
+  string buffer( size, '\0' );
+  fd.read( buffer );
+  return buffer;
+}
+
+void expect_order( const string& order, const string& expected )
+{
+  if ( order != expected ) {
+    throw runtime_error( "rules were served in order \"" + order + "\", expected \"" + expected + "\"" );
+  }
+}
+
+const char* name( EventLoop::Backend backend )
+{
+  return backend == EventLoop::Backend::Poll ? "poll: " : "epoll: ";
+}
+
+// Dispatch::AllReady serves every ready rule in one call, in the order they were added; Dispatch::OneRule serves
+// them one per call, in the same order.
+void all_ready_in_order( EventLoop::Backend backend )
+{
+  for ( const auto dispatch : { EventLoop::Dispatch::OneRule, EventLoop::Dispatch::AllReady } ) {
+    EventLoop loop { backend };
+    loop.set_dispatch( dispatch );
+    vector<pair<LocalStreamSocket, LocalStreamSocket>> pairs;
+    pairs.reserve( 3 ); // the callbacks hold references
+    string order;
+    for ( const char tag : { 'a', 'b', 'c' } ) {
+      pairs.push_back( socket_pair() );
+      LocalStreamSocket& reader = pairs.back().first;
+      loop.add_rule( string { tag }, reader, Direction::In, [&order, &reader, tag] {
+        order += tag;
+        (void)read_some( reader, 100 );
+      } );
+    }
+
+    // written in the opposite order to the rules
+    for ( size_t i = pairs.size(); i-- > 0; ) {
+      pairs[i].second.write( "x" );
+    }
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    if ( dispatch == EventLoop::Dispatch::OneRule ) {
+      expect_order( order, "a" );
+      test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+      test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    }
+    expect_order( order, "abc" );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+  }
+}
+
+// A ready rule cancelled by an earlier callback in the same call is skipped, and so is one whose fd an earlier
+// callback closed (that rule is dropped, with its cancel callback, by the end of the next call).
+void changed_by_an_earlier_callback( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  loop.set_dispatch( EventLoop::Dispatch::AllReady );
+  auto [a, a_peer] = socket_pair();
+  auto [b, b_peer] = socket_pair();
+  auto [c, c_peer] = socket_pair();
+  auto [d, d_peer] = socket_pair();
+
+  string order;
+  size_t c_cancels = 0;
+  optional<EventLoop::RuleHandle> b_rule;
+  loop.add_rule( "a", a, Direction::In, [&] {
+    order += 'a';
+    (void)read_some( a, 100 );
+    b_rule->cancel();
+    c.close();
+  } );
+  b_rule = loop.add_rule( "b", b, Direction::In, [&] {
+    order += 'b';
+    (void)read_some( b, 100 );
+  } );
+  loop.add_rule(
+    loop.add_category( "c" ),
+    c,
+    Direction::In,
+    [&] {
+      order += 'c';
+      (void)read_some( c, 100 );
+    },
+    {},
+    [&] { ++c_cancels; } );
+  loop.add_rule( "d", d, Direction::In, [&] {
+    order += 'd';
+    (void)read_some( d, 100 );
+  } );
+
+  for ( auto* peer : { &a_peer, &b_peer, &c_peer, &d_peer } ) {
+    peer->write( "x" );
+  }
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+  expect_order( order, "ad" );
+
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+  test_should_be( c_cancels, size_t { 1 } );
+  expect_order( order, "ad" );
+}
+
+// A rule added by a callback is not served in the call that added it (its fd was not waited for), even if it is
+// ready; it is served on the next call.
+void added_mid_pass( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  loop.set_dispatch( EventLoop::Dispatch::AllReady );
+  auto [a, a_peer] = socket_pair();
+  auto [b, b_peer] = socket_pair();
+
+  string order;
+  loop.add_rule( "a", a, Direction::In, [&] {
+    order += 'a';
+    (void)read_some( a, 100 );
+    loop.add_rule( "b", b, Direction::In, [&] {
+      order += 'b';
+      (void)read_some( b, 100 );
+    } );
+  } );
+
+  b_peer.write( "x" );
+  a_peer.write( "x" );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+  expect_order( order, "a" );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+  expect_order( order, "ab" );
+}
+
+// With a budget, a rule on a non-blocking fd runs again while each run reads something, up to the budget, and the
+// other ready rules are still served in the same call. On a blocking fd the budget does not apply.
+void budget( EventLoop::Backend backend )
+{
+  for ( const bool non_blocking : { true, false } ) {
+    EventLoop loop { backend };
+    loop.set_dispatch( EventLoop::Dispatch::AllReady );
+    auto [busy, busy_peer] = socket_pair();
+    auto [other, other_peer] = socket_pair();
+    busy.set_blocking( not non_blocking );
+
+    size_t busy_runs = 0;
+    string busy_read;
+    size_t other_runs = 0;
+    loop
+      .add_rule( "busy",
+                 busy,
+                 Direction::In,
+                 [&] {
+                   ++busy_runs;
+                   busy_read += read_some( busy, 1 ); // one byte per run
+                 } )
+      .set_budget( 4 );
+    loop.add_rule( "other", other, Direction::In, [&] {
+      ++other_runs;
+      (void)read_some( other, 100 );
+    } );
+
+    busy_peer.write( "0123456" );
+    other_peer.write( "x" );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    test_should_be( busy_runs, non_blocking ? size_t { 4 } : size_t { 1 } );
+    test_should_be( busy_read.size(), busy_runs );
+    test_should_be( other_runs, size_t { 1 } );
+
+    if ( non_blocking ) {
+      // three bytes left: the fourth run finds nothing, and ends the streak
+      test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+      test_should_be( busy_runs, size_t { 8 } );
+      test_should_be( busy_read.size(), size_t { 7 } );
+      test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+    }
+  }
+}
+
+} // namespace
+
+int main()
+{
+  for ( const auto backend : { EventLoop::Backend::Poll, EventLoop::Backend::Epoll } ) {
+    try {
+      all_ready_in_order( backend );
+      changed_by_an_earlier_callback( backend );
+      added_mid_pass( backend );
+      budget( backend );
+    } catch ( const exception& e ) {
+      cerr << name( backend ) << e.what() << endl;
+      return 1;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
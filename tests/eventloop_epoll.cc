@@ -0,0 +1,277 @@
+#include "eventloop.hh"
+#include "exception.hh"
+#include "socket.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <cstdlib>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+pair<LocalStreamSocket, LocalStreamSocket> socket_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds.data() ) );
+  return { LocalStreamSocket { FileDescriptor { fds[0] } }, LocalStreamSocket { FileDescriptor { fds[1] } } };
+}
+
+string read_some( FileDescriptor& fd, size_t size )
+{
+  string buffer( size, '\0' );
+  fd.read( buffer );
+  return buffer;
+}
+
+void expect_order( const string& order, const string& expected )
+{
+  if ( order != expected ) {
+    throw runtime_error( "rules were served in order \"" + order + "\", expected \"" + expected + "\"" );
+  }
+}
+
+// An fd's In and Out rules share its registration; an interest function arms and disarms its rule, and ready
+// rules are served in the order they were added.
+void in_and_out_on_one_fd()
+{
+  EventLoop loop;
+  test_should_be( loop.backend() == EventLoop::Backend::Epoll, true );
+  auto [a, b] = socket_pair();
+
+  string received;
+  string to_send;
+  string order;
+  loop.add_rule( "read a", a, Direction::In, [&] {
+    order += 'r';
+    received += read_some( a, 100 );
+  } );
+  loop.add_rule(
+    "write a",
+    a,
+    Direction::Out,
+    [&] {
+      order += 'w';
+      to_send.erase( 0, a.write( to_send ) );
+    },
+    [&] { return not to_send.empty(); } );
+
+  // nothing to read, nothing to write
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+
+  to_send = "hello";
+  b.write( "abc" );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+  expect_order( order, "r" );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+  expect_order( order, "rw" );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+  if ( received != "abc" or read_some( b, 100 ) != "hello" ) {
+    throw runtime_error( "wrong data through the rules" );
+  }
+
+  // both at once
+  loop.set_dispatch( EventLoop::Dispatch::AllReady );
+  to_send = "again";
+  b.write( "def" );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+  expect_order( order, "rwrw" );
+  test_should_be( loop.backend() == EventLoop::Backend::Epoll, true );
+}
+
+// A second rule for the same fd and direction shares the fd's registration with the first, whether it is added
+// between calls or by a callback: the loop stays with epoll and serves both, and cancelling one leaves the other.
+void second_rule_for_a_direction()
+{
+  for ( const bool from_callback : { false, true } ) {
+    EventLoop loop;
+    loop.set_dispatch( EventLoop::Dispatch::AllReady );
+    auto [a, b] = socket_pair();
+    auto [c, d] = socket_pair();
+    size_t first_runs = 0;
+    size_t second_runs = 0;
+    optional<EventLoop::RuleHandle> second_handle;
+    const auto second = [&] {
+      second_handle = loop.add_rule( "second reader", a, Direction::In, [&] {
+        ++second_runs;
+        (void)read_some( a, 1 );
+      } );
+    };
+
+    loop.add_rule( "first reader", a, Direction::In, [&] {
+      ++first_runs;
+      (void)read_some( a, 1 );
+    } );
+    loop.add_rule( "other fd", c, Direction::In, [&] {
+      (void)read_some( c, 100 );
+      if ( from_callback ) {
+        second();
+      }
+    } );
+    if ( from_callback ) {
+      d.write( "x" );
+      test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    } else {
+      second();
+    }
+    test_should_be( loop.backend() == EventLoop::Backend::Epoll, true );
+
+    b.write( "xy" );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    test_should_be( first_runs, size_t { 1 } );
+    test_should_be( second_runs, size_t { 1 } );
+
+    second_handle->cancel();
+    b.write( "z" );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    test_should_be( first_runs, size_t { 2 } );
+    test_should_be( second_runs, size_t { 1 } );
+    test_should_be( loop.backend() == EventLoop::Backend::Epoll, true );
+  }
+}
+
+// A rule set to have its interest evaluated on change is evaluated after its own callback runs and after
+// interest_changed(), and not otherwise.
+void interest_on_change()
+{
+  EventLoop loop;
+  auto [a, b] = socket_pair();
+  string to_send;
+  size_t evaluations = 0;
+  auto handle = loop.add_rule(
+    "write a",
+    a,
+    Direction::Out,
+    [&] { to_send.erase( 0, a.write( to_send ) ); },
+    [&] {
+      ++evaluations;
+      return not to_send.empty();
+    } );
+  handle.set_interest_on_change();
+
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, true );
+  test_should_be( evaluations, size_t { 1 } );
+
+  // unannounced, the change goes unnoticed
+  to_send = "hello";
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, true );
+  test_should_be( evaluations, size_t { 1 } );
+
+  handle.interest_changed();
+  handle.interest_changed(); // once is enough
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+  test_should_be( evaluations, size_t { 3 } ); // once before the wait, and once after the callback
+  test_should_be( read_some( b, 100 ) == "hello", true );
+
+  // the callback emptied to_send, so the rule is disarmed without another evaluation
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, true );
+  test_should_be( evaluations, size_t { 3 } );
+}
+
+// Closing an fd behind the loop's back, then reusing its number for another fd: the stale rule (in either
+// direction) is dropped, with its cancel callback, when a rule is added for the new fd.
+void fd_number_reused()
+{
+  for ( const Direction stale_direction : { Direction::In, Direction::Out } ) {
+    EventLoop loop;
+    auto [a, b] = socket_pair();
+    size_t cancelled = 0;
+    loop.add_rule(
+      loop.add_category( "stale" ),
+      a,
+      stale_direction,
+      [] { throw runtime_error( "rule on a closed fd was served" ); },
+      {},
+      [&] { ++cancelled; } );
+    const int fd_num = a.fd_num();
+    a.close();
+
+    auto [c, d] = socket_pair();
+    test_should_be( c.fd_num(), fd_num ); // the lowest free number
+    bool writable = false;
+    loop.add_rule( "new", c, Direction::Out, [&] {
+      writable = true;
+      c.write( "x" );
+    } );
+    test_should_be( cancelled, size_t { 1 } );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    test_should_be( writable, true );
+    test_should_be( loop.backend() == EventLoop::Backend::Epoll, true );
+    test_should_be( cancelled, size_t { 1 } );
+  }
+}
+
+// Rules go away when cancelled (without their cancel callback) or at EOF (with it), and then the loop exits.
+void cancel_and_eof()
+{
+  EventLoop loop;
+  auto [a, b] = socket_pair();
+  auto [c, d] = socket_pair();
+  size_t eof_cancels = 0;
+  auto handle = loop.add_rule(
+    loop.add_category( "cancelled" ),
+    a,
+    Direction::In,
+    [&] { (void)read_some( a, 100 ); },
+    {},
+    [] { throw runtime_error( "cancel callback of a cancelled rule" ); } );
+  loop.add_rule(
+    loop.add_category( "until eof" ),
+    c,
+    Direction::In,
+    [&] { (void)read_some( c, 100 ); },
+    {},
+    [&] { ++eof_cancels; } );
+
+  handle.cancel();
+  b.write( "ignored" );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+
+  d.shutdown( SHUT_WR );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+  test_should_be( c.eof(), true );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, true );
+  test_should_be( eof_cancels, size_t { 1 } );
+}
+
+// epoll cannot watch a regular file, which poll reports as always ready.
+void regular_file()
+{
+  EventLoop loop;
+  FileDescriptor file { CheckSystemCall( "open", ::open( "/proc/self/exe", O_RDONLY | O_CLOEXEC ) ) };
+  size_t reads = 0;
+  loop.add_rule( "file", file, Direction::In, [&] {
+    ++reads;
+    (void)read_some( file, 100 );
+  } );
+  test_should_be( loop.backend() == EventLoop::Backend::Poll, true );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+  test_should_be( reads, size_t { 1 } );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    in_and_out_on_one_fd();
+    second_rule_for_a_direction();
+    interest_on_change();
+    fd_number_reused();
+    cancel_and_eof();
+    regular_file();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,165 @@
+#include "eventloop.hh"
+#include "exception.hh"
+#include "socket.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <utility>
+
+using namespace std;
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+namespace {
+
+pair<LocalStreamSocket, LocalStreamSocket> socket_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds.data() ) );
+  return { LocalStreamSocket { FileDescriptor { fds[0] } }, LocalStreamSocket { FileDescriptor { fds[1] } } };
+}
+
+const char* name( EventLoop::Backend backend )
+{
+  return backend == EventLoop::Backend::Poll ? "poll: " : "epoll: ";
+}
+
+constexpr uint64_t ms_in_ns( uint64_t ms )
+{
+  return ms * 1000 * 1000;
+}
+
+const EventLoop::RuleCategory& category( const EventLoop::Snapshot& snapshot, const string& category_name )
+{
+  for ( const auto& c : snapshot.categories ) {
+    if ( c.name == category_name ) {
+      return c;
+    }
+  }
+  throw runtime_error( "no category " + category_name );
+}
+
+// Nothing is recorded until instrumentation is turned on.
+void off_by_default( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  test_should_be( loop.instrumented(), false );
+  auto [a, b] = socket_pair();
+  string received;
+  loop.add_rule( "read", b, Direction::In, [&] { b.read( received ); } );
+  a.write( "x" );
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Success, true );
+
+  const auto snapshot = loop.snapshot();
+  test_should_be( snapshot.calls, uint64_t { 0 } );
+  test_should_be( snapshot.wait_ns + snapshot.busy_ns, uint64_t { 0 } );
+  test_should_be( category( snapshot, "read" ).callbacks, uint64_t { 0 } );
+}
+
+// Callbacks, interest checks, timers and waiting are each charged where they belong.
+void records_each_category( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  loop.set_instrumented( true );
+  auto [a, b] = socket_pair();
+
+  string received;
+  size_t interest_checks = 0;
+  loop.add_rule(
+    "slow read",
+    b,
+    Direction::In,
+    [&] {
+      b.read( received );
+      this_thread::sleep_for( 5ms );
+    },
+    [&] {
+      ++interest_checks;
+      return true;
+    } );
+  bool timer_fired = false;
+  loop.add_timer( "timer", steady_clock::now(), [&] { timer_fired = true; } );
+
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Success, true ); // the timer
+  test_should_be( timer_fired, true );
+  for ( size_t i = 0; i < 3; ++i ) {
+    a.write( "x" );
+    test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Success, true );
+  }
+  test_should_be( loop.wait_next_event( 30 ) == EventLoop::Result::Timeout, true );
+
+  const auto snapshot = loop.snapshot();
+  test_should_be( snapshot.calls, uint64_t { 5 } );
+
+  const auto& slow = category( snapshot, "slow read" );
+  test_should_be( slow.callbacks, uint64_t { 3 } );
+  test_should_be( slow.callback_ns >= ms_in_ns( 15 ), true );
+  test_should_be( slow.max_callback_ns >= ms_in_ns( 5 ), true );
+  test_should_be( slow.max_callback_ns <= slow.callback_ns, true );
+  test_should_be( slow.callback_quantile_ns( 0.5 ) >= ms_in_ns( 5 ), true );
+  test_should_be( slow.callback_quantile_ns( 0.99 ) <= slow.max_callback_ns, true );
+  test_should_be( slow.interest_evaluations, static_cast<uint64_t>( interest_checks ) );
+  test_should_be( slow.interest_evaluations > 0, true );
+
+  test_should_be( category( snapshot, "timer" ).callbacks, uint64_t { 1 } );
+
+  test_should_be( snapshot.wait_ns >= ms_in_ns( 30 ), true );
+  test_should_be( snapshot.busy_ns >= ms_in_ns( 15 ), true );
+  test_should_be( snapshot.utilization() > 0 and snapshot.utilization() < 1, true );
+
+  // the summary lists the active categories only
+  ostringstream summary;
+  loop.summary( summary );
+  test_should_be( summary.str().find( "slow read" ) != string::npos, true );
+  test_should_be( summary.str().find( "timer" ) != string::npos, true );
+  test_should_be( summary.str().find( "posted tasks" ) == string::npos, true );
+  test_should_be( summary.str().find( "5 calls" ) != string::npos, true );
+}
+
+// Turning instrumentation off stops the counters without clearing them.
+void turned_off_again( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  loop.set_instrumented( true );
+  auto [a, b] = socket_pair();
+  string received;
+  loop.add_rule( "read", b, Direction::In, [&] { b.read( received ); } );
+
+  a.write( "x" );
+  loop.wait_next_event( -1 );
+  loop.set_instrumented( false );
+  a.write( "x" );
+  loop.wait_next_event( -1 );
+
+  const auto snapshot = loop.snapshot();
+  test_should_be( snapshot.calls, uint64_t { 1 } );
+  test_should_be( category( snapshot, "read" ).callbacks, uint64_t { 1 } );
+}
+
+} // namespace
+
+int main()
+{
+  for ( const auto backend : { EventLoop::Backend::Poll, EventLoop::Backend::Epoll } ) {
+    try {
+      off_by_default( backend );
+      records_each_category( backend );
+      turned_off_again( backend );
+    } catch ( const exception& e ) {
+      cerr << name( backend ) << e.what() << endl;
+      return 1;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+#include "eventloop.hh"
+#include "exception.hh"
+#include "socket.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+namespace {
+
+pair<LocalStreamSocket, LocalStreamSocket> socket_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds.data() ) );
+  return { LocalStreamSocket { FileDescriptor { fds[0] } }, LocalStreamSocket { FileDescriptor { fds[1] } } };
+}
+
+const char* name( EventLoop::Backend backend )
+{
+  return backend == EventLoop::Backend::Poll ? "poll: " : "epoll: ";
+}
+
+// A task posted from another thread wakes a wait_next_event( -1 ) that is blocked on an idle fd at once, and runs
+// on the loop's thread.
+void wakes_a_blocked_wait( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  auto [idle, idle_peer] = socket_pair();
+  loop.add_rule( "idle", idle, Direction::In, [] { throw runtime_error( "the idle socket became readable" ); } );
+
+  thread::id ran_on;
+  atomic<bool> posted = false;
+  steady_clock::time_point posted_at;
+  thread poster { [&] {
+    this_thread::sleep_for( 50ms );
+    posted_at = steady_clock::now();
+    posted = true;
+    loop.post( [&] { ran_on = this_thread::get_id(); } );
+  } };
+
+  const auto result = loop.wait_next_event( -1 );
+  const auto woke_at = steady_clock::now();
+  poster.join();
+
+  test_should_be( result == EventLoop::Result::Success, true );
+  test_should_be( posted.load(), true );
+  test_should_be( ran_on == this_thread::get_id(), true );
+  const auto delay = duration_cast<milliseconds>( woke_at - posted_at );
+  if ( delay > 20ms ) {
+    throw runtime_error( "the loop woke up " + to_string( delay.count() ) + " ms after the post" );
+  }
+}
+
+// Tasks from several threads all run, each thread's in the order it posted them.
+void many_posters( EventLoop::Backend backend )
+{
+  constexpr size_t posters = 4;
+  constexpr size_t per_poster = 5000;
+  EventLoop loop { backend };
+  auto [idle, idle_peer] = socket_pair();
+  loop.add_rule( "idle", idle, Direction::In, [] { throw runtime_error( "the idle socket became readable" ); } );
+
+  vector<vector<size_t>> ran( posters ); // only touched by the tasks, on the loop's thread
+  size_t total = 0;
+  vector<thread> threads;
+  for ( size_t p = 0; p < posters; ++p ) {
+    threads.emplace_back( [&, p] {
+      for ( size_t i = 0; i < per_poster; ++i ) {
+        loop.post( [&, p, i] {
+          ran[p].push_back( i );
+          ++total;
+        } );
+      }
+    } );
+  }
+
+  while ( total < posters * per_poster ) {
+    if ( loop.wait_next_event( 1000 ) != EventLoop::Result::Success ) {
+      throw runtime_error( "posted tasks stopped running after " + to_string( total ) );
+    }
+  }
+  for ( auto& t : threads ) {
+    t.join();
+  }
+
+  for ( size_t p = 0; p < posters; ++p ) {
+    test_should_be( ran[p].size(), per_poster );
+    for ( size_t i = 0; i < per_poster; ++i ) {
+      if ( ran[p][i] != i ) {
+        throw runtime_error( "poster " + to_string( p ) + "'s tasks ran out of order" );
+      }
+    }
+  }
+}
+
+// A task that throws propagates out of wait_next_event, and the tasks posted after it run on the next call.
+void throwing_task( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  auto [idle, idle_peer] = socket_pair();
+  loop.add_rule( "idle", idle, Direction::In, [] { throw runtime_error( "the idle socket became readable" ); } );
+
+  string ran;
+  loop.post( [&] { ran += 'a'; } );
+  loop.post( [] { throw out_of_range( "from a task" ); } );
+  loop.post( [&] { ran += 'b'; } );
+
+  bool threw = false;
+  try {
+    loop.wait_next_event( 0 );
+  } catch ( const out_of_range& ) {
+    threw = true;
+  }
+  test_should_be( threw, true );
+  test_should_be( ran == "a", true );
+
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+  test_should_be( ran == "ab", true );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+}
+
+// The loop may run a task, and be destroyed, before the post() that handed it over has returned; destroying it
+// waits for that call instead of letting it touch a freed loop.
+void destroyed_right_after_a_post( EventLoop::Backend backend )
+{
+  for ( size_t round = 0; round < 200; ++round ) {
+    bool ran = false;
+    thread poster;
+    {
+      EventLoop loop { backend };
+      auto [idle, idle_peer] = socket_pair();
+      loop.add_rule( "idle", idle, Direction::In, [] { throw runtime_error( "the idle socket became readable" ); } );
+      poster = thread { [&] { loop.post( [&] { ran = true; } ); } };
+      while ( not ran ) {
+        loop.wait_next_event( -1 );
+      }
+    }
+    poster.join();
+  }
+}
+
+} // namespace
+
+int main()
+{
+  for ( const auto backend : { EventLoop::Backend::Poll, EventLoop::Backend::Epoll } ) {
+    try {
+      wakes_a_blocked_wait( backend );
+      many_posters( backend );
+      throwing_task( backend );
+      destroyed_right_after_a_post( backend );
+    } catch ( const exception& e ) {
+      cerr << name( backend ) << e.what() << endl;
+      return 1;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
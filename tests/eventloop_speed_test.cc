@@ -0,0 +1,177 @@
+#include "eventloop.hh"
+#include "exception.hh"
+#include "socket.hh"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+// Round-trip times of `rounds` pings over loopback UDP, each echoed by a second thread; both threads wait with
+// an EventLoop that busy-polls for `spin_budget` (or, with a budget of zero, just waits)
+vector<double> ping_pong( const size_t rounds, const microseconds spin_budget )
+{
+  UDPSocket client_socket;
+  UDPSocket echo_socket;
+  client_socket.bind( Address { "127.0.0.1", 0 } );
+  echo_socket.bind( Address { "127.0.0.1", 0 } );
+  client_socket.connect( echo_socket.local_address() );
+  echo_socket.connect( client_socket.local_address() );
+  client_socket.set_blocking( false );
+  echo_socket.set_blocking( false );
+  if ( spin_budget.count() > 0 ) {
+    client_socket.set_busy_poll( spin_budget );
+    echo_socket.set_busy_poll( spin_budget );
+  }
+
+  EventLoop echo_loop;
+  echo_loop.set_busy_poll( spin_budget );
+  bool echo_done = false;
+  echo_loop.add_rule( "echo", echo_socket, Direction::In, [&] {
+    string payload;
+    echo_socket.read( payload );
+    echo_socket.write( payload );
+  } );
+  thread echo_thread { [&] {
+    while ( not echo_done ) {
+      echo_loop.wait_next_event( -1 );
+    }
+  } };
+
+  EventLoop client_loop;
+  client_loop.set_busy_poll( spin_budget );
+  size_t replies = 0;
+  client_loop.add_rule( "replies", client_socket, Direction::In, [&] {
+    string payload;
+    client_socket.read( payload );
+    ++replies;
+  } );
+
+  const string ping( 64, 'x' );
+  vector<double> rtts_us;
+  rtts_us.reserve( rounds );
+  for ( size_t i = 0; i < rounds; ++i ) {
+    const auto start = steady_clock::now();
+    client_socket.write( ping );
+    while ( replies <= i ) {
+      if ( client_loop.wait_next_event( 1000 ) == EventLoop::Result::Timeout ) {
+        throw runtime_error( "ping " + to_string( i ) + " got no reply" );
+      }
+    }
+    rtts_us.push_back( duration_cast<duration<double, micro>>( steady_clock::now() - start ).count() );
+  }
+
+  echo_loop.post( [&] { echo_done = true; } );
+  echo_thread.join();
+  return rtts_us;
+}
+
+void speed_test( const size_t rounds, const microseconds spin_budget )
+{
+  ping_pong( rounds / 10, spin_budget ); // warm up
+  auto rtts_us = ping_pong( rounds, spin_budget );
+  sort( rtts_us.begin(), rtts_us.end() );
+  const double p50 = rtts_us.at( rtts_us.size() / 2 );
+  const double p99 = rtts_us.at( rtts_us.size() * 99 / 100 );
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  const string mode
+    = spin_budget.count() > 0 ? "busy-poll (" + to_string( spin_budget.count() ) + " us spin)" : "blocking";
+  cout << "EventLoop UDP ping-pong over loopback, " << mode << ": p50 " << fixed << setprecision( 1 ) << p50
+       << " us, p99 " << p99 << " us over " << rounds << " round trips.\n";
+
+  debug_output << "      EventLoop ping-pong, " << setw( 26 ) << left << mode + ":" << right << " p50 " << fixed
+               << setprecision( 1 ) << setw( 7 ) << p50 << " us, p99 " << setw( 7 ) << p99 << " us\n";
+}
+
+pair<LocalStreamSocket, LocalStreamSocket> socket_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds.data() ) );
+  return { LocalStreamSocket { FileDescriptor { fds[0] } }, LocalStreamSocket { FileDescriptor { fds[1] } } };
+}
+
+// Mean time (us) for the loop to notice and serve one readable socket while `idle` other sockets, each with a rule
+// of its own, stay quiet
+double wakeup_with_idle_fds( const EventLoop::Backend backend, const size_t idle, const size_t rounds )
+{
+  EventLoop loop { backend };
+  vector<pair<LocalStreamSocket, LocalStreamSocket>> idle_pairs;
+  idle_pairs.reserve( idle );
+  const size_t idle_category = loop.add_category( "idle" );
+  for ( size_t i = 0; i < idle; ++i ) {
+    idle_pairs.push_back( socket_pair() );
+    loop.add_rule( idle_category, idle_pairs.back().first, Direction::In, [] {
+      throw runtime_error( "an idle socket became readable" );
+    } );
+  }
+
+  auto [active, writer] = socket_pair();
+  string buffer;
+  loop.add_rule( "active", active, Direction::In, [&] {
+    buffer.resize( 1 );
+    active.read( buffer );
+  } );
+
+  const auto start = steady_clock::now();
+  for ( size_t i = 0; i < rounds; ++i ) {
+    writer.write( "x" );
+    if ( loop.wait_next_event( -1 ) != EventLoop::Result::Success ) {
+      throw runtime_error( "the active socket was not served" );
+    }
+  }
+  const duration<double, micro> elapsed = steady_clock::now() - start;
+  return elapsed.count() / static_cast<double>( rounds );
+}
+
+void idle_fds_test( const size_t idle )
+{
+  const size_t rounds = max<size_t>( 200'000 / idle, 100 );
+  const double poll_us = wakeup_with_idle_fds( EventLoop::Backend::Poll, idle, rounds );
+  const double epoll_us = wakeup_with_idle_fds( EventLoop::Backend::Epoll, idle, rounds );
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "EventLoop wakeup with one active and " << idle << " idle sockets: poll " << fixed << setprecision( 1 )
+       << poll_us << " us, epoll " << epoll_us << " us (mean over " << rounds << " wakeups).\n";
+
+  debug_output << "      EventLoop wakeup, " << setw( 5 ) << idle << " idle sockets:    poll " << fixed
+               << setprecision( 1 ) << setw( 7 ) << poll_us << " us, epoll " << setw( 7 ) << epoll_us << " us\n";
+}
+
+void program_body()
+{
+  if ( thread::hardware_concurrency() < 2 ) {
+    cout << "Note: only one CPU, so the busy-polling threads take turns spinning; expect busy-poll to lose.\n";
+  }
+  speed_test( 10000, microseconds { 0 } );
+  speed_test( 10000, microseconds { 50 } );
+  idle_fds_test( 1000 );
+  idle_fds_test( 5000 );
+}
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+#include "eventloop.hh"
+#include "test_should_be.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+namespace {
+
+void expect_within( steady_clock::duration elapsed, milliseconds low, milliseconds high, const string& what )
+{
+  if ( elapsed < low or elapsed > high ) {
+    throw runtime_error( what + " took " + to_string( duration_cast<milliseconds>( elapsed ).count() )
+                         + " ms, expected " + to_string( low.count() ) + " to " + to_string( high.count() ) );
+  }
+}
+
+// A one-shot timer whose deadline has already passed fires on the next call (once the millisecond it was added
+// in has been processed), and only once.
+void past_deadline()
+{
+  EventLoop loop;
+  size_t fired = 0;
+  loop.add_timer( "late", steady_clock::now() - 1s, [&] { ++fired; } );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+  test_should_be( fired, size_t { 1 } );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, true );
+
+  // added after the loop has run, in the same millisecond or not
+  loop.add_timer( "later", steady_clock::now() - 1ms, [&] { ++fired; } );
+  const auto start = steady_clock::now();
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Success, true );
+  expect_within( steady_clock::now() - start, 0ms, 100ms, "a timer already due" );
+  test_should_be( fired, size_t { 2 } );
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Exit, true );
+}
+
+// A timer cancelled before it fires never runs, and does not keep the loop waiting; a callback can cancel its own
+// periodic timer, or another timer due in the same call.
+void cancelled()
+{
+  EventLoop loop;
+  size_t fired = 0;
+  auto handle = loop.add_timer( "cancelled", steady_clock::now() + 50ms, [&] { ++fired; } );
+  handle.cancel();
+  const auto start = steady_clock::now();
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Exit, true );
+  expect_within( steady_clock::now() - start, 0ms, 100ms, "a wait with only a cancelled timer" );
+  test_should_be( fired, size_t { 0 } );
+
+  size_t periodic_runs = 0;
+  optional<EventLoop::RuleHandle> periodic;
+  periodic = loop.add_periodic_timer( "periodic", 5ms, [&] {
+    if ( ++periodic_runs == 3 ) {
+      periodic->cancel();
+    }
+  } );
+  while ( loop.wait_next_event( -1 ) != EventLoop::Result::Exit ) {}
+  test_should_be( periodic_runs, size_t { 3 } );
+
+  // both due by the same call: the first to fire cancels the other, whichever it is
+  optional<EventLoop::RuleHandle> first;
+  optional<EventLoop::RuleHandle> second;
+  const auto deadline = steady_clock::now() + 10ms;
+  first = loop.add_timer( "first", deadline, [&] {
+    ++fired;
+    second->cancel();
+  } );
+  second = loop.add_timer( "second", deadline, [&] {
+    ++fired;
+    first->cancel();
+  } );
+  this_thread::sleep_for( 20ms );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+  test_should_be( fired, size_t { 1 } );
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Exit, true );
+}
+
+// A periodic timer that falls behind by several periods fires once when the loop catches up, not once per missed
+// period, and stays on its original schedule.
+void periodic_skip_ahead()
+{
+  EventLoop loop;
+  constexpr auto period = 50ms;
+  const auto start = steady_clock::now();
+  size_t runs = 0;
+  steady_clock::time_point last_run;
+  loop.add_periodic_timer( "periodic", period, [&] {
+    ++runs;
+    last_run = steady_clock::now();
+  } );
+
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Success, true );
+  test_should_be( runs, size_t { 1 } );
+  expect_within( last_run - start, 45ms, 150ms, "the first firing" );
+
+  this_thread::sleep_for( 4 * period + 10ms ); // a stall: firings at 100, 150, 200 and 250 ms are missed
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+  test_should_be( runs, size_t { 2 } );
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+  test_should_be( runs, size_t { 2 } );
+
+  // the next firing is at the next multiple of the period
+  const auto stalled_until = last_run;
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Success, true );
+  test_should_be( runs, size_t { 3 } );
+  const auto off_schedule = duration_cast<milliseconds>( last_run - start ) % period;
+  expect_within( last_run - stalled_until, 1ms, period + 5ms, "the first firing after the stall" );
+  expect_within( min( off_schedule, period - off_schedule ), 0ms, 15ms, "the offset from the schedule" );
+}
+
+// With no fd rules, a pending timer keeps wait_next_event from returning Exit: it waits for the timer instead (or
+// times out first).
+void pending_timer_is_not_exit()
+{
+  EventLoop loop;
+  size_t fired = 0;
+  const auto start = steady_clock::now();
+  loop.add_timer( "pending", start + 30ms, [&] { ++fired; } );
+
+  test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+  test_should_be( loop.wait_next_event( 5 ) == EventLoop::Result::Timeout, true );
+  test_should_be( fired, size_t { 0 } );
+
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Success, true );
+  test_should_be( fired, size_t { 1 } );
+  expect_within( steady_clock::now() - start, 30ms, 150ms, "the wait for the timer" );
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Exit, true );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    past_deadline();
+    cancelled();
+    periodic_skip_ahead();
+    pending_timer_is_not_exit();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
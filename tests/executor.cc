@@ -0,0 +1,138 @@
+#include "eventloop.hh"
+#include "executor.hh"
+#include "test_should_be.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono_literals;
+
+namespace {
+
+// Tasks submitted from outside the pool all run, on the workers, by the time the Executor is destroyed.
+void submitted_from_outside()
+{
+  atomic<size_t> ran = 0;
+  mutex ids_mutex;
+  set<thread::id> ids;
+  {
+    Executor executor { 3 };
+    test_should_be( executor.threads(), size_t { 3 } );
+    for ( size_t i = 0; i < 10000; ++i ) {
+      executor.submit( [&] {
+        ++ran;
+        const lock_guard lock { ids_mutex };
+        ids.insert( this_thread::get_id() );
+      } );
+    }
+  }
+  test_should_be( ran.load(), size_t { 10000 } );
+  test_should_be( ids.count( this_thread::get_id() ), size_t { 0 } );
+  test_should_be( ids.size() <= 3, true );
+}
+
+// Tasks that split themselves up submit from inside the pool (onto their worker's own deque); idle workers steal
+// them, and every piece runs once.
+void submitted_from_inside()
+{
+  constexpr size_t depth = 14; // 2^14 leaves
+  atomic<size_t> leaves = 0;
+  atomic<size_t> tasks = 0;
+  Executor executor { 4 };
+
+  function<void( size_t )> split = [&]( size_t level ) {
+    ++tasks;
+    if ( level == depth ) {
+      ++leaves;
+      return;
+    }
+    executor.submit( [&, level] { split( level + 1 ); } );
+    executor.submit( [&, level] { split( level + 1 ); } );
+  };
+  executor.submit( [&] { split( 0 ); } );
+
+  const auto deadline = chrono::steady_clock::now() + 10s;
+  while ( leaves.load() < ( size_t { 1 } << depth ) ) {
+    if ( chrono::steady_clock::now() > deadline ) {
+      throw runtime_error( "only " + to_string( leaves.load() ) + " leaves ran" );
+    }
+    this_thread::sleep_for( 1ms );
+  }
+  this_thread::sleep_for( 10ms ); // nothing beyond the leaves
+  test_should_be( tasks.load(), ( size_t { 2 } << depth ) - 1 );
+}
+
+// offload() runs the work on the pool and hands its result (or its exception) back on the loop's thread; the
+// loop does not exit while work is outstanding.
+void offload_round_trips()
+{
+  Executor executor { 2 };
+  EventLoop loop;
+  const auto loop_thread = this_thread::get_id();
+
+  int result = 0;
+  thread::id work_thread;
+  bool done_on_loop = false;
+  loop.offload(
+    executor,
+    [&] {
+      work_thread = this_thread::get_id();
+      this_thread::sleep_for( 20ms );
+      return 6 * 7;
+    },
+    [&]( int x ) {
+      result = x;
+      done_on_loop = this_thread::get_id() == loop_thread;
+    } );
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Success, true );
+  test_should_be( result, 42 );
+  test_should_be( done_on_loop, true );
+  test_should_be( work_thread == loop_thread, false );
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Exit, true );
+
+  // work that returns nothing
+  bool void_done = false;
+  loop.offload( executor, [] {}, [&] { void_done = true; } );
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Success, true );
+  test_should_be( void_done, true );
+
+  // work that throws: the exception comes out of wait_next_event, and `done` is not called
+  bool done_after_throw = false;
+  loop.offload(
+    executor, []() -> int { throw out_of_range( "from work" ); }, [&]( int ) { done_after_throw = true; } );
+  bool threw = false;
+  try {
+    loop.wait_next_event( -1 );
+  } catch ( const out_of_range& ) {
+    threw = true;
+  }
+  test_should_be( threw, true );
+  test_should_be( done_after_throw, false );
+  test_should_be( loop.wait_next_event( -1 ) == EventLoop::Result::Exit, true );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    submitted_from_outside();
+    submitted_from_inside();
+    offload_round_trips();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+#include "exception.hh"
+#include "file_descriptor.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <cstdlib>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+pair<FileDescriptor, FileDescriptor> socket_pair( int type )
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, type | SOCK_CLOEXEC, 0, fds.data() ) );
+  return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+}
+
+// write() throws if nothing could be written, even on a non-blocking fd; try_write() returns zero instead (e.g.,
+// for a datagram the device has no room for), and both carry on once there is room again.
+void write_to_a_full_fd()
+{
+  for ( const int type : { SOCK_STREAM, SOCK_DGRAM } ) {
+    auto [writer, reader] = socket_pair( type );
+    writer.set_blocking( false );
+
+    const vector<string> datagram { "header", string( 1000, 'x' ) };
+    size_t written = 0;
+    while ( writer.try_write( datagram ) > 0 ) {
+      ++written;
+    }
+    test_should_be( written > 0, true );
+    test_should_be( writer.try_write( datagram ), size_t { 0 } );
+
+    bool threw = false;
+    try {
+      writer.write( datagram );
+    } catch ( const runtime_error& ) {
+      threw = true;
+    }
+    test_should_be( threw, true );
+    test_should_be( writer.write( "" ), size_t { 0 } ); // nothing to write is not an error
+
+    string buffer;
+    reader.read( buffer );
+    test_should_be( buffer.empty(), false );
+    while ( writer.try_write( datagram ) == 0 ) { // a stream may need more than one read to make room
+      reader.read( buffer );
+    }
+  }
+}
+
+pair<FileDescriptor, FileDescriptor> make_pipe()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "pipe2", ::pipe2( fds.data(), O_NONBLOCK | O_CLOEXEC ) );
+  return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+}
+
+// splice() moves bytes from a socket through a pipe to another socket; it returns zero without marking EOF when
+// the source has nothing yet or when asked to move nothing, and marks EOF when the source is finished.
+void splice_through_a_pipe()
+{
+  auto [writer, source] = socket_pair( SOCK_STREAM );
+  auto [destination, reader] = socket_pair( SOCK_STREAM );
+  auto [pipe_out, pipe_in] = make_pipe();
+  source.set_blocking( false );
+  destination.set_blocking( false );
+
+  test_should_be( source.splice( pipe_in, 4096 ), size_t { 0 } ); // would block
+  test_should_be( source.eof(), false );
+
+  writer.write( "hello, world" );
+  test_should_be( source.splice( pipe_in, 5 ), size_t { 5 } );
+  test_should_be( source.splice( pipe_in, 4096 ), size_t { 7 } );
+  test_should_be( source.read_count(), 2U );
+  test_should_be( pipe_in.write_count(), 2U );
+
+  test_should_be( pipe_out.splice( destination, 0 ), size_t { 0 } );
+  test_should_be( pipe_out.eof(), false );
+  test_should_be( pipe_out.splice( destination, 12 ), size_t { 12 } );
+  string buffer;
+  reader.read( buffer );
+  test_should_be( buffer == "hello, world", true );
+
+  writer.close();
+  test_should_be( source.splice( pipe_in, 4096 ), size_t { 0 } );
+  test_should_be( source.eof(), true );
+
+  // an fd pair with no pipe between them cannot be spliced
+  bool threw = false;
+  try {
+    reader.splice( destination, 10 );
+  } catch ( const unix_error& ) {
+    threw = true;
+  }
+  test_should_be( threw, true );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    write_to_a_full_fd();
+    splice_through_a_pipe();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
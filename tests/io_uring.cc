@@ -0,0 +1,197 @@
+#include "eventloop.hh"
+#include "exception.hh"
+#include "io_uring.hh"
+#include "tcp_stack_helpers.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono_literals;
+
+// Builds devices the way only a test may
+struct IOUringDatagramDeviceTest
+{
+  // A device whose multishot receive the kernel rejects with EINVAL (multishot does not take MSG_WAITALL), as a
+  // kernel without multishot receive would
+  static unique_ptr<IOUringDatagramDevice> rejecting_multishot( FileDescriptor device, size_t max_datagram )
+  {
+    return unique_ptr<IOUringDatagramDevice> {
+      new IOUringDatagramDevice( move( device ), max_datagram, MSG_WAITALL ) };
+  }
+};
+
+namespace {
+
+constexpr size_t max_datagram = 512;
+
+pair<FileDescriptor, FileDescriptor> datagram_socket_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds.data() ) );
+  return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+}
+
+// Serve the device's ready() signal until `done` holds, collecting the datagrams received
+vector<string> receive_until( IOUringDatagramDevice& device, const function<bool( const vector<string>& )>& done )
+{
+  vector<string> received;
+  EventLoop loop;
+  loop.add_rule( "receive", device.ready(), Direction::In, [&] {
+    device.receive( [&]( string_view datagram ) { received.emplace_back( datagram ); } );
+  } );
+  while ( not done( received ) ) {
+    if ( loop.wait_next_event( 1000 ) != EventLoop::Result::Success ) {
+      throw runtime_error( "device stopped receiving after " + to_string( received.size() ) + " datagrams" );
+    }
+  }
+  return received;
+}
+
+void expect_datagrams( const vector<string>& received, const vector<string>& expected )
+{
+  test_should_be( received.size(), expected.size() );
+  for ( size_t i = 0; i < expected.size(); ++i ) {
+    if ( received[i] != expected[i] ) {
+      throw runtime_error( "datagram " + to_string( i ) + " arrived as \"" + received[i] + "\"" );
+    }
+  }
+}
+
+// Datagrams go both ways over a socket pair, whether reception is one multishot receive or, once the kernel has
+// rejected that, a set of reads. More datagrams pass than there are receive buffers, so buffers are given back
+// and reused.
+void datagrams_over_a_socket_pair()
+{
+  for ( const bool reject_multishot : { false, true } ) {
+    auto [device_end, peer] = datagram_socket_pair();
+    auto device = reject_multishot
+                    ? IOUringDatagramDeviceTest::rejecting_multishot( move( device_end ), max_datagram )
+                    : make_unique<IOUringDatagramDevice>( move( device_end ), max_datagram );
+    test_should_be( device->multishot(), true );
+    if ( reject_multishot ) {
+      // the rejection comes back as a completion, and the device re-arms with reads
+      (void)receive_until( *device, [&]( const vector<string>& ) { return not device->multishot(); } );
+    }
+
+    // in bursts smaller than the socket's queue, so that the peer never blocks
+    for ( size_t burst = 0; burst < 50; ++burst ) {
+      vector<string> sent;
+      for ( size_t i = 0; i < 8; ++i ) {
+        sent.push_back( payload( static_cast<char>( 'a' + i ), 1 + ( burst * 8 + i ) * 37 % max_datagram ) );
+        peer.write( sent.back() );
+      }
+      expect_datagrams( receive_until( *device, [&]( const auto& r ) { return r.size() == sent.size(); } ),
+                        sent );
+    }
+    test_should_be( device->multishot(), not reject_multishot );
+
+    // writes are gathered, sent in order at flush(), and one too long for a buffer goes out in its place
+    const vector<vector<string>> writes {
+      { "head", "er" }, { "second" }, { payload( 'x', max_datagram ), "!" }, { "", "last" } };
+    for ( const auto& write : writes ) {
+      device->write( write );
+    }
+    device->flush();
+    for ( const auto& write : writes ) {
+      string expected;
+      for ( const auto& part : write ) {
+        expected += part;
+      }
+      string buffer;
+      peer.read( buffer );
+      if ( buffer != expected ) {
+        throw runtime_error( "peer read \"" + buffer.substr( 0, 20 ) + "\" instead of \"" + expected.substr( 0, 20 )
+                             + "\"" );
+      }
+    }
+  }
+}
+
+// A device that is not a socket (like a TunFD) is read by a set of reads, which see its EOF.
+void reads_until_eof()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "pipe2", ::pipe2( fds.data(), O_CLOEXEC ) );
+  FileDescriptor write_end { fds[1] };
+  IOUringDatagramDevice device { FileDescriptor { fds[0] }, max_datagram };
+  test_should_be( device.multishot(), false );
+
+  for ( const string chunk : { "one", "two", "three" } ) {
+    write_end.write( chunk );
+    expect_datagrams( receive_until( device, []( const auto& r ) { return not r.empty(); } ), { chunk } );
+  }
+  test_should_be( device.eof(), false );
+
+  write_end.close();
+  (void)receive_until( device, [&]( const vector<string>& ) { return device.eof(); } );
+}
+
+// A write the kernel fails (here, because the peer has gone) is counted as a dropped datagram rather than thrown,
+// and the device goes on writing.
+void failed_writes_are_dropped()
+{
+  auto [device_end, peer] = datagram_socket_pair();
+  IOUringDatagramDevice device { move( device_end ), max_datagram };
+  peer.close();
+
+  const auto deadline = chrono::steady_clock::now() + 5s;
+  for ( size_t written = 0; device.writes_failed() < 3 and chrono::steady_clock::now() < deadline; ) {
+    if ( written < 3 ) {
+      device.write( { "lost " + to_string( written++ ) } );
+    }
+    device.flush();
+  }
+  test_should_be( device.writes_failed(), uint64_t { 3 } );
+}
+
+// Two TCPStacks that read and write their devices through io_uring carry a connection.
+void tcp_stacks_over_io_uring()
+{
+  auto [client_device, server_device] = device_pair();
+  TCPStack client_stack { client_device.duplicate(), TCPStack::DeviceIO::IOUring };
+  TCPStack server_stack { server_device.duplicate(), TCPStack::DeviceIO::IOUring };
+  TCPListener listener = server_stack.listen( test_config(), server, 8 );
+
+  LocalStreamSocket client = client_stack.connect( test_config(), Address { client_ip.ip(), 40001 }, server );
+  AcceptedConnection accepted = accept_within( listener, 5s );
+
+  const string to_server = payload( 'a', 300000 );
+  const string to_client = payload( 'A', 200000 );
+  const auto [received_by_client, received_by_server] = exchange( client, to_server, accepted.socket, to_client );
+  expect_data( "client", received_by_client, to_client );
+  expect_data( "server", received_by_server, to_server );
+  test_should_be( server_stack.stats().segments_received > 0, true );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    datagrams_over_a_socket_pair();
+    reads_until_eof();
+    failed_writes_are_dropped();
+    tcp_stacks_over_io_uring();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,105 @@
+#include "mpsc_queue.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// On one thread: push() reports when the queue was empty, and drain() hands the elements over in the order they
+// were pushed.
+void one_thread()
+{
+  MPSCQueue<unique_ptr<int>> queue;
+  test_should_be( queue.drain( []( unique_ptr<int>& ) { throw runtime_error( "drained an empty queue" ); } ),
+                  size_t { 0 } );
+
+  test_should_be( queue.push( make_unique<int>( 1 ) ), true );
+  test_should_be( queue.push( make_unique<int>( 2 ) ), false );
+  test_should_be( queue.push( make_unique<int>( 3 ) ), false );
+  vector<int> drained;
+  test_should_be( queue.drain( [&]( unique_ptr<int>& x ) { drained.push_back( *x ); } ), size_t { 3 } );
+  if ( drained != vector<int> { 1, 2, 3 } ) {
+    throw runtime_error( "elements drained out of order" );
+  }
+  test_should_be( queue.push( make_unique<int>( 4 ) ), true ); // empty again
+
+  // should `f` throw, the rest are destroyed (the sanitizers would catch a leak), and the queue stays usable
+  test_should_be( queue.push( make_unique<int>( 5 ) ), false );
+  bool threw = false;
+  try {
+    queue.drain( []( unique_ptr<int>& ) { throw runtime_error( "from f" ); } );
+  } catch ( const runtime_error& ) {
+    threw = true;
+  }
+  test_should_be( threw, true );
+  test_should_be( queue.push( make_unique<int>( 6 ) ), true );
+
+  // and the destructor frees what is left
+  test_should_be( queue.push( make_unique<int>( 7 ) ), false );
+}
+
+// Several producers push while the consumer drains: every element arrives exactly once, and each producer's
+// elements arrive in the order it pushed them.
+void producers_and_consumer()
+{
+  constexpr size_t producers = 4;
+  constexpr uint64_t per_producer = 200000;
+  MPSCQueue<pair<size_t, uint64_t>> queue; // (producer, sequence number)
+
+  vector<thread> threads;
+  for ( size_t p = 0; p < producers; ++p ) {
+    threads.emplace_back( [&queue, p] {
+      for ( uint64_t i = 0; i < per_producer; ++i ) {
+        queue.push( { p, i } );
+      }
+    } );
+  }
+
+  vector<uint64_t> next( producers );
+  uint64_t received = 0;
+  string error;
+  while ( received < producers * per_producer ) {
+    received += queue.drain( [&]( const pair<size_t, uint64_t>& x ) {
+      if ( x.second != next.at( x.first ) and error.empty() ) {
+        error = "producer " + to_string( x.first ) + ": element " + to_string( x.second ) + " arrived when "
+                + to_string( next.at( x.first ) ) + " was expected";
+      }
+      next.at( x.first ) = x.second + 1;
+    } );
+  }
+  for ( auto& t : threads ) {
+    t.join();
+  }
+
+  if ( not error.empty() ) {
+    throw runtime_error( error );
+  }
+  test_should_be( received, producers * per_producer );
+  test_should_be( queue.drain( []( const pair<size_t, uint64_t>& ) {} ), size_t { 0 } );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    one_thread();
+    producers_and_consumer();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+#include "tcp_peer_test_harness.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+int main()
+{
+  try {
+    const uint32_t remote_isn = 23452;
+    const uint32_t local_isn = 8711;
+    const uint16_t remote_window = 65535;
+    const string full( TCPConfig::MAX_PAYLOAD_SIZE, 'x' );
+    const uint64_t round_trip = TCPConfig::TIMEOUT_DFLT;
+
+    TCPConfig cfg;
+    cfg.isn = Wrap32 { local_isn };
+    cfg.ack_delay = 0;
+    cfg.recv_capacity = 4 * TCPConfig::MAX_PAYLOAD_SIZE;
+
+    // Fill a receive window of `capacity` bytes, have the application read it all, and let a round trip pass; the
+    // peer then announces `window`.
+    const auto fill_and_drain = [&]( TCPPeerTestHarness& test, uint32_t& seqno, uint64_t capacity, uint16_t window ) {
+      for ( uint64_t left = capacity; left > 0; left -= full.size() ) {
+        test.execute( SegmentArrives {}.with_seqno( seqno ).with_ackno( local_isn + 1 ).with_data( full ) );
+        seqno += full.size();
+        test.execute( ExpectMessage {}.with_ackno( seqno ).with_win( static_cast<uint16_t>( left - full.size() ) ) );
+      }
+      test.execute( Read { capacity } );
+      test.execute( Tick { round_trip } );
+      test.execute( ExpectMessage {}.with_ackno( seqno ).with_win( window ) );
+      test.execute( ExpectNoMessage {} );
+    };
+
+    {
+      TCPPeerTestHarness test { "receive buffer stays fixed without a ceiling", cfg };
+      test.handshake( remote_isn, local_isn, remote_window );
+      uint32_t seqno = remote_isn + 1;
+      fill_and_drain( test, seqno, cfg.recv_capacity, cfg.recv_capacity );
+      fill_and_drain( test, seqno, cfg.recv_capacity, cfg.recv_capacity );
+    }
+
+    {
+      TCPConfig tuned = cfg;
+      tuned.recv_capacity_max = 1 << 20;
+      TCPPeerTestHarness test { "receive buffer doubles as the application drains it, up to 65535", tuned };
+      test.handshake( remote_isn, local_isn, remote_window );
+      uint32_t seqno = remote_isn + 1;
+      for ( uint64_t capacity = tuned.recv_capacity; capacity < 64000; capacity *= 2 ) {
+        fill_and_drain( test, seqno, capacity, capacity * 2 );
+      }
+      fill_and_drain( test, seqno, 64000, UINT16_MAX );
+
+      // An idle round trip would halve the buffer, but not below the window already advertised.
+      test.execute( Tick { round_trip } );
+      test.execute( ExpectNoMessage {} );
+      test.execute( SegmentArrives {}.with_seqno( seqno ).with_ackno( local_isn + 1 ).with_data( full ) );
+      test.execute( ExpectMessage {}
+                      .with_ackno( seqno + full.size() )
+                      .with_win( static_cast<uint16_t>( UINT16_MAX - full.size() ) ) );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+#include "tcp_peer_test_harness.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+int main()
+{
+  try {
+    const uint32_t remote_isn = 23452;
+    const uint32_t local_isn = 8711;
+    const uint16_t remote_window = 65535;
+    const string full( TCPConfig::MAX_PAYLOAD_SIZE, 'x' );
+
+    TCPConfig cfg;
+    cfg.isn = Wrap32 { local_isn };
+
+    {
+      TCPPeerTestHarness test { "ACK for one in-order segment is delayed until the deadline", cfg };
+      test.handshake( remote_isn, local_isn, remote_window );
+      test.execute( ExpectDeadline { {} } );
+      test.execute( SegmentArrives {}.with_seqno( remote_isn + 1 ).with_ackno( local_isn + 1 ).with_data( full ) );
+      test.execute( ExpectBytesAvailable { full.size() } );
+      test.execute( ExpectNoMessage {} );
+      test.execute( ExpectDeadline { cfg.ack_delay } );
+      test.execute( Tick { cfg.ack_delay - 1u } );
+      test.execute( ExpectNoMessage {} );
+      test.execute( ExpectDeadline { 1 } );
+      test.execute( Tick { 1 } );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 1 + full.size() ).with_payload_size( 0 ) );
+      test.execute( ExpectNoMessage {} );
+      test.execute( ExpectDeadline { {} } );
+    }
+
+    {
+      TCPPeerTestHarness test { "deadline runs from the first unacknowledged segment", cfg };
+      test.handshake( remote_isn, local_isn, remote_window );
+      test.execute( SegmentArrives {}.with_seqno( remote_isn + 1 ).with_ackno( local_isn + 1 ).with_data( "abc" ) );
+      test.execute( ExpectNoMessage {} );
+      test.execute( Tick { 30 } );
+      test.execute( SegmentArrives {}.with_seqno( remote_isn + 4 ).with_ackno( local_isn + 1 ).with_data( "def" ) );
+      test.execute( ExpectNoMessage {} );
+      test.execute( ExpectDeadline { cfg.ack_delay - 30u } );
+      test.execute( Tick { cfg.ack_delay - 30u } );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 7 ) );
+      test.execute( ExpectNoMessage {} );
+    }
+
+    {
+      TCPPeerTestHarness test { "second full-sized segment is acknowledged at once", cfg };
+      test.handshake( remote_isn, local_isn, remote_window );
+      test.execute( SegmentArrives {}.with_seqno( remote_isn + 1 ).with_ackno( local_isn + 1 ).with_data( full ) );
+      test.execute( ExpectNoMessage {} );
+      test.execute(
+        SegmentArrives {}.with_seqno( remote_isn + 1 + full.size() ).with_ackno( local_isn + 1 ).with_data( full ) );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 1 + 2 * full.size() ) );
+      test.execute( ExpectNoMessage {} );
+      test.execute( ExpectDeadline { {} } );
+
+      // The count starts over after every ACK.
+      test.execute( SegmentArrives {}
+                      .with_seqno( remote_isn + 1 + 2 * full.size() )
+                      .with_ackno( local_isn + 1 )
+                      .with_data( full ) );
+      test.execute( ExpectNoMessage {} );
+      test.execute( ExpectDeadline { cfg.ack_delay } );
+    }
+
+    {
+      TCPPeerTestHarness test { "out-of-order data is acknowledged at once", cfg };
+      test.handshake( remote_isn, local_isn, remote_window );
+      test.execute(
+        SegmentArrives {}.with_seqno( remote_isn + 1 + full.size() ).with_ackno( local_isn + 1 ).with_data( full ) );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 1 ) );
+      test.execute( ExpectNoMessage {} );
+
+      // The segment that fills the hole is acknowledged at once too, so the sender learns the hole is gone.
+      test.execute( SegmentArrives {}.with_seqno( remote_isn + 1 ).with_ackno( local_isn + 1 ).with_data( "abc" ) );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 4 ) );
+      test.execute( SegmentArrives {}.with_seqno( remote_isn + 4 ).with_ackno( local_isn + 1 ).with_data(
+        string( full.size() - 3, 'y' ) ) );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 1 + 2 * full.size() ) );
+      test.execute( ExpectNoMessage {} );
+    }
+
+    {
+      TCPPeerTestHarness test { "FIN is acknowledged at once", cfg };
+      test.handshake( remote_isn, local_isn, remote_window );
+      test.execute( SegmentArrives {}.with_seqno( remote_isn + 1 ).with_ackno( local_isn + 1 ).with_data( "abc" ) );
+      test.execute( ExpectNoMessage {} );
+      test.execute(
+        SegmentArrives {}.with_seqno( remote_isn + 4 ).with_ackno( local_isn + 1 ).with_data( "def" ).with_fin() );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 8 ) );
+      test.execute( ExpectNoMessage {} );
+    }
+
+    {
+      TCPConfig no_delay = cfg;
+      no_delay.ack_delay = 0;
+      TCPPeerTestHarness test { "ack_delay = 0 acknowledges every segment", no_delay };
+      test.handshake( remote_isn, local_isn, remote_window );
+      test.execute( SegmentArrives {}.with_seqno( remote_isn + 1 ).with_ackno( local_isn + 1 ).with_data( "abc" ) );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 4 ) );
+      test.execute( ExpectDeadline { {} } );
+    }
+
+    {
+      TCPConfig small = cfg;
+      small.recv_capacity = 4 * TCPConfig::MAX_PAYLOAD_SIZE;
+      const uint16_t threshold = TCPConfig::MAX_PAYLOAD_SIZE; // min( capacity / 2, MSS )
+      TCPPeerTestHarness test { "window update is sent only once the window reopens by the threshold", small };
+      test.handshake( remote_isn, local_isn, remote_window );
+      for ( uint32_t i = 0; i < 4; ++i ) {
+        test.execute( SegmentArrives {}
+                        .with_seqno( remote_isn + 1 + i * full.size() )
+                        .with_ackno( local_isn + 1 )
+                        .with_data( full ) );
+        if ( i % 2 == 1 ) {
+          test.execute( ExpectMessage {}.with_ackno( remote_isn + 1 + ( i + 1 ) * full.size() ) );
+        }
+        test.execute( ExpectNoMessage {} );
+      }
+      // The last ACK closed the window.
+      test.execute( Read { threshold / 2 } );
+      test.execute( Tick { 0 } );
+      test.execute( ExpectNoMessage {} );
+      test.execute( Read { threshold / 2 - 1u } );
+      test.execute( Tick { 0 } );
+      test.execute( ExpectNoMessage {} );
+      test.execute( Read { 1 } );
+      test.execute( Tick { 0 } );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 1 + 4 * full.size() ).with_win( threshold ) );
+      test.execute( ExpectNoMessage {} );
+
+      // Once announced, the window is not announced again for every further byte read.
+      test.execute( Read { threshold } );
+      test.execute( Tick { 0 } );
+      test.execute( ExpectNoMessage {} );
+    }
+
+    {
+      TCPConfig small = cfg;
+      small.recv_capacity = 4 * TCPConfig::MAX_PAYLOAD_SIZE;
+      const uint16_t threshold = TCPConfig::MAX_PAYLOAD_SIZE;
+      TCPPeerTestHarness test { "window_update() announces a reopened window without a tick", small };
+      test.handshake( remote_isn, local_isn, remote_window );
+      for ( uint32_t i = 0; i < 4; ++i ) {
+        test.execute( SegmentArrives {}
+                        .with_seqno( remote_isn + 1 + i * full.size() )
+                        .with_ackno( local_isn + 1 )
+                        .with_data( full ) );
+      }
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 1 + 2 * full.size() ) );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 1 + 4 * full.size() ).with_win( 0 ) );
+
+      test.execute( Read { threshold - 1u } );
+      test.execute( WindowUpdate {} );
+      test.execute( ExpectNoMessage {} );
+      test.execute( Read { 1 } );
+      test.execute( WindowUpdate {} );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 1 + 4 * full.size() ).with_win( threshold ) );
+      test.execute( WindowUpdate {} );
+      test.execute( ExpectNoMessage {} );
+
+      // An update that is not due leaves a held-back ACK to its deadline.
+      test.execute( SegmentArrives {}
+                      .with_seqno( remote_isn + 1 + 4 * full.size() )
+                      .with_ackno( local_isn + 1 )
+                      .with_data( "x" ) );
+      test.execute( WindowUpdate {} );
+      test.execute( ExpectNoMessage {} );
+      test.execute( ExpectDeadline { cfg.ack_delay } );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
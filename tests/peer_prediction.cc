@@ -0,0 +1,124 @@
+#include "tcp_peer_test_harness.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+int main()
+{
+  try {
+    const uint32_t remote_isn = 23452;
+    const uint32_t local_isn = 8711;
+    const uint16_t remote_window = 65535;
+
+    TCPConfig cfg;
+    cfg.isn = Wrap32 { local_isn };
+
+    {
+      TCPPeerTestHarness test { "the handshake takes the full path", cfg };
+      test.handshake( remote_isn, local_isn, remote_window );
+      test.execute( ExpectPrediction { { .data_hits = 0, .ack_hits = 0, .misses = 2 } } );
+    }
+
+    {
+      TCPPeerTestHarness test { "in-order data takes the fast path", cfg };
+      test.handshake( remote_isn, local_isn, remote_window );
+      test.execute( SegmentArrives {}
+                      .with_seqno( remote_isn + 1 )
+                      .with_ackno( local_isn + 1 )
+                      .with_win( remote_window )
+                      .with_data( "abc" ) );
+      test.execute( SegmentArrives {}
+                      .with_seqno( remote_isn + 4 )
+                      .with_ackno( local_isn + 1 )
+                      .with_win( remote_window )
+                      .with_data( "def" ) );
+      test.execute( ExpectPrediction { { .data_hits = 2, .ack_hits = 0, .misses = 2 } } );
+      test.execute( ExpectBytesAvailable { 6 } );
+      test.execute( ExpectNoMessage {} );
+      test.execute( Tick { cfg.ack_delay } );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 7 ) );
+    }
+
+    {
+      TCPPeerTestHarness test { "a pure ACK for new data takes the fast path", cfg };
+      test.handshake( remote_isn, local_isn, remote_window );
+      test.execute( Write { "hello" } );
+      test.execute( ExpectMessage {}.with_seqno( local_isn + 1 ).with_payload_size( 5 ) );
+      test.execute( ExpectDeadline { cfg.rt_timeout } );
+      test.execute( SegmentArrives {}.with_seqno( remote_isn + 1 ).with_ackno( local_isn + 6 ).with_win( 1000 ) );
+      test.execute( ExpectPrediction { { .data_hits = 0, .ack_hits = 1, .misses = 2 } } );
+      test.execute( ExpectNoMessage {} );
+      test.execute( ExpectDeadline { {} } );
+
+      // Data with the window unchanged since that ACK is predicted again.
+      test.execute(
+        SegmentArrives {}.with_seqno( remote_isn + 1 ).with_ackno( local_isn + 6 ).with_win( 1000 ).with_data( "x" ) );
+      test.execute( ExpectPrediction { { .data_hits = 1, .ack_hits = 1, .misses = 2 } } );
+    }
+
+    {
+      TCPPeerTestHarness test { "FIN falls back to the full path", cfg };
+      test.handshake( remote_isn, local_isn, remote_window );
+      test.execute( SegmentArrives {}
+                      .with_seqno( remote_isn + 1 )
+                      .with_ackno( local_isn + 1 )
+                      .with_win( remote_window )
+                      .with_data( "abc" )
+                      .with_fin() );
+      test.execute( ExpectPrediction { { .data_hits = 0, .ack_hits = 0, .misses = 3 } } );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 5 ) );
+      test.execute( ExpectBytesAvailable { 3 } );
+    }
+
+    {
+      TCPPeerTestHarness test { "out-of-order data falls back to the full path", cfg };
+      test.handshake( remote_isn, local_isn, remote_window );
+      test.execute( SegmentArrives {}
+                      .with_seqno( remote_isn + 4 )
+                      .with_ackno( local_isn + 1 )
+                      .with_win( remote_window )
+                      .with_data( "def" ) );
+      test.execute( ExpectPrediction { { .data_hits = 0, .ack_hits = 0, .misses = 3 } } );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 1 ) );
+      test.execute( ExpectBytesAvailable { 0 } );
+
+      // Filling the hole is not predicted either: the Reassembler has bytes pending.
+      test.execute( SegmentArrives {}
+                      .with_seqno( remote_isn + 1 )
+                      .with_ackno( local_isn + 1 )
+                      .with_win( remote_window )
+                      .with_data( "abc" ) );
+      test.execute( ExpectPrediction { { .data_hits = 0, .ack_hits = 0, .misses = 4 } } );
+      test.execute( ExpectMessage {}.with_ackno( remote_isn + 7 ) );
+      test.execute( ExpectBytesAvailable { 6 } );
+    }
+
+    {
+      TCPPeerTestHarness test { "a changed window with data falls back to the full path", cfg };
+      test.handshake( remote_isn, local_isn, remote_window );
+      test.execute(
+        SegmentArrives {}.with_seqno( remote_isn + 1 ).with_ackno( local_isn + 1 ).with_win( 100 ).with_data( "abc" ) );
+      test.execute( ExpectPrediction { { .data_hits = 0, .ack_hits = 0, .misses = 3 } } );
+      test.execute( ExpectBytesAvailable { 3 } );
+    }
+
+    {
+      TCPPeerTestHarness test { "RST falls back to the full path", cfg };
+      test.handshake( remote_isn, local_isn, remote_window );
+      test.execute(
+        SegmentArrives {}.with_seqno( remote_isn + 1 ).with_ackno( local_isn + 1 ).with_win( remote_window ).with_rst() );
+      test.execute( ExpectPrediction { { .data_hits = 0, .ack_hits = 0, .misses = 3 } } );
+      test.execute( ExpectInboundError { true } );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
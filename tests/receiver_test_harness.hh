@@ -8,6 +8,7 @@
 #include <optional>
 #include <sstream>
 #include <utility>
+#include <vector>
 
 template<std::derived_from<TestStep<Reassembler>> T>
 struct DirectReassemblerTest : public TestStep<TCPReceiver>
@@ -118,6 +119,15 @@ struct HasAckno : public ExpectBool<TCPReceiver>
   bool value( TCPReceiver& rs ) const override { return rs.send().ackno.has_value(); }
 };
 
+struct ResizeReceiveBuffer : public Action<TCPReceiver>
+{
+  uint64_t capacity_;
+
+  explicit ResizeReceiveBuffer( uint64_t capacity ) : capacity_( capacity ) {}
+  std::string description() const override { return "set_capacity( " + std::to_string( capacity_ ) + " )"; }
+  void execute( TCPReceiver& rs ) const override { rs.set_capacity( capacity_ ); }
+};
+
 struct SegmentArrives : public Action<TCPReceiver>
 {
   TCPSenderMessage msg_ {};
@@ -191,3 +201,29 @@ struct SegmentArrives : public Action<TCPReceiver>
     return ss.str();
   }
 };
+
+struct SegmentsArrive : public Action<TCPReceiver>
+{
+  std::vector<SegmentArrives> segments_;
+
+  explicit SegmentsArrive( std::vector<SegmentArrives> segments ) : segments_( std::move( segments ) ) {}
+
+  void execute( TCPReceiver& rs ) const override
+  {
+    std::vector<TCPSenderMessage> msgs;
+    for ( const auto& seg : segments_ ) {
+      msgs.push_back( seg.msg_ );
+    }
+    rs.receive_batch( msgs );
+  }
+
+  std::string description() const override
+  {
+    std::ostringstream ss;
+    ss << "receive batch of " << segments_.size() << " segments:";
+    for ( const auto& seg : segments_ ) {
+      ss << " [" << seg.description() << "]";
+    }
+    return ss.str();
+  }
+};
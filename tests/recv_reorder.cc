@@ -127,6 +127,35 @@ int main()
       test.execute( BytesPushed { 8 } );
     }
 
+    {
+      const uint32_t isn = uniform_int_distribution<uint32_t> { 0, UINT32_MAX }( rd );
+      TCPReceiverTestHarness test { "batch of contiguous segments", 2358 };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( SegmentsArrive { { SegmentArrives {}.with_seqno( isn + 1 ).with_data( "abc" ),
+                                       SegmentArrives {}.with_seqno( isn + 4 ).with_data( "def" ),
+                                       SegmentArrives {}.with_seqno( isn + 7 ).with_data( "gh" ).with_fin() } } );
+      test.execute( ExpectAckno { Wrap32 { isn + 10 } } );
+      test.execute( BytesPushed { 8 } );
+      test.execute( ReadAll { "abcdefgh" } );
+      test.execute( IsClosed { true } );
+    }
+
+    {
+      const uint32_t isn = uniform_int_distribution<uint32_t> { 0, UINT32_MAX }( rd );
+      TCPReceiverTestHarness test { "batch with gaps and reordering", 2358 };
+      test.execute( SegmentsArrive { { SegmentArrives {}.with_syn().with_seqno( isn ).with_data( "ab" ),
+                                       SegmentArrives {}.with_seqno( isn + 6 ).with_data( "fg" ),
+                                       SegmentArrives {}.with_seqno( isn + 8 ).with_data( "h" ),
+                                       SegmentArrives {}.with_seqno( isn + 3 ).with_data( "c" ) } } );
+      test.execute( ExpectAckno { Wrap32 { isn + 4 } } );
+      test.execute( BytesPending { 3 } );
+      test.execute( ReadAll { "abc" } );
+      test.execute( SegmentsArrive { { SegmentArrives {}.with_seqno( isn + 4 ).with_data( "de" ) } } );
+      test.execute( ExpectAckno { Wrap32 { isn + 9 } } );
+      test.execute( BytesPending { 0 } );
+      test.execute( ReadAll { "defgh" } );
+    }
+
   } catch ( const exception& e ) {
     cerr << e.what() << endl;
     return 1;
@@ -105,6 +105,40 @@ int main()
       test.execute( BytesPending( 0 ) );
     }
 
+    {
+      const size_t cap = 4;
+      const uint32_t isn = 23452;
+      TCPReceiverTestHarness test { "growing the buffer opens the window", cap };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( "abcd" ) );
+      test.execute( ExpectWindow { 0 } );
+      test.execute( ResizeReceiveBuffer { 8 } );
+      test.execute( ExpectWindow { 4 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 5 ).with_data( "efgh" ) );
+      test.execute( ExpectAckno { Wrap32 { isn + 9 } } );
+      test.execute( ExpectWindow { 0 } );
+      test.execute( ReadAll { "abcdefgh" } );
+      test.execute( ExpectWindow { 8 } );
+      test.execute( ResizeReceiveBuffer { 2 } );
+      test.execute( ExpectWindow { 2 } );
+    }
+
+    {
+      const size_t cap = 8;
+      const uint32_t isn = 23452;
+      TCPReceiverTestHarness test { "shrinking the buffer keeps out-of-order bytes", cap };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( SegmentArrives {}.with_seqno( isn + 5 ).with_data( "efgh" ) );
+      test.execute( BytesPending( 4 ) );
+      test.execute( ResizeReceiveBuffer { 2 } );
+      test.execute( ExpectWindow { 8 } );
+      test.execute( BytesPending( 4 ) );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( "abcd" ) );
+      test.execute( ExpectAckno { Wrap32 { isn + 9 } } );
+      test.execute( ReadAll { "abcdefgh" } );
+      test.execute( ResizeReceiveBuffer { 2 } );
+      test.execute( ExpectWindow { 2 } );
+    }
   } catch ( const exception& e ) {
     cerr << e.what() << endl;
     return 1;
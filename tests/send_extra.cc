@@ -325,6 +325,40 @@ int main()
       test.execute( ExpectSeqnosInFlight { 0 } );
     }
 
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      const size_t rto = uniform_int_distribution<uint16_t> { 30, 10000 }( rd );
+      cfg.isn = isn;
+      cfg.rt_timeout = rto;
+      cfg.max_payload_size = TCPConfig::MAX_OFFLOAD_SIZE;
+
+      const string nicechars = "abcdefghijklmnopqrstuvwxyz";
+      string bigstring;
+      for ( unsigned int i = 0; i < 20 * TCPConfig::MAX_PAYLOAD_SIZE; i++ ) {
+        bigstring.push_back( nicechars.at( rd() % nicechars.size() ) );
+      }
+
+      TCPSenderTestHarness test { "max_payload_size allows super-segments, still limited by window", cfg };
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_no_flags().with_syn( true ).with_payload_size( 0 ).with_seqno( isn ) );
+      test.execute( Push { string( bigstring ) }.with_close() );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_win( 5000 ) );
+      test.execute( ExpectMessage {}
+                      .with_no_flags()
+                      .with_payload_size( 5000 )
+                      .with_data( bigstring.substr( 0, 5000 ) )
+                      .with_seqno( isn + 1 ) );
+      test.execute( ExpectNoSegment {} );
+      test.execute( AckReceived { Wrap32 { isn + 5001 } }.with_win( 40000 ) );
+      test.execute( ExpectMessage {}
+                      .with_payload_size( bigstring.size() - 5000 )
+                      .with_data( bigstring.substr( 5000 ) )
+                      .with_seqno( isn + 5001 )
+                      .with_fin( true ) );
+      test.execute( ExpectSeqnosInFlight { bigstring.size() - 5000 + 1 } );
+    }
+
     {
       TCPConfig cfg;
       const Wrap32 isn( rd() );
@@ -48,6 +48,28 @@ int main()
       test.execute( HasError { false } );
     }
 
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      const uint16_t retx_timeout = uniform_int_distribution<uint16_t> { 10, 10000 }( rd );
+      cfg.isn = isn;
+      cfg.rt_timeout = retx_timeout;
+
+      TCPSenderTestHarness test { "Deadline follows the retransmission timer", cfg };
+      test.execute( ExpectDeadline { nullopt } );
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_no_flags().with_syn( true ).with_payload_size( 0 ).with_seqno( isn ) );
+      test.execute( ExpectDeadline { retx_timeout } );
+      test.execute( Tick { retx_timeout - 1U } );
+      test.execute( ExpectDeadline { 1 } );
+      test.execute( Tick { 1 } );
+      test.execute( ExpectMessage {}.with_no_flags().with_syn( true ).with_payload_size( 0 ).with_seqno( isn ) );
+      // exponential back-off
+      test.execute( ExpectDeadline { 2 * retx_timeout } );
+      test.execute( AckReceived { Wrap32 { isn + 1 } } );
+      test.execute( ExpectDeadline { nullopt } );
+    }
+
     {
       TCPConfig cfg;
       const Wrap32 isn( rd() );
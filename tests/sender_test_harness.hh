@@ -18,6 +18,7 @@ struct SenderAndOutput
 {
   TCPSender sender;
   std::queue<TCPSenderMessage> output {};
+  size_t max_payload_size { TCPConfig::MAX_PAYLOAD_SIZE };
 
   auto make_transmit()
   {
@@ -80,6 +81,22 @@ struct ExpectConsecutiveRetransmissions : public ExpectNumber<SenderAndOutput, u
   uint64_t value( SenderAndOutput& ss ) const override { return ss.sender.consecutive_retransmissions(); }
 };
 
+struct ExpectDeadline : public Expectation<SenderAndOutput>
+{
+  std::optional<uint64_t> ms_;
+  explicit ExpectDeadline( std::optional<uint64_t> ms ) : ms_( ms ) {}
+  static std::string str( std::optional<uint64_t> ms ) { return ms.has_value() ? to_string( ms.value() ) : "none"; }
+  std::string description() const override { return "ms_until_deadline = " + str( ms_ ); }
+  void execute( SenderAndOutput& ss ) const override
+  {
+    const auto result = ss.sender.ms_until_deadline();
+    if ( result != ms_ ) {
+      throw ExpectationViolation { "TCPSender reported ms_until_deadline = " + str( result ) + ", but expected "
+                                   + str( ms_ ) };
+    }
+  }
+};
+
 struct ExpectNoSegment : public Expectation<SenderAndOutput>
 {
   std::string description() const override { return "nothing to send"; }
@@ -340,7 +357,7 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
     if ( payload_size.has_value() and seg.payload.size() != payload_size.value() ) {
       throw ExpectationViolation( "payload_size", payload_size.value(), seg.payload.size() );
     }
-    if ( seg.payload.size() > TCPConfig::MAX_PAYLOAD_SIZE ) {
+    if ( seg.payload.size() > ss.max_payload_size ) {
       throw ExpectationViolation( "payload has length (" + std::to_string( seg.payload.size() )
                                   + ") greater than the maximum" );
     }
@@ -359,6 +376,9 @@ public:
   TCPSenderTestHarness( std::string name, TCPConfig config )
     : TestHarness( move( name ),
                    "initial_RTO_ms=" + to_string( config.rt_timeout ),
-                   { TCPSender { ByteStream { config.send_capacity }, config.isn, config.rt_timeout } } )
+                   { TCPSender {
+                       ByteStream { config.send_capacity }, config.isn, config.rt_timeout, config.max_payload_size },
+                     {},
+                     config.max_payload_size } )
   {}
 };
@@ -0,0 +1,163 @@
+#include "exception.hh"
+#include "sharded_tcp_stack.hh"
+#include "tcp_stack_helpers.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr uint16_t first_port = 45001;
+constexpr uint16_t connections = 8;
+
+// Every connection is served by the shard that its FourTuple hashes to, on both ends, and carries its own data.
+void connections_spread_over_shards()
+{
+  auto [client_device, server_device] = device_pair();
+  ShardedTCPStack client_stack { client_device.duplicate(), 3 };
+  ShardedTCPStack server_stack { server_device.duplicate(), 4, true };
+  test_should_be( client_stack.shard_count(), size_t { 3 } );
+  test_should_be( server_stack.shard_count(), size_t { 4 } );
+
+  TCPListener listener = server_stack.listen( test_config(), server, connections );
+
+  // one listener per address, across all shards
+  bool threw = false;
+  try {
+    (void)server_stack.listen( test_config(), server, 1 );
+  } catch ( const runtime_error& ) {
+    threw = true;
+  }
+  test_should_be( threw, true );
+
+  map<uint16_t, LocalStreamSocket> clients;
+  vector<size_t> client_shard_load( client_stack.shard_count() );
+  vector<size_t> server_shard_load( server_stack.shard_count() );
+  for ( uint16_t port = first_port; port < first_port + connections; ++port ) {
+    const Address local { client_ip.ip(), port };
+    clients.emplace( port, client_stack.connect( test_config(), local, server ) );
+    ++client_shard_load.at( client_stack.shard_for( FourTuple::of( local, server ) ) );
+    ++server_shard_load.at( server_stack.shard_for( FourTuple::of( server, local ) ) );
+  }
+
+  map<uint16_t, AcceptedConnection> accepted;
+  for ( uint16_t i = 0; i < connections; ++i ) {
+    AcceptedConnection connection = accept_within( listener, 5s );
+    const uint16_t port = connection.peer_address.port();
+    if ( not clients.contains( port ) or accepted.contains( port ) ) {
+      throw runtime_error( "accepted an unexpected connection from port " + to_string( port ) );
+    }
+    accepted.emplace( port, move( connection ) );
+  }
+  test_should_be( server_stack.connection_count(), size_t { connections } );
+  test_should_be( client_stack.connection_count(), size_t { connections } );
+
+  for ( auto& [port, client] : clients ) {
+    const auto tag = static_cast<char>( 'a' + port - first_port );
+    const auto [to_client, to_server] = exchange(
+      client, payload( tag, 30000 ), accepted.at( port ).socket, payload( static_cast<char>( tag - 32 ), 20000 ) );
+    expect_data( "client on port " + to_string( port ), to_client, payload( static_cast<char>( tag - 32 ), 20000 ) );
+    expect_data( "server, from port " + to_string( port ), to_server, payload( tag, 30000 ) );
+  }
+
+  const auto client_stats = client_stack.stats();
+  for ( size_t shard = 0; shard < client_stats.size(); ++shard ) {
+    test_should_be( client_stats[shard].stack.connections_opened, uint64_t { client_shard_load[shard] } );
+  }
+  const auto server_stats = server_stack.stats();
+  for ( size_t shard = 0; shard < server_stats.size(); ++shard ) {
+    test_should_be( server_stats[shard].stack.connections_opened, uint64_t { server_shard_load[shard] } );
+    if ( server_shard_load[shard] > 0 and server_stats[shard].datagrams_steered == 0 ) {
+      throw runtime_error( "no datagrams were steered to shard " + to_string( shard ) );
+    }
+  }
+}
+
+// Destroying the listener frees the address on every shard.
+void listen_again()
+{
+  auto [client_device, server_device] = device_pair();
+  ShardedTCPStack client_stack { client_device.duplicate(), 2 };
+  ShardedTCPStack server_stack { server_device.duplicate(), 2 };
+  {
+    const TCPListener first = server_stack.listen( test_config(), server, 4 );
+  }
+  TCPListener listener = server_stack.listen( test_config(), server, 4 );
+
+  LocalStreamSocket client = client_stack.connect( test_config(), Address { client_ip.ip(), first_port }, server );
+  AcceptedConnection connection = accept_within( listener, 5s );
+  const auto [to_client, to_server] = exchange( client, "ping", connection.socket, "pong" );
+  expect_data( "client", to_client, "pong" );
+  expect_data( "server", to_server, "ping" );
+}
+
+// Restricts the calling thread (and the threads it starts) to one CPU, for as long as it exists
+class OneCPU
+{
+  cpu_set_t _original {};
+
+public:
+  OneCPU()
+  {
+    CheckSystemCall( "sched_getaffinity", ::sched_getaffinity( 0, sizeof( _original ), &_original ) );
+    size_t last = 0; // the last allowed CPU, so that with several, CPU 0 is not among those left
+    for ( size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu ) {
+      if ( CPU_ISSET( cpu, &_original ) ) {
+        last = cpu;
+      }
+    }
+    cpu_set_t restricted;
+    CPU_ZERO( &restricted );
+    CPU_SET( last, &restricted );
+    CheckSystemCall( "sched_setaffinity", ::sched_setaffinity( 0, sizeof( restricted ), &restricted ) );
+  }
+  ~OneCPU() { ::sched_setaffinity( 0, sizeof( _original ), &_original ); }
+
+  OneCPU( const OneCPU& ) = delete;
+  OneCPU& operator=( const OneCPU& ) = delete;
+};
+
+// In a restricted CPU set (as in a container), a stack sizes itself and pins its threads to the CPUs it may use.
+void restricted_cpu_set()
+{
+  const OneCPU one_cpu;
+  auto [client_device, server_device] = device_pair();
+  ShardedTCPStack client_stack { client_device.duplicate(), 3, true };
+  ShardedTCPStack server_stack { server_device.duplicate(), 0, true };
+  test_should_be( server_stack.shard_count(), size_t { 1 } );
+
+  TCPListener listener = server_stack.listen( test_config(), server, 4 );
+  LocalStreamSocket client = client_stack.connect( test_config(), Address { client_ip.ip(), first_port }, server );
+  AcceptedConnection connection = accept_within( listener, 5s );
+  const auto [to_client, to_server] = exchange( client, "ping", connection.socket, "pong" );
+  expect_data( "client", to_client, "pong" );
+  expect_data( "server", to_server, "ping" );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    connections_spread_over_shards();
+    listen_again();
+    restricted_cpu_set();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
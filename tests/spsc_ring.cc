@@ -0,0 +1,111 @@
+#include "spsc_ring.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+void single_thread()
+{
+  test_should_be( SPSCRing<int> { 0 }.capacity(), size_t { 1 } );
+  test_should_be( SPSCRing<int> { 5 }.capacity(), size_t { 8 } );
+
+  SPSCRing<int> ring { 4 };
+  test_should_be( ring.pop().has_value(), false );
+
+  // fill and empty it several times over, so the counters wrap around the array
+  int next_in = 0;
+  int next_out = 0;
+  for ( int round = 0; round < 5; ++round ) {
+    while ( ring.push( int { next_in } ) ) {
+      ++next_in;
+    }
+    test_should_be( next_in - next_out, 4 );
+
+    // a failed push leaves the value alone
+    int rejected = -1;
+    test_should_be( ring.push( move( rejected ) ), false );
+    test_should_be( rejected, -1 );
+
+    for ( int i = 0; i < 3 - round % 2; ++i ) {
+      const auto value = ring.pop();
+      test_should_be( value.has_value(), true );
+      test_should_be( value.value(), next_out++ );
+    }
+  }
+  while ( const auto value = ring.pop() ) {
+    test_should_be( value.value(), next_out++ );
+  }
+  test_should_be( next_out, next_in );
+}
+
+// Values that own memory are moved through, not copied or leaked (checked by the sanitizers).
+void move_only_values()
+{
+  SPSCRing<unique_ptr<string>> ring { 2 };
+  test_should_be( ring.push( make_unique<string>( "a" ) ), true );
+  test_should_be( ring.push( make_unique<string>( "b" ) ), true );
+  auto rejected = make_unique<string>( "c" );
+  test_should_be( ring.push( move( rejected ) ), false );
+  if ( not rejected or *rejected != "c" ) {
+    throw runtime_error( "a rejected push took its value" );
+  }
+  if ( *ring.pop().value() != "a" or *ring.pop().value() != "b" ) {
+    throw runtime_error( "values came out wrong" );
+  }
+}
+
+// One producer and one consumer thread: every value arrives, once, in order.
+void two_threads()
+{
+  constexpr uint64_t count = 1'000'000;
+  SPSCRing<uint64_t> ring { 64 };
+
+  thread producer { [&] {
+    for ( uint64_t i = 0; i < count; ++i ) {
+      while ( not ring.push( uint64_t { i } ) ) {
+        this_thread::yield();
+      }
+    }
+  } };
+
+  uint64_t expected = 0;
+  while ( expected < count ) {
+    if ( const auto value = ring.pop() ) {
+      if ( value.value() != expected ) {
+        producer.join();
+        throw runtime_error( "expected " + to_string( expected ) + ", popped " + to_string( value.value() ) );
+      }
+      ++expected;
+    } else {
+      this_thread::yield();
+    }
+  }
+  producer.join();
+  test_should_be( ring.pop().has_value(), false );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    single_thread();
+    move_only_values();
+    two_threads();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
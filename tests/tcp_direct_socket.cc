@@ -0,0 +1,162 @@
+#include "parser.hh"
+#include "tcp_direct_socket_impl.hh"
+#include "tcp_stack_helpers.hh"
+#include "test_should_be.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono_literals;
+
+namespace {
+
+// As TCPOverIPv4OverTunFdAdapter, but over one end of a device_pair(), so that a TCPDirectSocket can talk to a
+// TCPStack without a TUN device.
+class TCPOverIPv4OverUDPAdapter : public TCPOverIPv4Adapter
+{
+  FileDescriptor _device;
+
+public:
+  explicit TCPOverIPv4OverUDPAdapter( FileDescriptor&& device ) : _device( move( device ) ) {}
+
+  optional<TCPMessage> read()
+  {
+    vector<string> strs( 2 );
+    strs.front().resize( IPv4Header::LENGTH );
+    _device.read( strs );
+    if ( strs.empty() ) {
+      return {};
+    }
+
+    InternetDatagram ip_dgram;
+    const vector<string> buffers = { strs.at( 0 ), strs.at( 1 ) };
+    if ( parse( ip_dgram, buffers ) ) {
+      return unwrap_tcp_in_ip( ip_dgram );
+    }
+    return {};
+  }
+
+  void write( const TCPMessage& seg )
+  {
+    segment_tcp_in_ip( seg, [&]( const InternetDatagram& dgram ) { _device.write( serialize( dgram ) ); } );
+  }
+
+  FileDescriptor& fd() { return _device; }
+};
+
+using DirectSocket = TCPDirectSocket<TCPOverIPv4OverUDPAdapter>;
+
+constexpr uint16_t client_port = 45001;
+
+FdAdapterConfig client_adapter_config()
+{
+  FdAdapterConfig config;
+  config.source = Address { client_ip.ip(), client_port };
+  config.destination = server;
+  return config;
+}
+
+string read_all( DirectSocket& socket )
+{
+  string all;
+  string buffer;
+  while ( not socket.eof() ) {
+    buffer.clear();
+    socket.read( buffer );
+    all += buffer;
+  }
+  return all;
+}
+
+// Data flows both ways at once between a TCPDirectSocket and a TCPStack connection, and both ends see the
+// other's FIN.
+void exchange_with_stack()
+{
+  auto [client_device, server_device] = device_pair();
+  TCPStack server_stack { server_device.duplicate() };
+  TCPListener listener = server_stack.listen( test_config(), server, 1 );
+
+  DirectSocket client { TCPOverIPv4OverUDPAdapter { client_device.duplicate() } };
+  client.connect( test_config(), client_adapter_config() );
+  if ( client.peer_address().to_string() != server.to_string() ) {
+    throw runtime_error( "unexpected peer address " + client.peer_address().to_string() );
+  }
+  AcceptedConnection connection = accept_within( listener, 5s );
+  test_should_be( connection.peer_address.port(), client_port );
+
+  const string to_server = payload( 'c', 200000 );
+  const string to_client = payload( 's', 150000 );
+  string received_by_server;
+  string received_by_client;
+  thread server_thread { [&] {
+    thread reader { [&] { received_by_server = ::read_all( connection.socket ); } };
+    write_all( connection.socket, to_client );
+    connection.socket.shutdown( SHUT_WR );
+    reader.join();
+  } };
+  thread client_writer { [&] {
+    test_should_be( client.write( to_server ), to_server.size() );
+    client.shutdown_write();
+  } };
+  received_by_client = read_all( client );
+  client_writer.join();
+  server_thread.join();
+
+  expect_data( "client", received_by_client, to_client );
+  expect_data( "server", received_by_server, to_server );
+  client.wait_until_closed();
+}
+
+// A receive window much smaller than the transfer: read() reopens it, announcing the window to the peer itself
+// when it reopens by enough (see TCPPeer::window_update), so the transfer does not wait on the TCPPeer thread.
+void small_receive_window()
+{
+  auto [client_device, server_device] = device_pair();
+  TCPStack server_stack { server_device.duplicate() };
+  TCPListener listener = server_stack.listen( test_config(), server, 1 );
+
+  TCPConfig client_config = test_config();
+  client_config.recv_capacity = 3000;
+  DirectSocket client { TCPOverIPv4OverUDPAdapter { client_device.duplicate() } };
+  client.connect( client_config, client_adapter_config() );
+  AcceptedConnection connection = accept_within( listener, 5s );
+
+  const string data = payload( 'w', 100 * client_config.recv_capacity );
+  thread server_thread { [&] {
+    write_all( connection.socket, data );
+    connection.socket.shutdown( SHUT_WR );
+  } };
+  const string received = read_all( client );
+  server_thread.join();
+  expect_data( "client", received, data );
+
+  client.shutdown_write();
+  expect_data( "server", ::read_all( connection.socket ), "" );
+  client.wait_until_closed();
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    exchange_with_stack();
+    small_receive_window();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,162 @@
+#include "ipv4_datagram.hh"
+#include "parser.hh"
+#include "random.hh"
+#include "tcp_config.hh"
+#include "tcp_over_ip.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const FourTuple tuple { Address { "169.254.144.9", 0 }.ipv4_numeric(),
+                        Address { "169.254.144.1", 0 }.ipv4_numeric(),
+                        40123,
+                        9090 };
+
+string random_payload( default_random_engine& rd, size_t size )
+{
+  string payload;
+  for ( size_t i = 0; i < size; ++i ) {
+    payload.push_back( static_cast<char>( 'a' + rd() % 26 ) );
+  }
+  return payload;
+}
+
+string flatten( const vector<string>& buffers )
+{
+  string out;
+  for ( const auto& buf : buffers ) {
+    out += buf;
+  }
+  return out;
+}
+
+// Cut `msg` up, then re-parse every piece from its bytes on the wire, checking both checksums, and that the pieces
+// are exactly the segments a sender with a MAX_PAYLOAD_SIZE limit would have sent.
+void check_segmentation( const string& name, const TCPMessage& msg )
+{
+  vector<InternetDatagram> pieces;
+  TCPOverIPv4Adapter::segment_tcp_in_ip( tuple, msg, [&]( const InternetDatagram& d ) { pieces.push_back( d ); } );
+
+  const string& payload = msg.sender.payload;
+  const size_t expected_pieces
+    = payload.empty() ? 1 : ( payload.size() + TCPConfig::MAX_PAYLOAD_SIZE - 1 ) / TCPConfig::MAX_PAYLOAD_SIZE;
+  if ( pieces.size() != expected_pieces ) {
+    throw runtime_error( name + ": expected " + to_string( expected_pieces ) + " datagrams, got "
+                         + to_string( pieces.size() ) );
+  }
+
+  size_t offset = 0;
+  for ( size_t i = 0; i < pieces.size(); ++i ) {
+    const string where = name + ", datagram " + to_string( i );
+    const bool first = i == 0;
+    const bool last = i + 1 == pieces.size();
+
+    const string wire = flatten( serialize( pieces[i] ) );
+    InternetDatagram reparsed;
+    if ( not parse( reparsed, string_view { wire } ) ) {
+      throw runtime_error( where + ": IPv4 header does not parse (bad checksum or length)" );
+    }
+    auto demuxed = TCPOverIPv4Adapter::demux_tcp_in_ip( reparsed );
+    if ( not demuxed.has_value() ) {
+      throw runtime_error( where + ": TCP segment does not parse (bad checksum)" );
+    }
+    const auto& [piece_tuple, piece] = demuxed.value();
+    if ( not( piece_tuple == FourTuple { tuple.remote_ip, tuple.local_ip, tuple.remote_port, tuple.local_port } ) ) {
+      throw runtime_error( where + ": addresses or ports changed" );
+    }
+
+    const string expected_payload = payload.substr( offset, TCPConfig::MAX_PAYLOAD_SIZE );
+    if ( piece.sender.payload != expected_payload ) {
+      throw runtime_error( where + ": wrong payload" );
+    }
+    test_should_be( reparsed.header.len, static_cast<uint16_t>( 40 + expected_payload.size() ) );
+
+    // the SYN occupies the first sequence number, so every later piece starts one further along
+    const Wrap32 expected_seqno = first ? msg.sender.seqno : msg.sender.seqno + msg.sender.SYN + offset;
+    test_should_be( piece.sender.seqno, expected_seqno );
+    test_should_be( piece.sender.SYN, first and msg.sender.SYN );
+    test_should_be( piece.sender.FIN, last and msg.sender.FIN );
+    test_should_be( piece.sender.RST, msg.sender.RST );
+    if ( piece.receiver.ackno != msg.receiver.ackno ) {
+      throw runtime_error( where + ": ackno should be " + to_string( msg.receiver.ackno ) + ", not "
+                           + to_string( piece.receiver.ackno ) );
+    }
+    test_should_be( piece.receiver.window_size, msg.receiver.window_size );
+
+    // byte for byte what wrap_tcp_in_ip would have made of the same segment
+    TCPMessage single { .sender = { .seqno = expected_seqno,
+                                    .SYN = piece.sender.SYN,
+                                    .payload = expected_payload,
+                                    .FIN = piece.sender.FIN,
+                                    .RST = msg.sender.RST },
+                        .receiver = msg.receiver };
+    if ( flatten( serialize( TCPOverIPv4Adapter::wrap_tcp_in_ip( tuple, single ) ) ) != wire ) {
+      throw runtime_error( where + ": differs from the same segment built without offload" );
+    }
+
+    offset += expected_payload.size();
+  }
+  test_should_be( offset, payload.size() );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    auto rd = get_random_engine();
+    const uint16_t mss = TCPConfig::MAX_PAYLOAD_SIZE;
+
+    for ( const size_t size : { 0UL, 1UL, 999UL, 1000UL, 1001UL, 2000UL, 3500UL, 65495UL } ) {
+      for ( const bool syn : { false, true } ) {
+        for ( const bool fin : { false, true } ) {
+          TCPMessage msg;
+          msg.sender.seqno = Wrap32 { static_cast<uint32_t>( rd() ) };
+          msg.sender.SYN = syn;
+          msg.sender.FIN = fin;
+          msg.sender.payload = random_payload( rd, size );
+          msg.receiver.ackno = Wrap32 { static_cast<uint32_t>( rd() ) };
+          msg.receiver.window_size = static_cast<uint16_t>( rd() );
+          check_segmentation( to_string( size ) + " bytes" + ( syn ? " +SYN" : "" ) + ( fin ? " +FIN" : "" ),
+                              msg );
+        }
+      }
+    }
+
+    // sequence numbers that wrap around in the middle of a super-segment, with every header field at its limits
+    {
+      TCPMessage msg;
+      msg.sender.seqno = Wrap32 { UINT32_MAX - 1500 };
+      msg.sender.SYN = true;
+      msg.sender.FIN = true;
+      msg.sender.payload = random_payload( rd, 5 * mss + 1 );
+      msg.receiver.ackno = Wrap32 { UINT32_MAX };
+      msg.receiver.window_size = UINT16_MAX;
+      check_segmentation( "seqno wrap", msg );
+    }
+
+    // a pure ACK (no ackno is also legal, as in a first SYN) and an RST go out unchanged
+    {
+      TCPMessage msg;
+      msg.sender.seqno = Wrap32 { 12345 };
+      msg.sender.payload = random_payload( rd, 2 * mss + 7 );
+      check_segmentation( "no ackno", msg );
+      msg.sender.RST = true;
+      check_segmentation( "RST", msg );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,323 @@
+#pragma once
+
+#include "common.hh"
+#include "tcp_config.hh"
+#include "tcp_peer.hh"
+#include "tcp_segment.hh"
+#include "wrapping_integers.hh"
+
+#include <optional>
+#include <queue>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+struct PeerAndOutput
+{
+  TCPPeer peer;
+  std::queue<TCPMessage> output {};
+
+  auto make_transmit()
+  {
+    return [&]( TCPMessage x ) { output.push( std::move( x ) ); };
+  }
+};
+
+inline std::string to_string( const TCPMessage& msg )
+{
+  std::ostringstream o;
+  o << "(seqno=" << msg.sender.seqno;
+  if ( msg.sender.SYN ) {
+    o << " +SYN";
+  }
+  if ( not msg.sender.payload.empty() ) {
+    o << " payload_len=" << msg.sender.payload.size();
+  }
+  if ( msg.sender.FIN ) {
+    o << " +FIN";
+  }
+  if ( msg.sender.RST or msg.receiver.RST ) {
+    o << " +RST";
+  }
+  o << " ackno=" << to_string( msg.receiver.ackno ) << " win=" << msg.receiver.window_size << ")";
+  return o.str();
+}
+
+struct SegmentArrives : public Action<PeerAndOutput>
+{
+  TCPMessage msg_ {};
+
+  SegmentArrives& with_syn()
+  {
+    msg_.sender.SYN = true;
+    return *this;
+  }
+
+  SegmentArrives& with_fin()
+  {
+    msg_.sender.FIN = true;
+    return *this;
+  }
+
+  SegmentArrives& with_rst()
+  {
+    msg_.sender.RST = true;
+    return *this;
+  }
+
+  SegmentArrives& with_seqno( uint32_t seqno )
+  {
+    msg_.sender.seqno = Wrap32 { seqno };
+    return *this;
+  }
+
+  SegmentArrives& with_data( std::string data )
+  {
+    msg_.sender.payload = std::move( data );
+    return *this;
+  }
+
+  SegmentArrives& with_ackno( uint32_t ackno )
+  {
+    msg_.receiver.ackno = Wrap32 { ackno };
+    return *this;
+  }
+
+  SegmentArrives& with_win( uint16_t win )
+  {
+    msg_.receiver.window_size = win;
+    return *this;
+  }
+
+  std::string description() const override { return "segment arrives " + to_string( msg_ ); }
+  void execute( PeerAndOutput& po ) const override { po.peer.receive( msg_, po.make_transmit() ); }
+};
+
+struct Tick : public Action<PeerAndOutput>
+{
+  uint64_t ms_;
+
+  explicit Tick( uint64_t ms ) : ms_( ms ) {}
+  std::string description() const override { return std::to_string( ms_ ) + " ms pass"; }
+  void execute( PeerAndOutput& po ) const override { po.peer.tick( ms_, po.make_transmit() ); }
+};
+
+struct Write : public Action<PeerAndOutput>
+{
+  std::string data_;
+
+  explicit Write( std::string data ) : data_( std::move( data ) ) {}
+  std::string description() const override { return "write \"" + Printer::prettify( data_ ) + "\", then push"; }
+  void execute( PeerAndOutput& po ) const override
+  {
+    po.peer.outbound_writer().push( data_ );
+    po.peer.push( po.make_transmit() );
+  }
+};
+
+struct Read : public Action<PeerAndOutput>
+{
+  uint64_t len_;
+
+  explicit Read( uint64_t len ) : len_( len ) {}
+  std::string description() const override { return "application reads " + std::to_string( len_ ) + " bytes"; }
+  void execute( PeerAndOutput& po ) const override
+  {
+    Reader& reader = po.peer.inbound_reader();
+    if ( reader.bytes_buffered() < len_ ) {
+      throw ExpectationViolation( "only " + std::to_string( reader.bytes_buffered() ) + " bytes are buffered" );
+    }
+    reader.pop( len_ );
+  }
+};
+
+struct WindowUpdate : public Action<PeerAndOutput>
+{
+  std::string description() const override { return "window update"; }
+  void execute( PeerAndOutput& po ) const override { po.peer.window_update( po.make_transmit() ); }
+};
+
+struct ExpectMessage : public Expectation<PeerAndOutput>
+{
+  std::optional<bool> syn {};
+  std::optional<bool> fin {};
+  std::optional<Wrap32> seqno {};
+  std::optional<size_t> payload_size {};
+  std::optional<Wrap32> ackno {};
+  std::optional<uint16_t> window {};
+
+  ExpectMessage& with_syn( bool syn_ )
+  {
+    syn = syn_;
+    return *this;
+  }
+
+  ExpectMessage& with_fin( bool fin_ )
+  {
+    fin = fin_;
+    return *this;
+  }
+
+  ExpectMessage& with_seqno( uint32_t seqno_ )
+  {
+    seqno = Wrap32 { seqno_ };
+    return *this;
+  }
+
+  ExpectMessage& with_payload_size( size_t payload_size_ )
+  {
+    payload_size = payload_size_;
+    return *this;
+  }
+
+  ExpectMessage& with_ackno( uint32_t ackno_ )
+  {
+    ackno = Wrap32 { ackno_ };
+    return *this;
+  }
+
+  ExpectMessage& with_win( uint16_t window_ )
+  {
+    window = window_;
+    return *this;
+  }
+
+  std::string description() const override
+  {
+    std::ostringstream o;
+    o << "message sent";
+    if ( seqno.has_value() ) {
+      o << " seqno=" << seqno.value();
+    }
+    if ( syn.has_value() ) {
+      o << ( syn.value() ? " +SYN" : " (no SYN)" );
+    }
+    if ( payload_size.has_value() ) {
+      o << " payload_len=" << payload_size.value();
+    }
+    if ( fin.has_value() ) {
+      o << ( fin.value() ? " +FIN" : " (no FIN)" );
+    }
+    if ( ackno.has_value() ) {
+      o << " ackno=" << ackno.value();
+    }
+    if ( window.has_value() ) {
+      o << " win=" << window.value();
+    }
+    return o.str();
+  }
+
+  void execute( PeerAndOutput& po ) const override
+  {
+    if ( po.output.empty() ) {
+      throw ExpectationViolation( "TCPPeer should have sent a message, but it did not" );
+    }
+    const TCPMessage msg = std::move( po.output.front() );
+    po.output.pop();
+
+    if ( syn.has_value() and msg.sender.SYN != syn.value() ) {
+      throw ExpectationViolation( "SYN flag", syn.value(), msg.sender.SYN );
+    }
+    if ( fin.has_value() and msg.sender.FIN != fin.value() ) {
+      throw ExpectationViolation( "FIN flag", fin.value(), msg.sender.FIN );
+    }
+    if ( seqno.has_value() and msg.sender.seqno != seqno.value() ) {
+      throw ExpectationViolation( "seqno", seqno.value(), msg.sender.seqno );
+    }
+    if ( payload_size.has_value() and msg.sender.payload.size() != payload_size.value() ) {
+      throw ExpectationViolation( "payload_size", payload_size.value(), msg.sender.payload.size() );
+    }
+    if ( ackno.has_value() and msg.receiver.ackno != ackno ) {
+      throw ExpectationViolation( "ackno", ackno, msg.receiver.ackno );
+    }
+    if ( window.has_value() and msg.receiver.window_size != window.value() ) {
+      throw ExpectationViolation( "window_size", window.value(), msg.receiver.window_size );
+    }
+  }
+};
+
+struct ExpectNoMessage : public Expectation<PeerAndOutput>
+{
+  std::string description() const override { return "nothing sent"; }
+  void execute( PeerAndOutput& po ) const override
+  {
+    if ( not po.output.empty() ) {
+      throw ExpectationViolation( "TCPPeer sent an unexpected message: " + to_string( po.output.front() ) );
+    }
+  }
+};
+
+struct ExpectDeadline : public Expectation<PeerAndOutput>
+{
+  std::optional<uint64_t> ms_;
+  explicit ExpectDeadline( std::optional<uint64_t> ms ) : ms_( ms ) {}
+  static std::string str( std::optional<uint64_t> ms ) { return ms.has_value() ? to_string( ms.value() ) : "none"; }
+  std::string description() const override { return "ms_until_deadline = " + str( ms_ ); }
+  void execute( PeerAndOutput& po ) const override
+  {
+    const auto result = po.peer.ms_until_deadline();
+    if ( result != ms_ ) {
+      throw ExpectationViolation { "TCPPeer reported ms_until_deadline = " + str( result ) + ", but expected "
+                                   + str( ms_ ) };
+    }
+  }
+};
+
+struct ExpectBytesAvailable : public ExpectNumber<PeerAndOutput, uint64_t>
+{
+  using ExpectNumber::ExpectNumber;
+  std::string name() const override { return "inbound bytes_buffered"; }
+  uint64_t value( PeerAndOutput& po ) const override { return po.peer.inbound_reader().bytes_buffered(); }
+};
+
+struct ExpectInboundError : public ExpectBool<PeerAndOutput>
+{
+  using ExpectBool::ExpectBool;
+  std::string name() const override { return "inbound has_error"; }
+  bool value( PeerAndOutput& po ) const override { return po.peer.inbound_reader().has_error(); }
+};
+
+struct ExpectPrediction : public Expectation<PeerAndOutput>
+{
+  TCPPeer::PredictionStats stats_;
+
+  explicit ExpectPrediction( TCPPeer::PredictionStats stats ) : stats_( stats ) {}
+  std::string description() const override
+  {
+    return "header prediction: " + std::to_string( stats_.data_hits ) + " data hits, "
+           + std::to_string( stats_.ack_hits ) + " ACK hits, " + std::to_string( stats_.misses ) + " misses";
+  }
+  void execute( PeerAndOutput& po ) const override
+  {
+    const auto& stats = po.peer.prediction_stats();
+    if ( stats.data_hits != stats_.data_hits ) {
+      throw ExpectationViolation( "data_hits", stats_.data_hits, stats.data_hits );
+    }
+    if ( stats.ack_hits != stats_.ack_hits ) {
+      throw ExpectationViolation( "ack_hits", stats_.ack_hits, stats.ack_hits );
+    }
+    if ( stats.misses != stats_.misses ) {
+      throw ExpectationViolation( "misses", stats_.misses, stats.misses );
+    }
+  }
+};
+
+class TCPPeerTestHarness : public TestHarness<PeerAndOutput>
+{
+public:
+  TCPPeerTestHarness( std::string name, const TCPConfig& config )
+    : TestHarness( std::move( name ),
+                   "isn=" + to_string( config.isn ) + ", recv_capacity=" + std::to_string( config.recv_capacity )
+                     + ", ack_delay=" + std::to_string( config.ack_delay ),
+                   { TCPPeer { config } } )
+  {}
+
+  // Accept a connection from a peer whose ISN is `remote_isn`; the remote end advertises a window of `window`.
+  void handshake( uint32_t remote_isn, uint32_t local_isn, uint16_t window )
+  {
+    execute( SegmentArrives {}.with_syn().with_seqno( remote_isn ).with_win( window ) );
+    execute( ExpectMessage {}.with_syn( true ).with_seqno( local_isn ).with_ackno( remote_isn + 1 ) );
+    execute( SegmentArrives {}.with_seqno( remote_isn + 1 ).with_ackno( local_isn + 1 ).with_win( window ) );
+    execute( ExpectNoMessage {} );
+  }
+};
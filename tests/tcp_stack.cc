@@ -0,0 +1,236 @@
+#include "parser.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_stack.hh"
+#include "tcp_stack_helpers.hh"
+#include "test_should_be.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono_literals;
+
+namespace {
+
+// Two connections between the same pair of addresses, told apart only by the client's port, carry different
+// data in both directions at the same time.
+void two_connections_demuxed()
+{
+  auto [client_device, server_device] = device_pair();
+  TCPStack client_stack { client_device.duplicate() };
+  TCPStack server_stack { server_device.duplicate() };
+  TCPListener listener = server_stack.listen( test_config(), server, 8 );
+
+  const vector<uint16_t> client_ports { 40001, 40002 };
+  vector<LocalStreamSocket> clients;
+  for ( const uint16_t port : client_ports ) {
+    clients.push_back( client_stack.connect( test_config(), Address { client_ip.ip(), port }, server ) );
+  }
+
+  vector<AcceptedConnection> accepted;
+  for ( size_t i = 0; i < clients.size(); ++i ) {
+    accepted.push_back( accept_within( listener, 5s ) );
+  }
+  test_should_be( server_stack.connection_count(), size_t { 2 } );
+  test_should_be( client_stack.connection_count(), size_t { 2 } );
+
+  // Each side of each connection writes and reads on its own thread, so nothing waits on a full buffer.
+  const size_t size = 200000;
+  vector<string> received_by_server( accepted.size() );
+  vector<string> received_by_client( clients.size() );
+  vector<exception_ptr> errors( 2 * clients.size() );
+  vector<thread> threads;
+  for ( size_t i = 0; i < clients.size(); ++i ) {
+    threads.emplace_back( [&, i] {
+      try {
+        write_all( clients[i], payload( static_cast<char>( 'a' + i ), size ) );
+        clients[i].shutdown( SHUT_WR );
+        received_by_client[i] = read_all( clients[i] );
+      } catch ( ... ) {
+        errors[2 * i] = current_exception();
+      }
+    } );
+    threads.emplace_back( [&, i] {
+      try {
+        auto& socket = accepted[i].socket;
+        const auto tag = static_cast<char>( 'A' + accepted[i].peer_address.port() - client_ports.front() );
+        write_all( socket, payload( tag, size / 2 ) );
+        socket.shutdown( SHUT_WR );
+        received_by_server[i] = read_all( socket );
+      } catch ( ... ) {
+        errors[2 * i + 1] = current_exception();
+      }
+    } );
+  }
+  for ( auto& t : threads ) {
+    t.join();
+  }
+  for ( const auto& error : errors ) {
+    if ( error ) {
+      rethrow_exception( error );
+    }
+  }
+
+  for ( size_t i = 0; i < accepted.size(); ++i ) {
+    const uint16_t port = accepted[i].peer_address.port();
+    const size_t client = port - client_ports.front();
+    if ( client >= clients.size() ) {
+      throw runtime_error( "accepted a connection from unexpected port " + to_string( port ) );
+    }
+    expect_data( "server, from port " + to_string( port ),
+                 received_by_server[i],
+                 payload( static_cast<char>( 'a' + client ), size ) );
+    expect_data( "client on port " + to_string( port ),
+                 received_by_client[client],
+                 payload( static_cast<char>( 'A' + client ), size / 2 ) );
+  }
+
+  test_should_be( client_stack.stats().connections_opened, uint64_t { 2 } );
+  test_should_be( server_stack.stats().connections_opened, uint64_t { 2 } );
+}
+
+// Every passive open draws its own initial sequence number, rather than the one in the listener's TCPConfig.
+void passive_opens_draw_fresh_isns()
+{
+  auto [raw, server_device] = device_pair();
+  TCPStack server_stack { server_device.duplicate() };
+  const TCPConfig cfg = test_config();
+  TCPListener listener = server_stack.listen( cfg, server, 8 );
+
+  set<string> isns;
+  for ( uint16_t port = 41000; port < 41004; ++port ) {
+    const FourTuple tuple = FourTuple::of( Address { client_ip.ip(), port }, server );
+    TCPMessage syn;
+    syn.sender.seqno = Wrap32 { 1000 };
+    syn.sender.SYN = true;
+    syn.receiver.window_size = 1000;
+    raw.write( serialize( TCPOverIPv4Adapter::wrap_tcp_in_ip( tuple, syn ) ) );
+
+    string reply;
+    raw.read( reply );
+    InternetDatagram dgram;
+    if ( not parse( dgram, string_view { reply } ) ) {
+      throw runtime_error( "SYN-ACK does not parse" );
+    }
+    const auto demuxed = TCPOverIPv4Adapter::demux_tcp_in_ip( dgram );
+    if ( not demuxed.has_value() or not demuxed->second.sender.SYN
+         or demuxed->second.receiver.ackno != Wrap32 { 1001 } ) {
+      throw runtime_error( "expected a SYN-ACK" );
+    }
+    if ( demuxed->second.sender.seqno == cfg.isn ) {
+      throw runtime_error( "passive open used the listener's ISN" );
+    }
+    isns.insert( to_string( demuxed->second.sender.seqno ) );
+  }
+  test_should_be( isns.size(), size_t { 4 } );
+}
+
+// SYNs beyond the backlog are dropped, and get in once accept() makes room.
+void backlog_limit()
+{
+  auto [client_device, server_device] = device_pair();
+  TCPStack client_stack { client_device.duplicate() };
+  TCPStack server_stack { server_device.duplicate() };
+  TCPListener listener = server_stack.listen( test_config(), server, 2 );
+
+  vector<LocalStreamSocket> clients;
+  for ( uint16_t port = 42001; port <= 42003; ++port ) {
+    clients.push_back( client_stack.connect( test_config(), Address { client_ip.ip(), port }, server ) );
+  }
+
+  const auto deadline = chrono::steady_clock::now() + 5s;
+  while ( listener.accept_queue_size() < 2 and chrono::steady_clock::now() < deadline ) {
+    this_thread::sleep_for( 1ms );
+  }
+  test_should_be( listener.accept_queue_size(), size_t { 2 } );
+
+  // several retransmissions of the third SYN later, it is still shut out
+  this_thread::sleep_for( 5 * chrono::milliseconds { test_config().rt_timeout } );
+  test_should_be( listener.accept_queue_size(), size_t { 2 } );
+  test_should_be( server_stack.connection_count(), size_t { 2 } );
+  test_should_be( server_stack.stats().connections_opened, uint64_t { 2 } );
+
+  set<uint16_t> ports;
+  ports.insert( accept_within( listener, 1s ).peer_address.port() );
+  ports.insert( accept_within( listener, 1s ).peer_address.port() );
+  ports.insert( accept_within( listener, 5s ).peer_address.port() );
+  if ( ports != set<uint16_t> { 42001, 42002, 42003 } ) {
+    throw runtime_error( "accepted the wrong connections" );
+  }
+  test_should_be( server_stack.stats().connections_opened, uint64_t { 3 } );
+}
+
+void accept_after_close()
+{
+  auto [client_device, server_device] = device_pair();
+  TCPStack client_stack { client_device.duplicate() };
+  auto server_stack = make_unique<TCPStack>( server_device.duplicate() );
+
+  // A connection that the client has already finished with is still handed out, data and all.
+  {
+    TCPListener listener = server_stack->listen( test_config(), server, 8 );
+    LocalStreamSocket client = client_stack.connect( test_config(), Address { client_ip.ip(), 43001 }, server );
+    write_all( client, "early bird" );
+    client.shutdown( SHUT_WR );
+    this_thread::sleep_for( 2 * chrono::milliseconds { test_config().rt_timeout } );
+
+    AcceptedConnection connection = accept_within( listener, 5s );
+    if ( read_all( connection.socket ) != "early bird" ) {
+      throw runtime_error( "connection closed before accept() lost its data" );
+    }
+
+    // a moved-from listener refuses to be used, rather than crashing
+    TCPListener moved = move( listener );
+    if ( moved.local_address().to_string() != server.to_string() ) {
+      throw runtime_error( "moving a listener changed its address" );
+    }
+    bool threw = false;
+    try {
+      (void)listener.local_address(); // NOLINT(bugprone-use-after-move)
+    } catch ( const runtime_error& ) {
+      threw = true;
+    }
+    test_should_be( threw, true );
+  }
+
+  // Once the listener is gone, the address is free to listen on again.
+  TCPListener listener = server_stack->listen( test_config(), server, 8 );
+
+  // Destroying the stack wakes up an accept() that is waiting, and later calls return at once.
+  optional<AcceptedConnection> result;
+  thread waiter { [&] { result = listener.accept(); } };
+  this_thread::sleep_for( 50ms );
+  server_stack.reset();
+  waiter.join();
+  test_should_be( result.has_value(), false );
+  test_should_be( listener.accept().has_value(), false );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    two_connections_demuxed();
+    passive_opens_draw_fresh_isns();
+    backlog_limit();
+    accept_after_close();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
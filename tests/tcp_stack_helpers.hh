@@ -0,0 +1,142 @@
+#pragma once
+
+#include "address.hh"
+#include "socket.hh"
+#include "tcp_config.hh"
+#include "tcp_stack.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Helpers for tests that run TCPStacks against each other
+
+inline const Address client_ip { "10.144.0.1", 0 };
+inline const Address server { "10.144.0.2", 80 };
+
+// Two UDP sockets on the loopback interface, connected to each other, stand in for a pair of IP devices: each
+// write is one datagram, as with a TUN device. The stacks get duplicates, so that both sockets stay open until
+// both stacks are gone (a datagram sent to a closed socket would fail the sender's next read).
+inline std::pair<UDPSocket, UDPSocket> device_pair()
+{
+  UDPSocket a;
+  UDPSocket b;
+  a.bind( Address { "127.0.0.1", 0 } );
+  b.bind( Address { "127.0.0.1", 0 } );
+  a.connect( b.local_address() );
+  b.connect( a.local_address() );
+  return { std::move( a ), std::move( b ) };
+}
+
+inline TCPConfig test_config()
+{
+  TCPConfig cfg;
+  cfg.rt_timeout = 100; // recover quickly from datagrams dropped by a full socket buffer
+  return cfg;
+}
+
+inline std::string read_all( LocalStreamSocket& socket )
+{
+  std::string all;
+  std::string buffer;
+  while ( not socket.eof() ) {
+    socket.read( buffer );
+    all += buffer;
+  }
+  return all;
+}
+
+inline void write_all( LocalStreamSocket& socket, std::string_view data )
+{
+  while ( not data.empty() ) {
+    data.remove_prefix( socket.write( data ) );
+  }
+}
+
+inline AcceptedConnection accept_within( TCPListener& listener, std::chrono::milliseconds limit )
+{
+  listener.set_blocking( false );
+  const auto deadline = std::chrono::steady_clock::now() + limit;
+  while ( std::chrono::steady_clock::now() < deadline ) {
+    if ( auto connection = listener.accept() ) {
+      return std::move( connection.value() );
+    }
+    std::this_thread::sleep_for( std::chrono::milliseconds { 1 } );
+  }
+  throw std::runtime_error( "no connection was accepted" );
+}
+
+inline std::string payload( char tag, size_t size )
+{
+  std::string data;
+  for ( size_t i = 0; i < size; ++i ) {
+    data.push_back( static_cast<char>( tag + i % 7 ) );
+  }
+  return data;
+}
+
+inline void expect_data( const std::string& who, const std::string& received, const std::string& expected )
+{
+  if ( received == expected ) {
+    return;
+  }
+  size_t i = 0;
+  while ( i < received.size() and i < expected.size() and received[i] == expected[i] ) {
+    ++i;
+  }
+  throw std::runtime_error( who + " received " + std::to_string( received.size() ) + " bytes instead of "
+                            + std::to_string( expected.size() ) + ", first differing at byte "
+                            + std::to_string( i ) );
+}
+
+// Write `to_b` into `a` and `to_a` into `b`, shutting down each writing half when done, while reading both sides to
+// EOF (every direction has its own thread, so none waits on another's full buffer)
+// \returns the bytes read from `a` and from `b`
+inline std::pair<std::string, std::string> exchange( LocalStreamSocket& a,
+                                                     std::string_view to_b,
+                                                     LocalStreamSocket& b,
+                                                     std::string_view to_a )
+{
+  std::pair<std::string, std::string> received;
+  const std::vector<std::function<void()>> jobs {
+    [&] {
+      write_all( a, to_b );
+      a.shutdown( SHUT_WR );
+    },
+    [&] {
+      write_all( b, to_a );
+      b.shutdown( SHUT_WR );
+    },
+    [&] { received.first = read_all( a ); },
+    [&] { received.second = read_all( b ); },
+  };
+
+  std::vector<std::exception_ptr> errors( jobs.size() );
+  std::vector<std::thread> threads;
+  for ( size_t i = 0; i < jobs.size(); ++i ) {
+    threads.emplace_back( [&, i] {
+      try {
+        jobs[i]();
+      } catch ( ... ) {
+        errors[i] = std::current_exception();
+      }
+    } );
+  }
+  for ( auto& t : threads ) {
+    t.join();
+  }
+  for ( const auto& error : errors ) {
+    if ( error ) {
+      std::rethrow_exception( error );
+    }
+  }
+  return received;
+}
@@ -0,0 +1,250 @@
+#include "random.hh"
+#include "test_should_be.hh"
+#include "timing_wheel.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using Wheel = TimingWheel<uint64_t>;
+
+constexpr uint64_t level_span = 64;                   // SLOTS: level 0 covers one slot per millisecond
+constexpr uint64_t wheel_span = uint64_t { 1 } << 30; // SLOTS ** LEVELS milliseconds
+
+// Advance `wheel` one millisecond at a time up to `until`, and check that every timer (whose value is its own
+// expiry) fires exactly at its expiry.
+void expect_exact_firing( Wheel& wheel, uint64_t from, uint64_t until )
+{
+  for ( uint64_t now = from; now <= until; ++now ) {
+    wheel.advance( now, [&]( uint64_t expiry ) {
+      if ( expiry != now ) {
+        throw runtime_error( "timer due at " + to_string( expiry ) + " fired at " + to_string( now ) );
+      }
+    } );
+  }
+}
+
+// Timers due on either side of the boundaries between levels fire on time, whether or not the clock starts on
+// a multiple of a level's span.
+void level_boundaries()
+{
+  for ( const uint64_t start : { uint64_t { 0 }, uint64_t { 1'000'003 } } ) {
+    Wheel wheel { start };
+    size_t scheduled = 0;
+    for ( const uint64_t boundary : { level_span, level_span * level_span, level_span * level_span * level_span } ) {
+      for ( const uint64_t offset : { boundary - 2, boundary - 1, boundary, boundary + 1 } ) {
+        wheel.schedule( start + offset, start + offset );
+        ++scheduled;
+      }
+    }
+    test_should_be( wheel.size(), scheduled );
+    expect_exact_firing( wheel, start, start + level_span * level_span * level_span + 1 );
+    test_should_be( wheel.size(), size_t { 0 } );
+  }
+}
+
+// One advance() over a long stretch fires everything in order of expiry, however many levels each timer was
+// cascaded through on the way.
+void cascade_order()
+{
+  auto rng = get_random_engine();
+  const uint64_t start = 12345;
+  Wheel wheel { start };
+  multimap<uint64_t, uint64_t> expected; // expiry -> value
+  for ( uint64_t value = 0; value < 10000; ++value ) {
+    const uint64_t span = uint64_t { 1 } << uniform_int_distribution<int> { 0, 28 }( rng );
+    const uint64_t expiry = start + uniform_int_distribution<uint64_t> { 0, span }( rng );
+    expected.emplace( expiry, value );
+  }
+  vector<uint64_t> expiry_of( expected.size() );
+  for ( const auto& [expiry, value] : expected ) {
+    expiry_of[value] = expiry;
+    wheel.schedule( expiry, value );
+  }
+
+  // first in slices that end at arbitrary points, then the rest at once
+  vector<uint64_t> fired;
+  uint64_t now = start;
+  for ( const uint64_t step : { uint64_t { 63 }, uint64_t { 4097 }, uint64_t { 262143 }, uint64_t { 1 } << 29 } ) {
+    now += step;
+    wheel.advance( now, [&]( uint64_t value ) {
+      if ( expiry_of[value] > now ) {
+        throw runtime_error( "timer due at " + to_string( expiry_of[value] ) + " fired at " + to_string( now ) );
+      }
+      fired.push_back( value );
+    } );
+  }
+  test_should_be( wheel.size(), size_t { 0 } );
+  test_should_be( fired.size(), expected.size() );
+  for ( size_t i = 1; i < fired.size(); ++i ) {
+    if ( expiry_of[fired[i - 1]] > expiry_of[fired[i]] ) {
+      throw runtime_error( "timer due at " + to_string( expiry_of[fired[i]] ) + " fired after one due at "
+                           + to_string( expiry_of[fired[i - 1]] ) );
+    }
+  }
+}
+
+// Handles of timers that fired or were cancelled no longer name anything, even once their storage is reused.
+void stale_handles()
+{
+  Wheel wheel { 0 };
+  uint64_t fired = 0;
+  const auto count = [&]( uint64_t ) { ++fired; };
+
+  const Wheel::Timer done = wheel.schedule( 10, 1 );
+  wheel.advance( 10, count );
+  test_should_be( fired, uint64_t { 1 } );
+  test_should_be( wheel.reschedule( done, 20 ), false );
+  wheel.cancel( done );
+
+  // the next timer takes over the fired one's storage
+  const Wheel::Timer reused = wheel.schedule( 30, 2 );
+  test_should_be( reused.index, done.index );
+  test_should_be( reused.generation == done.generation, false );
+  wheel.cancel( done );
+  test_should_be( wheel.reschedule( done, 15 ), false );
+  test_should_be( wheel.size(), size_t { 1 } );
+
+  // and a cancelled timer's handle is as dead as a fired one's
+  wheel.cancel( reused );
+  test_should_be( wheel.size(), size_t { 0 } );
+  test_should_be( wheel.reschedule( reused, 40 ), false );
+  const Wheel::Timer again = wheel.schedule( 50, 3 );
+  test_should_be( again.index, done.index );
+  wheel.cancel( reused );
+  wheel.cancel( done );
+  test_should_be( wheel.size(), size_t { 1 } );
+  wheel.advance( 49, count );
+  test_should_be( fired, uint64_t { 1 } );
+  wheel.advance( 50, count );
+  test_should_be( fired, uint64_t { 2 } );
+
+  // a pending timer can be moved either way, across levels
+  const Wheel::Timer moved = wheel.schedule( 100000, 4 );
+  test_should_be( wheel.reschedule( moved, 60 ), true );
+  wheel.advance( 60, count );
+  test_should_be( fired, uint64_t { 3 } );
+  const Wheel::Timer later = wheel.schedule( 70, 5 );
+  test_should_be( wheel.reschedule( later, 5000 ), true );
+  wheel.advance( 4999, count );
+  test_should_be( fired, uint64_t { 3 } );
+  wheel.advance( 5000, count );
+  test_should_be( fired, uint64_t { 4 } );
+}
+
+// `fire` may cancel, reschedule and schedule timers; one it schedules for a time already passed fires later in
+// the same advance().
+void changes_from_fire()
+{
+  Wheel wheel { 0 };
+  vector<uint64_t> fired;
+  const Wheel::Timer cancelled = wheel.schedule( 20, 2 );
+  const Wheel::Timer postponed = wheel.schedule( 20, 3 );
+  wheel.schedule( 19, 1 );
+  wheel.advance( 20, [&]( uint64_t value ) {
+    fired.push_back( value );
+    if ( value == 1 ) {
+      wheel.cancel( cancelled );
+      test_should_be( wheel.reschedule( postponed, 25 ), true );
+      wheel.schedule( 10, 4 );
+    }
+  } );
+  if ( fired != vector<uint64_t> { 1, 4 } ) {
+    throw runtime_error( "fire() changed the wheel, and then the wrong timers fired" );
+  }
+  test_should_be( wheel.size(), size_t { 1 } );
+  wheel.advance( 24, [&]( uint64_t value ) { fired.push_back( value ); } );
+  test_should_be( fired.size(), size_t { 2 } );
+  wheel.advance( 25, [&]( uint64_t value ) { fired.push_back( value ); } );
+  test_should_be( fired.back(), uint64_t { 3 } );
+}
+
+// Timers due further ahead than the wheel spans are parked and still fire exactly on time.
+void beyond_the_span()
+{
+  const uint64_t start = 777;
+  Wheel wheel { start };
+  const vector<uint64_t> expiries { start + wheel_span - 1,
+                                    start + wheel_span,
+                                    start + wheel_span + 12345,
+                                    start + 3 * wheel_span + 1,
+                                    start + 70 * wheel_span };
+  for ( const uint64_t expiry : expiries ) {
+    wheel.schedule( expiry, expiry );
+  }
+
+  for ( const uint64_t expiry : expiries ) {
+    const auto next = wheel.next_event();
+    if ( not next.has_value() or next.value() > expiry ) {
+      throw runtime_error( "next_event() is past the next expiry, " + to_string( expiry ) );
+    }
+    uint64_t fired = 0;
+    const auto fire = [&]( uint64_t value ) {
+      if ( value != expiry ) {
+        throw runtime_error( "timer due at " + to_string( value ) + " fired at " + to_string( expiry ) );
+      }
+      ++fired;
+    };
+    wheel.advance( expiry - 1, fire );
+    test_should_be( fired, uint64_t { 0 } );
+    wheel.advance( expiry, fire );
+    test_should_be( fired, uint64_t { 1 } );
+  }
+  test_should_be( wheel.size(), size_t { 0 } );
+  test_should_be( wheel.next_event().has_value(), false );
+}
+
+// A timer scheduled (or rescheduled) for a time advance() has already reached fires at the next advance() to a
+// later time, not at one to the same time.
+void scheduled_in_the_past()
+{
+  Wheel wheel { 1000 };
+  uint64_t fired = 0;
+  const auto count = [&]( uint64_t ) { ++fired; };
+  wheel.advance( 5000, count );
+
+  wheel.schedule( 10, 1 );
+  wheel.schedule( 5000, 2 );
+  const Wheel::Timer moved = wheel.schedule( 6000, 3 );
+  test_should_be( wheel.reschedule( moved, 4000 ), true );
+  test_should_be( wheel.next_event().value(), uint64_t { 5001 } );
+  wheel.advance( 5000, count );
+  test_should_be( fired, uint64_t { 0 } );
+  wheel.advance( 5001, count );
+  test_should_be( fired, uint64_t { 3 } );
+
+  // a wheel created at a time later than a timer's expiry, too
+  Wheel late { 1 << 20 };
+  late.schedule( 5, 4 );
+  late.advance( 1 << 20, count );
+  test_should_be( fired, uint64_t { 4 } );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    level_boundaries();
+    cascade_order();
+    stale_handles();
+    changes_from_fire();
+    beyond_the_span();
+    scheduled_in_the_past();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
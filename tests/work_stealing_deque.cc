@@ -0,0 +1,119 @@
+#include "test_should_be.hh"
+#include "work_stealing_deque.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// On one thread: the owner pops the newest element, a thief steals the oldest, and the deque grows past its
+// initial capacity without losing any.
+void one_thread()
+{
+  WorkStealingDeque<uint64_t> deque { 4 };
+  test_should_be( deque.empty(), true );
+  test_should_be( deque.pop().has_value(), false );
+  test_should_be( deque.steal().has_value(), false );
+
+  for ( uint64_t i = 0; i < 10; ++i ) {
+    deque.push( i );
+  }
+  test_should_be( deque.steal().value(), uint64_t { 0 } );
+  test_should_be( deque.pop().value(), uint64_t { 9 } );
+  test_should_be( deque.steal().value(), uint64_t { 1 } );
+  test_should_be( deque.pop().value(), uint64_t { 8 } );
+
+  // wrapping around the array, then growing again
+  for ( uint64_t i = 10; i < 20; ++i ) {
+    deque.push( i );
+  }
+  vector<uint64_t> popped;
+  while ( const auto x = deque.pop() ) {
+    popped.push_back( x.value() );
+  }
+  const vector<uint64_t> expected { 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 7, 6, 5, 4, 3, 2 };
+  if ( popped != expected ) {
+    throw runtime_error( "elements popped in the wrong order" );
+  }
+  test_should_be( deque.empty(), true );
+}
+
+// The owner pushes and pops while several thieves steal, from a small initial array that has to grow many times:
+// every element is taken exactly once.
+void owner_and_thieves()
+{
+  constexpr uint64_t count = 300000;
+  constexpr size_t thieves = 3;
+  WorkStealingDeque<uint64_t> deque { 2 };
+  const auto taken = make_unique<atomic<uint8_t>[]>( count );
+  atomic<bool> owner_done = false;
+  vector<uint64_t> stolen( thieves );
+
+  vector<thread> threads;
+  for ( size_t t = 0; t < thieves; ++t ) {
+    threads.emplace_back( [&, t] {
+      while ( not owner_done.load() or not deque.empty() ) {
+        if ( const auto x = deque.steal() ) {
+          taken[x.value()].fetch_add( 1 );
+          ++stolen[t];
+        }
+      }
+    } );
+  }
+
+  uint64_t popped = 0;
+  for ( uint64_t i = 0; i < count; ++i ) {
+    deque.push( i );
+    if ( i % 3 == 0 ) { // the owner keeps some of its work, racing the thieves for the last element
+      if ( const auto x = deque.pop() ) {
+        taken[x.value()].fetch_add( 1 );
+        ++popped;
+      }
+    }
+  }
+  while ( const auto x = deque.pop() ) {
+    taken[x.value()].fetch_add( 1 );
+    ++popped;
+  }
+  owner_done = true;
+  for ( auto& t : threads ) {
+    t.join();
+  }
+
+  uint64_t total = popped;
+  for ( const uint64_t s : stolen ) {
+    total += s;
+  }
+  test_should_be( total, count );
+  for ( uint64_t i = 0; i < count; ++i ) {
+    if ( taken[i].load() != 1 ) {
+      throw runtime_error( "element " + to_string( i ) + " was taken " + to_string( taken[i].load() ) + " times" );
+    }
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    one_thread();
+    owner_and_thieves();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
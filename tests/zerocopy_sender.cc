@@ -0,0 +1,140 @@
+#include "exception.hh"
+#include "socket.hh"
+#include "test_should_be.hh"
+#include "zerocopy_sender.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+using namespace std;
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+namespace {
+
+pair<TCPSocket, TCPSocket> connected_pair()
+{
+  TCPSocket listener;
+  listener.set_reuseaddr();
+  listener.bind( Address { "127.0.0.1", 0 } );
+  listener.listen();
+  TCPSocket client;
+  client.connect( listener.local_address() );
+  return { move( client ), listener.accept() };
+}
+
+string pattern( size_t size, size_t seed )
+{
+  string data( size, '\0' );
+  for ( size_t i = 0; i < size; ++i ) {
+    data[i] = static_cast<char>( i * 7 + seed );
+  }
+  return data;
+}
+
+// Wait (a bounded time) for the kernel to release every buffer the sender holds.
+void drain( TCPSocket& socket, ZeroCopySender& sender )
+{
+  const auto deadline = steady_clock::now() + 5s;
+  sender.reap();
+  while ( sender.buffers_held() > 0 and steady_clock::now() < deadline ) {
+    pollfd pfd { socket.fd_num(), 0, 0 };
+    ::poll( &pfd, 1, 100 );
+    sender.reap();
+  }
+}
+
+// Large buffers go out by zero-copy and small ones by a plain write, in order, and every held buffer is released
+// once the kernel is done with it.
+void sends_in_order()
+{
+  auto [client, server] = connected_pair();
+  client.set_blocking( false );
+  server.set_blocking( false );
+  ZeroCopySender sender { client, 4096 };
+
+  string expected;
+  for ( size_t i = 0; i < 20; ++i ) {
+    string data = pattern( i % 2 ? 100 : 50000, i );
+    expected += data;
+    sender.push( move( data ) );
+  }
+  sender.push( "" ); // ignored
+  test_should_be( sender.bytes_unsent(), expected.size() );
+
+  string received;
+  string buffer;
+  const auto deadline = steady_clock::now() + 5s;
+  while ( received.size() < expected.size() and steady_clock::now() < deadline ) {
+    sender.send();
+    sender.reap();
+    server.read( buffer );
+    received += buffer;
+  }
+  test_should_be( sender.bytes_unsent(), size_t { 0 } );
+  test_should_be( received.size(), expected.size() );
+  test_should_be( received == expected, true );
+  test_should_be( sender.zerocopy_writes() > 0, true );
+  test_should_be( sender.plain_writes() >= 10, true );
+
+  drain( client, sender );
+  test_should_be( sender.buffers_held(), size_t { 0 } );
+}
+
+// With nobody reading, send() writes what fits and leaves the rest queued; small buffers do not make it throw.
+void full_socket()
+{
+  auto [client, server] = connected_pair();
+  client.set_blocking( false );
+  server.set_blocking( false );
+  ZeroCopySender sender { client, 1 << 20 }; // every write is a plain one
+
+  size_t pushed = 0;
+  while ( pushed < ( 64 << 20 ) ) {
+    sender.push( pattern( 1000, pushed ) );
+    pushed += 1000;
+    sender.send();
+    if ( sender.bytes_unsent() > 0 ) {
+      break;
+    }
+  }
+  test_should_be( sender.bytes_unsent() > 0, true );
+  const size_t unsent = sender.bytes_unsent();
+  sender.send(); // still full
+  test_should_be( sender.bytes_unsent(), unsent );
+
+  // reading makes room for the rest
+  string buffer;
+  size_t received = 0;
+  const auto deadline = steady_clock::now() + 5s;
+  while ( received < pushed and steady_clock::now() < deadline ) {
+    server.read( buffer );
+    received += buffer.size();
+    sender.send();
+  }
+  test_should_be( received, pushed );
+  test_should_be( sender.zerocopy_writes(), uint64_t { 0 } );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    sends_in_order();
+    full_socket();
+  } catch ( const unix_error& e ) {
+    cout << "MSG_ZEROCOPY unavailable on this kernel (" << e.what() << "), skipping.\n";
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+#include "buffer_pool.hh"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+void PooledBuffer::_release()
+{
+  if ( _block and --_block->refs == 0 ) {
+    _block->pool->_put_back( _block );
+  }
+  _block = nullptr;
+}
+
+size_t PooledBuffer::capacity() const
+{
+  return _block ? _block->pool->buffer_size() : 0;
+}
+
+void PooledBuffer::resize( const size_t size )
+{
+  if ( size > capacity() ) {
+    throw runtime_error( "PooledBuffer::resize: " + to_string( size ) + " bytes exceeds capacity of "
+                         + to_string( capacity() ) );
+  }
+  if ( _block ) {
+    _block->size = size;
+  }
+}
+
+BufferPool::BufferPool( const size_t buffer_size, const size_t buffers_per_slab )
+  : _buffer_size( buffer_size ), _buffers_per_slab( max<size_t>( buffers_per_slab, 1 ) )
+{
+  if ( _buffer_size == 0 ) {
+    throw runtime_error( "BufferPool: buffer size must be positive" );
+  }
+  _add_slab();
+}
+
+PooledBuffer BufferPool::get()
+{
+  if ( _free.empty() ) {
+    _add_slab();
+  }
+  PooledBuffer::Block* const block = _free.back();
+  _free.pop_back();
+  block->size = _buffer_size;
+  return PooledBuffer { block };
+}
+
+// The free list is pushed in reverse, so the buffers of a fresh slab are handed out in address order
+void BufferPool::_add_slab()
+{
+  Slab slab { make_unique_for_overwrite<char[]>( _buffer_size * _buffers_per_slab ),
+              make_unique<PooledBuffer::Block[]>( _buffers_per_slab ) };
+  _free.reserve( ( _slabs.size() + 1 ) * _buffers_per_slab );
+  for ( size_t i = _buffers_per_slab; i-- > 0; ) {
+    slab.blocks[i] = { this, slab.bytes.get() + i * _buffer_size, 0, 0 };
+    _free.push_back( &slab.blocks[i] );
+  }
+  _slabs.push_back( move( slab ) );
+}
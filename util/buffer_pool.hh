@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class BufferPool;
+
+//! \brief A reference-counted handle to a buffer of a BufferPool
+//! \details Copies share the buffer; when the last handle is destroyed, the buffer goes back to its pool's free
+//! list instead of to the allocator. A default-constructed handle (or one moved from) has no buffer and is empty.
+//! Handles are not thread-safe: a buffer and its copies belong to the thread that owns the pool.
+class PooledBuffer
+{
+  friend class BufferPool;
+
+  struct Block
+  {
+    BufferPool* pool;
+    char* data;
+    size_t size;
+    size_t refs;
+  };
+
+  Block* _block {};
+
+  explicit PooledBuffer( Block* block ) : _block( block ) { ++_block->refs; }
+  void _release();
+
+public:
+  PooledBuffer() = default;
+  ~PooledBuffer() { _release(); }
+
+  PooledBuffer( const PooledBuffer& other ) : _block( other._block )
+  {
+    if ( _block ) {
+      ++_block->refs;
+    }
+  }
+  PooledBuffer& operator=( const PooledBuffer& other )
+  {
+    PooledBuffer copy { other };
+    std::swap( _block, copy._block );
+    return *this;
+  }
+  PooledBuffer( PooledBuffer&& other ) noexcept : _block( std::exchange( other._block, nullptr ) ) {}
+  PooledBuffer& operator=( PooledBuffer&& other ) noexcept
+  {
+    if ( this != &other ) {
+      _release();
+      _block = std::exchange( other._block, nullptr );
+    }
+    return *this;
+  }
+
+  char* data() { return _block ? _block->data : nullptr; }
+  const char* data() const { return _block ? _block->data : nullptr; }
+
+  //! Number of bytes in use
+  size_t size() const { return _block ? _block->size : 0; }
+  bool empty() const { return size() == 0; }
+
+  //! Most bytes the buffer can hold (the pool's buffer size)
+  size_t capacity() const;
+
+  //! Set the number of bytes in use (at most capacity()), without touching the contents
+  void resize( size_t size );
+
+  std::string_view view() const { return { data(), size() }; }
+  operator std::string_view() const { return view(); } // NOLINT(*-explicit-*)
+};
+
+//! \brief Fixed-size buffers carved out of preallocated slabs, for reading without a malloc per read
+//! \details The pool allocates its buffers a slab at a time and hands them out as PooledBuffer handles. A buffer
+//! whose last handle is dropped goes back on the free list, to be handed out again (most recently freed first,
+//! while it is still in the cache); a new slab is allocated only when the free list is empty, so once a
+//! receive path has warmed up, it allocates nothing. The pool must outlive every buffer it has handed out, and
+//! like its buffers is not thread-safe.
+class BufferPool
+{
+  friend class PooledBuffer;
+
+public:
+  //! \param[in] buffer_size is the capacity of each buffer
+  //! \param[in] buffers_per_slab is how many buffers to allocate at once
+  explicit BufferPool( size_t buffer_size = 16384, size_t buffers_per_slab = 64 );
+
+  //! Take a free buffer (allocating a new slab if none is free), with its size set to its capacity
+  PooledBuffer get();
+
+  size_t buffer_size() const { return _buffer_size; }
+  size_t slabs() const { return _slabs.size(); }                            //!< Slabs allocated so far
+  size_t available() const { return _free.size(); }                        //!< Buffers on the free list
+  size_t in_use() const { return slabs() * _buffers_per_slab - available(); } //!< Buffers handed out
+
+  ~BufferPool() = default;
+  BufferPool( const BufferPool& ) = delete;
+  BufferPool& operator=( const BufferPool& ) = delete;
+  BufferPool( BufferPool&& ) = delete;
+  BufferPool& operator=( BufferPool&& ) = delete;
+
+private:
+  struct Slab
+  {
+    std::unique_ptr<char[]> bytes;
+    std::unique_ptr<PooledBuffer::Block[]> blocks;
+  };
+
+  size_t _buffer_size;
+  size_t _buffers_per_slab;
+  std::vector<Slab> _slabs {};
+  std::vector<PooledBuffer::Block*> _free {};
+
+  void _add_slab();
+  void _put_back( PooledBuffer::Block* block ) { _free.push_back( block ); }
+};
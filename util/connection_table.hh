@@ -0,0 +1,154 @@
+#pragma once
+
+#include "address.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+//! The addresses and ports that identify a TCP connection, as seen from this end
+struct FourTuple
+{
+  uint32_t local_ip {};
+  uint32_t remote_ip {};
+  uint16_t local_port {};
+  uint16_t remote_port {};
+
+  static FourTuple of( const Address& local, const Address& remote )
+  {
+    return { local.ipv4_numeric(), remote.ipv4_numeric(), local.port(), remote.port() };
+  }
+
+  Address local_address() const { return Address { Address::from_ipv4_numeric( local_ip ).ip(), local_port }; }
+  Address remote_address() const { return Address { Address::from_ipv4_numeric( remote_ip ).ip(), remote_port }; }
+
+  bool operator==( const FourTuple& other ) const = default;
+
+  //! Well-mixed 64-bit hash (all four fields affect every output bit)
+  uint64_t hash() const
+  {
+    uint64_t x = ( static_cast<uint64_t>( local_ip ) << 32 | remote_ip )
+                 ^ std::rotl( static_cast<uint64_t>( local_port ) << 16 | remote_port, 47 );
+    // splitmix64 finalizer
+    x = ( x ^ ( x >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+    x = ( x ^ ( x >> 27 ) ) * 0x94d049bb133111ebULL;
+    return x ^ ( x >> 31 );
+  }
+};
+
+//! \brief Hash map from FourTuple to connection state
+//! \details Open addressing with linear probing over a power-of-two array of slots, kept at most 70% full.
+//! Erasure uses backward-shift deletion (no tombstones), so lookups stay short however many connections come
+//! and go. Pointers to values are invalidated by any insertion or erasure.
+template<class V>
+class ConnectionTable
+{
+  struct Slot
+  {
+    FourTuple key {};
+    std::optional<V> value {}; // empty if the slot is free
+  };
+
+  std::vector<Slot> slots_;
+  size_t size_ {};
+
+  size_t mask() const { return slots_.size() - 1; }
+  size_t home( const FourTuple& key ) const { return key.hash() & mask(); }
+
+  //! Slot holding `key`, or the free slot where the probe for it ended
+  size_t probe( const FourTuple& key ) const
+  {
+    size_t i = home( key );
+    while ( slots_[i].value.has_value() and not( slots_[i].key == key ) ) {
+      i = ( i + 1 ) & mask();
+    }
+    return i;
+  }
+
+  void grow()
+  {
+    std::vector<Slot> old( slots_.size() * 2 );
+    std::swap( old, slots_ );
+    for ( auto& slot : old ) {
+      if ( slot.value.has_value() ) {
+        slots_[probe( slot.key )] = std::move( slot );
+      }
+    }
+  }
+
+public:
+  explicit ConnectionTable( size_t initial_capacity = 16 )
+    : slots_( std::bit_ceil( std::max<size_t>( initial_capacity, 2 ) ) )
+  {}
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  V* find( const FourTuple& key )
+  {
+    Slot& slot = slots_[probe( key )];
+    return slot.value.has_value() ? &slot.value.value() : nullptr;
+  }
+
+  const V* find( const FourTuple& key ) const
+  {
+    const Slot& slot = slots_[probe( key )];
+    return slot.value.has_value() ? &slot.value.value() : nullptr;
+  }
+
+  //! Insert `value` unless `key` is already present
+  //! \returns the value stored under `key`, and whether it was inserted
+  std::pair<V*, bool> emplace( const FourTuple& key, V&& value )
+  {
+    if ( ( size_ + 1 ) * 10 > slots_.size() * 7 ) {
+      grow();
+    }
+    Slot& slot = slots_[probe( key )];
+    if ( slot.value.has_value() ) {
+      return { &slot.value.value(), false };
+    }
+    slot.key = key;
+    slot.value.emplace( std::move( value ) );
+    ++size_;
+    return { &slot.value.value(), true };
+  }
+
+  //! \returns true if `key` was present
+  bool erase( const FourTuple& key )
+  {
+    size_t hole = probe( key );
+    if ( not slots_[hole].value.has_value() ) {
+      return false;
+    }
+    slots_[hole].value.reset();
+    --size_;
+
+    // Pull back any later entry of the probe run that may legally occupy the hole, so that no lookup can
+    // stop early at it.
+    for ( size_t i = ( hole + 1 ) & mask(); slots_[i].value.has_value(); i = ( i + 1 ) & mask() ) {
+      const size_t distance_from_home = ( i - home( slots_[i].key ) ) & mask();
+      const size_t distance_to_hole = ( i - hole ) & mask();
+      if ( distance_from_home >= distance_to_hole ) {
+        slots_[hole] = std::move( slots_[i] );
+        slots_[i].value.reset();
+        hole = i;
+      }
+    }
+    return true;
+  }
+
+  //! Call `f( key, value )` for each entry (the table must not be modified meanwhile)
+  template<class F>
+  void for_each( F&& f )
+  {
+    for ( auto& slot : slots_ ) {
+      if ( slot.value.has_value() ) {
+        f( std::as_const( slot.key ), slot.value.value() );
+      }
+    }
+  }
+};
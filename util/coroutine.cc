@@ -0,0 +1,195 @@
+#include "coroutine.hh"
+
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+//! A coroutine that starts at once and frees itself when it finishes (nothing awaits it)
+struct Detached
+{
+  struct promise_type
+  {
+    Detached get_return_object() noexcept { return {}; }
+    suspend_never initial_suspend() noexcept { return {}; }
+    suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { terminate(); }
+  };
+};
+
+Detached run_detached( EventLoop& loop, Task<> task )
+{
+  try {
+    co_await task;
+  } catch ( ... ) {
+    loop.post( [error = current_exception()] { rethrow_exception( error ); } );
+  }
+}
+
+void make_non_blocking( FileDescriptor& fd )
+{
+  if ( not fd.non_blocking() ) {
+    fd.set_blocking( false );
+  }
+}
+} // namespace
+
+AsyncIO::AsyncIO( EventLoop& loop )
+  : _loop( loop )
+  , _reads( loop.add_category( "coroutine reads" ) )
+  , _writes( loop.add_category( "coroutine writes" ) )
+  , _accepts( loop.add_category( "coroutine accepts" ) )
+  , _sleeps( loop.add_category( "coroutine sleeps" ) )
+{}
+
+void AsyncIO::spawn( Task<> task )
+{
+  run_detached( _loop, move( task ) );
+}
+
+AsyncIO::Operation::~Operation()
+{
+  if ( _rule.has_value() ) {
+    _rule->cancel();
+  }
+}
+
+//! \details The rule's callback retries the operation, and resumes the coroutine once it completes (or fails).
+//! Should the loop drop the rule instead (the fd was closed, hung up or had an error), the operation is tried
+//! one last time, so that the coroutine gets its EOF or error.
+void AsyncIO::Operation::_wait( const coroutine_handle<> awaiter,
+                                FileDescriptor& fd,
+                                const Direction direction,
+                                const size_t category_id )
+{
+  _awaiter = awaiter;
+  _rule = _io._loop.add_rule(
+    category_id, fd, direction, [this] { _retry( false ); }, {}, [this] { _retry( true ); } );
+}
+
+//! \param[in] last_chance is whether the rule has been dropped, so that the operation must complete or fail now
+void AsyncIO::Operation::_retry( const bool last_chance )
+{
+  try {
+    if ( not _attempt() ) {
+      if ( not last_chance ) {
+        return;
+      }
+      throw runtime_error( "AsyncIO: fd can no longer be waited for" );
+    }
+  } catch ( ... ) {
+    _error = current_exception();
+  }
+  _resume();
+}
+
+//! \details The coroutine may destroy this operation, so nothing is touched after it is resumed.
+void AsyncIO::Operation::_resume()
+{
+  if ( _rule.has_value() ) {
+    _rule->cancel();
+    _rule.reset();
+  }
+  exchange( _awaiter, {} ).resume();
+}
+
+void AsyncIO::Operation::_rethrow_error() const
+{
+  if ( _error ) {
+    rethrow_exception( _error );
+  }
+}
+
+AsyncIO::ReadOperation AsyncIO::read( FileDescriptor& fd, string& buffer )
+{
+  return ReadOperation { *this, fd, buffer };
+}
+
+AsyncIO::ReadOperation::ReadOperation( AsyncIO& io, FileDescriptor& fd, string& buffer )
+  : Operation( io ), _fd( fd ), _buffer( buffer ), _size( buffer.size() )
+{
+  make_non_blocking( _fd );
+}
+
+bool AsyncIO::ReadOperation::_attempt()
+{
+  _buffer.resize( _size );
+  _fd.read( _buffer );
+  return not _buffer.empty() or _fd.eof();
+}
+
+void AsyncIO::ReadOperation::await_suspend( const coroutine_handle<> awaiter )
+{
+  _wait( awaiter, _fd, Direction::In, _io._reads );
+}
+
+AsyncIO::WriteOperation AsyncIO::write( FileDescriptor& fd, const string_view data )
+{
+  return WriteOperation { *this, fd, data };
+}
+
+AsyncIO::WriteOperation::WriteOperation( AsyncIO& io, FileDescriptor& fd, const string_view data )
+  : Operation( io ), _fd( fd ), _remaining( data )
+{
+  make_non_blocking( _fd );
+}
+
+bool AsyncIO::WriteOperation::_attempt()
+{
+  while ( not _remaining.empty() ) {
+    const size_t written = _fd.try_write( _remaining );
+    if ( written == 0 ) {
+      return false;
+    }
+    _remaining.remove_prefix( written );
+  }
+  return true;
+}
+
+void AsyncIO::WriteOperation::await_suspend( const coroutine_handle<> awaiter )
+{
+  _wait( awaiter, _fd, Direction::Out, _io._writes );
+}
+
+AsyncIO::AcceptOperation AsyncIO::accept( TCPSocket& listener )
+{
+  return AcceptOperation { *this, listener };
+}
+
+AsyncIO::AcceptOperation::AcceptOperation( AsyncIO& io, TCPSocket& listener ) : Operation( io ), _listener( listener )
+{
+  make_non_blocking( _listener );
+}
+
+bool AsyncIO::AcceptOperation::_attempt()
+{
+  _accepted = _listener.try_accept();
+  return _accepted.has_value();
+}
+
+void AsyncIO::AcceptOperation::await_suspend( const coroutine_handle<> awaiter )
+{
+  _wait( awaiter, _listener, Direction::In, _io._accepts );
+}
+
+TCPSocket AsyncIO::AcceptOperation::await_resume()
+{
+  _rethrow_error();
+  return move( _accepted.value() );
+}
+
+AsyncIO::SleepOperation AsyncIO::sleep( const chrono::milliseconds duration )
+{
+  return SleepOperation { *this, duration };
+}
+
+AsyncIO::SleepOperation::SleepOperation( AsyncIO& io, const chrono::milliseconds duration )
+  : Operation( io ), _deadline( chrono::steady_clock::now() + duration )
+{}
+
+void AsyncIO::SleepOperation::await_suspend( const coroutine_handle<> awaiter )
+{
+  _awaiter = awaiter;
+  _rule = _io._loop.add_timer( _io._sleeps, _deadline, [this] { _resume(); } );
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include "eventloop.hh"
+#include "file_descriptor.hh"
+#include "socket.hh"
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+//! \brief A coroutine that produces a T (or nothing), to be awaited by another coroutine or started with
+//! AsyncIO::spawn
+//! \details A Task does not start until it is awaited (or spawned), and resumes its awaiter directly when it
+//! finishes. An exception that escapes the coroutine is rethrown to its awaiter. Destroying a Task destroys a
+//! coroutine that has not finished, along with any operation it is suspended on.
+template<class T = void>
+class [[nodiscard]] Task
+{
+  struct PromiseBase
+  {
+    std::coroutine_handle<> continuation { std::noop_coroutine() }; //!< The awaiter, resumed at the end
+    std::exception_ptr error {};
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter
+    {
+      bool await_ready() noexcept { return false; }
+      template<class P>
+      std::coroutine_handle<> await_suspend( std::coroutine_handle<P> self ) noexcept
+      {
+        return self.promise().continuation;
+      }
+      void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+
+  struct ValuePromise : PromiseBase
+  {
+    std::optional<T> value {};
+    void return_value( T v ) { value.emplace( std::move( v ) ); }
+  };
+
+  struct VoidPromise : PromiseBase
+  {
+    void return_void() {}
+  };
+
+public:
+  struct promise_type : std::conditional_t<std::is_void_v<T>, VoidPromise, ValuePromise>
+  {
+    Task get_return_object() { return Task { std::coroutine_handle<promise_type>::from_promise( *this ) }; }
+  };
+
+  Task( Task&& other ) noexcept : _handle( std::exchange( other._handle, {} ) ) {}
+  Task& operator=( Task&& other ) noexcept
+  {
+    if ( this != &other ) {
+      if ( _handle ) {
+        _handle.destroy();
+      }
+      _handle = std::exchange( other._handle, {} );
+    }
+    return *this;
+  }
+  Task( const Task& ) = delete;
+  Task& operator=( const Task& ) = delete;
+
+  ~Task()
+  {
+    if ( _handle ) {
+      _handle.destroy();
+    }
+  }
+
+  bool await_ready() const noexcept { return not _handle or _handle.done(); }
+
+  std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiter ) noexcept
+  {
+    _handle.promise().continuation = awaiter;
+    return _handle;
+  }
+
+  T await_resume()
+  {
+    if ( _handle.promise().error ) {
+      std::rethrow_exception( _handle.promise().error );
+    }
+    if constexpr ( not std::is_void_v<T> ) {
+      return std::move( _handle.promise().value.value() );
+    }
+  }
+
+private:
+  std::coroutine_handle<promise_type> _handle;
+
+  explicit Task( std::coroutine_handle<promise_type> handle ) : _handle( handle ) {}
+};
+
+//! \brief Awaitable reads, writes, accepts and sleeps on an EventLoop, for coroutines of type Task
+//! \details Each operation is first tried right away (so a coroutine that keeps up with its fd never waits);
+//! only if it would block does it add a rule to the loop, which resumes the coroutine once the operation has
+//! succeeded and is cancelled as it does. Thousands of coroutines can thus share the loop's thread, each
+//! suspended in a frame of a few hundred bytes rather than blocked on a thread stack. The fds are put in
+//! non-blocking mode.
+//!
+//! ~~~{.cpp}
+//! Task<> echo( AsyncIO& io, TCPSocket connection )
+//! {
+//!   std::string buffer;
+//!   while ( co_await io.read( connection, buffer ), not connection.eof() ) {
+//!     co_await io.write( connection, buffer );
+//!   }
+//! }
+//! ~~~
+class AsyncIO
+{
+  //! Rule of a suspended operation: cancelled when the operation completes or is destroyed
+  class Operation
+  {
+  protected:
+    AsyncIO& _io;
+    std::optional<EventLoop::RuleHandle> _rule {};
+    std::exception_ptr _error {};
+    std::coroutine_handle<> _awaiter {};
+
+    explicit Operation( AsyncIO& io ) : _io( io ) {}
+    virtual bool _attempt() = 0; //!< Try the operation; returns whether it is complete
+    void _wait( std::coroutine_handle<> awaiter, FileDescriptor& fd, Direction direction, size_t category_id );
+    void _retry( bool last_chance );
+    void _resume();
+    void _rethrow_error() const;
+
+  public:
+    bool await_ready() { return _attempt(); }
+
+    virtual ~Operation();
+    Operation( const Operation& ) = delete;
+    Operation& operator=( const Operation& ) = delete;
+    Operation( Operation&& ) = delete;
+    Operation& operator=( Operation&& ) = delete;
+  };
+
+public:
+  class ReadOperation;
+  class WriteOperation;
+  class AcceptOperation;
+  class SleepOperation;
+
+  explicit AsyncIO( EventLoop& loop );
+
+  EventLoop& loop() { return _loop; }
+
+  //! Start `task`, letting it run to completion on its own; an exception that escapes it is rethrown from
+  //! EventLoop::wait_next_event
+  void spawn( Task<> task );
+
+  //! Read into `buffer`, waiting until the fd is readable (as FileDescriptor::read, the size of `buffer` is the
+  //! most to read, or FileDescriptor::kReadBufferSize if it is empty). At EOF, `buffer` is left empty.
+  ReadOperation read( FileDescriptor& fd, std::string& buffer );
+
+  //! Write all of `data`, waiting for the fd to be writable as often as needed
+  WriteOperation write( FileDescriptor& fd, std::string_view data );
+
+  //! Accept a connection on a listening socket, waiting for one if need be
+  AcceptOperation accept( TCPSocket& listener );
+
+  //! Resume after `duration` (or, with a duration of zero, after the loop has served other rules)
+  SleepOperation sleep( std::chrono::milliseconds duration );
+
+private:
+  EventLoop& _loop;
+  size_t _reads;
+  size_t _writes;
+  size_t _accepts;
+  size_t _sleeps;
+};
+
+class AsyncIO::ReadOperation : public Operation
+{
+  FileDescriptor& _fd;
+  std::string& _buffer;
+  size_t _size;
+
+  bool _attempt() override;
+
+public:
+  ReadOperation( AsyncIO& io, FileDescriptor& fd, std::string& buffer );
+  void await_suspend( std::coroutine_handle<> awaiter );
+  void await_resume() const { _rethrow_error(); }
+};
+
+class AsyncIO::WriteOperation : public Operation
+{
+  FileDescriptor& _fd;
+  std::string_view _remaining;
+
+  bool _attempt() override;
+
+public:
+  WriteOperation( AsyncIO& io, FileDescriptor& fd, std::string_view data );
+  void await_suspend( std::coroutine_handle<> awaiter );
+  void await_resume() const { _rethrow_error(); }
+};
+
+class AsyncIO::AcceptOperation : public Operation
+{
+  TCPSocket& _listener;
+  std::optional<TCPSocket> _accepted {};
+
+  bool _attempt() override;
+
+public:
+  AcceptOperation( AsyncIO& io, TCPSocket& listener );
+  void await_suspend( std::coroutine_handle<> awaiter );
+  TCPSocket await_resume();
+};
+
+class AsyncIO::SleepOperation : public Operation
+{
+  std::chrono::steady_clock::time_point _deadline;
+
+  bool _attempt() override { return false; }
+
+public:
+  SleepOperation( AsyncIO& io, std::chrono::milliseconds duration );
+  void await_suspend( std::coroutine_handle<> awaiter );
+  void await_resume() const {}
+};
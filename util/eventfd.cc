@@ -0,0 +1,30 @@
+#include "eventfd.hh"
+#include "exception.hh"
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <sys/eventfd.h>
+
+using namespace std;
+
+EventFD::EventFD() : FileDescriptor( ::CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) )
+{
+  set_blocking( false ); // keep FileDescriptor's record of the flag in sync
+}
+
+void EventFD::notify( const uint64_t n )
+{
+  write( string_view { reinterpret_cast<const char*>( &n ), sizeof( n ) } );
+}
+
+uint64_t EventFD::drain()
+{
+  string buffer( sizeof( uint64_t ), 0 );
+  read( buffer );
+  uint64_t count = 0;
+  if ( buffer.size() == sizeof( count ) ) {
+    memcpy( &count, buffer.data(), sizeof( count ) );
+  }
+  return count;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "file_descriptor.hh"
+
+#include <cstdint>
+
+//! A FileDescriptor to a Linux [eventfd](\ref man2::eventfd) counter, used by one thread to wake up another
+//! thread's EventLoop
+class EventFD : public FileDescriptor
+{
+public:
+  //! Create a non-blocking eventfd with a count of zero
+  EventFD();
+
+  //! Add `n` to the count, making the eventfd readable
+  void notify( uint64_t n = 1 );
+
+  //! Reset the count to zero
+  //! \returns the count before the reset (zero if the eventfd was not readable)
+  uint64_t drain();
+};
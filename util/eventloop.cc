@@ -2,12 +2,144 @@
 #include "exception.hh"
 #include "socket.hh"
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <climits>
+#include <cmath>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <span>
+#include <thread>
 
 using namespace std;
 
+namespace {
+constexpr size_t MAX_EPOLL_EVENTS = 64; // most ready fds taken from the kernel per epoll_wait
+
+uint32_t epoll_events_for( const Direction direction )
+{
+  return direction == Direction::In ? EPOLLIN : EPOLLOUT;
+}
+
+uint64_t timestamp_ms()
+{
+  return chrono::duration_cast<chrono::milliseconds>( chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+uint64_t timestamp_ns()
+{
+  return chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now().time_since_epoch() ).count();
+}
+} // namespace
+
+EventLoop::EventLoop( const Backend backend ) : _backend( backend ), _timers( timestamp_ms() )
+{
+  _rule_categories.reserve( 64 );
+
+  if ( _backend == Backend::Epoll ) {
+    const int epoll_fd = ::epoll_create1( EPOLL_CLOEXEC );
+    if ( epoll_fd < 0 ) {
+      _backend = Backend::Poll;
+    } else {
+      _epoll.emplace( epoll_fd );
+      _epoll_events.resize( MAX_EPOLL_EVENTS );
+    }
+  }
+
+  // posted tasks are run by a background rule, registered first so that it is served first
+  const auto rule = make_shared<FDRule>( BasicRule { add_category( "posted tasks" ), {}, [this] { _run_posted(); } },
+                                         _posted_ready.duplicate(),
+                                         Direction::In,
+                                         [] {},
+                                         [] {} );
+  rule->background = true;
+  _fd_rules.push_back( rule );
+  if ( _backend == Backend::Epoll ) {
+    rule->position = prev( _fd_rules.end() );
+    _epoll_register( *rule );
+  }
+}
+
+EventLoop::~EventLoop()
+{
+  while ( _posting.load() > 0 ) {
+    this_thread::yield();
+  }
+}
+
+void EventLoop::post( CallbackT task )
+{
+  ++_posting;
+  if ( _posted.push( move( task ) ) ) {
+    _posted_ready.notify();
+  }
+  --_posting;
+}
+
+void EventLoop::set_error_queue_handler( const FileDescriptor& fd, CallbackT handler )
+{
+  if ( handler ) {
+    _error_queue_handlers[fd.fd_num()] = move( handler );
+  } else {
+    _error_queue_handlers.erase( fd.fd_num() );
+  }
+}
+
+//! \returns whether the error reported on the fd was only messages on its error queue, which its handler has now
+//! read
+bool EventLoop::_handle_error_queue( const int fd_num )
+{
+  const auto handler = _error_queue_handlers.find( fd_num );
+  if ( handler == _error_queue_handlers.end() ) {
+    return false;
+  }
+  handler->second();
+
+  pollfd pfd { fd_num, 0, 0 };
+  CheckSystemCall( "poll", ::poll( &pfd, 1, 0 ) );
+  return not( pfd.revents & ( POLLERR | POLLNVAL ) );
+}
+
+//! \details Rethrows the exception (if any) thrown by the offloaded work.
+void EventLoop::_complete_offload( const exception_ptr& error )
+{
+  --_offloaded;
+  if ( error ) {
+    rethrow_exception( error );
+  }
+}
+
+//! \returns whether work is offloaded or tasks are posted, which background rules must stay armed to complete
+bool EventLoop::_background_work() const
+{
+  return _offloaded > 0 or not _posted_batch.empty() or not _posted.empty();
+}
+
+//! \details The eventfd is drained before the queue is taken: a task posted in between then finds the queue
+//! empty and notifies again, so no task is left waiting for a wakeup that already happened. Should a task throw,
+//! the tasks after it run on the next call.
+void EventLoop::_run_posted()
+{
+  _posted_ready.drain();
+  _posted.drain( [&]( CallbackT& task ) { _posted_batch.push_back( move( task ) ); } );
+
+  while ( not _posted_batch.empty() ) {
+    const CallbackT task = move( _posted_batch.front() );
+    _posted_batch.pop_front();
+    try {
+      task();
+    } catch ( ... ) {
+      if ( not _posted_batch.empty() ) {
+        _posted_ready.notify();
+      }
+      throw;
+    }
+  }
+}
+
 unsigned int EventLoop::FDRule::service_count() const
 {
   return direction == Direction::In ? fd.read_count() : fd.write_count();
@@ -39,6 +171,10 @@ EventLoop::FDRule::FDRule( BasicRule&& base,
   , error( move( s_error ) )
 {}
 
+EventLoop::TimerRule::TimerRule( BasicRule&& base, const uint64_t s_expiry, const uint64_t s_period )
+  : BasicRule( base ), expiry( s_expiry ), period( s_period )
+{}
+
 EventLoop::RuleHandle EventLoop::add_rule( size_t category_id,
                                            FileDescriptor& fd,
                                            Direction direction,
@@ -54,7 +190,13 @@ EventLoop::RuleHandle EventLoop::add_rule( size_t category_id,
   _fd_rules.emplace_back( make_shared<FDRule>(
     BasicRule { category_id, interest, callback }, fd.duplicate(), direction, cancel, error ) );
 
-  return RuleHandle { _fd_rules.back() };
+  const auto rule = _fd_rules.back();
+  if ( _backend == Backend::Epoll ) {
+    rule->position = prev( _fd_rules.end() );
+    _epoll_register( *rule );
+  }
+
+  return RuleHandle { rule, _cancelled, _interest_changed };
 }
 
 EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
@@ -70,18 +212,474 @@ EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
   return RuleHandle { _non_fd_rules.back() };
 }
 
+EventLoop::RuleHandle EventLoop::add_timer( const size_t category_id,
+                                            const chrono::steady_clock::time_point deadline,
+                                            const CallbackT& callback )
+{
+  const auto expiry = chrono::ceil<chrono::milliseconds>( deadline.time_since_epoch() ).count();
+  return _add_timer( category_id, max<int64_t>( expiry, 0 ), 0, callback );
+}
+
+EventLoop::RuleHandle EventLoop::add_periodic_timer( const size_t category_id,
+                                                     const chrono::milliseconds period,
+                                                     const CallbackT& callback )
+{
+  if ( period.count() <= 0 ) {
+    throw invalid_argument( "EventLoop: timer period must be positive" );
+  }
+  const auto period_ms = static_cast<uint64_t>( period.count() );
+  return _add_timer( category_id, timestamp_ms() + period_ms, period_ms, callback );
+}
+
+EventLoop::RuleHandle EventLoop::_add_timer( const size_t category_id,
+                                             const uint64_t expiry,
+                                             const uint64_t period,
+                                             const CallbackT& callback )
+{
+  if ( category_id >= _rule_categories.size() ) {
+    throw out_of_range( "bad category_id" );
+  }
+
+  auto rule = make_shared<TimerRule>( BasicRule { category_id, {}, callback }, expiry, period );
+  rule->timer = _timers.schedule( expiry, rule );
+  return RuleHandle { rule, _cancelled_timers };
+}
+
 void EventLoop::RuleHandle::cancel()
 {
   const shared_ptr<BasicRule> rule_shared_ptr = rule_weak_ptr_.lock();
-  if ( rule_shared_ptr ) {
+  if ( rule_shared_ptr and not rule_shared_ptr->cancel_requested ) {
     rule_shared_ptr->cancel_requested = true;
+    if ( const auto cancelled = cancelled_.lock() ) {
+      cancelled->push_back( rule_shared_ptr );
+    }
+  }
+}
+
+void EventLoop::RuleHandle::set_budget( const unsigned budget )
+{
+  if ( const shared_ptr<BasicRule> rule_shared_ptr = rule_weak_ptr_.lock() ) {
+    rule_shared_ptr->budget = max( budget, 1U );
+  }
+}
+
+void EventLoop::RuleHandle::set_interest_on_change()
+{
+  const shared_ptr<BasicRule> rule_shared_ptr = rule_weak_ptr_.lock();
+  if ( rule_shared_ptr and not interest_changed_.expired() ) { // only a handle to an fd rule has the queue
+    static_cast<FDRule&>( *rule_shared_ptr ).interest_on_change = true;
+    interest_changed(); // for the loop to stop watching the rule
   }
 }
 
+void EventLoop::RuleHandle::interest_changed()
+{
+  const shared_ptr<BasicRule> rule_shared_ptr = rule_weak_ptr_.lock();
+  const shared_ptr<CancelQueue> interest_changed = interest_changed_.lock();
+  if ( rule_shared_ptr and interest_changed and not rule_shared_ptr->cancel_requested ) {
+    auto& rule = static_cast<FDRule&>( *rule_shared_ptr );
+    if ( not rule.interest_queued ) {
+      rule.interest_queued = true;
+      interest_changed->push_back( rule_shared_ptr );
+    }
+  }
+}
+
+//! \details A rule with no interest function is armed for good; any other rule is armed when its interest
+//! function is first found true. (Errors and hangups are reported regardless, as with poll.)
+void EventLoop::_epoll_register( FDRule& rule )
+{
+  const int fd_num = rule.fd.fd_num();
+  if ( _epoll_entries.size() <= static_cast<size_t>( fd_num ) ) {
+    _epoll_entries.resize( fd_num + 1 );
+  }
+
+  // Rules of this fd number that are cancelled but not yet dropped (e.g., by a callback on this call), or whose fd
+  // was closed (so that the number may now belong to another file), go first.
+  const auto is_stale = []( const FDRule* r ) { return r->cancel_requested or r->fd.closed(); };
+  if ( any_of( _epoll_entries[fd_num].rules.begin(), _epoll_entries[fd_num].rules.end(), is_stale ) ) {
+    vector<shared_ptr<FDRule>> rules; // keeps them alive through their cancel callbacks
+    for ( FDRule* r : _epoll_entries[fd_num].rules ) {
+      rules.push_back( *r->position );
+    }
+    for ( const auto& stale : rules ) {
+      if ( is_stale( stale.get() ) and _epoll_registered( *stale ) ) {
+        _epoll_drop( *stale, not stale->cancel_requested );
+        if ( _backend != Backend::Epoll ) {
+          return; // the cancel callback made the loop fall back to poll, which will serve the new rule too
+        }
+      }
+    }
+  }
+
+  EpollEntry& entry = _epoll_entries[fd_num];
+  if ( entry.rules.empty() ) {
+    epoll_event event {};
+    event.data.fd = fd_num;
+    if ( ::epoll_ctl( _epoll->fd_num(), EPOLL_CTL_ADD, fd_num, &event ) < 0 ) {
+      if ( errno == EPERM ) {
+        _fall_back_to_poll(); // e.g., a regular file, which poll reports as always ready
+        return;
+      }
+      throw unix_error( "epoll_ctl" );
+    }
+    entry.events = 0;
+  }
+  entry.rules.push_back( &rule );
+  rule.order = _next_rule_order++;
+
+  if ( rule.interest ) {
+    rule.watch_index = _watched.size();
+    _watched.push_back( &rule );
+  } else {
+    _epoll_arm( rule, true );
+  }
+}
+
+void EventLoop::_epoll_arm( FDRule& rule, const bool armed )
+{
+  if ( rule.armed != armed ) {
+    rule.armed = armed;
+    if ( not rule.background ) {
+      armed ? ++_armed_count : --_armed_count;
+    }
+    _epoll_update( rule.fd.fd_num() );
+  }
+}
+
+//! \details Brings the fd's registration in line with the `armed` flags of its rules.
+void EventLoop::_epoll_update( const int fd_num )
+{
+  EpollEntry& entry = _epoll_entries.at( fd_num );
+  uint32_t events = 0;
+  for ( const FDRule* rule : entry.rules ) {
+    events |= rule->armed ? epoll_events_for( rule->direction ) : 0U;
+  }
+  if ( events != entry.events ) {
+    epoll_event event {};
+    event.events = events;
+    event.data.fd = fd_num;
+    CheckSystemCall( "epoll_ctl", ::epoll_ctl( _epoll->fd_num(), EPOLL_CTL_MOD, fd_num, &event ) );
+    entry.events = events;
+  }
+}
+
+//! \details Deregisters the rule and destroys it, calling its cancel callback first if asked to. The fd is still
+//! open at this point (the rule holds a reference), unless its owner closed it explicitly, in which case the
+//! kernel has already forgotten it.
+void EventLoop::_epoll_drop( FDRule& rule, const bool call_cancel )
+{
+  const int fd_num = rule.fd.fd_num();
+  EpollEntry& entry = _epoll_entries.at( fd_num );
+  entry.rules.erase( find( entry.rules.begin(), entry.rules.end(), &rule ) );
+  if ( rule.armed ) {
+    rule.armed = false;
+    _armed_count -= rule.background ? 0 : 1;
+  }
+  if ( rule.fd.closed() ) {
+    // The kernel forgot the fd when it was closed, and the number may already name another file: leave the
+    // registration alone (any other rule on the entry has the same closed fd, and is dropped in turn).
+    if ( entry.rules.empty() ) {
+      entry.events = 0;
+    }
+  } else if ( not entry.rules.empty() ) {
+    _epoll_update( fd_num );
+  } else {
+    CheckSystemCall( "epoll_ctl", ::epoll_ctl( _epoll->fd_num(), EPOLL_CTL_DEL, fd_num, nullptr ) );
+    entry.events = 0;
+  }
+
+  _epoll_unwatch( rule );
+
+  const auto owner = *rule.position; // keeps the rule alive through its cancel callback
+  _fd_rules.erase( rule.position );
+  rule.cancel_requested = true; // a stale entry in _cancelled must not drop it twice
+  if ( call_cancel ) {
+    rule.cancel();
+  }
+}
+
+//! \returns whether the rule is still registered (and not already dropped, e.g. to make room for a new rule)
+bool EventLoop::_epoll_registered( const FDRule& rule ) const
+{
+  const EpollEntry& entry = _epoll_entries.at( rule.fd.fd_num() );
+  return find( entry.rules.begin(), entry.rules.end(), &rule ) != entry.rules.end();
+}
+
+void EventLoop::_epoll_unwatch( FDRule& rule )
+{
+  if ( rule.watch_index != NOT_WATCHED ) {
+    _watched[rule.watch_index] = _watched.back();
+    _watched[rule.watch_index]->watch_index = rule.watch_index;
+    _watched.pop_back();
+    rule.watch_index = NOT_WATCHED;
+  }
+}
+
+//! \details Drops the rule if it is defunct, or else arms or disarms it as its interest function says.
+//! \returns whether the rule is still registered
+bool EventLoop::_epoll_reevaluate( FDRule& rule )
+{
+  if ( _epoll_drop_if_defunct( &rule ) ) {
+    return false;
+  }
+  _epoll_arm( rule, _interested( rule ) );
+  return true;
+}
+
+//! \details As poll's backend does at the start of each call: a rule whose fd has reached EOF (for reading) or
+//! been closed is cancelled.
+//! \returns whether the rule was dropped
+bool EventLoop::_epoll_drop_if_defunct( FDRule* rule )
+{
+  if ( rule and ( ( rule->direction == Direction::In and rule->fd.eof() ) or rule->fd.closed() ) ) {
+    _epoll_drop( *rule, true );
+    return true;
+  }
+  return false;
+}
+
+void EventLoop::_fall_back_to_poll()
+{
+  _backend = Backend::Poll;
+  _epoll.reset();
+  _epoll_entries.clear();
+  _epoll_events.clear();
+  _watched.clear();
+  _cancelled->clear();
+  _interest_changed->clear();
+}
+
+void EventLoop::_report_error( const FDRule& rule ) const
+{
+  /* see if fd is a socket */
+  int socket_error = 0;
+  socklen_t optlen = sizeof( socket_error );
+  const int ret = getsockopt( rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
+  if ( ret == -1 and errno == ENOTSOCK ) {
+    cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( rule.category_id ).name << "\"\n";
+  } else if ( ret == -1 ) {
+    throw unix_error( "getsockopt" );
+  } else if ( optlen != sizeof( socket_error ) ) {
+    throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
+  } else if ( socket_error ) {
+    cerr << "error on polled socket for rule \"" << _rule_categories.at( rule.category_id ).name
+         << "\": " << strerror( socket_error ) << "\n";
+  }
+}
+
+//! \details Runs the callback of a ready rule, then (up to the rule's budget) runs it again while it keeps
+//! reading or writing its fd without blocking.
+void EventLoop::_serve( FDRule& rule )
+{
+  auto count_before = rule.service_count();
+  _run_callback( rule );
+
+  if ( count_before == rule.service_count() and ( not rule.fd.closed() ) and _interested( rule ) ) {
+    throw runtime_error( "EventLoop: busy wait detected: rule \"" + _rule_categories.at( rule.category_id ).name
+                         + "\" did not read/write fd and is still interested" );
+  }
+
+  for ( unsigned runs = 1; runs < rule.budget; ++runs ) {
+    if ( count_before == rule.service_count() or rule.cancel_requested or not rule.fd.non_blocking()
+         or rule.fd.closed() or ( rule.direction == Direction::In and rule.fd.eof() ) or not _interested( rule ) ) {
+      break;
+    }
+    count_before = rule.service_count();
+    _run_callback( rule );
+  }
+}
+
+//! \returns `timeout_ms`, shortened if need be to wake up for the next timer
+int EventLoop::_timeout_for_timers( const int timeout_ms )
+{
+  const auto next = _timers.next_event();
+  if ( not next.has_value() ) {
+    return timeout_ms;
+  }
+  const uint64_t now = timestamp_ms();
+  const int until_next = next.value() > now ? static_cast<int>( min<uint64_t>( next.value() - now, INT_MAX ) ) : 0;
+  return timeout_ms < 0 ? until_next : min( timeout_ms, until_next );
+}
+
+//! \details Drops cancelled timers, then runs the callbacks of the timers that are due and reschedules the
+//! periodic ones.
+//! \returns whether any timer fired
+bool EventLoop::_fire_timers()
+{
+  for ( const auto& weak_rule : exchange( *_cancelled_timers, {} ) ) {
+    if ( const auto rule = weak_rule.lock() ) {
+      auto& timer_rule = static_cast<TimerRule&>( *rule );
+      if ( timer_rule.timer.has_value() ) {
+        _timers.cancel( timer_rule.timer.value() );
+        timer_rule.timer.reset();
+      }
+    }
+  }
+
+  if ( _timers.size() == 0 ) {
+    return false;
+  }
+
+  bool fired = false;
+  const uint64_t now = timestamp_ms();
+  _timers.advance( now, [&]( shared_ptr<TimerRule>& rule ) {
+    rule->timer.reset();
+    if ( rule->cancel_requested ) {
+      return;
+    }
+
+    fired = true;
+    _run_callback( *rule );
+
+    if ( rule->period > 0 and not rule->cancel_requested ) {
+      rule->expiry += rule->period;
+      if ( rule->expiry <= now ) {
+        rule->expiry += ( now - rule->expiry ) / rule->period * rule->period + rule->period; // skip missed firings
+      }
+      rule->timer = _timers.schedule( rule->expiry, rule );
+    }
+  } );
+  return fired;
+}
+
+template<class F>
+int EventLoop::_timed_wait( F&& wait )
+{
+  if ( not _instrumented ) {
+    return wait();
+  }
+  const uint64_t start = timestamp_ns();
+  const int ret = wait();
+  _wait_ns += timestamp_ns() - start;
+  return ret;
+}
+
+bool EventLoop::_interested( const BasicRule& rule )
+{
+  if ( not rule.interest ) {
+    return true;
+  }
+  if ( not _instrumented ) {
+    return rule.interest();
+  }
+
+  auto& category = _rule_categories.at( rule.category_id );
+  const uint64_t start = timestamp_ns();
+  const bool ret = rule.interest();
+  ++category.interest_evaluations;
+  category.interest_ns += timestamp_ns() - start;
+  return ret;
+}
+
+void EventLoop::_run_callback( const BasicRule& rule )
+{
+  if ( not _instrumented ) {
+    rule.callback();
+    return;
+  }
+
+  const size_t category_id = rule.category_id; // the callback may cancel the rule
+  const uint64_t start = timestamp_ns();
+  rule.callback();
+  const uint64_t elapsed = timestamp_ns() - start;
+
+  auto& category = _rule_categories.at( category_id );
+  ++category.callbacks;
+  category.callback_ns += elapsed;
+  category.max_callback_ns = max( category.max_callback_ns, elapsed );
+  ++category.callback_histogram.at( min<size_t>( bit_width( elapsed ), HISTOGRAM_BUCKETS - 1 ) );
+}
+
+//! \details The time not spent waiting for fds is counted as busy, even if some of it went to the loop's own
+//! bookkeeping rather than to callbacks.
+EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
+{
+  if ( not _instrumented ) {
+    return _wait_next_event( timeout_ms );
+  }
+
+  struct Accounting
+  {
+    EventLoop& loop;
+    uint64_t start = timestamp_ns();
+    uint64_t wait_before = loop._wait_ns;
+    ~Accounting() { loop._busy_ns += ( timestamp_ns() - start ) - ( loop._wait_ns - wait_before ); }
+  } accounting { *this };
+
+  ++_calls;
+  return _wait_next_event( timeout_ms );
+}
+
+EventLoop::Snapshot EventLoop::snapshot() const
+{
+  return { _rule_categories, _calls, _wait_ns, _busy_ns };
+}
+
+uint64_t EventLoop::RuleCategory::callback_quantile_ns( const double p ) const
+{
+  const auto rank = static_cast<uint64_t>( ceil( p * static_cast<double>( callbacks ) ) );
+  uint64_t seen = 0;
+  for ( size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket ) {
+    seen += callback_histogram.at( bucket );
+    if ( seen >= max<uint64_t>( rank, 1 ) ) {
+      return bucket == 0 ? 0 : min( uint64_t { 1 } << bucket, max_callback_ns );
+    }
+  }
+  return max_callback_ns;
+}
+
+double EventLoop::Snapshot::utilization() const
+{
+  return busy_ns + wait_ns == 0 ? 0 : static_cast<double>( busy_ns ) / static_cast<double>( busy_ns + wait_ns );
+}
+
+void EventLoop::Snapshot::summary( ostream& out ) const
+{
+  vector<const RuleCategory*> active;
+  for ( const auto& category : categories ) {
+    if ( category.callbacks > 0 or category.interest_evaluations > 0 ) {
+      active.push_back( &category );
+    }
+  }
+  sort( active.begin(), active.end(), []( const auto* a, const auto* b ) {
+    return a->callback_ns + a->interest_ns > b->callback_ns + b->interest_ns;
+  } );
+
+  const auto us = []( const uint64_t ns ) { return static_cast<double>( ns ) / 1000; };
+  const auto saved_flags = out.flags();
+  const auto saved_precision = out.precision();
+
+  out << left << setw( 44 ) << "category" << right << setw( 10 ) << "callbacks" << setw( 12 ) << "total ms"
+      << setw( 10 ) << "mean us" << setw( 10 ) << "p50 us" << setw( 10 ) << "p99 us" << setw( 10 ) << "max us"
+      << setw( 12 ) << "interests" << setw( 12 ) << "int. ms" << "\n";
+  out << fixed << setprecision( 1 );
+  for ( const auto* category : active ) {
+    const auto mean_ns = category->callbacks == 0 ? 0 : category->callback_ns / category->callbacks;
+    out << left << setw( 44 ) << category->name.substr( 0, 43 ) << right << setw( 10 ) << category->callbacks
+        << setw( 12 ) << us( category->callback_ns ) / 1000 << setw( 10 ) << us( mean_ns ) << setw( 10 )
+        << us( category->callback_quantile_ns( 0.5 ) ) << setw( 10 ) << us( category->callback_quantile_ns( 0.99 ) )
+        << setw( 10 ) << us( category->max_callback_ns ) << setw( 12 ) << category->interest_evaluations
+        << setw( 12 ) << us( category->interest_ns ) / 1000 << "\n";
+  }
+  out << "wait_next_event: " << calls << " calls, busy " << us( busy_ns ) / 1000 << " ms, idle "
+      << us( wait_ns ) / 1000 << " ms (" << 100 * utilization() << "% busy)\n";
+  out << "(p50 and p99 are upper bounds, from power-of-two histogram buckets)\n";
+
+  out.flags( saved_flags );
+  out.precision( saved_precision );
+}
+
 // NOLINTBEGIN(*-cognitive-complexity)
 // NOLINTBEGIN(*-signed-bitwise)
-EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
+EventLoop::Result EventLoop::_wait_next_event( const int timeout_ms )
 {
+  // first, the timers that are already due
+  bool non_fd_rule_fired = _fire_timers();
+  if ( non_fd_rule_fired and _dispatch == Dispatch::OneRule ) {
+    return Result::Success;
+  }
+
   // first, handle the non-file-descriptor-related rules
   {
     for ( auto it = _non_fd_rules.begin(); it != _non_fd_rules.end(); ) {
@@ -94,7 +692,7 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
       }
 
       uint8_t iterations = 0;
-      while ( this_rule.interest() ) {
+      while ( _interested( this_rule ) ) {
         if ( iterations++ >= 128 ) {
           throw runtime_error( "EventLoop: busy wait detected: rule \""
                                + _rule_categories.at( this_rule.category_id ).name + "\" is still interested after "
@@ -102,21 +700,101 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
         }
 
         rule_fired = true;
-        this_rule.callback();
+        _run_callback( this_rule );
       }
 
       if ( rule_fired ) {
-        return Result::Success; /* only serve one rule on each iteration */
+        if ( _dispatch == Dispatch::OneRule ) {
+          return Result::Success; /* only serve one rule on each iteration */
+        }
+        non_fd_rule_fired = true;
       }
 
       ++it;
     }
   }
 
-  // now the file-descriptor-related rules. poll any "interested" file descriptors
+  // now the file-descriptor-related rules (without waiting, if there has already been an event, and only until
+  // the next timer otherwise)
+  const uint64_t deadline = timestamp_ms() + static_cast<uint64_t>( max( timeout_ms, 0 ) );
+  int remaining_ms = timeout_ms;
+  while ( true ) {
+    const int fd_timeout_ms = non_fd_rule_fired ? 0 : _timeout_for_timers( remaining_ms );
+    Result result = _wait_fds( fd_timeout_ms );
+
+    if ( result == Result::Exit and _timers.size() > 0 ) {
+      // no fd to wait for, but a timer to wait for
+      if ( fd_timeout_ms > 0 ) {
+        CheckSystemCall( "poll", _timed_wait( [&] { return ::poll( nullptr, 0, fd_timeout_ms ); } ) );
+      }
+      result = Result::Timeout;
+    }
+
+    // and the timers that fell due while waiting
+    if ( result != Result::Success or _dispatch == Dispatch::AllReady ) {
+      non_fd_rule_fired |= _fire_timers();
+    }
+
+    if ( non_fd_rule_fired ) {
+      return Result::Success;
+    }
+    if ( result != Result::Timeout or fd_timeout_ms == remaining_ms ) {
+      return result;
+    }
+
+    // The wait was cut short for the timers, but none fired: the wheel woke up to cascade timers between its
+    // levels, ahead of their expiry. Wait for the rest of the caller's timeout.
+    if ( timeout_ms >= 0 ) {
+      const uint64_t now = timestamp_ms();
+      if ( now >= deadline ) {
+        return Result::Timeout;
+      }
+      remaining_ms = static_cast<int>( deadline - now );
+    }
+  }
+}
+
+//! \details With busy-polling on, the backend is first called with a timeout of zero until an fd is ready or the
+//! spin budget (or `timeout_ms`, if shorter) runs out; then it waits for whatever is left of `timeout_ms`.
+EventLoop::Result EventLoop::_wait_fds( const int timeout_ms )
+{
+  const auto wait = [&]( const int ms ) { return _backend == Backend::Epoll ? _wait_epoll( ms ) : _wait_poll( ms ); };
+  if ( _spin_budget.count() <= 0 or timeout_ms == 0 ) {
+    return wait( timeout_ms );
+  }
+
+  const auto start = chrono::steady_clock::now();
+  auto spin_until = start + _spin_budget;
+  if ( timeout_ms > 0 ) {
+    spin_until = min( spin_until, start + chrono::milliseconds { timeout_ms } );
+  }
+
+  auto now = start;
+  do {
+    const Result result = wait( 0 );
+    if ( result != Result::Timeout ) {
+      return result;
+    }
+    now = chrono::steady_clock::now();
+  } while ( now < spin_until );
+
+  if ( timeout_ms < 0 ) {
+    return wait( -1 );
+  }
+  const auto spun = chrono::duration_cast<chrono::milliseconds>( now - start ).count();
+  return spun >= timeout_ms ? Result::Timeout : wait( static_cast<int>( timeout_ms - spun ) );
+}
+
+EventLoop::Result EventLoop::_wait_poll( const int timeout_ms )
+{
+  _cancelled->clear(); // only the epoll backend needs these (rules are dropped below by their flag)
+  _interest_changed->clear(); // ... and these (every interest function is evaluated below)
+
+  // poll any "interested" file descriptors
   vector<pollfd> pollfds {};
   pollfds.reserve( _fd_rules.size() );
   bool something_to_poll = false;
+  const bool keep_background = _background_work();
 
   // set up the pollfd for each rule
   for ( auto it = _fd_rules.begin(); it != _fd_rules.end(); ) { // NOTE: it gets erased or incremented in loop body
@@ -143,9 +821,9 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
       continue;
     }
 
-    if ( this_rule.interest() ) {
+    if ( _interested( this_rule ) ) {
       pollfds.push_back( { this_rule.fd.fd_num(), static_cast<int16_t>( this_rule.direction ), 0 } );
-      something_to_poll = true;
+      something_to_poll |= not this_rule.background or keep_background;
     } else {
       pollfds.push_back( { this_rule.fd.fd_num(), 0, 0 } ); // placeholder --- we still want errors
     }
@@ -158,33 +836,27 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
   }
 
   // call poll -- wait until one of the fds satisfies one of the rules (writeable/readable)
-  if ( 0 == CheckSystemCall( "poll", ::poll( pollfds.data(), pollfds.size(), timeout_ms ) ) ) {
+  if ( 0
+       == CheckSystemCall( "poll",
+                           _timed_wait( [&] { return ::poll( pollfds.data(), pollfds.size(), timeout_ms ); } ) ) ) {
     return Result::Timeout;
   }
 
-  // go through the poll results
-  for ( auto [it, idx] = make_pair( _fd_rules.begin(), static_cast<size_t>( 0 ) ); it != _fd_rules.end(); ++idx ) {
+  // go through the poll results (rules added by callbacks along the way were not polled)
+  for ( auto [it, idx] = make_pair( _fd_rules.begin(), static_cast<size_t>( 0 ) );
+        it != _fd_rules.end() and idx < pollfds.size();
+        ++idx ) {
     const auto& this_pollfd = pollfds.at( idx );
     auto& this_rule = **it;
 
-    const auto poll_error = static_cast<bool>( this_pollfd.revents & ( POLLERR | POLLNVAL ) );
-    if ( poll_error ) {
-      /* see if fd is a socket */
-      int socket_error = 0;
-      socklen_t optlen = sizeof( socket_error );
-      const int ret = getsockopt( this_rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
-      if ( ret == -1 and errno == ENOTSOCK ) {
-        cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\"\n";
-      } else if ( ret == -1 ) {
-        throw unix_error( "getsockopt" );
-      } else if ( optlen != sizeof( socket_error ) ) {
-        throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
-      } else if ( socket_error ) {
-        cerr << "error on polled socket for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\": " << strerror( socket_error ) << "\n";
-      }
+    if ( this_rule.cancel_requested or this_rule.fd.closed() ) {
+      ++it; // by an earlier callback on this call; the rule is dropped on the next call
+      continue;
+    }
 
+    const auto poll_error = static_cast<bool>( this_pollfd.revents & ( POLLERR | POLLNVAL ) );
+    if ( poll_error and not _handle_error_queue( this_rule.fd.fd_num() ) ) {
+      _report_error( this_rule );
       this_rule.error();
       this_rule.cancel();
       it = _fd_rules.erase( it );
@@ -205,20 +877,163 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
 
     if ( poll_ready ) {
       // we only want to call callback if revents includes the event we asked for
-      const auto count_before = this_rule.service_count();
-      this_rule.callback();
+      _serve( this_rule );
+      if ( _dispatch == Dispatch::OneRule ) {
+        return Result::Success; /* only serve one rule on each iteration */
+      }
+    }
 
-      if ( count_before == this_rule.service_count() and ( not this_rule.fd.closed() ) and this_rule.interest() ) {
-        throw runtime_error( "EventLoop: busy wait detected: rule \""
-                             + _rule_categories.at( this_rule.category_id ).name
-                             + "\" did not read/write fd and is still interested" );
+    ++it; // if we got here, it means we didn't call _fd_rules.erase()
+  }
+
+  return Result::Success;
+}
+
+//! \details Rules stay registered with the kernel between calls, and epoll_wait reports just the ready fds, each
+//! leading straight to its rules. The work done on each call is proportional to the ready fds, the rules
+//! cancelled or marked changed since the last call, and the rules whose interest function is evaluated on every
+//! call (since that is how such a rule announces a change; only the changes cost a system call). A rule set to
+//! RuleHandle::set_interest_on_change is instead evaluated after its callback runs and when marked changed.
+EventLoop::Result EventLoop::_wait_epoll( const int timeout_ms )
+{
+  for ( const auto& weak_rule : exchange( *_cancelled, {} ) ) {
+    if ( const auto rule = weak_rule.lock(); rule and _epoll_registered( static_cast<FDRule&>( *rule ) ) ) {
+      _epoll_drop( static_cast<FDRule&>( *rule ), false ); // no cancel callback, as with poll
+    }
+  }
+
+  _interest_batch.swap( *_interest_changed );
+  for ( const auto& weak_rule : _interest_batch ) {
+    const auto rule = weak_rule.lock();
+    if ( not rule ) {
+      continue;
+    }
+    auto& this_rule = static_cast<FDRule&>( *rule );
+    this_rule.interest_queued = false;
+    if ( this_rule.cancel_requested or not _epoll_registered( this_rule ) ) {
+      continue;
+    }
+    if ( this_rule.interest_on_change ) {
+      _epoll_unwatch( this_rule );
+    }
+    if ( not _epoll_reevaluate( this_rule ) and _backend != Backend::Epoll ) {
+      _interest_batch.clear();
+      return _wait_poll( timeout_ms ); // the cancel callback made the loop fall back to poll
+    }
+  }
+  _interest_batch.clear();
+
+  for ( size_t i = 0; i < _watched.size(); ) { // NOTE: _watched[i] may be replaced by a dropped rule's successor
+    FDRule& this_rule = *_watched[i];
+    if ( _epoll_drop_if_defunct( &this_rule ) ) {
+      if ( _backend != Backend::Epoll ) {
+        return _wait_poll( timeout_ms ); // the cancel callback made the loop fall back to poll
       }
+      continue;
+    }
+    _epoll_arm( this_rule, _interested( this_rule ) );
+    ++i;
+  }
 
-      return Result::Success; /* only serve one rule on each iteration */
+  // quit if there is nothing left to poll
+  if ( _armed_count == 0 and not _background_work() ) {
+    return Result::Exit;
+  }
+
+  const int ready = _timed_wait( [&] {
+    return ::epoll_wait(
+      _epoll->fd_num(), _epoll_events.data(), static_cast<int>( _epoll_events.size() ), timeout_ms );
+  } );
+  if ( ready < 0 and errno == EINTR ) {
+    return Result::Timeout; // unlike poll, epoll_wait is not restarted after task work (e.g., for io_uring) runs
+  }
+  if ( CheckSystemCall( "epoll_wait", ready ) == 0 ) {
+    return Result::Timeout;
+  }
+
+  // Handle errors and hangups on every ready fd, then serve the ready rules: as with poll, in the order they were
+  // added (or just the first of them, with Dispatch::OneRule).
+  _ready_rules.clear();
+  for ( const auto& event : span { _epoll_events.data(), static_cast<size_t>( ready ) } ) {
+    if ( _backend != Backend::Epoll ) {
+      return Result::Success; // a callback made the loop fall back to poll
+    }
+    _entry_rules.clear();
+    for ( FDRule* rule : _epoll_entries.at( event.data.fd ).rules ) {
+      _entry_rules.push_back( *rule->position ); // keeps the rules alive through their callbacks
     }
 
-    ++it; // if we got here, it means we didn't call _fd_rules.erase()
+    if ( ( event.events & EPOLLERR ) and not _handle_error_queue( event.data.fd ) ) {
+      for ( const auto& rule : _entry_rules ) {
+        if ( _backend == Backend::Epoll and not rule->cancel_requested ) {
+          _report_error( *rule );
+          rule->error();
+          _epoll_drop( *rule, true );
+        }
+      }
+      continue;
+    }
+
+    for ( const auto& rule : _entry_rules ) {
+      if ( _backend != Backend::Epoll or rule->cancel_requested ) {
+        continue;
+      }
+
+      const bool ready_for_rule = rule->armed and ( event.events & epoll_events_for( rule->direction ) );
+      const bool hup = event.events & EPOLLHUP;
+      if ( hup and ( ( rule->armed and not ready_for_rule ) or rule->direction == Direction::Out ) ) {
+        _epoll_drop( *rule, true ); // as with poll: the fd is defunct in this direction
+        continue;
+      }
+
+      if ( ready_for_rule ) {
+        _ready_rules.push_back( rule ); // keeps the rule alive, should a callback cancel it
+      }
+    }
+  }
+
+  const auto by_order = []( const auto& a, const auto& b ) { return a->order < b->order; };
+  if ( _dispatch == Dispatch::OneRule and not _ready_rules.empty() ) {
+    _ready_rules = { *min_element( _ready_rules.begin(), _ready_rules.end(), by_order ) };
+  } else {
+    sort( _ready_rules.begin(), _ready_rules.end(), by_order );
+  }
+
+  for ( const auto& next_rule : _ready_rules ) {
+    if ( _backend != Backend::Epoll ) {
+      break; // a callback made the loop fall back to poll
+    }
+    if ( next_rule->cancel_requested ) {
+      continue; // by an earlier callback
+    }
+    if ( next_rule->fd.closed() ) {
+      _epoll_drop( *next_rule, true ); // by an earlier callback (as poll would on the next call)
+      continue;
+    }
+
+    _serve( *next_rule );
+
+    // The callback may have reached EOF (or closed the fd) for this rule or another one on the same fd, and may
+    // have changed this rule's interest.
+    if ( _backend == Backend::Epoll and not next_rule->cancel_requested ) {
+      _entry_rules.clear();
+      for ( FDRule* rule : _epoll_entries.at( next_rule->fd.fd_num() ).rules ) {
+        _entry_rules.push_back( *rule->position );
+      }
+      for ( const auto& rule : _entry_rules ) {
+        if ( _backend != Backend::Epoll or rule->cancel_requested ) {
+          continue;
+        }
+        if ( rule == next_rule and rule->interest_on_change ) {
+          _epoll_reevaluate( *rule );
+        } else {
+          _epoll_drop_if_defunct( rule.get() );
+        }
+      }
+    }
   }
+  _ready_rules.clear();
+  _entry_rules.clear();
 
   return Result::Success;
 }
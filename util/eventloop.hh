@@ -1,13 +1,29 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <list>
 #include <memory>
+#include <optional>
 #include <ostream>
 #include <poll.h>
+#include <string>
 #include <string_view>
+#include <type_traits>
+#include <sys/epoll.h>
+#include <unordered_map>
+#include <vector>
 
+#include "eventfd.hh"
+#include "executor.hh"
 #include "file_descriptor.hh"
+#include "mpsc_queue.hh"
+#include "timing_wheel.hh"
 
 //! Waits for events on file descriptors and executes corresponding callbacks.
 class EventLoop
@@ -20,23 +36,81 @@ public:
     Out = POLLOUT //!< Callback will be triggered when Rule::fd is writable.
   };
 
-private:
-  using CallbackT = std::function<void( void )>;
-  using InterestT = std::function<bool( void )>;
+  //! Returned by each call to EventLoop::wait_next_event.
+  enum class Result
+  {
+    Success, //!< At least one Rule was triggered.
+    Timeout, //!< No rules were triggered before timeout (or the wait was interrupted).
+    Exit     //!< All rules have been canceled or were uninterested, and no timer or posted task is pending; make
+             //!< no further calls to EventLoop::wait_next_event (and expect no task posted later to run).
+  };
 
+  //! How EventLoop::wait_next_event waits for file descriptors.
+  enum class Backend
+  {
+    Poll, //!< [poll(2)](\ref man2::poll) every interested fd on each call
+    Epoll //!< [epoll(7)](\ref man7::epoll): fds stay registered, and only the ready ones are reported
+  };
+
+  //! How many rules EventLoop::wait_next_event serves on each call.
+  enum class Dispatch
+  {
+    OneRule, //!< The first rule found ready (the rule added first, among ready fds)
+    AllReady //!< Every rule found ready, in the order they were added
+  };
+
+  //! Buckets of a callback-time histogram (see RuleCategory::callback_histogram)
+  static constexpr size_t HISTOGRAM_BUCKETS = 40;
+
+  //! A category of rules, with the timing of its rules while instrumentation is on (see set_instrumented)
   struct RuleCategory
   {
     std::string name;
+    uint64_t callbacks {};       //!< Callbacks run
+    uint64_t callback_ns {};     //!< Total time spent in them
+    uint64_t max_callback_ns {}; //!< Longest of them
+    //! Callbacks by duration: bucket 0 counts those under 1 ns, and bucket i those of 2^(i-1) to 2^i ns
+    std::array<uint64_t, HISTOGRAM_BUCKETS> callback_histogram {};
+    uint64_t interest_evaluations {}; //!< Calls to the rules' interest functions
+    uint64_t interest_ns {};          //!< Total time spent in them
+
+    //! Upper bound (from the histogram) of the `p`th quantile (0 to 1) of callback time, in ns
+    uint64_t callback_quantile_ns( double p ) const;
+  };
+
+  //! The loop's timing data (see set_instrumented)
+  struct Snapshot
+  {
+    std::vector<RuleCategory> categories {}; //!< Indexed by category id
+    uint64_t calls {};                       //!< Calls to wait_next_event
+    uint64_t wait_ns {}; //!< Time spent waiting in poll or epoll_wait (including busy-poll spins): idle
+    uint64_t busy_ns {}; //!< The rest of the time spent in wait_next_event: busy
+
+    //! Busy time as a fraction of the time spent in wait_next_event
+    double utilization() const;
+
+    //! Write a table of the categories with any activity, busiest first, and the loop's utilization
+    void summary( std::ostream& out ) const;
   };
 
+private:
+  using CallbackT = std::function<void( void )>;
+  using InterestT = std::function<bool( void )>;
+
+  static constexpr size_t NOT_WATCHED = -1;
+
   struct BasicRule
   {
     size_t category_id;
     InterestT interest;
     CallbackT callback;
     bool cancel_requested {};
+    unsigned budget { 1 }; //!< Most callbacks per call to wait_next_event (see RuleHandle::set_budget)
 
     BasicRule( size_t s_category_id, InterestT s_interest, CallbackT s_callback );
+
+    //! An empty `interest` function means the rule is always interested.
+    bool interested() const { return not interest or interest(); }
   };
 
   struct FDRule : public BasicRule
@@ -45,6 +119,19 @@ private:
     Direction direction; //!< Direction::In for reading from fd, Direction::Out for writing to fd.
     CallbackT cancel;    //!< A callback that is called when the rule is cancelled (e.g. on EOF or hangup)
     CallbackT error;     //!< A callback that is called when the fd has an error before cancellation
+    bool background {};  //!< Keeps wait_next_event from returning Result::Exit only while work is offloaded or posted
+
+    //! \name
+    //! Bookkeeping of the epoll backend
+
+    //!@{
+    bool armed {};                                            //!< Is the fd registered for `direction`?
+    uint64_t order {};                                        //!< Among ready rules, the lowest is served first
+    std::list<std::shared_ptr<FDRule>>::iterator position {}; //!< In _fd_rules
+    size_t watch_index { NOT_WATCHED };                       //!< In _watched, if the rule has an interest function
+    bool interest_on_change {}; //!< See RuleHandle::set_interest_on_change
+    bool interest_queued {};    //!< Is the rule in _interest_changed?
+    //!@}
 
     FDRule( BasicRule&& base, FileDescriptor&& s_fd, Direction s_direction, CallbackT s_cancel, CallbackT s_error );
 
@@ -53,34 +140,153 @@ private:
     unsigned int service_count() const;
   };
 
+  struct TimerRule : public BasicRule
+  {
+    uint64_t expiry; //!< Milliseconds on the steady clock
+    uint64_t period; //!< Milliseconds between firings of a periodic timer (zero for a one-shot timer)
+    std::optional<TimingWheel<std::shared_ptr<TimerRule>>::Timer> timer {}; //!< While scheduled
+
+    TimerRule( BasicRule&& base, uint64_t s_expiry, uint64_t s_period );
+  };
+
   std::vector<RuleCategory> _rule_categories {};
   std::list<std::shared_ptr<FDRule>> _fd_rules {};
   std::list<std::shared_ptr<BasicRule>> _non_fd_rules {};
 
-public:
-  EventLoop() { _rule_categories.reserve( 64 ); }
-
-  //! Returned by each call to EventLoop::wait_next_event.
-  enum class Result
+  //! The rules (in either direction, any number of each) of an fd registered with epoll
+  struct EpollEntry
   {
-    Success, //!< At least one Rule was triggered.
-    Timeout, //!< No rules were triggered before timeout.
-    Exit     //!< All rules have been canceled or were uninterested; make no further calls to
-             //!< EventLoop::wait_next_event.
+    std::vector<FDRule*> rules {}; //!< In the order they were added
+    uint32_t events {};            //!< Events the fd is registered for
   };
 
+  //! Rules cancelled (or whose interest changed) through their RuleHandle, for the epoll backend to act on
+  using CancelQueue = std::vector<std::weak_ptr<BasicRule>>;
+
+  Backend _backend;
+  Dispatch _dispatch { Dispatch::OneRule };
+  std::chrono::microseconds _spin_budget {}; //!< See set_busy_poll()
+
+  bool _instrumented {}; //!< See set_instrumented()
+  uint64_t _calls {};
+  uint64_t _wait_ns {};
+  uint64_t _busy_ns {};
+  std::optional<FileDescriptor> _epoll {};
+  std::vector<EpollEntry> _epoll_entries {}; //!< Indexed by fd number
+  std::vector<epoll_event> _epoll_events {};
+  std::vector<FDRule*> _watched {}; //!< Rules whose interest function must be evaluated on every call
+  std::vector<std::shared_ptr<FDRule>> _entry_rules {}; //!< The rules of the fd being handled
+  std::vector<std::shared_ptr<FDRule>> _ready_rules {}; //!< Rules to serve on this call
+  size_t _armed_count {}; //!< Not counting background rules
+  uint64_t _next_rule_order {};
+  std::shared_ptr<CancelQueue> _cancelled { std::make_shared<CancelQueue>() };
+  std::shared_ptr<CancelQueue> _interest_changed { std::make_shared<CancelQueue>() };
+  CancelQueue _interest_batch {}; //!< Taken from _interest_changed on this call
+
+  TimingWheel<std::shared_ptr<TimerRule>> _timers;
+  std::shared_ptr<CancelQueue> _cancelled_timers { std::make_shared<CancelQueue>() };
+
+  MPSCQueue<CallbackT> _posted {}; //!< Tasks handed over by EventLoop::post
+  EventFD _posted_ready {};        //!< Readable when _posted may have tasks
+  std::deque<CallbackT> _posted_batch {}; //!< Tasks taken from _posted and not yet run
+  std::atomic<unsigned> _posting {};      //!< Calls to post() under way, which the destructor waits out
+  size_t _offloaded {};            //!< Offloaded stages whose completion has not yet run
+
+  std::unordered_map<int, CallbackT> _error_queue_handlers {}; //!< See set_error_queue_handler(), by fd number
+
+  void _epoll_register( FDRule& rule );
+  void _epoll_arm( FDRule& rule, bool armed );
+  void _epoll_update( int fd_num );
+  void _epoll_unwatch( FDRule& rule );
+  bool _epoll_reevaluate( FDRule& rule );
+  void _epoll_drop( FDRule& rule, bool call_cancel );
+  bool _epoll_drop_if_defunct( FDRule* rule );
+  bool _epoll_registered( const FDRule& rule ) const;
+  void _fall_back_to_poll();
+
+  Result _wait_next_event( int timeout_ms );
+  Result _wait_fds( int timeout_ms );
+  template<class F>
+  int _timed_wait( F&& wait );
+  bool _interested( const BasicRule& rule );
+  void _run_callback( const BasicRule& rule );
+  Result _wait_poll( int timeout_ms );
+  Result _wait_epoll( int timeout_ms );
+  void _report_error( const FDRule& rule ) const;
+  bool _handle_error_queue( int fd_num );
+  void _serve( FDRule& rule );
+  int _timeout_for_timers( int timeout_ms );
+  bool _fire_timers();
+  void _run_posted();
+  bool _background_work() const;
+  void _complete_offload( const std::exception_ptr& error );
+
+public:
+  //! \param[in] backend is the preferred backend; EventLoop falls back to Backend::Poll if epoll is unavailable,
+  //! or if an fd that epoll cannot watch (e.g., a regular file) is added
+  explicit EventLoop( Backend backend = Backend::Epoll );
+
+  //! The backend in use
+  Backend backend() const { return _backend; }
+
+  //! Serve one ready rule (the default) or every ready rule on each call to wait_next_event
+  void set_dispatch( Dispatch dispatch ) { _dispatch = dispatch; }
+  Dispatch dispatch() const { return _dispatch; }
+
+  //! \brief Busy-poll: before blocking, spin for up to `spin_budget` checking the fds without waiting
+  //! \details Trades a core for latency: an fd that becomes ready while the loop spins is served without the
+  //! sleep and wakeup of a blocking poll. Spinning stops at the first event, or once `spin_budget` has passed
+  //! with none, and the loop then waits as usual. A budget of zero (the default) turns busy-polling off. (For
+  //! sockets on a NIC with NAPI, Socket::set_busy_poll also lets the kernel spin on the device queue.)
+  void set_busy_poll( std::chrono::microseconds spin_budget ) { _spin_budget = spin_budget; }
+  std::chrono::microseconds busy_poll() const { return _spin_budget; }
+
+  //! \brief Record the time spent in each category's callbacks and interest functions, and the time the loop
+  //! spends waiting (off by default, as it reads the clock around every callback)
+  void set_instrumented( bool instrumented ) { _instrumented = instrumented; }
+  bool instrumented() const { return _instrumented; }
+
+  //! Timing data recorded so far
+  Snapshot snapshot() const;
+
+  //! Write the timing data recorded so far (see Snapshot::summary)
+  void summary( std::ostream& out ) const { snapshot().summary( out ); }
+
   size_t add_category( const std::string& name );
 
   class RuleHandle
   {
     std::weak_ptr<BasicRule> rule_weak_ptr_;
+    std::weak_ptr<CancelQueue> cancelled_ {};
+    std::weak_ptr<CancelQueue> interest_changed_ {};
 
   public:
     template<class RuleType>
-    explicit RuleHandle( const std::shared_ptr<RuleType> x ) : rule_weak_ptr_( x )
+    explicit RuleHandle( const std::shared_ptr<RuleType> x,
+                         std::weak_ptr<CancelQueue> cancelled = {},
+                         std::weak_ptr<CancelQueue> interest_changed = {} )
+      : rule_weak_ptr_( x ), cancelled_( std::move( cancelled ) ), interest_changed_( std::move( interest_changed ) )
     {}
 
     void cancel();
+
+    //! \brief Let the rule's callback run up to `budget` times per call to wait_next_event (the default is once)
+    //! \details As with a NAPI poll budget, the callback runs again only while the rule stays interested, its
+    //! last run read or wrote the fd, and the fd is non-blocking (so a run that finds nothing more to do returns
+    //! at once). A busy rule can drain its fd without a poll between runs, and the budget keeps it from starving
+    //! the other rules.
+    void set_budget( unsigned budget );
+
+    //! \brief Evaluate the rule's interest function only after its callback has run and after interest_changed(),
+    //! instead of on every call to wait_next_event
+    //! \details With the epoll backend, a rule on an fd that is not ready then costs nothing per call, however many
+    //! such rules there are. In exchange, the rule's owner must call interest_changed() whenever anything other
+    //! than the rule's own callback may change what the interest function returns; EOF on the fd, and its being
+    //! closed, are also noticed only at those times. The poll backend evaluates every rule on every call anyway.
+    void set_interest_on_change();
+
+    //! The rule's interest function may now return something else (see set_interest_on_change)
+    void interest_changed();
   };
 
   RuleHandle add_rule(
@@ -88,7 +294,7 @@ public:
     FileDescriptor& fd,
     Direction direction,
     const CallbackT& callback,
-    const InterestT& interest = [] { return true; },
+    const InterestT& interest = {},
     const CallbackT& cancel = [] {},
     const CallbackT& error = [] {} );
 
@@ -97,7 +303,86 @@ public:
     const CallbackT& callback,
     const InterestT& interest = [] { return true; } );
 
-  //! Calls [poll(2)](\ref man2::poll) and then executes callback for each ready fd.
+  //! \brief Call `callback` once, at `deadline`
+  //! \details The loop wakes up for the timer (no fd needs to be ready), and runs its callback on the first call to
+  //! wait_next_event at or after the deadline (rounded up to the millisecond). RuleHandle::cancel() cancels it.
+  RuleHandle add_timer( size_t category_id,
+                        std::chrono::steady_clock::time_point deadline,
+                        const CallbackT& callback );
+
+  //! \brief Call `callback` every `period`, starting one period from now
+  //! \details Firings stay on the original schedule; if the loop falls behind by more than a period, the missed
+  //! firings are skipped rather than run back to back.
+  RuleHandle add_periodic_timer( size_t category_id, std::chrono::milliseconds period, const CallbackT& callback );
+
+  //! \brief Run `task` on the loop's thread, from wait_next_event, as soon as possible
+  //! \details This is the one EventLoop method that may be called from any thread. It wakes the loop at once,
+  //! however long its timeout; tasks run in the order they were posted (by each thread). wait_next_event does not
+  //! return Result::Exit while a task it can see is waiting to run.
+  void post( CallbackT task );
+
+  //! \brief Call `handler` whenever messages are waiting on the error queue of `fd`, a socket (e.g., completions
+  //! of MSG_ZEROCOPY writes; see ZeroCopySender)
+  //! \details poll reports a waiting message as an error on the socket. Once the handler has read the queue, the
+  //! loop treats the fd as healthy rather than failing its rules; only an error left after the handler has run
+  //! fails them. The handler is called only while some rule watches `fd`. An empty handler removes it.
+  void set_error_queue_handler( const FileDescriptor& fd, CallbackT handler );
+
+  //! \brief Run `work()` on `executor`, then `done( result )` (or just `done()` if `work` returns void) on this
+  //! loop's thread
+  //! \details For a CPU-bound stage of a callback (e.g., parsing or checksumming a batch of datagrams). Call from
+  //! the loop's thread; `done` runs from a later call to wait_next_event, which does not return Result::Exit
+  //! while any offloaded work is outstanding. If `work` throws, the exception is rethrown from that call to
+  //! wait_next_event instead.
+  template<class Work, class Done>
+  void offload( Executor& executor, Work work, Done done )
+  {
+    using ResultT = std::invoke_result_t<Work&>;
+    ++_offloaded;
+    executor.submit( [this, work = std::move( work ), done = std::move( done )]() mutable {
+      std::exception_ptr error {};
+      if constexpr ( std::is_void_v<ResultT> ) {
+        try {
+          work();
+        } catch ( ... ) {
+          error = std::current_exception();
+        }
+        post( [this, done = std::move( done ), error]() mutable {
+          _complete_offload( error );
+          done();
+        } );
+      } else {
+        auto result = std::make_shared<std::optional<ResultT>>();
+        try {
+          result->emplace( work() );
+        } catch ( ... ) {
+          error = std::current_exception();
+        }
+        post( [this, done = std::move( done ), error, result]() mutable {
+          _complete_offload( error );
+          done( std::move( result->value() ) );
+        } );
+      }
+    } );
+  }
+
+  //! \name
+  //! Rules hold pointers to the loop, so an EventLoop can be neither copied nor moved
+
+  //!@{
+  EventLoop( const EventLoop& ) = delete;
+  EventLoop( EventLoop&& ) = delete;
+  EventLoop& operator=( const EventLoop& ) = delete;
+  EventLoop& operator=( EventLoop&& ) = delete;
+  //! Waits for calls to post() from other threads to return (a task may run, and the loop be destroyed, before
+  //! the call that posted it has returned)
+  ~EventLoop();
+  //!@}
+
+  //! Waits (with [poll(2)](\ref man2::poll) or [epoll_wait(2)](\ref man2::epoll_wait)) until an interested fd is
+  //! ready or a timer is due, and then executes the callback of one ready fd or the due timers (or, with
+  //! Dispatch::AllReady, all of them). A pending timer shortens the wait as needed, and keeps the loop from
+  //! returning Result::Exit.
   Result wait_next_event( int timeout_ms );
 
   // convenience function to add category and rule at the same time
@@ -106,6 +391,21 @@ public:
   {
     return add_rule( add_category( name ), std::forward<Targs>( Fargs )... );
   }
+
+  template<typename... Targs>
+  auto add_timer( const std::string& name, Targs&&... Fargs )
+  {
+    return add_timer( add_category( name ), std::forward<Targs>( Fargs )... );
+  }
+
+  template<typename... Targs>
+  auto add_periodic_timer( const std::string& name, Targs&&... Fargs )
+  {
+    return add_periodic_timer( add_category( name ), std::forward<Targs>( Fargs )... );
+  }
+
+private:
+  RuleHandle _add_timer( size_t category_id, uint64_t expiry, uint64_t period, const CallbackT& callback );
 };
 
 using Direction = EventLoop::Direction;
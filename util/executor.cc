@@ -0,0 +1,104 @@
+#include "executor.hh"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+// The Executor (if any) whose worker is running on this thread, and the worker's index
+thread_local const Executor* current_executor = nullptr; // NOLINT(*-avoid-non-const-global-variables)
+thread_local size_t current_worker = 0;                  // NOLINT(*-avoid-non-const-global-variables)
+} // namespace
+
+Executor::Executor( const size_t threads )
+{
+  _workers.reserve( max<size_t>( threads, 1 ) );
+  for ( size_t i = 0; i < max<size_t>( threads, 1 ); ++i ) {
+    _workers.push_back( make_unique<Worker>() );
+  }
+  for ( size_t i = 0; i < _workers.size(); ++i ) {
+    _workers[i]->thread = thread( [this, i] { _work( i ); } );
+  }
+}
+
+Executor::~Executor()
+{
+  {
+    const lock_guard lock { _mutex };
+    _stopping = true;
+  }
+  _wake.notify_all();
+  for ( const auto& worker : _workers ) {
+    worker->thread.join();
+  }
+}
+
+//! \details The count of queued tasks goes up before the task is published, and a sleeping worker rechecks it
+//! under _mutex before waiting, so either the worker sees the task or the submitter sees the sleeper and wakes
+//! it.
+void Executor::submit( Task task )
+{
+  _queued.fetch_add( 1 );
+
+  if ( current_executor == this ) {
+    _workers[current_worker]->tasks.push( make_unique<Task>( move( task ) ).release() );
+  } else {
+    const lock_guard lock { _mutex };
+    _submitted.push_back( move( task ) );
+    _submitted_size.fetch_add( 1 );
+  }
+
+  if ( _sleeping.load() > 0 ) {
+    const lock_guard lock { _mutex };
+    _wake.notify_one();
+  }
+}
+
+//! \details In order: the worker's own newest task, the oldest task submitted from outside, and the oldest task
+//! of each other worker in turn (starting with the next one, so that thieves spread out).
+unique_ptr<Executor::Task> Executor::_find_task( const size_t index )
+{
+  if ( const auto task = _workers[index]->tasks.pop() ) {
+    return unique_ptr<Task> { task.value() };
+  }
+
+  if ( _submitted_size.load() > 0 ) {
+    const lock_guard lock { _mutex };
+    if ( not _submitted.empty() ) {
+      auto task = make_unique<Task>( move( _submitted.front() ) );
+      _submitted.pop_front();
+      _submitted_size.fetch_sub( 1 );
+      return task;
+    }
+  }
+
+  for ( size_t i = 1; i < _workers.size(); ++i ) {
+    if ( const auto task = _workers[( index + i ) % _workers.size()]->tasks.steal() ) {
+      return unique_ptr<Task> { task.value() };
+    }
+  }
+
+  return nullptr;
+}
+
+void Executor::_work( const size_t index )
+{
+  current_executor = this;
+  current_worker = index;
+
+  while ( true ) {
+    if ( const auto task = _find_task( index ) ) {
+      _queued.fetch_sub( 1 );
+      ( *task )();
+      continue;
+    }
+
+    unique_lock lock { _mutex };
+    if ( _stopping and _queued.load() == 0 ) {
+      return;
+    }
+    _sleeping.fetch_add( 1 );
+    _wake.wait( lock, [&] { return _queued.load() > 0 or _stopping; } );
+    _sleeping.fetch_sub( 1 );
+  }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "work_stealing_deque.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! \brief A pool of worker threads that share CPU-bound tasks by work stealing
+//! \details Each worker keeps its own WorkStealingDeque. A task submitted by a worker (e.g., a task that splits
+//! itself up) goes on that worker's deque, where the worker takes it back last-in first-out while it is still
+//! hot in the cache; a task submitted from any other thread, such as an EventLoop's, goes on a shared queue. A
+//! worker that runs out of tasks takes from the shared queue, then steals the oldest task of another worker,
+//! and sleeps only when no task is queued anywhere.
+//!
+//! To run a stage of an EventLoop callback on an Executor and get its result back on the loop, see
+//! EventLoop::offload.
+class Executor
+{
+public:
+  using Task = std::function<void( void )>;
+
+  //! Start `threads` worker threads (by default, one per hardware thread)
+  explicit Executor( size_t threads = std::thread::hardware_concurrency() );
+
+  //! Run every task already submitted, then stop the workers
+  ~Executor();
+
+  //! Queue `task` to run on one of the workers (from any thread). A task must not throw.
+  void submit( Task task );
+
+  //! Number of worker threads
+  size_t threads() const { return _workers.size(); }
+
+  Executor( const Executor& ) = delete;
+  Executor( Executor&& ) = delete;
+  Executor& operator=( const Executor& ) = delete;
+  Executor& operator=( Executor&& ) = delete;
+
+private:
+  struct Worker
+  {
+    WorkStealingDeque<Task*> tasks {};
+    std::thread thread {};
+  };
+
+  std::vector<std::unique_ptr<Worker>> _workers {};
+
+  std::mutex _mutex {};
+  std::condition_variable _wake {};
+  std::deque<Task> _submitted {}; //!< Tasks submitted from outside the pool (guarded by _mutex)
+  bool _stopping {};              //!< Guarded by _mutex
+
+  std::atomic<size_t> _queued {};          //!< Tasks submitted and not yet taken by a worker
+  std::atomic<size_t> _submitted_size {};  //!< Lets workers skip _mutex when _submitted is empty
+  std::atomic<size_t> _sleeping {};        //!< Workers waiting on _wake
+
+  void _work( size_t index );
+  std::unique_ptr<Task> _find_task( size_t index );
+};
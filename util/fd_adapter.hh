@@ -6,6 +6,7 @@
 #include "tcp_config.hh"
 #include "tcp_segment.hh"
 
+#include <cstdint>
 #include <optional>
 #include <utility>
 
@@ -39,4 +40,7 @@ public:
 
   //! Called periodically when time elapses
   void tick( const size_t unused [[maybe_unused]] ) {}
+
+  //! Milliseconds until tick() has work to do (never, for adapters without timers)
+  std::optional<uint64_t> ms_until_deadline() const { return {}; }
 };
@@ -151,6 +151,73 @@ void FileDescriptor::read( vector<string>& buffers )
   }
 }
 
+PooledBuffer FileDescriptor::read( BufferPool& pool )
+{
+  PooledBuffer buffer = pool.get();
+
+  const ssize_t bytes_read = ::read( fd_num(), buffer.data(), buffer.size() );
+  if ( bytes_read < 0 ) {
+    if ( internal_fd_->non_blocking_ and ( errno == EAGAIN or errno == EINPROGRESS ) ) {
+      buffer.resize( 0 );
+      return buffer;
+    }
+    throw unix_error { "read" };
+  }
+
+  register_read();
+
+  if ( bytes_read == 0 ) {
+    internal_fd_->eof_ = true;
+  }
+
+  if ( bytes_read > static_cast<ssize_t>( buffer.size() ) ) {
+    throw runtime_error( "read() read more than requested" );
+  }
+
+  buffer.resize( bytes_read );
+  return buffer;
+}
+
+size_t FileDescriptor::read( BufferPool& pool, vector<PooledBuffer>& buffers, const size_t limit )
+{
+  const size_t limit_for_fd = non_blocking() ? limit : min<size_t>( limit, 1 );
+  size_t count = 0;
+  while ( count < limit_for_fd ) {
+    PooledBuffer buffer = read( pool );
+    if ( buffer.empty() ) {
+      break;
+    }
+    buffers.push_back( move( buffer ) );
+    ++count;
+  }
+  return count;
+}
+
+size_t FileDescriptor::splice( FileDescriptor& out, const size_t len )
+{
+  if ( len == 0 ) {
+    return 0; // splice(2) would return zero too, which is not EOF
+  }
+
+  const ssize_t bytes_moved
+    = ::splice( fd_num(), nullptr, out.fd_num(), nullptr, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+  if ( bytes_moved < 0 ) {
+    if ( errno == EAGAIN ) {
+      return 0;
+    }
+    throw unix_error { "splice" };
+  }
+
+  register_read();
+  out.register_write();
+
+  if ( bytes_moved == 0 ) {
+    internal_fd_->eof_ = true;
+  }
+
+  return bytes_moved;
+}
+
 size_t FileDescriptor::write( string_view buffer )
 {
   return write( vector<string_view> { buffer } );
@@ -167,6 +234,32 @@ size_t FileDescriptor::write( const vector<std::string>& buffers )
 }
 
 size_t FileDescriptor::write( const vector<string_view>& buffers )
+{
+  const size_t bytes_written = gather_write( buffers );
+
+  if ( bytes_written == 0 and any_of( buffers.begin(), buffers.end(), []( auto x ) { return not x.empty(); } ) ) {
+    throw runtime_error( "write returned 0 given non-empty input buffer" );
+  }
+
+  return bytes_written;
+}
+
+size_t FileDescriptor::try_write( string_view buffer )
+{
+  return gather_write( { buffer } );
+}
+
+size_t FileDescriptor::try_write( const vector<string>& buffers )
+{
+  vector<string_view> views;
+  views.reserve( buffers.size() );
+  for ( const auto& x : buffers ) {
+    views.push_back( x );
+  }
+  return gather_write( views );
+}
+
+size_t FileDescriptor::gather_write( const vector<string_view>& buffers )
 {
   vector<iovec> iovecs;
   iovecs.reserve( buffers.size() );
@@ -180,10 +273,6 @@ size_t FileDescriptor::write( const vector<string_view>& buffers )
     = CheckSystemCall( "writev", ::writev( fd_num(), iovecs.data(), static_cast<int>( iovecs.size() ) ) );
   register_write();
 
-  if ( bytes_written == 0 and total_size != 0 ) {
-    throw runtime_error( "write returned 0 given non-empty input buffer" );
-  }
-
   if ( bytes_written > static_cast<ssize_t>( total_size ) ) {
     throw runtime_error( "write wrote more than length of input buffer" );
   }
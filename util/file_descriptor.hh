@@ -1,5 +1,7 @@
 #pragma once
 
+#include "buffer_pool.hh"
+
 #include <cstddef>
 #include <limits>
 #include <memory>
@@ -43,10 +45,11 @@ class FileDescriptor
   // private constructor used to duplicate the FileDescriptor (increase the reference count)
   explicit FileDescriptor( std::shared_ptr<FDWrapper> other_shared_ptr );
 
-protected:
-  // size of buffer to allocate for read()
-  static constexpr size_t kReadBufferSize = 16384;
+  // Gather-write the buffers with one writev(2)
+  // returns number of bytes written (zero if the fd is non-blocking and would block)
+  size_t gather_write( const std::vector<std::string_view>& buffers );
 
+protected:
   void set_eof() { internal_fd_->eof_ = true; }
   void register_read() { ++internal_fd_->read_count_; }   // increment read count
   void register_write() { ++internal_fd_->write_count_; } // increment write count
@@ -55,6 +58,9 @@ protected:
   T CheckSystemCall( std::string_view s_attempt, T return_value ) const;
 
 public:
+  // size of buffer to allocate for read()
+  static constexpr size_t kReadBufferSize = 16384;
+
   // Construct from a file descriptor number returned by the kernel
   explicit FileDescriptor( int fd );
 
@@ -65,12 +71,28 @@ public:
   void read( std::string& buffer );
   void read( std::vector<std::string>& buffers );
 
+  // Read into a buffer taken from `pool` (empty if the fd is non-blocking and would block, or at EOF)
+  PooledBuffer read( BufferPool& pool );
+  // Read up to `limit` times (once if the fd is blocking), appending a pooled buffer per read to `buffers`;
+  // stops early if the fd would block or reaches EOF. Returns the number of buffers appended.
+  size_t read( BufferPool& pool, std::vector<PooledBuffer>& buffers, size_t limit );
+
+  // Move up to `len` bytes from this fd to `out` with splice(2), never copying them into user space (one of the
+  // two must be a pipe). Returns the number of bytes moved: zero if either side would block, at EOF (which marks
+  // this fd's eof()), or if `len` is zero.
+  size_t splice( FileDescriptor& out, size_t len );
+
   // Attempt to write a buffer
   // returns number of bytes written
   size_t write( std::string_view buffer );
   size_t write( const std::vector<std::string_view>& buffers );
   size_t write( const std::vector<std::string>& buffers );
 
+  // Attempt to write a buffer without waiting (e.g., a datagram to a device whose queue may be full)
+  // returns number of bytes written (zero if the fd is non-blocking and would block)
+  size_t try_write( std::string_view buffer );
+  size_t try_write( const std::vector<std::string>& buffers );
+
   // Close the underlying file descriptor
   void close() { internal_fd_->close(); }
 
@@ -87,6 +109,7 @@ public:
   int fd_num() const { return internal_fd_->fd_; }                        // underlying descriptor number
   bool eof() const { return internal_fd_->eof_; }                         // EOF flag state
   bool closed() const { return internal_fd_->closed_; }                   // closed flag state
+  bool non_blocking() const { return internal_fd_->non_blocking_; }       // non-blocking flag state
   unsigned int read_count() const { return internal_fd_->read_count_; }   // number of reads
   unsigned int write_count() const { return internal_fd_->write_count_; } // number of writes
 
@@ -0,0 +1,372 @@
+#include "io_uring.hh"
+#include "exception.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+
+using namespace std;
+
+namespace {
+constexpr unsigned RECEIVE_BUFFERS = 256; // no more than the receive ring's completion queue can hold
+constexpr unsigned READS_ARMED = 32;      // reads kept outstanding on a device that is not a socket
+constexpr unsigned SEND_SLOTS = 256;
+constexpr uint16_t BUFFER_GROUP = 0;
+constexpr uint64_t RECEIVE = 0; // user_data of each kind of request on the receive ring
+constexpr uint64_t PROVIDE = 1;
+constexpr uint64_t CANCEL = 2;
+constexpr uint64_t CURRENT_POSITION = numeric_limits<uint64_t>::max();
+
+int io_uring_setup( const unsigned entries, io_uring_params& params )
+{
+  return CheckSystemCall( "io_uring_setup", static_cast<int>( ::syscall( __NR_io_uring_setup, entries, &params ) ) );
+}
+
+bool is_socket( const FileDescriptor& fd )
+{
+  struct stat info {};
+  CheckSystemCall( "fstat", ::fstat( fd.fd_num(), &info ) );
+  return S_ISSOCK( info.st_mode );
+}
+} // namespace
+
+IOUring::Mapping::Mapping( const FileDescriptor& fd, const size_t s_length, const off_t offset )
+  : address( ::mmap( nullptr, s_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd.fd_num(), offset ) )
+  , length( s_length )
+{
+  if ( address == MAP_FAILED ) {
+    address = nullptr;
+    throw unix_error( "mmap io_uring" );
+  }
+}
+
+IOUring::Mapping::~Mapping()
+{
+  if ( address ) {
+    ::munmap( address, length );
+  }
+}
+
+IOUring::Mapping::Mapping( Mapping&& other ) noexcept
+  : address( exchange( other.address, nullptr ) ), length( other.length )
+{}
+
+IOUring::Mapping& IOUring::Mapping::operator=( Mapping&& other ) noexcept
+{
+  swap( address, other.address );
+  swap( length, other.length );
+  return *this;
+}
+
+IOUring::IOUring( const unsigned entries ) : _fd( io_uring_setup( entries, _params ) )
+{
+  size_t sq_length = _params.sq_off.array + _params.sq_entries * sizeof( unsigned );
+  size_t cq_length = _params.cq_off.cqes + _params.cq_entries * sizeof( io_uring_cqe );
+  if ( _params.features & IORING_FEAT_SINGLE_MMAP ) {
+    sq_length = cq_length = max( sq_length, cq_length );
+  }
+
+  _sq_ring = Mapping( _fd, sq_length, IORING_OFF_SQ_RING );
+  char* const sq_base = static_cast<char*>( _sq_ring.address );
+  char* cq_base = sq_base;
+  if ( not( _params.features & IORING_FEAT_SINGLE_MMAP ) ) {
+    _cq_ring = Mapping( _fd, cq_length, IORING_OFF_CQ_RING );
+    cq_base = static_cast<char*>( _cq_ring.address );
+  }
+  _sqes_map = Mapping( _fd, _params.sq_entries * sizeof( io_uring_sqe ), IORING_OFF_SQES );
+
+  _sq.head = reinterpret_cast<unsigned*>( sq_base + _params.sq_off.head );
+  _sq.tail = reinterpret_cast<unsigned*>( sq_base + _params.sq_off.tail );
+  _sq.mask = *reinterpret_cast<unsigned*>( sq_base + _params.sq_off.ring_mask );
+  _sq.entries = _params.sq_entries;
+  _sq.sqes = static_cast<io_uring_sqe*>( _sqes_map.address );
+  _sq_tail = _sq_submitted = *_sq.tail;
+
+  // Entries are always used in ring order, so the indirection array is the identity.
+  unsigned* const array = reinterpret_cast<unsigned*>( sq_base + _params.sq_off.array );
+  for ( unsigned i = 0; i < _sq.entries; ++i ) {
+    array[i] = i;
+  }
+
+  _cq.head = reinterpret_cast<unsigned*>( cq_base + _params.cq_off.head );
+  _cq.tail = reinterpret_cast<unsigned*>( cq_base + _params.cq_off.tail );
+  _cq.mask = *reinterpret_cast<unsigned*>( cq_base + _params.cq_off.ring_mask );
+  _cq.cqes = reinterpret_cast<io_uring_cqe*>( cq_base + _params.cq_off.cqes );
+}
+
+io_uring_sqe& IOUring::next_sqe( const uint8_t opcode, const int fd, const uint64_t user_data )
+{
+  if ( _sq_tail - atomic_ref( *_sq.head ).load( memory_order_acquire ) >= _sq.entries ) {
+    submit();
+    if ( _sq_tail - atomic_ref( *_sq.head ).load( memory_order_acquire ) >= _sq.entries ) {
+      throw runtime_error( "IOUring: submission queue full" );
+    }
+  }
+
+  io_uring_sqe& sqe = _sq.sqes[_sq_tail & _sq.mask];
+  sqe = {};
+  sqe.opcode = opcode;
+  sqe.fd = fd;
+  sqe.user_data = user_data;
+  ++_sq_tail;
+  return sqe;
+}
+
+unsigned IOUring::submit( const unsigned wait_for )
+{
+  const unsigned to_submit = _sq_tail - _sq_submitted;
+  if ( to_submit == 0 and wait_for == 0 ) {
+    return 0;
+  }
+
+  atomic_ref( *_sq.tail ).store( _sq_tail, memory_order_release );
+  const unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+  while ( true ) {
+    const long ret = ::syscall( __NR_io_uring_enter, _fd.fd_num(), to_submit, wait_for, flags, nullptr, 0 );
+    if ( ret >= 0 ) {
+      _sq_submitted += static_cast<unsigned>( ret );
+      return static_cast<unsigned>( ret );
+    }
+    if ( errno != EINTR ) {
+      throw unix_error( "io_uring_enter" );
+    }
+  }
+}
+
+void IOUring::_register( const unsigned opcode, const void* arg, const unsigned count )
+{
+  CheckSystemCall( "io_uring_register",
+                   static_cast<int>( ::syscall( __NR_io_uring_register, _fd.fd_num(), opcode, arg, count ) ) );
+}
+
+void IOUring::register_buffers( const vector<iovec>& buffers )
+{
+  _register( IORING_REGISTER_BUFFERS, buffers.data(), static_cast<unsigned>( buffers.size() ) );
+}
+
+void IOUring::register_eventfd( const FileDescriptor& eventfd )
+{
+  const int fd = eventfd.fd_num();
+  _register( IORING_REGISTER_EVENTFD, &fd, 1 );
+}
+
+IOUringDatagramDevice::IOUringDatagramDevice( FileDescriptor device, const size_t max_datagram )
+  : IOUringDatagramDevice( move( device ), max_datagram, 0 )
+{}
+
+IOUringDatagramDevice::IOUringDatagramDevice( FileDescriptor device,
+                                              const size_t max_datagram,
+                                              const int multishot_msg_flags )
+  : _device( move( device ) )
+  , _max_datagram( max_datagram )
+  , _multishot( is_socket( _device ) )
+  , _multishot_msg_flags( multishot_msg_flags )
+  , _receive_buffers( RECEIVE_BUFFERS * max_datagram )
+  , _receive_ring( RECEIVE_BUFFERS )
+  , _send_buffers( SEND_SLOTS * max_datagram )
+  , _send_ring( SEND_SLOTS )
+{
+  if ( max_datagram == 0 or max_datagram > numeric_limits<uint32_t>::max() ) {
+    throw runtime_error( "IOUringDatagramDevice: invalid max_datagram" );
+  }
+  _device.set_blocking( true );
+
+  _receive_ring.register_eventfd( _ready );
+  _provide( 0, RECEIVE_BUFFERS );
+
+  vector<iovec> slots;
+  for ( unsigned i = 0; i < SEND_SLOTS; ++i ) {
+    slots.push_back( { _send_buffers.data() + i * max_datagram, max_datagram } );
+    _free_slots.push_back( static_cast<uint16_t>( SEND_SLOTS - 1 - i ) );
+  }
+  _send_ring.register_buffers( slots );
+
+  _arm_receives();
+  _receive_ring.submit();
+}
+
+IOUringDatagramDevice::~IOUringDatagramDevice()
+{
+  try {
+    _await_writes();
+
+    // Cancel the outstanding receptions, and wait until the kernel is done with them (and with the buffers).
+    _eof = true;
+    if ( _receives_outstanding > 0 ) {
+      io_uring_sqe& sqe = _receive_ring.next_sqe( IORING_OP_ASYNC_CANCEL, -1, CANCEL );
+      sqe.cancel_flags = IORING_ASYNC_CANCEL_ANY;
+      bool cancel_failed = false;
+      while ( _receives_outstanding > 0 and not cancel_failed ) {
+        _receive_ring.submit( 1 );
+        _receive_ring.reap( [&]( const io_uring_cqe& cqe ) {
+          if ( cqe.user_data == CANCEL ) {
+            cancel_failed = cqe.res < 0 and cqe.res != -ENOENT; // closing the ring will have to do
+          } else if ( cqe.user_data == RECEIVE and not( cqe.flags & IORING_CQE_F_MORE ) ) {
+            --_receives_outstanding;
+          }
+        } );
+      }
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception destructing IOUringDatagramDevice: " << e.what() << endl;
+  }
+}
+
+//! \details Called with the receive ring's completions all reaped, so every buffer not lent to the kernel is free
+void IOUringDatagramDevice::_arm_receives()
+{
+  if ( _eof ) {
+    return;
+  }
+
+  for ( const unsigned target = _multishot ? 1 : READS_ARMED; _receives_outstanding < target;
+        ++_receives_outstanding ) {
+    io_uring_sqe& sqe
+      = _receive_ring.next_sqe( _multishot ? IORING_OP_RECV : IORING_OP_READ, _device.fd_num(), RECEIVE );
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = BUFFER_GROUP;
+    if ( _multishot ) {
+      sqe.ioprio = IORING_RECV_MULTISHOT;
+      sqe.msg_flags = static_cast<uint32_t>( _multishot_msg_flags );
+    } else {
+      sqe.len = static_cast<uint32_t>( _max_datagram );
+      sqe.off = CURRENT_POSITION;
+    }
+  }
+}
+
+//! \details Submitted along with the next re-arm. Only a failure to provide the buffers posts a completion.
+void IOUringDatagramDevice::_provide( const uint16_t first_buffer, const unsigned count )
+{
+  io_uring_sqe& sqe = _receive_ring.next_sqe( IORING_OP_PROVIDE_BUFFERS, static_cast<int>( count ), PROVIDE );
+  sqe.addr = reinterpret_cast<uint64_t>( _receive_buffers.data() + first_buffer * _max_datagram );
+  sqe.len = static_cast<uint32_t>( _max_datagram );
+  sqe.off = first_buffer;
+  sqe.buf_group = BUFFER_GROUP;
+  if ( _receive_ring.features() & IORING_FEAT_CQE_SKIP ) {
+    sqe.flags = IOSQE_CQE_SKIP_SUCCESS;
+  }
+}
+
+void IOUringDatagramDevice::receive( const function<void( string_view )>& on_datagram )
+{
+  _ready.drain();
+
+  _receive_ring.reap( [&]( const io_uring_cqe& cqe ) {
+    if ( cqe.user_data == PROVIDE and cqe.res < 0 ) {
+      throw unix_error( "io_uring provide buffers", -cqe.res );
+    }
+    if ( cqe.user_data != RECEIVE ) {
+      return;
+    }
+    if ( not( cqe.flags & IORING_CQE_F_MORE ) ) {
+      --_receives_outstanding;
+    }
+
+    if ( cqe.flags & IORING_CQE_F_BUFFER ) {
+      const auto buffer_id = static_cast<uint16_t>( cqe.flags >> IORING_CQE_BUFFER_SHIFT );
+      if ( cqe.res > 0 ) {
+        on_datagram( { _receive_buffers.data() + buffer_id * _max_datagram, static_cast<size_t>( cqe.res ) } );
+      } else if ( cqe.res == 0 and not _multishot ) {
+        _eof = true;
+      }
+      _provide( buffer_id, 1 );
+      return;
+    }
+
+    switch ( -cqe.res ) {
+      case 0:
+        if ( not _multishot ) {
+          _eof = true;
+        }
+        break;
+      case ENOBUFS:   // every buffer was taken; reception is re-armed below, once they are back
+      case ECANCELED: // e.g., a multishot receive interrupted by the kernel
+      case EINTR:
+      case EAGAIN:
+        break;
+      case EINVAL:
+        if ( _multishot ) {
+          _multishot = false; // multishot receive is not supported by this kernel, so fall back to reads
+          break;
+        }
+        [[fallthrough]];
+      default:
+        throw unix_error( "io_uring receive", -cqe.res );
+    }
+  } );
+
+  _arm_receives();
+  _receive_ring.submit();
+}
+
+void IOUringDatagramDevice::write( const vector<string>& buffers )
+{
+  size_t length = 0;
+  for ( const auto& buffer : buffers ) {
+    length += buffer.size();
+  }
+
+  if ( length > _max_datagram ) {
+    _await_writes(); // so the datagram leaves in order
+    _device.write( buffers );
+    return;
+  }
+
+  if ( _free_slots.empty() ) {
+    _reap_writes();
+    while ( _free_slots.empty() ) {
+      _send_ring.submit( 1 );
+      _reap_writes();
+    }
+  }
+
+  const uint16_t slot = _free_slots.back();
+  _free_slots.pop_back();
+  char* const data = _send_buffers.data() + slot * _max_datagram;
+  size_t offset = 0;
+  for ( const auto& buffer : buffers ) {
+    memcpy( data + offset, buffer.data(), buffer.size() );
+    offset += buffer.size();
+  }
+
+  io_uring_sqe& sqe = _send_ring.next_sqe( IORING_OP_WRITE_FIXED, _device.fd_num(), slot );
+  sqe.addr = reinterpret_cast<uint64_t>( data );
+  sqe.len = static_cast<uint32_t>( length );
+  sqe.buf_index = slot;
+  sqe.off = CURRENT_POSITION;
+}
+
+void IOUringDatagramDevice::flush()
+{
+  _send_ring.submit();
+  _reap_writes();
+}
+
+void IOUringDatagramDevice::_reap_writes()
+{
+  _send_ring.reap( [&]( const io_uring_cqe& cqe ) {
+    _free_slots.push_back( static_cast<uint16_t>( cqe.user_data ) );
+    if ( cqe.res < 0 ) {
+      ++_writes_failed; // the datagram is dropped, as by a full NIC queue; TCP will retransmit
+    }
+  } );
+}
+
+void IOUringDatagramDevice::_await_writes()
+{
+  _send_ring.submit();
+  _reap_writes();
+  while ( _free_slots.size() < SEND_SLOTS ) {
+    _send_ring.submit( 1 );
+    _reap_writes();
+  }
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "eventfd.hh"
+#include "file_descriptor.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <linux/io_uring.h>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+
+//! \brief A Linux [io_uring](\ref man7::io_uring) instance: a submission queue and a completion queue shared with
+//! the kernel, driven through the raw system calls
+//! \details Requests are prepared in place with next_sqe() and handed to the kernel in one batch by submit();
+//! completions are taken off the completion queue by reap() without any system call.
+class IOUring
+{
+public:
+  //! Set up rings with room for `entries` submissions (and twice as many completions)
+  explicit IOUring( unsigned entries );
+
+  //! Next free submission queue entry, zeroed except for `opcode`, `fd` and `user_data`. Submits what is already
+  //! queued first if the queue is full.
+  io_uring_sqe& next_sqe( uint8_t opcode, int fd, uint64_t user_data );
+
+  //! Hand the prepared entries to the kernel
+  //! \param[in] wait_for is the number of completions to wait for (zero returns right away)
+  //! \returns the number of entries submitted
+  unsigned submit( unsigned wait_for = 0 );
+
+  //! Number of prepared entries not yet submitted
+  unsigned unsubmitted() const { return _sq_tail - _sq_submitted; }
+
+  //! Take every completion posted so far off the queue, calling `f( const io_uring_cqe& )` on each (after the
+  //! entry has been released back to the kernel, so `f` may prepare and submit more requests)
+  //! \returns the number of completions taken
+  template<class F>
+  size_t reap( F&& f )
+  {
+    const unsigned first = *_cq.head;
+    const unsigned tail = std::atomic_ref( *_cq.tail ).load( std::memory_order_acquire );
+    for ( unsigned head = first; head != tail; ++head ) {
+      const io_uring_cqe cqe = _cq.cqes[head & _cq.mask];
+      std::atomic_ref( *_cq.head ).store( head + 1, std::memory_order_release );
+      f( cqe );
+    }
+    return tail - first;
+  }
+
+  //! Register fixed buffers for IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED (`buf_index` is the position in
+  //! `buffers`)
+  void register_buffers( const std::vector<iovec>& buffers );
+
+  //! Have the kernel signal `eventfd` whenever it posts a completion, so an EventLoop can wait for completions
+  void register_eventfd( const FileDescriptor& eventfd );
+
+  //! IORING_FEAT_* flags supported by the kernel
+  uint32_t features() const { return _params.features; }
+
+  //! \name
+  //! The kernel holds pointers into the rings, so an IOUring can be neither copied nor moved
+
+  //!@{
+  IOUring( const IOUring& ) = delete;
+  IOUring( IOUring&& ) = delete;
+  IOUring& operator=( const IOUring& ) = delete;
+  IOUring& operator=( IOUring&& ) = delete;
+  //!@}
+
+private:
+  //! A region mapped from the io_uring file descriptor, unmapped on destruction
+  struct Mapping
+  {
+    void* address {};
+    size_t length {};
+
+    Mapping() = default;
+    Mapping( const FileDescriptor& fd, size_t length, off_t offset );
+    ~Mapping();
+    Mapping( const Mapping& ) = delete;
+    Mapping& operator=( const Mapping& ) = delete;
+    Mapping( Mapping&& other ) noexcept;
+    Mapping& operator=( Mapping&& other ) noexcept;
+  };
+
+  io_uring_params _params {}; //!< As filled in by the kernel
+  FileDescriptor _fd;
+  Mapping _sq_ring {};
+  Mapping _cq_ring {}; //!< Empty if the kernel maps both rings at once (IORING_FEAT_SINGLE_MMAP)
+  Mapping _sqes_map {};
+
+  struct
+  {
+    unsigned* head {};
+    unsigned* tail {};
+    unsigned mask {};
+    unsigned entries {};
+    io_uring_sqe* sqes {};
+  } _sq {};
+
+  struct
+  {
+    unsigned* head {};
+    unsigned* tail {};
+    unsigned mask {};
+    io_uring_cqe* cqes {};
+  } _cq {};
+
+  unsigned _sq_tail {};      //!< Tail of the submission queue, including prepared entries not yet published
+  unsigned _sq_submitted {}; //!< Tail as of the last submit()
+
+  void _register( unsigned opcode, const void* arg, unsigned count );
+};
+
+//! \brief An IPv4 (or any other) datagram device whose reads and writes go through io_uring
+//! \details Reception is always armed: a multishot receive if the device is a socket, otherwise a fixed number of
+//! reads (e.g., on a TunFD), each taking one of a pool of provided buffers as a datagram arrives. The kernel
+//! signals ready() when datagrams are waiting, and receive() hands over everything received since the last call,
+//! then gives the buffers back and re-arms reception with one system call.
+//!
+//! Writes are copied into registered buffers and queued; flush() submits every write queued since the last
+//! flush with one system call. The device is put in blocking mode, which io_uring needs in order to wait for
+//! data (rather than fail with EAGAIN), and from then on should only be read and written through this object.
+class IOUringDatagramDevice
+{
+public:
+  //! \param[in] device is the datagram device to take over
+  //! \param[in] max_datagram is the size of each receive and write buffer; longer datagrams are truncated on
+  //! receipt and written with a plain [write(2)](\ref man2::write)
+  explicit IOUringDatagramDevice( FileDescriptor device, size_t max_datagram = 2048 );
+
+  //! Cancel outstanding requests and wait for the kernel to let go of the buffers
+  ~IOUringDatagramDevice();
+
+  //! Readable when received datagrams are waiting (for an EventLoop rule that calls receive())
+  EventFD& ready() { return _ready; }
+
+  //! Hand each datagram received since the last call to `on_datagram`, then re-arm reception
+  void receive( const std::function<void( std::string_view )>& on_datagram );
+
+  //! Queue a datagram, gathered from `buffers`, to be written by the next flush()
+  void write( const std::vector<std::string>& buffers );
+
+  //! Submit the queued writes
+  void flush();
+
+  //! Writes the kernel failed (e.g., with ENOBUFS or EAGAIN when the device's queue was full), each a datagram
+  //! lost as it would be on the wire
+  uint64_t writes_failed() const { return _writes_failed; }
+
+  //! Has the device reached EOF?
+  bool eof() const { return _eof; }
+
+  //! Is reception one multishot receive (on a socket, if the kernel supports it) rather than a set of reads?
+  bool multishot() const { return _multishot; }
+
+  //! \name
+  //! The kernel holds pointers into this object's buffers, so it can be neither copied nor moved
+
+  //!@{
+  IOUringDatagramDevice( const IOUringDatagramDevice& ) = delete;
+  IOUringDatagramDevice( IOUringDatagramDevice&& ) = delete;
+  IOUringDatagramDevice& operator=( const IOUringDatagramDevice& ) = delete;
+  IOUringDatagramDevice& operator=( IOUringDatagramDevice&& ) = delete;
+  //!@}
+
+private:
+  friend struct IOUringDatagramDeviceTest;
+
+  //! As above, adding `multishot_msg_flags` to the multishot receive (a test passes flags the kernel rejects, as
+  //! an older kernel rejects the receive itself)
+  IOUringDatagramDevice( FileDescriptor device, size_t max_datagram, int multishot_msg_flags );
+
+  FileDescriptor _device;
+  size_t _max_datagram;
+  bool _multishot; //!< Is the device a socket (so one receive request serves every datagram)?
+  int _multishot_msg_flags;
+  EventFD _ready {};
+
+  //! Reception: datagrams land in `_receive_buffers`, provided to the kernel, and the ring's completions signal
+  //! _ready. (The buffers are declared first so that they outlive the ring.)
+  std::vector<char> _receive_buffers;
+  IOUring _receive_ring;
+  unsigned _receives_outstanding {};
+  bool _eof {};
+
+  //! Transmission: datagrams are copied into slots of `_send_buffers`, registered with the ring
+  std::vector<char> _send_buffers;
+  std::vector<uint16_t> _free_slots {};
+  IOUring _send_ring;
+  uint64_t _writes_failed {};
+
+  void _arm_receives();
+  void _provide( uint16_t first_buffer, unsigned count );
+  void _reap_writes();
+  void _await_writes();
+};
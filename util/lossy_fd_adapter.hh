@@ -5,6 +5,7 @@
 #include "tcp_config.hh"
 #include "tcp_segment.hh"
 
+#include <cstdint>
 #include <optional>
 #include <random>
 #include <utility>
@@ -66,4 +67,5 @@ public:
   const FdAdapterConfig& config() const { return _adapter.config(); } //!< FdAdapterBase::config passthrough
   FdAdapterConfig& config_mut() { return _adapter.config_mut(); }     //!< FdAdapterBase::config_mut passthrough
   void tick( const size_t ms_since_last_tick ) { _adapter.tick( ms_since_last_tick ); }
+  std::optional<uint64_t> ms_until_deadline() const { return _adapter.ms_until_deadline(); }
 };
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+//! \brief Unbounded lock-free queue from any number of producer threads to one consumer thread
+//! \details Producers push onto an intrusive stack with one compare-and-swap; the consumer takes the whole stack
+//! with one exchange and reverses it, so elements come out in the order they were pushed. (Only the consumer
+//! ever removes nodes, so the stack is immune to ABA.)
+template<class T>
+class MPSCQueue
+{
+  struct Node
+  {
+    T value;
+    Node* next;
+  };
+
+  std::atomic<Node*> head_ { nullptr }; // most recently pushed node
+
+  static void destroy( Node* node )
+  {
+    while ( node ) {
+      delete std::exchange( node, node->next );
+    }
+  }
+
+public:
+  MPSCQueue() = default;
+  ~MPSCQueue() { destroy( head_.load( std::memory_order_acquire ) ); }
+
+  MPSCQueue( const MPSCQueue& ) = delete;
+  MPSCQueue& operator=( const MPSCQueue& ) = delete;
+
+  //! Any thread
+  //! \returns true if the queue was empty, i.e. if the consumer may need waking
+  bool push( T&& value )
+  {
+    // once pushed, the node belongs to the consumer (which may already have freed it), so the old head is read
+    // from a local
+    Node* head = head_.load( std::memory_order_relaxed );
+    auto* node = new Node { std::move( value ), head };
+    while ( not head_.compare_exchange_weak( head, node, std::memory_order_release, std::memory_order_relaxed ) ) {
+      node->next = head;
+    }
+    return head == nullptr;
+  }
+
+  //! Any thread; only a hint while producers are pushing
+  bool empty() const { return head_.load( std::memory_order_acquire ) == nullptr; }
+
+  //! Consumer only: take everything pushed so far, calling `f( T& )` on each element in order
+  //! \details Should `f` throw, the elements it has not reached are destroyed unprocessed.
+  //! \returns the number of elements taken
+  template<class F>
+  size_t drain( F&& f )
+  {
+    Node* reversed = head_.exchange( nullptr, std::memory_order_acquire );
+    Node* node = nullptr;
+    while ( reversed ) {
+      Node* const next = reversed->next;
+      reversed->next = node;
+      node = reversed;
+      reversed = next;
+    }
+
+    struct Guard
+    {
+      Node*& node;
+      ~Guard() { destroy( node ); }
+    } guard { node };
+
+    size_t count = 0;
+    while ( node ) {
+      Node* const next = node->next;
+      f( node->value );
+      delete node;
+      node = next;
+      ++count;
+    }
+    return count;
+  }
+};
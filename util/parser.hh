@@ -14,11 +14,12 @@
 
 class Parser
 {
+  // Views of the buffers being parsed (which must outlive the Parser); the bytes are copied only into the
+  // objects that keep them, e.g. a payload taken with all_remaining()
   class BufferList
   {
     uint64_t size_ {};
-    std::deque<std::string> buffer_ {};
-    uint64_t skip_ {};
+    std::deque<std::string_view> buffer_ {};
 
   public:
     explicit BufferList( const std::vector<std::string>& buffers )
@@ -28,6 +29,8 @@ class Parser
       }
     }
 
+    explicit BufferList( std::string_view buffer ) { append( buffer ); }
+
     uint64_t size() const { return size_; }
     uint64_t serialized_length() const { return size(); }
     bool empty() const { return size_ == 0; }
@@ -37,19 +40,18 @@ class Parser
       if ( buffer_.empty() ) {
         throw std::runtime_error( "peek on empty BufferList" );
       }
-      return std::string_view { buffer_.front() }.substr( skip_ );
+      return buffer_.front();
     }
 
     void remove_prefix( uint64_t len )
     {
       while ( len and not buffer_.empty() ) {
         const uint64_t to_pop_now = std::min( len, peek().size() );
-        skip_ += to_pop_now;
+        buffer_.front().remove_prefix( to_pop_now );
         len -= to_pop_now;
         size_ -= to_pop_now;
-        if ( skip_ == buffer_.front().size() ) {
+        if ( buffer_.front().empty() ) {
           buffer_.pop_front();
-          skip_ = 0;
         }
       }
     }
@@ -57,54 +59,33 @@ class Parser
     void dump_all( std::vector<std::string>& out )
     {
       out.clear();
-      if ( empty() ) {
-        return;
-      }
-      std::string first_str = std::move( buffer_.front() );
-      if ( skip_ ) {
-        first_str = first_str.substr( skip_ );
-      }
-      out.emplace_back( std::move( first_str ) );
-      buffer_.pop_front();
-      for ( auto&& x : buffer_ ) {
-        out.emplace_back( std::move( x ) );
+      out.reserve( buffer_.size() );
+      for ( const auto x : buffer_ ) {
+        out.emplace_back( x );
       }
+      buffer_.clear();
+      size_ = 0;
     }
 
     void dump_all( std::string& out )
     {
-      std::vector<std::string> concat;
-      dump_all( concat );
-      if ( concat.size() == 1 ) {
-        out = std::move( concat.front() );
-        return;
-      }
-
       out.clear();
-      for ( const auto& s : concat ) {
-        out.append( s );
+      out.reserve( size_ );
+      for ( const auto x : buffer_ ) {
+        out.append( x );
       }
+      buffer_.clear();
+      size_ = 0;
     }
 
-    std::vector<std::string_view> buffer() const
-    {
-      if ( empty() ) {
-        return {};
-      }
-      std::vector<std::string_view> ret;
-      ret.reserve( buffer_.size() );
-      auto tmp_skip = skip_;
-      for ( const auto& x : buffer_ ) {
-        ret.push_back( std::string_view { x }.substr( tmp_skip ) );
-        tmp_skip = 0;
-      }
-      return ret;
-    }
+    std::vector<std::string_view> buffer() const { return { buffer_.begin(), buffer_.end() }; }
 
-    void append( std::string str )
+    void append( std::string_view str )
     {
-      size_ += str.size();
-      buffer_.push_back( std::move( str ) );
+      if ( not str.empty() ) {
+        size_ += str.size();
+        buffer_.push_back( str );
+      }
     }
   };
 
@@ -120,6 +101,8 @@ class Parser
 
 public:
   explicit Parser( const std::vector<std::string>& input ) : input_( input ) {}
+  explicit Parser( std::string_view input ) : input_( input ) {}
+  explicit Parser( std::vector<std::string>&& input ) = delete; // would leave the Parser viewing a temporary
 
   const BufferList& input() const { return input_; }
 
@@ -236,3 +219,12 @@ bool parse( T& obj, const std::vector<std::string>& buffers, Targs&&... Fargs )
   obj.parse( p, std::forward<Targs>( Fargs )... );
   return not p.has_error();
 }
+
+// As above, parsing a contiguous buffer (e.g. a PooledBuffer) in place
+template<class T, typename... Targs>
+bool parse( T& obj, std::string_view buffer, Targs&&... Fargs )
+{
+  Parser p { buffer };
+  obj.parse( p, std::forward<Targs>( Fargs )... );
+  return not p.has_error();
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "address.hh"
+#include "buffer_pool.hh"
+#include "connection_table.hh"
+#include "eventfd.hh"
+#include "eventloop.hh"
+#include "file_descriptor.hh"
+#include "socket.hh"
+#include "tcp_config.hh"
+#include "tcp_stack.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+//! \brief A TCPStack split into independent shards, one thread each, sharing one IPv4 datagram device
+//! \details Every shard is a complete TCPStack with its own EventLoop, connection table and timers; shards share
+//! nothing but the device. A dispatcher thread reads the device and steers each datagram to the shard that owns
+//! its connection, chosen by FourTuple::hash (as receive-side scaling does in a NIC), through a lock-free
+//! single-producer queue per shard. Shards write their segments to the device directly.
+//!
+//! Every thread has buffer pools of its own, since a BufferPool is not thread-safe: the dispatcher reads the
+//! device into its pool, and hands each datagram to its shard as a parsed copy, so no pooled buffer crosses
+//! threads. (Each shard, being a TCPStack, has its own pool too, but only a stack that reads a device uses it.)
+class ShardedTCPStack
+{
+public:
+  //! \param[in] ip_device reads and writes one IPv4 datagram at a time (e.g., a TunFD)
+  //! \param[in] shards is the number of shard threads (0 means one per CPU the process may run on)
+  //! \param[in] pin_threads pins the dispatcher to the first CPU the process may run on and the shards
+  //! round-robin to the others (on a single CPU, every thread shares it); a thread that cannot be pinned is
+  //! reported on stderr and left unpinned
+  ShardedTCPStack( FileDescriptor&& ip_device, size_t shards, bool pin_threads = false );
+
+  //! Stop the dispatcher and every shard; connections still open are abandoned
+  ~ShardedTCPStack();
+
+  //! Open a connection on the shard that owns it (see TCPStack::connect)
+  LocalStreamSocket connect( const TCPConfig& c_tcp, const Address& local, const Address& remote );
+
+  //! Accept connections on every shard, handing them all out through one listener (see TCPStack::listen)
+  //! \details If any shard refuses the listener, none keeps it.
+  TCPListener listen( const TCPConfig& c_tcp, const Address& local, size_t backlog );
+
+  size_t shard_count() const { return _shards.size(); }
+
+  //! Shard that owns the connection identified by `tuple`
+  size_t shard_for( const FourTuple& tuple ) const { return tuple.hash() % _shards.size(); }
+
+  //! Number of connections being served by all shards
+  size_t connection_count() const;
+
+  //! Counters for one shard
+  struct ShardStats
+  {
+    TCPStack::Stats stack {};
+    uint64_t datagrams_steered {}; //!< Datagrams the dispatcher handed to the shard
+    uint64_t datagrams_dropped {}; //!< Datagrams dropped because the shard's queue was full
+    size_t connections {};
+  };
+
+  //! Snapshot of every shard's counters (may be called from any thread)
+  std::vector<ShardStats> stats() const;
+
+  //! \name
+  //! The dispatcher thread holds pointers into this object, so it can be neither copied nor moved
+
+  //!@{
+  ShardedTCPStack( const ShardedTCPStack& ) = delete;
+  ShardedTCPStack( ShardedTCPStack&& ) = delete;
+  ShardedTCPStack& operator=( const ShardedTCPStack& ) = delete;
+  ShardedTCPStack& operator=( ShardedTCPStack&& ) = delete;
+  //!@}
+
+private:
+  //! Per-shard counters written by the dispatcher thread
+  struct DispatchCounters
+  {
+    std::atomic<uint64_t> steered { 0 };
+    std::atomic<uint64_t> dropped { 0 };
+  };
+
+  FileDescriptor _device;
+  std::vector<std::unique_ptr<TCPStack>> _shards {};
+  std::vector<TCPStack::Inbound*> _inbound {}; //!< Each shard's queue (owned by the shard)
+  std::unique_ptr<DispatchCounters[]> _dispatch_counters {};
+
+  EventLoop _eventloop {};
+  BufferPool _receive_buffers { TCPStack::kDatagramBufferSize, 4 }; //!< Dispatcher thread only
+  EventFD _stop {};
+  std::atomic_bool _abort { false };
+  std::thread _dispatcher {};
+
+  void _dispatch_main();
+  void _dispatch();
+};
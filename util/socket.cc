@@ -2,9 +2,15 @@
 
 #include "exception.hh"
 
+#include <algorithm>
+#include <array>
 #include <cstddef>
+#include <cstring>
+#include <linux/errqueue.h>
 #include <linux/if_packet.h>
 #include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <stdexcept>
 #include <sys/ioctl.h>
 #include <unistd.h>
@@ -151,6 +157,143 @@ void DatagramSocket::send( const string_view payload )
   register_write();
 }
 
+namespace {
+// Room for one control message carrying a T
+template<class T>
+struct alignas( cmsghdr ) Control
+{
+  array<char, CMSG_SPACE( sizeof( T ) )> bytes;
+};
+} // namespace
+
+vector<string_view> DatagramSocket::ReceivedDatagram::segments() const
+{
+  const string_view whole = payload.view();
+  if ( segment_size == 0 ) {
+    return { whole };
+  }
+
+  vector<string_view> ret;
+  ret.reserve( ( whole.size() + segment_size - 1 ) / segment_size );
+  for ( size_t offset = 0; offset < whole.size(); offset += segment_size ) {
+    ret.push_back( whole.substr( offset, segment_size ) );
+  }
+  return ret;
+}
+
+//! \note If a buffer of `pool` is too small to hold a received datagram, this method throws a std::runtime_error
+size_t DatagramSocket::recv_batch( BufferPool& pool, vector<ReceivedDatagram>& datagrams, const size_t limit )
+{
+  array<PooledBuffer, kMaxBatch> buffers;
+  array<Address::Raw, kMaxBatch> source_addresses;
+  array<iovec, kMaxBatch> iovecs {};
+  array<mmsghdr, kMaxBatch> messages {};
+  array<Control<int>, kMaxBatch> controls {};
+
+  size_t received = 0;
+  while ( received < limit ) {
+    const size_t batch = min( limit - received, kMaxBatch );
+    for ( size_t i = 0; i < batch; ++i ) {
+      if ( buffers[i].capacity() == 0 ) {
+        buffers[i] = pool.get();
+      }
+      iovecs[i] = { buffers[i].data(), buffers[i].capacity() };
+      messages[i] = {};
+      messages[i].msg_hdr.msg_name = &source_addresses[i].storage;
+      messages[i].msg_hdr.msg_namelen = sizeof( source_addresses[i].storage );
+      messages[i].msg_hdr.msg_iov = &iovecs[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+      messages[i].msg_hdr.msg_control = controls[i].bytes.data();
+      messages[i].msg_hdr.msg_controllen = controls[i].bytes.size();
+    }
+
+    // only the first batch may wait; after that, take just what is already queued
+    const int flags = received == 0 ? MSG_WAITFORONE : MSG_DONTWAIT;
+    const int count = ::recvmmsg( fd_num(), messages.data(), batch, flags, nullptr );
+    if ( count < 0 and received > 0 and errno == EAGAIN ) {
+      break;
+    }
+    CheckSystemCall( "recvmmsg", count );
+    if ( count <= 0 ) {
+      break;
+    }
+
+    register_read();
+    for ( size_t i = 0; i < static_cast<size_t>( count ); ++i ) {
+      if ( messages[i].msg_hdr.msg_flags & MSG_TRUNC ) { // NOLINT(*-bitwise)
+        throw runtime_error( "recvmmsg (oversized datagram)" );
+      }
+      uint16_t segment_size = 0;
+      for ( cmsghdr* c = CMSG_FIRSTHDR( &messages[i].msg_hdr ); c; c = CMSG_NXTHDR( &messages[i].msg_hdr, c ) ) {
+        if ( c->cmsg_level == SOL_UDP and c->cmsg_type == UDP_GRO ) {
+          int gso_size = 0;
+          memcpy( &gso_size, CMSG_DATA( c ), sizeof( gso_size ) );
+          segment_size = gso_size < static_cast<int>( messages[i].msg_len ) ? gso_size : 0;
+        }
+      }
+      buffers[i].resize( messages[i].msg_len );
+      datagrams.push_back(
+        { Address { source_addresses[i], messages[i].msg_hdr.msg_namelen }, move( buffers[i] ), segment_size } );
+    }
+    received += count;
+
+    if ( static_cast<size_t>( count ) < batch ) {
+      break;
+    }
+  }
+
+  return received;
+}
+
+size_t DatagramSocket::send_batch( span<const OutgoingDatagram> datagrams )
+{
+  array<mmsghdr, kMaxBatch> messages {};
+  array<Control<uint16_t>, kMaxBatch> controls {};
+  vector<iovec> iovecs;
+
+  size_t sent = 0;
+  while ( sent < datagrams.size() ) {
+    const auto batch = datagrams.subspan( sent, min( datagrams.size() - sent, kMaxBatch ) );
+
+    iovecs.clear();
+    for ( const auto& datagram : batch ) {
+      for ( const auto piece : datagram.payload ) {
+        iovecs.push_back( { const_cast<char*>( piece.data() ), piece.size() } ); // NOLINT(*-const-cast)
+      }
+    }
+
+    size_t next_iovec = 0;
+    for ( size_t i = 0; i < batch.size(); ++i ) {
+      messages[i] = {};
+      if ( batch[i].destination ) {
+        messages[i].msg_hdr.msg_name = const_cast<sockaddr*>( batch[i].destination->raw() ); // NOLINT(*-const-cast)
+        messages[i].msg_hdr.msg_namelen = batch[i].destination->size();
+      }
+      messages[i].msg_hdr.msg_iov = iovecs.data() + next_iovec;
+      messages[i].msg_hdr.msg_iovlen = batch[i].payload.size();
+      next_iovec += batch[i].payload.size();
+      if ( batch[i].segment_size > 0 ) {
+        messages[i].msg_hdr.msg_control = controls[i].bytes.data();
+        messages[i].msg_hdr.msg_controllen = controls[i].bytes.size();
+        cmsghdr* const c = CMSG_FIRSTHDR( &messages[i].msg_hdr );
+        c->cmsg_level = SOL_UDP;
+        c->cmsg_type = UDP_SEGMENT;
+        c->cmsg_len = CMSG_LEN( sizeof( uint16_t ) );
+        memcpy( CMSG_DATA( c ), &batch[i].segment_size, sizeof( uint16_t ) );
+      }
+    }
+
+    const int count = CheckSystemCall( "sendmmsg", ::sendmmsg( fd_num(), messages.data(), batch.size(), 0 ) );
+    if ( count == 0 ) {
+      break;
+    }
+    register_write();
+    sent += count;
+  }
+
+  return sent;
+}
+
 // mark the socket as listening for incoming connections
 //! \param[in] backlog is the number of waiting connections to queue (see [listen(2)](\ref man2::listen))
 void TCPSocket::listen( const int backlog )
@@ -167,6 +310,69 @@ TCPSocket TCPSocket::accept()
   return TCPSocket( FileDescriptor( CheckSystemCall( "accept", ::accept( fd_num(), nullptr, nullptr ) ) ) );
 }
 
+// accept a new incoming connection, without waiting for one
+//! \returns a new TCPSocket connected to the peer, or std::nullopt if the socket is non-blocking and no connection
+//! is waiting
+optional<TCPSocket> TCPSocket::try_accept()
+{
+  const int fd = ::accept( fd_num(), nullptr, nullptr );
+  if ( fd < 0 and ( errno == EAGAIN or errno == EWOULDBLOCK ) ) {
+    return nullopt;
+  }
+  register_read();
+  return TCPSocket( FileDescriptor( CheckSystemCall( "accept", fd ) ) );
+}
+
+void TCPSocket::set_zerocopy()
+{
+  setsockopt( SOL_SOCKET, SO_ZEROCOPY, int { true } );
+}
+
+optional<size_t> TCPSocket::write_zerocopy( const string_view buffer )
+{
+  const ssize_t bytes_written = ::send( fd_num(), buffer.data(), buffer.size(), MSG_ZEROCOPY );
+  if ( bytes_written < 0 and errno == ENOBUFS ) {
+    return nullopt;
+  }
+  register_write();
+  return CheckSystemCall( "send", bytes_written );
+}
+
+//! \details The error queue never blocks; the loop stops at the first call that finds it empty.
+size_t TCPSocket::read_zerocopy_completions( vector<ZeroCopyCompletion>& completions )
+{
+  size_t count = 0;
+  while ( true ) {
+    Control<sock_extended_err> control {};
+    msghdr message {};
+    message.msg_control = control.bytes.data();
+    message.msg_controllen = control.bytes.size();
+
+    if ( ::recvmsg( fd_num(), &message, MSG_ERRQUEUE ) < 0 ) {
+      if ( errno == EAGAIN ) {
+        return count;
+      }
+      throw unix_error { "recvmsg(MSG_ERRQUEUE)" };
+    }
+    register_read();
+
+    for ( cmsghdr* c = CMSG_FIRSTHDR( &message ); c; c = CMSG_NXTHDR( &message, c ) ) {
+      if ( not( ( c->cmsg_level == SOL_IP and c->cmsg_type == IP_RECVERR )
+                or ( c->cmsg_level == SOL_IPV6 and c->cmsg_type == IPV6_RECVERR ) ) ) {
+        continue;
+      }
+      sock_extended_err error {};
+      memcpy( &error, CMSG_DATA( c ), sizeof( error ) );
+      if ( error.ee_errno != 0 or error.ee_origin != SO_EE_ORIGIN_ZEROCOPY ) {
+        continue;
+      }
+      completions.push_back(
+        { error.ee_info, error.ee_data, static_cast<bool>( error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED ) } );
+      ++count;
+    }
+  }
+}
+
 // get socket option
 template<typename option_type>
 socklen_t Socket::getsockopt( const int level, const int option, option_type& option_value ) const
@@ -200,6 +406,17 @@ void Socket::set_reuseaddr()
   setsockopt( SOL_SOCKET, SO_REUSEADDR, int { true } );
 }
 
+void UDPSocket::set_gro( const bool enabled )
+{
+  setsockopt( SOL_UDP, UDP_GRO, int { enabled } );
+}
+
+// spin on the device queue before sleeping in a blocking read or poll
+void Socket::set_busy_poll( const chrono::microseconds budget )
+{
+  setsockopt( SOL_SOCKET, SO_BUSY_POLL, static_cast<int>( budget.count() ) );
+}
+
 void Socket::throw_if_error() const
 {
   int socket_error = 0;
@@ -3,9 +3,14 @@
 #include "address.hh"
 #include "file_descriptor.hh"
 
+#include <chrono>
 #include <cstdint>
 #include <functional>
+#include <optional>
+#include <span>
+#include <string_view>
 #include <sys/socket.h>
+#include <vector>
 
 //! \brief Base class for network sockets (TCP, UDP, etc.)
 //! \details Socket is generally used via a subclass. See TCPSocket and UDPSocket for usage examples.
@@ -54,6 +59,11 @@ public:
   //! Allow local address to be reused sooner via [SO_REUSEADDR](\ref man7::socket)
   void set_reuseaddr();
 
+  //! Let a blocking read or poll spin on the device queue for up to `budget` before sleeping, via
+  //! [SO_BUSY_POLL](\ref man7::socket) (only devices with NAPI polling spin, and a budget above
+  //! net.core.busy_read needs CAP_NET_ADMIN)
+  void set_busy_poll( std::chrono::microseconds budget );
+
   //! Check for errors (will be seen on non-blocking sockets)
   void throw_if_error() const;
 };
@@ -71,6 +81,39 @@ public:
 
   //! Send datagram to the socket's connected address (must call connect() first)
   void send( std::string_view payload );
+
+  //! A datagram received by recv_batch
+  struct ReceivedDatagram
+  {
+    Address source_address;
+    PooledBuffer payload;
+    uint16_t segment_size {}; //!< If nonzero, `payload` is same-size datagrams coalesced by UDP GRO
+
+    //! The datagrams in `payload`: itself, or the pieces it splits into if it was coalesced
+    std::vector<std::string_view> segments() const;
+  };
+
+  //! A datagram for send_batch
+  struct OutgoingDatagram
+  {
+    std::vector<std::string_view> payload {}; //!< Pieces gathered, in order, into one datagram
+    std::optional<Address> destination {};    //!< If empty, the socket's connected address
+    uint16_t segment_size {}; //!< If nonzero, the kernel splits the payload into datagrams of this size (UDP GSO)
+  };
+
+  //! Most datagrams moved by one [recvmmsg(2)](\ref man2::recvmmsg) or [sendmmsg(2)](\ref man2::sendmmsg)
+  static constexpr size_t kMaxBatch = 64;
+
+  //! Receive up to `limit` datagrams, each into a buffer from `pool`, with as few calls to
+  //! [recvmmsg(2)](\ref man2::recvmmsg) as possible, appending them to `datagrams`
+  //! \details Waits (if the socket is blocking) only for the first datagram, then takes whatever else is queued.
+  //! \returns the number of datagrams received (zero if the socket is non-blocking and none is waiting)
+  size_t recv_batch( BufferPool& pool, std::vector<ReceivedDatagram>& datagrams, size_t limit );
+
+  //! Send `datagrams`, in order, with as few calls to [sendmmsg(2)](\ref man2::sendmmsg) as possible
+  //! \returns the number of datagrams sent, counting each segmented payload once (fewer than all only if the
+  //! socket is non-blocking and would block)
+  size_t send_batch( std::span<const OutgoingDatagram> datagrams );
 };
 
 //! A wrapper around [UDP sockets](\ref man7::udp)
@@ -82,6 +125,13 @@ class UDPSocket : public DatagramSocket
 public:
   //! Default: construct an unbound, unconnected UDP socket
   UDPSocket() : DatagramSocket( AF_INET, SOCK_DGRAM ) {}
+
+  //! Let the kernel coalesce same-size datagrams from one sender into one receive, via
+  //! [UDP_GRO](\ref man7::udp) (see ReceivedDatagram::segment_size; buffers should then hold 64 KiB)
+  void set_gro( bool enabled );
+
+  //! Most datagrams one segmented payload may carry (see OutgoingDatagram::segment_size)
+  static constexpr size_t kMaxSegments = 64;
 };
 
 //! A wrapper around [TCP sockets](\ref man7::tcp)
@@ -101,6 +151,33 @@ public:
 
   //! Accept a new incoming connection
   TCPSocket accept();
+
+  //! Accept a new incoming connection if one is waiting (on a non-blocking socket)
+  //! \returns std::nullopt if no connection is waiting
+  std::optional<TCPSocket> try_accept();
+
+  //! Allow writes with [MSG_ZEROCOPY](\ref man7::socket) via [SO_ZEROCOPY](\ref man7::socket) (see
+  //! ZeroCopySender, which keeps the buffers alive until the kernel is done with them)
+  void set_zerocopy();
+
+  //! \brief Write from `buffer` with MSG_ZEROCOPY: the kernel sends straight from the buffer's pages, which must
+  //! not change or be freed until a completion (see read_zerocopy_completions) covers this write
+  //! \returns the number of bytes written (zero if the socket is non-blocking and would block), or std::nullopt
+  //! if the kernel could not pin the pages (ENOBUFS), in which case nothing was written and a plain write should
+  //! be used instead. Each call that writes bytes is numbered, counting from zero, for its completion.
+  std::optional<size_t> write_zerocopy( std::string_view buffer );
+
+  //! A range of MSG_ZEROCOPY writes the kernel is done with
+  struct ZeroCopyCompletion
+  {
+    uint32_t first;
+    uint32_t last;
+    bool copied; //!< The kernel copied the data after all (e.g. over loopback), so zero-copy gained nothing
+  };
+
+  //! Take every completion waiting on the socket's error queue, appending them to `completions`
+  //! \returns the number of completions taken
+  size_t read_zerocopy_completions( std::vector<ZeroCopyCompletion>& completions );
 };
 
 //! A wrapper around [packet sockets](\ref man7:packet)
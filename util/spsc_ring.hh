@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+//! \brief Bounded lock-free queue between exactly one producer thread and one consumer thread
+//! \details A power-of-two array of slots indexed by two free-running counters. Each counter is written by only
+//! one side and sits on its own cache line; each side also keeps a private copy of the other side's counter
+//! and rereads it only when the queue looks full (or empty), so a busy queue costs no shared-line traffic
+//! per element.
+template<class T>
+class SPSCRing
+{
+  static constexpr size_t CACHE_LINE = 64;
+
+  std::vector<T> slots_;
+  size_t mask_;
+
+  alignas( CACHE_LINE ) std::atomic<size_t> head_ { 0 }; // next slot to pop (written by the consumer)
+  size_t cached_tail_ { 0 };                             // consumer's copy of tail_
+
+  alignas( CACHE_LINE ) std::atomic<size_t> tail_ { 0 }; // next slot to push (written by the producer)
+  size_t cached_head_ { 0 };                             // producer's copy of head_
+
+public:
+  //! \param[in] capacity is rounded up to a power of two
+  explicit SPSCRing( size_t capacity )
+    : slots_( std::bit_ceil( std::max<size_t>( capacity, 1 ) ) ), mask_( slots_.size() - 1 )
+  {}
+
+  size_t capacity() const { return slots_.size(); }
+
+  //! Producer only
+  //! \returns false (leaving `value` untouched) if the queue is full
+  bool push( T&& value )
+  {
+    const size_t tail = tail_.load( std::memory_order_relaxed );
+    if ( tail - cached_head_ == slots_.size() ) {
+      cached_head_ = head_.load( std::memory_order_acquire );
+      if ( tail - cached_head_ == slots_.size() ) {
+        return false;
+      }
+    }
+    slots_[tail & mask_] = std::move( value );
+    tail_.store( tail + 1, std::memory_order_release );
+    return true;
+  }
+
+  //! Consumer only
+  //! \returns std::nullopt if the queue is empty
+  std::optional<T> pop()
+  {
+    const size_t head = head_.load( std::memory_order_relaxed );
+    if ( head == cached_tail_ ) {
+      cached_tail_ = tail_.load( std::memory_order_acquire );
+      if ( head == cached_tail_ ) {
+        return std::nullopt;
+      }
+    }
+    std::optional<T> value { std::move( slots_[head & mask_] ) };
+    head_.store( head + 1, std::memory_order_release );
+    return value;
+  }
+};
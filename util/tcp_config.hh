@@ -15,11 +15,17 @@ public:
   static constexpr size_t MAX_PAYLOAD_SIZE = 1000;  //!< Conservative max payload size for real Internet
   static constexpr uint16_t TIMEOUT_DFLT = 1000;    //!< Default re-transmit timeout is 1 second
   static constexpr unsigned MAX_RETX_ATTEMPTS = 8;  //!< Maximum re-transmit attempts before giving up
+  static constexpr uint16_t ACK_DELAY_DFLT = 40;    //!< Default delayed-ACK timeout, in milliseconds
+  static constexpr size_t MAX_OFFLOAD_SIZE = 65495; //!< Largest payload that fits in one IPv4 datagram
 
-  uint16_t rt_timeout = TIMEOUT_DFLT;      //!< Initial value of the retransmission timeout, in milliseconds
-  size_t recv_capacity = DEFAULT_CAPACITY; //!< Receive capacity, in bytes
-  size_t send_capacity = DEFAULT_CAPACITY; //!< Sender capacity, in bytes
-  Wrap32 isn { 137 };                      //!< Default initial sequence number
+  uint16_t rt_timeout = TIMEOUT_DFLT;         //!< Initial value of the retransmission timeout, in milliseconds
+  size_t recv_capacity = DEFAULT_CAPACITY;    //!< Receive capacity, in bytes
+  size_t send_capacity = DEFAULT_CAPACITY;    //!< Sender capacity, in bytes
+  size_t recv_capacity_max = 0;               //!< Receive-buffer auto-tuning ceiling (off if <= recv_capacity)
+  size_t send_capacity_max = 0;               //!< Send-buffer auto-tuning ceiling (off if <= send_capacity)
+  Wrap32 isn { 137 };                         //!< Default initial sequence number
+  uint16_t ack_delay = ACK_DELAY_DFLT;        //!< Longest time an ACK may be delayed, in milliseconds (0 disables)
+  size_t max_payload_size = MAX_PAYLOAD_SIZE; //!< Largest payload per message (adapter segments larger)
 };
 
 //! Config for classes derived from FdAdapter
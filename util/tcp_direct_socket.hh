@@ -0,0 +1,129 @@
+#pragma once
+
+#include "eventfd.hh"
+#include "eventloop.hh"
+#include "tcp_config.hh"
+#include "tcp_peer.hh"
+#include "tuntap_adapter.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+//! \brief Multithreaded wrapper around TCPPeer whose reads and writes go straight to the peer's ByteStreams
+//! \details Like TCPMinnowSocket, a TCPPeer thread reads datagrams and runs the timers. But there is no socket
+//! pair between the owner and that thread: write() pushes into the TCPPeer's outbound stream (and sends the
+//! resulting segments) on the owner's thread, and read() copies out of its inbound stream, so each chunk costs
+//! no system calls and one copy fewer in each direction. The two threads share the TCPPeer under a mutex;
+//! the owner waits on condition variables for data or buffer space, and wakes the TCPPeer thread up through an
+//! eventfd.
+//!
+//! Because it is not a file descriptor, a TCPDirectSocket can't be handed to an EventLoop or to poll(2).
+template<TCPDatagramAdapter AdaptT>
+class TCPDirectSocket
+{
+public:
+  //! Construct from the interface that the TCPPeer thread will use to read and write datagrams
+  explicit TCPDirectSocket( AdaptT&& datagram_interface );
+
+  //! Connect using the specified configurations; blocks until connect succeeds or fails
+  void connect( const TCPConfig& c_tcp, const FdAdapterConfig& c_ad );
+
+  //! Listen and accept using the specified configurations; blocks until accept succeeds or fails
+  void listen_and_accept( const TCPConfig& c_tcp, const FdAdapterConfig& c_ad );
+
+  //! Read into `buffer` (resized to FileDescriptor::kReadBufferSize first if it is empty), waiting until at
+  //! least one byte is available or the inbound stream has ended; `buffer` is resized to the number of bytes
+  //! read (zero at EOF)
+  void read( std::string& buffer );
+
+  //! Write all of `buffer`, waiting for space in the outbound stream as needed
+  //! \returns the number of bytes written, which is less than `buffer.size()` only if the connection failed
+  size_t write( std::string_view buffer );
+
+  //! End the outbound stream (sends a FIN once the stream's data has been sent)
+  void shutdown_write();
+
+  //! Has read() reached the end of the inbound stream?
+  bool eof() const { return _eof; }
+
+  //! End the outbound stream, and wait for TCPPeer to finish
+  //! \note Calling this function is only advisable if the socket has reached EOF,
+  //! or else may wait foreever for remote peer to close the TCP connection.
+  void wait_until_closed();
+
+  //! Abandon the connection if it is still open
+  ~TCPDirectSocket();
+
+  // Return peer address from underlying datagram adapter
+  const Address& peer_address() const { return _datagram_adapter.config().destination; }
+
+  //! \name
+  //! This object cannot be safely moved or copied, since it is in use by two threads simultaneously
+
+  //!@{
+  TCPDirectSocket( const TCPDirectSocket& ) = delete;
+  TCPDirectSocket( TCPDirectSocket&& ) = delete;
+  TCPDirectSocket& operator=( const TCPDirectSocket& ) = delete;
+  TCPDirectSocket& operator=( TCPDirectSocket&& ) = delete;
+  //!@}
+
+private:
+  //! Adapter to underlying datagram socket (e.g., UDP or IP); used under _mutex once the TCPPeer thread runs
+  AdaptT _datagram_adapter;
+
+  //! TCP state machine, shared by both threads under _mutex
+  std::optional<TCPPeer> _tcp {};
+  std::mutex _mutex {};
+
+  std::condition_variable _readable {}; //!< Inbound data or EOF may be available
+  std::condition_variable _writable {}; //!< Outbound capacity may be available, or the connection failed
+
+  //! Wakes up the TCPPeer thread
+  EventFD _wakeup {};
+
+  //! Segments read from the datagram adapter in one event, delivered to TCPPeer as a batch
+  std::vector<TCPMessage> _inbound_burst {};
+
+  //! eventloop of the TCPPeer thread (new inbound datagram, wakeup)
+  EventLoop _eventloop {};
+
+  //! Set up the TCPPeer and the event loop
+  void _initialize_TCP( const TCPConfig& config );
+
+  //! Send segments through the adapter (caller holds _mutex)
+  void _transmit( const TCPMessage& msg ) { _datagram_adapter.write( msg ); }
+
+  //! Deadline (of the TCPPeer or the adapter) the TCPPeer thread went to sleep with; guarded by _mutex, and
+  //! relative to clocks that only move while the thread holds _mutex
+  std::optional<uint64_t> _sleep_deadline {};
+
+  //! Wake the TCPPeer thread up if the owner has made the TCPPeer's deadline earlier than _sleep_deadline
+  void _wake_if_deadline_moved();
+
+  //! Process events while specified condition is true (called without _mutex; the condition runs under it)
+  void _tcp_loop( const std::function<bool()>& condition );
+
+  //! Main loop of TCPPeer thread
+  void _tcp_main();
+
+  //! Handle to the TCPPeer thread; owner thread calls join() in the destructor
+  std::thread _tcp_thread {};
+
+  std::atomic_bool _abort { false }; //!< Flag used by the owner to force the TCPPeer thread to shut down
+
+  bool _finished { false };          //!< Has the TCPPeer thread exited? (guarded by _mutex)
+  bool _outbound_shutdown { false }; //!< Has the owner shut down the outbound data to the TCP connection?
+  bool _eof { false };               //!< Has read() returned the end of the inbound stream?
+};
+
+using TCPOverIPv4DirectSocket = TCPDirectSocket<TCPOverIPv4OverTunFdAdapter>;
+using LossyTCPOverIPv4DirectSocket = TCPDirectSocket<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>>;
@@ -0,0 +1,272 @@
+#include "tcp_direct_socket.hh"
+#include "tcp_socket_common.hh"
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+//! \param[in] datagram_interface is the underlying interface (e.g. to UDP, IP, or Ethernet)
+template<TCPDatagramAdapter AdaptT>
+TCPDirectSocket<AdaptT>::TCPDirectSocket( AdaptT&& datagram_interface )
+  : _datagram_adapter( std::move( datagram_interface ) )
+{
+  _datagram_adapter.fd().set_blocking( false );
+}
+
+//! \param[in] condition is a function returning true if loop should continue
+//! \details As in TCPMinnowSocket, the loop sleeps until an event or the earliest deadline. The owner's calls
+//! can move that deadline earlier (e.g., by sending the first segment of a flight), in which case they wake the
+//! loop up through _wakeup.
+template<TCPDatagramAdapter AdaptT>
+void TCPDirectSocket<AdaptT>::_tcp_loop( const std::function<bool()>& condition )
+{
+  auto base_time = timestamp_ms();
+  while ( true ) {
+    int timeout = -1;
+    {
+      const std::lock_guard lock { _mutex };
+      if ( not condition() ) {
+        break;
+      }
+      _sleep_deadline = earliest_deadline( _tcp->ms_until_deadline(), _datagram_adapter.ms_until_deadline() );
+      if ( _tcp.value().active() and _sleep_deadline.has_value() ) {
+        timeout = static_cast<int>( std::min<uint64_t>( _sleep_deadline.value(), INT_MAX ) );
+      }
+    }
+
+    auto ret = _eventloop.wait_next_event( timeout );
+    if ( ret == EventLoop::Result::Exit or _abort ) {
+      break;
+    }
+
+    const std::lock_guard lock { _mutex };
+    if ( _tcp.value().active() ) {
+      const auto next_time = timestamp_ms();
+      _tcp.value().tick( next_time - base_time, [&]( auto x ) { _transmit( x ); } );
+      _datagram_adapter.tick( next_time - base_time );
+      base_time = next_time;
+    }
+
+    // ACKs (or a timeout) may have freed outbound space, and segments may have brought inbound data
+    _writable.notify_all();
+    _readable.notify_all();
+  }
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPDirectSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
+{
+  _tcp.emplace( config );
+
+  // Only two events reach the TCPPeer thread: incoming datagrams, and wakeups from the owner. Outbound and
+  // inbound bytes are moved by the owner itself in write() and read().
+
+  // rule 1: read from filtered packet stream and dump into TCPPeer
+  _eventloop.add_rule(
+    "receive TCP segment from the network",
+    _datagram_adapter.fd(),
+    Direction::In,
+    [&] {
+      const std::lock_guard lock { _mutex };
+      read_burst( _datagram_adapter, _inbound_burst );
+      _tcp->receive_batch( _inbound_burst, [&]( auto x ) { _transmit( x ); } );
+    },
+    [&] {
+      const std::lock_guard lock { _mutex };
+      return _tcp->active();
+    } );
+
+  // rule 2: wakeups from the owner (e.g., to notice that it is shutting down)
+  _eventloop.add_rule( "wake up TCPPeer thread", _wakeup, Direction::In, [&] { _wakeup.drain(); } );
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPDirectSocket<AdaptT>::read( std::string& buffer )
+{
+  if ( buffer.empty() ) {
+    buffer.resize( FileDescriptor::kReadBufferSize );
+  }
+
+  std::unique_lock lock { _mutex };
+  if ( not _tcp.has_value() ) {
+    throw std::runtime_error( "read() before TCPDirectSocket connected" );
+  }
+
+  Reader& inbound = _tcp->inbound_reader();
+  _readable.wait( lock, [&] {
+    return inbound.bytes_buffered() or inbound.is_finished() or inbound.has_error() or _finished;
+  } );
+
+  size_t copied = 0;
+  while ( copied < buffer.size() and inbound.bytes_buffered() ) {
+    const std::string_view chunk = inbound.peek().substr( 0, buffer.size() - copied );
+    std::copy( chunk.begin(), chunk.end(), buffer.begin() + static_cast<ptrdiff_t>( copied ) );
+    inbound.pop( chunk.size() );
+    copied += chunk.size();
+  }
+  buffer.resize( copied );
+
+  if ( copied == 0 ) {
+    _eof = true;
+    return;
+  }
+
+  if ( _tcp->active() ) {
+    _tcp->window_update( [&]( auto x ) { _transmit( x ); } );
+  }
+}
+
+//! \details Called with _mutex held, after the owner has done something that may have set a timer
+template<TCPDatagramAdapter AdaptT>
+void TCPDirectSocket<AdaptT>::_wake_if_deadline_moved()
+{
+  const auto deadline = earliest_deadline( _tcp->ms_until_deadline(), _datagram_adapter.ms_until_deadline() );
+  if ( deadline.has_value() and ( not _sleep_deadline.has_value() or deadline < _sleep_deadline ) ) {
+    _sleep_deadline = deadline;
+    _wakeup.notify();
+  }
+}
+
+template<TCPDatagramAdapter AdaptT>
+size_t TCPDirectSocket<AdaptT>::write( std::string_view buffer )
+{
+  std::unique_lock lock { _mutex };
+  if ( not _tcp.has_value() or _outbound_shutdown ) {
+    throw std::runtime_error( "write() on TCPDirectSocket that is not connected or was shut down" );
+  }
+
+  Writer& outbound = _tcp->outbound_writer();
+  size_t written = 0;
+  while ( written < buffer.size() ) {
+    _writable.wait( lock, [&] { return outbound.available_capacity() > 0 or not _tcp->active() or _finished; } );
+    if ( not _tcp->active() or _finished ) {
+      break;
+    }
+
+    const size_t n = std::min( outbound.available_capacity(), buffer.size() - written );
+    outbound.push( std::string { buffer.substr( written, n ) } );
+    written += n;
+    _tcp->push( [&]( auto x ) { _transmit( x ); } );
+    _wake_if_deadline_moved();
+  }
+  return written;
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPDirectSocket<AdaptT>::shutdown_write()
+{
+  const std::lock_guard lock { _mutex };
+  if ( not _tcp.has_value() or _outbound_shutdown ) {
+    return;
+  }
+  _outbound_shutdown = true;
+  _tcp->outbound_writer().close();
+  if ( _tcp->active() ) {
+    _tcp->push( [&]( auto x ) { _transmit( x ); } );
+    _wake_if_deadline_moved();
+  }
+}
+
+template<TCPDatagramAdapter AdaptT>
+TCPDirectSocket<AdaptT>::~TCPDirectSocket()
+{
+  try {
+    if ( _tcp_thread.joinable() ) {
+      std::cerr << "Warning: unclean shutdown of TCPDirectSocket\n";
+      // force the other side to exit
+      _abort.store( true );
+      _wakeup.notify();
+      _tcp_thread.join();
+    }
+  } catch ( const std::exception& e ) {
+    std::cerr << "Exception destructing TCPDirectSocket: " << e.what() << std::endl;
+  }
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPDirectSocket<AdaptT>::wait_until_closed()
+{
+  shutdown_write();
+  if ( _tcp_thread.joinable() ) {
+    std::cerr << "DEBUG: minnow waiting for clean shutdown... ";
+    _tcp_thread.join();
+    std::cerr << "done.\n";
+  }
+}
+
+//! \param[in] c_tcp is the TCPConfig for the TCPConnection
+//! \param[in] c_ad is the FdAdapterConfig for the FdAdapter
+template<TCPDatagramAdapter AdaptT>
+void TCPDirectSocket<AdaptT>::connect( const TCPConfig& c_tcp, const FdAdapterConfig& c_ad )
+{
+  if ( _tcp ) {
+    throw std::runtime_error( "connect() with TCPConnection already initialized" );
+  }
+
+  _initialize_TCP( c_tcp );
+
+  _datagram_adapter.config_mut() = c_ad;
+
+  std::cerr << "DEBUG: minnow connecting to " << c_ad.destination.to_string() << "...\n";
+
+  _tcp->push( [&]( auto x ) { _transmit( x ); } );
+
+  if ( _tcp->sender().sequence_numbers_in_flight() != 1 ) {
+    throw std::runtime_error( "After TCPConnection::connect(), expected sequence_numbers_in_flight() == 1" );
+  }
+
+  _tcp_loop( [&] { return _tcp->sender().sequence_numbers_in_flight() == 1; } );
+  if ( _tcp->inbound_reader().has_error() ) {
+    std::cerr << "DEBUG: minnow error on connecting to " << c_ad.destination.to_string() << ".\n";
+  } else {
+    std::cerr << "DEBUG: minnow successfully connected to " << c_ad.destination.to_string() << ".\n";
+  }
+
+  _tcp_thread = std::thread( &TCPDirectSocket::_tcp_main, this );
+}
+
+//! \param[in] c_tcp is the TCPConfig for the TCPConnection
+//! \param[in] c_ad is the FdAdapterConfig for the FdAdapter
+template<TCPDatagramAdapter AdaptT>
+void TCPDirectSocket<AdaptT>::listen_and_accept( const TCPConfig& c_tcp, const FdAdapterConfig& c_ad )
+{
+  if ( _tcp ) {
+    throw std::runtime_error( "listen_and_accept() with TCPConnection already initialized" );
+  }
+
+  _initialize_TCP( c_tcp );
+
+  _datagram_adapter.config_mut() = c_ad;
+  _datagram_adapter.set_listening( true );
+
+  std::cerr << "DEBUG: minnow listening for incoming connection...\n";
+  _tcp_loop( [&] { return ( not _tcp->has_ackno() ) or ( _tcp->sender().sequence_numbers_in_flight() ); } );
+  std::cerr << "DEBUG: minnow new connection from " << _datagram_adapter.config().destination.to_string() << ".\n";
+
+  _tcp_thread = std::thread( &TCPDirectSocket::_tcp_main, this );
+}
+
+//! \details The TCPPeer outlives the thread, so the owner can still read whatever inbound data is left.
+template<TCPDatagramAdapter AdaptT>
+void TCPDirectSocket<AdaptT>::_tcp_main()
+{
+  try {
+    _tcp_loop( [&] { return _tcp->active(); } );
+
+    const std::lock_guard lock { _mutex };
+    _finished = true;
+    _readable.notify_all();
+    _writable.notify_all();
+    std::cerr << "DEBUG: minnow TCP connection finished "
+              << ( _tcp->inbound_reader().has_error() ? "uncleanly.\n" : "cleanly.\n" );
+  } catch ( const std::exception& e ) {
+    std::cerr << "Exception in TCPConnection runner thread: " << e.what() << "\n";
+    throw;
+  }
+}
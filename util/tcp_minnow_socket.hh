@@ -1,6 +1,7 @@
 #pragma once
 
 #include "byte_stream.hh"
+#include "eventfd.hh"
 #include "eventloop.hh"
 #include "file_descriptor.hh"
 #include "socket.hh"
@@ -72,9 +73,15 @@ private:
   //! TCP state machine
   std::optional<TCPPeer> _tcp {};
 
+  //! Segments read from the datagram adapter in one event, delivered to TCPPeer as a batch
+  std::vector<TCPMessage> _inbound_burst {};
+
   //! eventloop that handles all the events (new inbound datagram, new outbound bytes, new inbound bytes)
   EventLoop _eventloop {};
 
+  //! Wakes up the TCPPeer thread (e.g., to abort)
+  EventFD _wakeup {};
+
   //! Process events while specified condition is true
   void _tcp_loop( const std::function<bool()>& condition );
 
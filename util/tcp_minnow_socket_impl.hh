@@ -1,10 +1,14 @@
 #include "tcp_minnow_socket.hh"
+#include "tcp_socket_common.hh"
 
 #include "exception.hh"
 #include "parser.hh"
 #include "tun.hh"
 
+#include <algorithm>
+#include <climits>
 #include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <iostream>
 #include <stdexcept>
@@ -15,22 +19,19 @@
 #include <unistd.h>
 #include <utility>
 
-static constexpr size_t TCP_TICK_MS = 10;
-
-inline uint64_t timestamp_ms()
-{
-  static_assert( std::is_same<std::chrono::steady_clock::duration, std::chrono::nanoseconds>::value );
-
-  return std::chrono::steady_clock::now().time_since_epoch().count() / 1000000;
-}
-
 //! \param[in] condition is a function returning true if loop should continue
+//! \details There is no periodic tick: the loop sleeps until an event or the earliest deadline reported by the
+//! TCPPeer and the adapter, whichever comes first, and ticks them after every wakeup.
 template<TCPDatagramAdapter AdaptT>
 void TCPMinnowSocket<AdaptT>::_tcp_loop( const std::function<bool()>& condition )
 {
   auto base_time = timestamp_ms();
   while ( condition() ) {
-    auto ret = _eventloop.wait_next_event( TCP_TICK_MS );
+    const int timeout
+      = ( _tcp.has_value() and _tcp->active() )
+          ? poll_timeout_ms( _tcp->ms_until_deadline(), _datagram_adapter.ms_until_deadline() )
+          : -1;
+    auto ret = _eventloop.wait_next_event( timeout );
     if ( ret == EventLoop::Result::Exit or _abort ) {
       break;
     }
@@ -59,6 +60,7 @@ TCPMinnowSocket<AdaptT>::TCPMinnowSocket( std::pair<FileDescriptor, FileDescript
 {
   _thread_data.set_blocking( false );
   set_blocking( false );
+  _datagram_adapter.fd().set_blocking( false );
 }
 
 template<TCPDatagramAdapter AdaptT>
@@ -86,9 +88,9 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
     _datagram_adapter.fd(),
     Direction::In,
     [&] {
-      if ( auto seg = _datagram_adapter.read() ) {
-        _tcp->receive( std::move( seg.value() ), [&]( auto x ) { _datagram_adapter.write( x ); } );
-      }
+      // Drain the datagrams that are already waiting, so TCPPeer can coalesce them and acknowledge them once.
+      read_burst( _datagram_adapter, _inbound_burst );
+      _tcp->receive_batch( _inbound_burst, [&]( auto x ) { _datagram_adapter.write( x ); } );
 
       // debugging output:
       if ( _thread_data.eof() and _tcp.value().sender().sequence_numbers_in_flight() == 0 and not _fully_acked ) {
@@ -105,8 +107,13 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
     _thread_data,
     Direction::In,
     [&] {
+      // (an empty string would be read into at full size, then dropped by push)
+      const uint64_t capacity = _tcp->outbound_writer().available_capacity();
+      if ( capacity == 0 ) {
+        return;
+      }
       std::string data;
-      data.resize( _tcp->outbound_writer().available_capacity() );
+      data.resize( capacity );
       _thread_data.read( data );
       _tcp->outbound_writer().push( move( data ) );
 
@@ -171,6 +178,14 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
       std::cerr << "DEBUG: minnow inbound stream had error.\n";
       _tcp->inbound_reader().set_error();
     } );
+
+  // rule 4: wakeup from the owner (the loop has no timeout while the TCPPeer is idle)
+  _eventloop.add_rule(
+    "wake up TCPPeer thread",
+    _wakeup,
+    Direction::In,
+    [&] { _wakeup.drain(); },
+    [&] { return _tcp->active() or not _inbound_shutdown; } );
 }
 
 //! \brief Call [socketpair](\ref man2::socketpair) and return connected Unix-domain sockets of specified type
@@ -199,6 +214,7 @@ TCPMinnowSocket<AdaptT>::~TCPMinnowSocket()
       std::cerr << "Warning: unclean shutdown of TCPMinnowSocket\n";
       // force the other side to exit
       _abort.store( true );
+      _wakeup.notify();
       _tcp_thread.join();
     }
   } catch ( const std::exception& e ) {
@@ -289,6 +305,6 @@ void TCPMinnowSocket<AdaptT>::_tcp_main()
     _tcp.reset();
   } catch ( const std::exception& e ) {
     std::cerr << "Exception in TCPConnection runner thread: " << e.what() << "\n";
-    throw e;
+    throw;
   }
 }
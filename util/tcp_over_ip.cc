@@ -1,16 +1,39 @@
 #include "tcp_over_ip.hh"
 
+#include "checksum.hh"
 #include "ipv4_datagram.hh"
 #include "ipv4_header.hh"
 #include "parser.hh"
+#include "tcp_config.hh"
 
-#include <arpa/inet.h>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 #include <unistd.h>
 #include <utility>
 
 using namespace std;
 
+namespace {
+// byte offsets of the fields that differ between the pieces of a segmented TCP message
+constexpr size_t TCP_SEQNO_OFFSET = 4;
+constexpr size_t TCP_FLAGS_OFFSET = 13;
+constexpr size_t TCP_CKSUM_OFFSET = 16;
+
+uint16_t get16( const string& buf, size_t offset )
+{
+  const auto hi = static_cast<uint8_t>( buf.at( offset ) );
+  const auto lo = static_cast<uint8_t>( buf.at( offset + 1 ) );
+  return static_cast<uint16_t>( hi << 8 | lo );
+}
+
+void put16( string& buf, size_t offset, uint16_t val )
+{
+  buf.at( offset ) = static_cast<char>( val >> 8 );
+  buf.at( offset + 1 ) = static_cast<char>( val );
+}
+} // namespace
+
 //! \details This function attempts to parse a TCP segment from
 //! the IP datagram's payload.
 //!
@@ -36,28 +59,23 @@ optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( const InternetDatagra
     return {};
   }
 
-  // does the IPv4 datagram claim that its payload is a TCP segment?
-  if ( ip_dgram.header.proto != IPv4Header::PROTO_TCP ) {
-    return {};
-  }
-
   // is the payload a valid TCP segment?
-  TCPSegment tcp_seg;
-  if ( not parse( tcp_seg, ip_dgram.payload, ip_dgram.header.pseudo_checksum() ) ) {
+  auto demuxed = demux_tcp_in_ip( ip_dgram );
+  if ( not demuxed.has_value() ) {
     return {};
   }
+  auto& [tuple, msg] = demuxed.value();
 
   // is the TCP segment for us?
-  if ( tcp_seg.udinfo.dst_port != config().source.port() ) {
+  if ( tuple.local_port != config().source.port() ) {
     return {};
   }
 
   // should we target this source addr/port (and use its destination addr as our source) in reply?
   if ( listening() ) {
-    if ( tcp_seg.message.sender.SYN and not tcp_seg.message.sender.RST ) {
-      config_mutable().source = Address { inet_ntoa( { htobe32( ip_dgram.header.dst ) } ), config().source.port() };
-      config_mutable().destination
-        = Address { inet_ntoa( { htobe32( ip_dgram.header.src ) } ), tcp_seg.udinfo.src_port };
+    if ( msg.sender.SYN and not msg.sender.RST ) {
+      config_mutable().source = tuple.local_address();
+      config_mutable().destination = tuple.remote_address();
       set_listening( false );
     } else {
       return {};
@@ -65,26 +83,65 @@ optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( const InternetDatagra
   }
 
   // is the TCP segment from our peer?
-  if ( tcp_seg.udinfo.src_port != config().destination.port() ) {
+  if ( tuple.remote_port != config().destination.port() ) {
     return {};
   }
 
-  return tcp_seg.message;
+  return std::move( msg );
+}
+
+//! \details Checks the protocol number and the TCP checksum, but not the addresses or ports
+optional<pair<FourTuple, TCPMessage>> TCPOverIPv4Adapter::demux_tcp_in_ip( const InternetDatagram& ip_dgram )
+{
+  // does the IPv4 datagram claim that its payload is a TCP segment?
+  if ( ip_dgram.header.proto != IPv4Header::PROTO_TCP ) {
+    return {};
+  }
+
+  // is the payload a valid TCP segment?
+  TCPSegment tcp_seg;
+  if ( not parse( tcp_seg, ip_dgram.payload, ip_dgram.header.pseudo_checksum() ) ) {
+    return {};
+  }
+
+  const FourTuple tuple {
+    ip_dgram.header.dst, ip_dgram.header.src, tcp_seg.udinfo.dst_port, tcp_seg.udinfo.src_port };
+  return pair { tuple, std::move( tcp_seg.message ) };
+}
+
+optional<FourTuple> TCPOverIPv4Adapter::peek_tuple( const InternetDatagram& ip_dgram )
+{
+  if ( ip_dgram.header.proto != IPv4Header::PROTO_TCP ) {
+    return {};
+  }
+
+  // the ports are the first two fields of the TCP header
+  Parser parser { ip_dgram.payload };
+  uint16_t src_port {};
+  uint16_t dst_port {};
+  parser.integer( src_port );
+  parser.integer( dst_port );
+  if ( parser.has_error() ) {
+    return {};
+  }
+
+  return FourTuple { ip_dgram.header.dst, ip_dgram.header.src, dst_port, src_port };
 }
 
 //! Takes a TCP segment, sets port numbers as necessary, and wraps it in an IPv4 datagram
-//! \param[in] seg is the TCP segment to convert
-InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( const TCPMessage& msg )
+//! \param[in] tuple identifies the connection (local end is the source)
+//! \param[in] msg is the TCP segment to convert
+InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( const FourTuple& tuple, const TCPMessage& msg )
 {
   TCPSegment seg { .message = msg };
   // set the port numbers in the TCP segment
-  seg.udinfo.src_port = config().source.port();
-  seg.udinfo.dst_port = config().destination.port();
+  seg.udinfo.src_port = tuple.local_port;
+  seg.udinfo.dst_port = tuple.remote_port;
 
   // create an Internet Datagram and set its addresses and length
   InternetDatagram ip_dgram;
-  ip_dgram.header.src = config().source.ipv4_numeric();
-  ip_dgram.header.dst = config().destination.ipv4_numeric();
+  ip_dgram.header.src = tuple.local_ip;
+  ip_dgram.header.dst = tuple.remote_ip;
   ip_dgram.header.len = ip_dgram.header.hlen * 4 + 20 /* tcp header len */ + seg.message.sender.payload.size();
 
   // set payload, calculating TCP checksum using information from IP header
@@ -94,3 +151,61 @@ InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( const TCPMessage& msg )
 
   return ip_dgram;
 }
+
+//! \details Messages that already fit in one segment go through wrap_tcp_in_ip. Larger payloads are cut into
+//! TCPConfig::MAX_PAYLOAD_SIZE pieces. The IPv4 and TCP headers are built and checksummed only once, as templates
+//! with no payload, a zero sequence number, and no SYN or FIN. Each piece copies the templates, patches in its
+//! own length, sequence number, and flags, and updates both checksums incrementally from the templates'
+//! folded sums, so only the piece's own payload has to be summed. SYN rides on the first piece, FIN on the last.
+void TCPOverIPv4Adapter::segment_tcp_in_ip( const FourTuple& tuple,
+                                            const TCPMessage& msg,
+                                            const DatagramTransmitFunction& transmit )
+{
+  const string_view payload = msg.sender.payload;
+  if ( payload.size() <= TCPConfig::MAX_PAYLOAD_SIZE ) {
+    transmit( wrap_tcp_in_ip( tuple, msg ) );
+    return;
+  }
+
+  TCPMessage header_msg { .receiver = msg.receiver };
+  header_msg.sender.RST = msg.sender.RST;
+  const InternetDatagram header_dgram = wrap_tcp_in_ip( tuple, header_msg );
+
+  string tcp_header;
+  for ( const auto& buf : header_dgram.payload ) {
+    tcp_header += buf;
+  }
+
+  // Folded one's-complement sums behind the templates' checksums. Both templates were summed with a payload
+  // length of zero, a zero sequence number, and no SYN/FIN, so each piece just adds its own contributions.
+  const uint32_t ip_sum = static_cast<uint16_t>( ~header_dgram.header.cksum );
+  const uint32_t tcp_sum = static_cast<uint16_t>( ~get16( tcp_header, TCP_CKSUM_OFFSET ) );
+  const uint32_t first_seqno = Wrap32Serializable { msg.sender.seqno }.raw_value();
+
+  for ( size_t offset = 0; offset < payload.size(); offset += TCPConfig::MAX_PAYLOAD_SIZE ) {
+    const string_view piece = payload.substr( offset, TCPConfig::MAX_PAYLOAD_SIZE );
+    const auto piece_len = static_cast<uint16_t>( piece.size() );
+    const bool first = offset == 0;
+    const bool last = offset + piece.size() == payload.size();
+
+    // the SYN occupies the first sequence number; every later piece starts that much further along
+    const uint32_t seqno = first ? first_seqno : first_seqno + msg.sender.SYN + offset;
+    const uint8_t flags
+      = ( first and msg.sender.SYN ? 0b0000'0010U : 0 ) | ( last and msg.sender.FIN ? 0b0000'0001U : 0 );
+
+    InternetChecksum tcp_check { tcp_sum + piece_len + ( seqno >> 16 ) + static_cast<uint16_t>( seqno ) + flags };
+    tcp_check.add( piece );
+
+    InternetDatagram dgram { .header = header_dgram.header, .payload = { tcp_header, string { piece } } };
+    dgram.header.len += piece_len;
+    dgram.header.cksum = InternetChecksum { ip_sum + piece_len }.value();
+
+    string& header = dgram.payload.front();
+    put16( header, TCP_SEQNO_OFFSET, seqno >> 16 );
+    put16( header, TCP_SEQNO_OFFSET + 2, seqno );
+    header.at( TCP_FLAGS_OFFSET ) = static_cast<char>( header.at( TCP_FLAGS_OFFSET ) | flags );
+    put16( header, TCP_CKSUM_OFFSET, tcp_check.value() );
+
+    transmit( dgram );
+  }
+}
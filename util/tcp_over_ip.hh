@@ -1,16 +1,50 @@
 #pragma once
 
+#include "connection_table.hh"
 #include "fd_adapter.hh"
 #include "ipv4_datagram.hh"
 #include "tcp_segment.hh"
 
+#include <functional>
 #include <optional>
+#include <utility>
 
 //! \brief A converter from TCP segments to serialized IPv4 datagrams
 class TCPOverIPv4Adapter : public FdAdapterBase
 {
 public:
+  using DatagramTransmitFunction = std::function<void( const InternetDatagram& )>;
+
   std::optional<TCPMessage> unwrap_tcp_in_ip( const InternetDatagram& ip_dgram );
 
-  InternetDatagram wrap_tcp_in_ip( const TCPMessage& msg );
+  InternetDatagram wrap_tcp_in_ip( const TCPMessage& msg ) { return wrap_tcp_in_ip( tuple(), msg ); }
+
+  //! Wraps a TCP message in IPv4 datagrams carrying at most TCPConfig::MAX_PAYLOAD_SIZE bytes of payload
+  //! each, cutting up "super-segments" produced with TCPConfig::max_payload_size (segmentation offload)
+  void segment_tcp_in_ip( const TCPMessage& msg, const DatagramTransmitFunction& transmit )
+  {
+    segment_tcp_in_ip( tuple(), msg, transmit );
+  }
+
+  //! \name
+  //! Connection-agnostic versions, for stacks that serve many connections over one device
+
+  //!@{
+  //! Parses a TCP segment from an IPv4 datagram, and identifies the connection it belongs to (from the receiving
+  //! end's point of view). Empty if the datagram does not carry a valid TCP segment.
+  static std::optional<std::pair<FourTuple, TCPMessage>> demux_tcp_in_ip( const InternetDatagram& ip_dgram );
+
+  //! Identifies the connection a datagram belongs to from the IP addresses and TCP ports alone, without parsing
+  //! or checking the segment (cheap enough for steering datagrams to the thread that will do so)
+  static std::optional<FourTuple> peek_tuple( const InternetDatagram& ip_dgram );
+
+  static InternetDatagram wrap_tcp_in_ip( const FourTuple& tuple, const TCPMessage& msg );
+
+  static void segment_tcp_in_ip( const FourTuple& tuple,
+                                 const TCPMessage& msg,
+                                 const DatagramTransmitFunction& transmit );
+  //!@}
+
+private:
+  FourTuple tuple() const { return FourTuple::of( config().source, config().destination ); }
 };
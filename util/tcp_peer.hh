@@ -7,8 +7,12 @@
 #include "tcp_sender.hh"
 #include "tcp_sender_message.hh"
 
+#include <algorithm>
+#include <cstdint>
 #include <functional>
 #include <optional>
+#include <span>
+#include <vector>
 
 class TCPPeer
 {
@@ -32,9 +36,54 @@ public:
   {
     cumulative_time_ += t;
     sender_.tick( t, make_send( transmit ) );
+
+    // Has a delayed ACK waited long enough?
+    need_send_ |= ( ack_pending_ and cumulative_time_ >= ack_deadline_ );
+
+    // Once per round trip, resize the send and receive buffers to follow the connection's actual demand.
+    autotune_buffers();
+
+    // Has the application drained enough to reopen a (nearly) closed window? If so, tell the peer right away.
+    need_send_ |= window_reopened();
+
+    if ( need_send_ ) {
+      send( sender_.make_empty_message(), transmit );
+    }
   }
   bool has_ackno() const { return receiver_.send().ackno.has_value(); }
 
+  // For owners that read the inbound stream outside of tick(): if that reopened a (nearly) closed window,
+  // announce it now instead of at the next tick.
+  void window_update( const TransmitFunction& transmit )
+  {
+    if ( window_reopened() ) {
+      send( sender_.make_empty_message(), transmit );
+    }
+  }
+
+  // Milliseconds until tick() next has work to do: a retransmission, a delayed ACK, or the end of the linger
+  // period (after which the peer becomes inactive). Empty if nothing is scheduled, so the owner can sleep until
+  // the next segment or application event; tick() must still be called after every such event.
+  std::optional<uint64_t> ms_until_deadline() const
+  {
+    std::optional<uint64_t> deadline = sender_.ms_until_deadline();
+    const auto consider = [&]( uint64_t at ) {
+      const uint64_t left = at > cumulative_time_ ? at - cumulative_time_ : 0;
+      deadline = std::min( deadline.value_or( left ), left );
+    };
+
+    if ( ack_pending_ ) {
+      consider( ack_deadline_ );
+    }
+
+    const bool streams_finished = receiver_.writer().is_closed() and sender_.reader().is_finished()
+                                  and sender_.sequence_numbers_in_flight() == 0;
+    if ( linger_after_streams_finish_ and streams_finished and active() ) {
+      consider( time_of_last_receipt_ + 10UL * cfg_.rt_timeout );
+    }
+    return deadline;
+  }
+
   /* Is the peer still active? */
   bool active() const
   {
@@ -49,58 +98,280 @@ public:
 
   void receive( TCPMessage msg, const TransmitFunction& transmit )
   {
-    if ( not active() ) {
+    if ( receive_predicted( msg, transmit ) ) {
+      return;
+    }
+    ++prediction_stats_.misses;
+    receive_slow( { &msg, 1 }, transmit );
+  }
+
+  // Receive a burst of messages that arrived together (e.g. in one read cycle). Contiguous in-order payloads
+  // are merged into a single Reassembler insert, and the whole burst is answered with at most one ACK.
+  // The messages are consumed.
+  void receive_batch( std::span<TCPMessage> msgs, const TransmitFunction& transmit )
+  {
+    if ( msgs.size() == 1 ) {
+      receive( std::move( msgs.front() ), transmit );
+      return;
+    }
+    receive_slow( msgs, transmit );
+  }
+
+  // Header-prediction counters (single-segment receives only; bursts always take the full path)
+  struct PredictionStats
+  {
+    uint64_t data_hits {}; // in-order data segments handled by the fast path
+    uint64_t ack_hits {};  // pure ACKs for new data handled by the fast path
+    uint64_t misses {};    // segments that needed the full path
+
+    double hit_rate() const
+    {
+      const uint64_t total = data_hits + ack_hits + misses;
+      return total == 0 ? 0.0 : static_cast<double>( data_hits + ack_hits ) / static_cast<double>( total );
+    }
+  };
+  const PredictionStats& prediction_stats() const { return prediction_stats_; }
+
+  // Testing interface
+  const TCPReceiver& receiver() const { return receiver_; }
+  const TCPSender& sender() const { return sender_; }
+
+private:
+  TCPConfig cfg_;
+  TCPSender sender_ { ByteStream { cfg_.send_capacity }, cfg_.isn, cfg_.rt_timeout, cfg_.max_payload_size };
+  TCPReceiver receiver_ { Reassembler { ByteStream { cfg_.recv_capacity } } };
+
+  bool need_send_ {};
+
+  // Delayed-ACK state (RFC 1122 4.2.3.2): ACK at least every second full-sized segment, and never later than
+  // cfg_.ack_delay milliseconds after the first unacknowledged segment arrived.
+  bool ack_pending_ {};          // is an ACK being held back?
+  uint64_t ack_deadline_ {};     // cumulative time by which the held-back ACK must be sent
+  uint64_t unacked_bytes_ {};    // in-order bytes received since the last ACK we sent
+  uint16_t last_window_sent_ {}; // window advertised in the last segment we sent
+
+  // Header prediction (Van Jacobson, "TCP/IP header prediction", 1990): while a bulk transfer is in progress,
+  // almost every segment is either the next in-order data segment carrying nothing new for our sender, or a
+  // pure ACK for new data. Both are recognized by comparing against the state the last segment left behind,
+  // and handled with only the updates they can actually cause (see receive_predicted).
+  std::optional<Wrap32> rcv_nxt_ {};    // the seqno we expect next (our ackno)
+  std::optional<Wrap32> peer_ackno_ {}; // ackno of the last segment given to the sender
+  uint16_t peer_window_ {};             // window of the last segment given to the sender
+  PredictionStats prediction_stats_ {};
+
+  // Buffer auto-tuning (see autotune_buffers)
+  static constexpr uint64_t MIN_TUNING_INTERVAL_MS = 10;
+  uint64_t tuning_epoch_start_ {};   // cumulative time when the current measurement began
+  uint64_t recv_popped_at_epoch_ {}; // inbound bytes read by the application as of that time
+  uint64_t send_popped_at_epoch_ {}; // outbound bytes sent by the TCPSender as of that time
+  uint64_t advertised_edge_ {};      // right edge (stream index) of the last window we advertised
+
+  std::vector<TCPSenderMessage> batch_ {}; // the sender halves of a burst, kept to reuse its allocation
+
+  bool linger_after_streams_finish_ { true }; // one peer may need to linger to make sure all closure conditions met
+  uint64_t cumulative_time_ {};
+  uint64_t time_of_last_receipt_ {};
+
+  // The full receive path, for any message or burst of messages.
+  void receive_slow( std::span<TCPMessage> msgs, const TransmitFunction& transmit )
+  {
+    if ( msgs.empty() or not active() ) {
       return;
     }
 
     // Record time in case this peer has to linger after streams finish.
     time_of_last_receipt_ = cumulative_time_;
 
-    // If SenderMessage occupies a sequence number, make sure to reply.
-    need_send_ |= ( msg.sender.sequence_length() > 0 );
-
-    // If SenderMessage is a "keep-alive" (with intentionally invalid seqno), make sure to reply.
-    // (N.B. orthodox TCP rules require a reply on any unacceptable segment.)
     const auto our_ackno = receiver_.send().ackno;
-    need_send_ |= ( our_ackno.has_value() and msg.sender.seqno + 1 == our_ackno.value() );
+    uint64_t payload_size = 0;
+    for ( const auto& msg : msgs ) {
+      // If SenderMessage is a "keep-alive" (with intentionally invalid seqno), make sure to reply.
+      // (N.B. orthodox TCP rules require a reply on any unacceptable segment.)
+      const bool keep_alive = our_ackno.has_value() and msg.sender.seqno + 1 == our_ackno.value();
+
+      // SYN, FIN, and RST are acknowledged immediately; only in-order data may have its ACK delayed.
+      need_send_ |= keep_alive or msg.sender.SYN or msg.sender.FIN or msg.sender.RST;
+
+      payload_size += msg.sender.payload.size();
+    }
+
+    // Remember enough to tell afterwards whether the payload arrived in order.
+    const uint64_t bytes_pushed_before = receiver_.writer().bytes_pushed();
+    const bool had_gap = receiver_.reassembler().bytes_pending() > 0;
 
     // Did the inbound stream finish before the outbound stream? If so, no need to linger after streams finish.
     if ( receiver_.writer().is_closed() and not sender_.reader().is_finished() ) {
       linger_after_streams_finish_ = false;
     }
 
-    // Give incoming TCPSenderMessage to receiver.
-    receiver_.receive( std::move( msg.sender ) );
+    // Give incoming TCPSenderMessages to receiver.
+    if ( msgs.size() == 1 ) {
+      receiver_.receive( std::move( msgs.front().sender ) );
+    } else {
+      batch_.clear();
+      for ( auto& msg : msgs ) {
+        batch_.push_back( std::move( msg.sender ) );
+      }
+      receiver_.receive_batch( batch_ );
+    }
+
+    // Give incoming TCPReceiverMessages to sender.
+    for ( const auto& msg : msgs ) {
+      sender_.receive( msg.receiver );
+    }
+
+    // Remember what the next segment should look like if the connection stays on its current course.
+    rcv_nxt_ = receiver_.send().ackno;
+    peer_ackno_ = msgs.back().receiver.ackno;
+    peer_window_ = msgs.back().receiver.window_size;
 
-    // Give incoming TCPReceiverMessage to sender.
-    sender_.receive( msg.receiver );
+    // Out-of-order, duplicate, truncated, or gap-filling data is acknowledged immediately so the sender learns
+    // about the hole (or the full window) quickly. In-order data may wait for a second segment or the ACK delay.
+    if ( payload_size > 0 ) {
+      const bool in_order
+        = not had_gap and receiver_.writer().bytes_pushed() == bytes_pushed_before + payload_size;
+      if ( in_order ) {
+        delay_ack( payload_size );
+      } else {
+        need_send_ = true;
+      }
+    }
 
-    // Send reply if needed.
+    // Send reply if needed. Any segment sent by push() carries the ACK along with it.
     push( transmit );
     if ( need_send_ ) {
       send( sender_.make_empty_message(), transmit );
     }
   }
 
-  // Testing interface
-  const TCPReceiver& receiver() const { return receiver_; }
-  const TCPSender& sender() const { return sender_; }
+  bool receive_predicted( TCPMessage& msg, const TransmitFunction& transmit )
+  {
+    const TCPSenderMessage& seg = msg.sender;
+    const TCPReceiverMessage& ack = msg.receiver;
+    if ( seg.SYN or seg.FIN or seg.RST or ack.RST or not rcv_nxt_.has_value() or seg.seqno != rcv_nxt_.value()
+         or not ack.ackno.has_value() or not peer_ackno_.has_value() or receiver_.reader().has_error()
+         or sender_.writer().has_error() ) {
+      return false;
+    }
 
-private:
-  TCPConfig cfg_;
-  TCPSender sender_ { ByteStream { cfg_.send_capacity }, cfg_.isn, cfg_.rt_timeout };
-  TCPReceiver receiver_ { Reassembler { ByteStream { cfg_.recv_capacity } } };
+    if ( ack.ackno == peer_ackno_ ) {
+      // In-order data that fits: the Reassembler passes it straight through, and the sender has nothing to learn.
+      // (An open receive stream keeps the peer active, so the linger rule cannot apply.)
+      const uint64_t size = seg.payload.size();
+      if ( size == 0 or ack.window_size != peer_window_ or receiver_.writer().is_closed()
+           or receiver_.reassembler().bytes_pending() > 0 or size > receiver_.writer().available_capacity()
+           or sender_.reader().bytes_buffered() > 0 ) {
+        return false;
+      }
+      time_of_last_receipt_ = cumulative_time_;
+      rcv_nxt_ = rcv_nxt_.value() + size;
+      receiver_.receive( std::move( msg.sender ) );
+      delay_ack( size );
+      ++prediction_stats_.data_hits;
+    } else {
+      // A pure ACK for new data (with or without a window update): nothing for the receiver, while the sender
+      // may be able to send more. (Data in flight keeps the peer active.)
+      if ( not seg.payload.empty() or sender_.sequence_numbers_in_flight() == 0 ) {
+        return false;
+      }
+      time_of_last_receipt_ = cumulative_time_;
+      if ( receiver_.writer().is_closed() and not sender_.reader().is_finished() ) {
+        linger_after_streams_finish_ = false;
+      }
+      peer_ackno_ = ack.ackno;
+      peer_window_ = ack.window_size;
+      sender_.receive( ack );
+      push( transmit );
+      ++prediction_stats_.ack_hits;
+    }
 
-  bool need_send_ {};
+    if ( need_send_ ) {
+      send( sender_.make_empty_message(), transmit );
+    }
+    return true;
+  }
+
+  void delay_ack( uint64_t bytes )
+  {
+    unacked_bytes_ += bytes;
+    if ( cfg_.ack_delay == 0 or unacked_bytes_ >= 2 * TCPConfig::MAX_PAYLOAD_SIZE ) {
+      need_send_ = true;
+      return;
+    }
+
+    if ( not ack_pending_ ) {
+      ack_pending_ = true;
+      ack_deadline_ = cumulative_time_ + cfg_.ack_delay;
+    }
+  }
+
+  // Receiver-side silly window avoidance: only announce a window that reopened by a meaningful amount.
+  bool window_reopened() const
+  {
+    if ( not has_ackno() ) {
+      return false;
+    }
+    const uint64_t threshold = std::min<uint64_t>( receiver_.writer().capacity() / 2, TCPConfig::MAX_PAYLOAD_SIZE );
+    const uint64_t window = receiver_.send().window_size;
+    return last_window_sent_ < threshold and window >= last_window_sent_ + threshold;
+  }
+
+  // Buffer auto-tuning (in the spirit of Linux's "dynamic right-sizing"): each ByteStream is sized to twice the
+  // bytes that passed through it in the last round trip -- the application's reads for the receive buffer, the
+  // TCPSender's for the send buffer -- between the configured initial size and ceiling. An idle buffer is halved
+  // back towards the initial size. Without window scaling the advertised window cannot exceed 65535 bytes, so the
+  // receive buffer never grows past that.
+  static uint64_t tuned_capacity( uint64_t current, uint64_t moved, uint64_t initial, uint64_t ceiling )
+  {
+    if ( 2 * moved > current ) {
+      return std::min( ceiling, std::max( 2 * moved, current ) );
+    }
+    if ( 4 * moved < current ) {
+      return std::max( initial, current / 2 );
+    }
+    return current;
+  }
+
+  void autotune_buffers()
+  {
+    const uint64_t rtt = sender_.rtt_estimate().value_or( cfg_.rt_timeout );
+    const uint64_t interval = std::max( rtt, MIN_TUNING_INTERVAL_MS );
+    if ( cumulative_time_ < tuning_epoch_start_ + interval ) {
+      return;
+    }
+
+    const uint64_t recv_popped = receiver_.reader().bytes_popped();
+    const uint64_t send_popped = sender_.reader().bytes_popped();
+
+    const uint64_t recv_ceiling = std::min<uint64_t>( cfg_.recv_capacity_max, UINT16_MAX );
+    if ( recv_ceiling > cfg_.recv_capacity ) {
+      const uint64_t target = tuned_capacity(
+        receiver_.writer().capacity(), recv_popped - recv_popped_at_epoch_, cfg_.recv_capacity, recv_ceiling );
+      // Never pull the right edge of an already-advertised window back in (RFC 9293 3.8.6).
+      const uint64_t edge_floor = advertised_edge_ > recv_popped ? advertised_edge_ - recv_popped : 0;
+      receiver_.set_capacity( std::max( target, edge_floor ) );
+    }
+
+    if ( cfg_.send_capacity_max > cfg_.send_capacity ) {
+      sender_.set_capacity( tuned_capacity( sender_.writer().capacity(),
+                                            send_popped - send_popped_at_epoch_,
+                                            cfg_.send_capacity,
+                                            cfg_.send_capacity_max ) );
+    }
+
+    tuning_epoch_start_ = cumulative_time_;
+    recv_popped_at_epoch_ = recv_popped;
+    send_popped_at_epoch_ = send_popped;
+  }
 
   void send( const TCPSenderMessage& sender_message, const TransmitFunction& transmit )
   {
     TCPMessage msg { sender_message, receiver_.send() };
+    last_window_sent_ = msg.receiver.window_size;
+    advertised_edge_ = receiver_.writer().bytes_pushed() + msg.receiver.window_size;
     transmit( std::move( msg ) );
     need_send_ = false;
+    ack_pending_ = false;
+    unacked_bytes_ = 0;
   }
-
-  bool linger_after_streams_finish_ { true }; // one peer may need to linger to make sure all closure conditions met
-  uint64_t cumulative_time_ {};
-  uint64_t time_of_last_receipt_ {};
 };
@@ -5,6 +5,13 @@
 #include "tcp_sender_message.hh"
 #include "udinfo.hh"
 
+//! A Wrap32 whose raw value can be read, for writing sequence numbers into headers
+class Wrap32Serializable : public Wrap32
+{
+public:
+  uint32_t raw_value() const { return raw_value_; }
+};
+
 struct TCPMessage
 {
   TCPSenderMessage sender {};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "tcp_segment.hh"
+#include "tuntap_adapter.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Helpers shared by the threads of TCPMinnowSocket and TCPDirectSocket
+
+inline constexpr size_t MAX_RECEIVE_BURST = 64; //!< Most datagrams handed to TCPPeer as one batch
+
+//! The earlier of two optional deadlines
+inline std::optional<uint64_t> earliest_deadline( std::optional<uint64_t> a, std::optional<uint64_t> b )
+{
+  if ( not a.has_value() or not b.has_value() ) {
+    return a.has_value() ? a : b;
+  }
+  return std::min( a.value(), b.value() );
+}
+
+//! Poll timeout that ends at the earlier of two deadlines (in ms from now), or -1 (none) if neither is set
+inline int poll_timeout_ms( std::optional<uint64_t> a, std::optional<uint64_t> b )
+{
+  const auto deadline = earliest_deadline( a, b );
+  return deadline.has_value() ? static_cast<int>( std::min<uint64_t>( deadline.value(), INT_MAX ) ) : -1;
+}
+
+//! \brief Read the datagrams already waiting on `adapter`, up to MAX_RECEIVE_BURST, into `burst`
+//! \details The adapter's fd is non-blocking, so reading goes on until a read would block (the fd's read count
+//! stops moving): a burst of N datagrams costs N + 1 reads. A datagram the adapter discards (not for this
+//! connection, or dropped by a lossy adapter) does not end the burst. On a blocking fd, reads only once.
+template<TCPDatagramAdapter AdaptT>
+void read_burst( AdaptT& adapter, std::vector<TCPMessage>& burst )
+{
+  burst.clear();
+  const size_t limit = adapter.fd().non_blocking() ? MAX_RECEIVE_BURST : 1;
+  for ( size_t i = 0; i < limit; ++i ) {
+    const unsigned int reads = adapter.fd().read_count();
+    auto seg = adapter.read();
+    if ( adapter.fd().read_count() == reads ) {
+      break;
+    }
+    if ( seg.has_value() ) {
+      burst.push_back( std::move( seg.value() ) );
+    }
+  }
+}
+
+inline uint64_t timestamp_ms()
+{
+  static_assert( std::is_same<std::chrono::steady_clock::duration, std::chrono::nanoseconds>::value );
+
+  return std::chrono::steady_clock::now().time_since_epoch().count() / 1000000;
+}
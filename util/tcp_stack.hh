@@ -0,0 +1,295 @@
+#pragma once
+
+#include "address.hh"
+#include "buffer_pool.hh"
+#include "connection_table.hh"
+#include "eventfd.hh"
+#include "eventloop.hh"
+#include "file_descriptor.hh"
+#include "io_uring.hh"
+#include "ipv4_header.hh"
+#include "socket.hh"
+#include "spsc_ring.hh"
+#include "tcp_config.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_peer.hh"
+#include "timing_wheel.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
+
+class TCPStack;
+class ShardedTCPStack;
+
+//! A connection handed out by TCPListener::accept()
+struct AcceptedConnection
+{
+  LocalStreamSocket socket; //!< Application's end of the connection
+  Address peer_address;     //!< Remote address and port of the peer
+};
+
+//! \brief Passive opener for a TCPStack, returned by TCPStack::listen()
+//! \details The stack answers SYNs for the listener's address on its own thread. A connection waits in the
+//! SYN-received queue until the three-way handshake completes, then in the established queue until accept()
+//! hands it out. The two queues together hold at most `backlog` connections; further SYNs are dropped, so the
+//! peer retransmits them later. Half-open connections are dropped after TCPConfig::MAX_RETX_ATTEMPTS
+//! retransmissions of the SYN-ACK. Destroying the listener stops listening (connections already accepted are
+//! unaffected).
+class TCPListener
+{
+public:
+  //! Take the next established connection
+  //! \returns std::nullopt if the listener is non-blocking and no connection is ready, or once the listener or
+  //! its stack has shut down; otherwise waits for a connection
+  std::optional<AcceptedConnection> accept();
+
+  //! Should accept() wait for a connection (the default) or return right away?
+  void set_blocking( bool blocking ) { _blocking = blocking; }
+
+  //! Address (and port) this listener accepts connections on; an IP address of 0.0.0.0 matches any
+  const Address& local_address() const { return queues().local_address; }
+
+  //! Number of established connections waiting to be accepted
+  size_t accept_queue_size() const;
+
+  ~TCPListener();
+
+  //! \name
+  //! Move-only (a moved-from listener throws std::runtime_error if used)
+
+  //!@{
+  TCPListener( TCPListener&& other ) noexcept = default;
+  TCPListener& operator=( TCPListener&& other ) noexcept;
+  TCPListener( const TCPListener& ) = delete;
+  TCPListener& operator=( const TCPListener& ) = delete;
+  //!@}
+
+private:
+  friend class TCPStack;
+  friend class ShardedTCPStack;
+
+  //! State shared between the listener and the stack thread
+  struct Queues
+  {
+    Address local_address;
+    size_t backlog;
+    mutable std::mutex mutex {};
+    std::condition_variable ready {};
+    std::deque<AcceptedConnection> established {}; //!< Handshake complete, waiting for accept()
+    size_t syn_received {};                        //!< Handshake in progress
+    bool closed {};                                //!< No longer listening
+
+    //! Does `tuple` belong to this listener?
+    bool matches( const FourTuple& tuple ) const;
+  };
+
+  std::shared_ptr<Queues> _queues;
+  bool _blocking { true };
+
+  explicit TCPListener( std::shared_ptr<Queues> queues ) : _queues( std::move( queues ) ) {}
+
+  //! The shared state (throws if the listener was moved from)
+  Queues& queues() const;
+
+  //! Stop listening and wake up anyone waiting in accept()
+  void close();
+};
+
+//! \brief A user-space TCP stack that serves many connections over one IPv4 datagram device
+//! \details One thread and one EventLoop carry every connection. Datagrams read from the device are routed to
+//! their TCPPeer through a ConnectionTable keyed by FourTuple, and every peer writes its segments back out
+//! through the same device. As with TCPMinnowSocket, the application talks to each connection through its own
+//! LocalStreamSocket; the stack thread copies bytes between those sockets and the TCPPeers.
+//!
+//! Each connection's next deadline (retransmission, delayed ACK, or the end of lingering) is a timer in one
+//! TimingWheel. The stack thread only ticks connections that had an event or whose timer fired, so idle
+//! connections cost nothing however many there are.
+//!
+//! By default the device is read and written with one system call per datagram. With DeviceIO::IOUring, reads
+//! and writes go through an IOUringDatagramDevice instead: everything received between two wakeups is handed
+//! over at once, and every datagram sent in one pass of the stack thread leaves in one batch.
+class TCPStack
+{
+public:
+  //! How the stack thread reads and writes the device
+  enum class DeviceIO
+  {
+    Syscalls, //!< [read(2)](\ref man2::read) and [write(2)](\ref man2::write), one datagram at a time
+    IOUring   //!< Batched through io_uring (throws unix_error if the kernel does not support it)
+  };
+
+  //! Take over a device that reads and writes one IPv4 datagram at a time (e.g., a TunFD)
+  explicit TCPStack( FileDescriptor&& ip_device, DeviceIO io = DeviceIO::Syscalls );
+
+  //! Stop the stack thread; connections still open are abandoned
+  ~TCPStack();
+
+  //! Open a connection from `local` to `remote` (may be called from any thread)
+  //! \returns the application's end of the connection, which reaches EOF when the connection is over
+  LocalStreamSocket connect( const TCPConfig& c_tcp, const Address& local, const Address& remote );
+
+  //! Start accepting connections addressed to `local` (may be called from any thread)
+  //! \param[in] c_tcp is the configuration of every accepted connection
+  //! \param[in] backlog is the most connections that may be either mid-handshake or waiting for accept()
+  TCPListener listen( const TCPConfig& c_tcp, const Address& local, size_t backlog );
+
+  //! Number of connections being served
+  size_t connection_count() const { return _connection_count.load(); }
+
+  //! Counters kept by the stack thread
+  struct Stats
+  {
+    uint64_t segments_received {};  //!< Valid TCP segments read (or handed over by a ShardedTCPStack)
+    uint64_t segments_unmatched {}; //!< ... of which matched no connection (and opened none)
+    uint64_t datagrams_sent {};
+    uint64_t datagrams_dropped {}; //!< Not sent because the device could not take them (e.g., its queue was full)
+    uint64_t connections_opened {}; //!< Active and passive opens
+  };
+
+  //! Snapshot of the counters (may be called from any thread)
+  Stats stats() const;
+
+  //! Record the timing of the stack thread's EventLoop rules, or stop (may be called from any thread)
+  void set_instrumented( bool instrumented );
+
+  //! The timing recorded so far, to find the rules that keep the stack thread busy (may be called from any
+  //! thread; waits for the stack thread to take the snapshot)
+  EventLoop::Snapshot eventloop_snapshot();
+
+  //! \name
+  //! The stack thread holds pointers into this object, so it can be neither copied nor moved
+
+  //!@{
+  TCPStack( const TCPStack& ) = delete;
+  TCPStack( TCPStack&& ) = delete;
+  TCPStack& operator=( const TCPStack& ) = delete;
+  TCPStack& operator=( TCPStack&& ) = delete;
+  //!@}
+
+private:
+  friend class ShardedTCPStack;
+
+  //! Largest datagram read from the device
+  static constexpr size_t kDatagramBufferSize = IPv4Header::LENGTH + FileDescriptor::kReadBufferSize;
+
+  //! State of one connection, owned by the stack thread
+  struct Connection
+  {
+    FourTuple tuple;
+    TCPPeer peer;
+    LocalStreamSocket app;              //!< Stack's end of the socket pair shared with the application
+    TCPPeer::TransmitFunction transmit; //!< Sends segments out through the device, addressed by `tuple`
+    std::vector<EventLoop::RuleHandle> rules {};
+    bool inbound_shutdown {};  //!< Has the inbound stream been delivered in full (or failed)?
+    bool outbound_shutdown {}; //!< Has the application finished writing?
+
+    uint64_t clock {};                                       //!< Time (ms) up to which `peer` has been ticked
+    std::optional<TimingWheel<Connection*>::Timer> timer {}; //!< Pending at `timer_expiry`, if set
+    uint64_t timer_expiry {};
+    bool touched {}; //!< Is the connection in _touched?
+
+    //! For a passive open still in SYN-received state: the listener that will hand out the connection, and the
+    //! application's end of the socket pair
+    std::shared_ptr<TCPListener::Queues> listener {};
+    std::optional<LocalStreamSocket> unaccepted {};
+  };
+
+  //! A listen() registration
+  struct Listening
+  {
+    TCPConfig config;
+    std::shared_ptr<TCPListener::Queues> queues;
+  };
+
+  //! A connect() request, waiting for the stack thread to pick it up
+  struct PendingConnect
+  {
+    TCPConfig config;
+    FourTuple tuple;
+    LocalStreamSocket socket;
+  };
+
+  //! Datagrams steered to this stack by a ShardedTCPStack, which reads the device on the stack's behalf
+  struct Inbound
+  {
+    SPSCRing<InternetDatagram> ring;
+    EventFD ready {}; //!< Readable when the ring may have new datagrams
+
+    explicit Inbound( size_t capacity ) : ring( capacity ) {}
+  };
+
+  FileDescriptor _device;
+  std::unique_ptr<Inbound> _inbound;                //!< If set, the device is only written
+  std::unique_ptr<IOUringDatagramDevice> _io_uring; //!< If set, the device is read and written through it
+  uint64_t _writes_failed_counted {};               //!< Failed writes of `_io_uring` already counted as dropped
+  EventLoop _eventloop {};
+  ConnectionTable<std::unique_ptr<Connection>> _connections {};
+  TimingWheel<Connection*> _timers;
+  std::vector<Connection*> _touched {}; //!< Connections that had events since the last _settle()
+
+  //! Rule categories shared by every connection's rules
+  size_t _push_category {};
+  size_t _pull_category {};
+
+  //! Requests from application threads, and the socket pair used to wake the stack thread up for them
+  std::mutex _pending_mutex {};
+  std::vector<PendingConnect> _pending_connects {};
+  bool _wakeup_pending {};
+  std::vector<Listening> _listeners {}; //!< Also guarded by _pending_mutex
+  LocalStreamSocket _wakeup_sender;
+  LocalStreamSocket _wakeup_receiver;
+
+  BufferPool _receive_buffers { kDatagramBufferSize, 4 }; //!< Datagrams read from the device (stack thread only)
+
+  std::default_random_engine _isn_generator; //!< Initial sequence numbers of passive opens (stack thread only)
+
+  std::atomic_bool _abort { false };
+  std::atomic<size_t> _connection_count { 0 };
+
+  //! Written only by the stack thread
+  struct
+  {
+    std::atomic<uint64_t> segments_received { 0 };
+    std::atomic<uint64_t> segments_unmatched { 0 };
+    std::atomic<uint64_t> datagrams_sent { 0 };
+    std::atomic<uint64_t> datagrams_dropped { 0 };
+    std::atomic<uint64_t> connections_opened { 0 };
+  } _counters {};
+
+  std::thread _thread {};
+
+  //! A stack that reads its datagrams from `inbound` instead of `ip_device`
+  TCPStack( FileDescriptor&& ip_device, std::unique_ptr<Inbound> inbound );
+
+  TCPStack( FileDescriptor&& ip_device,
+            DeviceIO io,
+            std::unique_ptr<Inbound> inbound,
+            std::pair<LocalStreamSocket, LocalStreamSocket> wakeup_pair );
+
+  void _listen( const TCPConfig& c_tcp, std::shared_ptr<TCPListener::Queues> queues );
+
+  void _wake_up();
+  void _main();
+  void _take_pending();
+  Connection* _add_connection( const TCPConfig& config, const FourTuple& tuple, LocalStreamSocket&& socket );
+  bool _passive_open( const FourTuple& tuple, TCPMessage&& syn );
+  void _finish_handshake( Connection& c );
+  void _receive_datagrams();
+  void _receive_steered();
+  void _receive_datagram( const InternetDatagram& dgram );
+  void _touch( Connection& c );
+  void _catch_up( Connection& c, uint64_t now );
+  void _settle( Connection& c, uint64_t now );
+  void _remove( const FourTuple& tuple );
+  void _write_datagram( const InternetDatagram& dgram );
+  void _count_failed_writes();
+};
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+//! \brief Hashed hierarchical timing wheel (Varghese and Lauck, 1987) with a resolution of one millisecond
+//! \details Timers sit on intrusive doubly-linked lists in LEVELS wheels of SLOTS slots each. Level 0 holds the
+//! timers due in the next SLOTS milliseconds, one slot per millisecond; each level above spans SLOTS times as
+//! much time as the one below, and a slot there is cascaded (its timers refiled on lower levels) when the clock
+//! reaches the start of its span. Scheduling, rescheduling and cancelling are O(1). Advancing the clock costs
+//! only the timers that fire or cascade: an occupancy bitmap per level lets advance() jump straight over
+//! stretches of time in which nothing happens, however long.
+//!
+//! Timers more than the wheel's span (about 12 days) ahead are parked on the top level and refiled as time
+//! passes, so they still fire on time.
+template<class T>
+class TimingWheel
+{
+public:
+  //! Names a scheduled timer. Cancelling or rescheduling a timer that has already fired (or been cancelled) is
+  //! harmless, even if its storage has since been reused.
+  struct Timer
+  {
+    uint32_t index;
+    uint32_t generation;
+  };
+
+  //! \param[in] now is the current time, in milliseconds on the caller's clock
+  explicit TimingWheel( uint64_t now ) : now_( now ) { heads_.fill( NIL ); }
+
+  //! Schedule `value` to be handed to the `fire` function of advance() at time `expiry` (or, if advance() has
+  //! already reached that time, at the next advance() to a later time)
+  Timer schedule( uint64_t expiry, T value )
+  {
+    uint32_t index = free_;
+    if ( index == NIL ) {
+      index = static_cast<uint32_t>( nodes_.size() );
+      nodes_.emplace_back();
+    } else {
+      free_ = nodes_[index].next;
+    }
+
+    Node& node = nodes_[index];
+    node.value = std::move( value );
+    node.expiry = expiry;
+    file( index );
+    ++size_;
+    return { index, node.generation };
+  }
+
+  //! Move a pending timer to a new expiry time
+  //! \returns false (doing nothing) if the timer has already fired or been cancelled
+  bool reschedule( Timer timer, uint64_t expiry )
+  {
+    if ( not pending( timer ) ) {
+      return false;
+    }
+    unlink( timer.index );
+    nodes_[timer.index].expiry = expiry;
+    file( timer.index );
+    return true;
+  }
+
+  //! Cancel a pending timer (does nothing if it has already fired or been cancelled)
+  void cancel( Timer timer )
+  {
+    if ( pending( timer ) ) {
+      unlink( timer.index );
+      release( timer.index );
+    }
+  }
+
+  //! Move the clock forward to `now`, calling `fire( T& )` for each timer due by then (in order of expiry,
+  //! to the millisecond). `fire` may schedule, reschedule and cancel timers.
+  template<class F>
+  void advance( uint64_t now, F&& fire )
+  {
+    while ( now_ <= now ) {
+      const uint64_t next = next_event().value_or( std::numeric_limits<uint64_t>::max() );
+      if ( next > now ) {
+        now_ = now + 1;
+        return;
+      }
+      now_ = next;
+
+      // At the start of a level's span, refile the timers of the slot that span belongs to.
+      for ( size_t level = 1; level < LEVELS and ( now_ & ( span( level ) - 1 ) ) == 0; ++level ) {
+        cascade( level, ( now_ >> ( level * BITS ) ) & MASK );
+      }
+
+      const size_t bucket = now_ & MASK;
+      ++now_;
+      while ( heads_[bucket] != NIL ) {
+        const uint32_t index = heads_[bucket];
+        unlink( index );
+        T value = std::move( nodes_[index].value );
+        release( index );
+        fire( value );
+      }
+    }
+  }
+
+  //! Earliest time at which advance() has anything to do: a timer fires, or a slot is cascaded (which is never
+  //! later than the earliest expiry)
+  //! \returns std::nullopt if no timer is pending
+  std::optional<uint64_t> next_event() const
+  {
+    std::optional<uint64_t> next;
+    for ( size_t level = 0; level < LEVELS; ++level ) {
+      if ( occupied_[level] == 0 ) {
+        continue;
+      }
+      // the first span on this level that starts at or after now_, then the first occupied slot from there
+      const size_t shift = level * BITS;
+      const uint64_t first = ( now_ + span( level ) - 1 ) >> shift;
+      const uint64_t start = ( first + std::countr_zero( std::rotr( occupied_[level], first & MASK ) ) ) << shift;
+      next = std::min( next.value_or( start ), start );
+    }
+    return next;
+  }
+
+  //! Number of pending timers
+  size_t size() const { return size_; }
+
+private:
+  static constexpr size_t BITS = 6;
+  static constexpr size_t SLOTS = size_t { 1 } << BITS; // one bit of an occupancy bitmap per slot
+  static constexpr uint64_t MASK = SLOTS - 1;
+  static constexpr size_t LEVELS = 5;
+  static constexpr uint32_t NIL = std::numeric_limits<uint32_t>::max();
+
+  static constexpr uint64_t span( size_t level ) { return uint64_t { 1 } << ( level * BITS ); }
+
+  struct Node
+  {
+    T value {};
+    uint64_t expiry {};
+    uint32_t prev { NIL };
+    uint32_t next { NIL }; // also links the free list
+    uint32_t bucket { NIL };
+    uint32_t generation {};
+  };
+
+  std::vector<Node> nodes_ {};
+  uint32_t free_ { NIL };
+  std::array<uint32_t, LEVELS * SLOTS> heads_ {};
+  std::array<uint64_t, LEVELS> occupied_ {};
+  uint64_t now_; // the next millisecond to be processed
+  size_t size_ {};
+
+  bool pending( Timer timer ) const
+  {
+    return timer.index < nodes_.size() and nodes_[timer.index].generation == timer.generation
+           and nodes_[timer.index].bucket != NIL;
+  }
+
+  //! Put a node on the slot of the lowest level whose span covers the time left until it is due
+  void file( uint32_t index )
+  {
+    Node& node = nodes_[index];
+    const uint64_t due = std::clamp( node.expiry, now_, now_ + span( LEVELS ) - 1 );
+    const uint64_t left = due - now_;
+    const size_t level = left == 0 ? 0 : ( std::bit_width( left ) - 1 ) / BITS;
+    const size_t slot = ( due >> ( level * BITS ) ) & MASK;
+
+    node.bucket = static_cast<uint32_t>( level * SLOTS + slot );
+    node.prev = NIL;
+    node.next = heads_[node.bucket];
+    if ( node.next != NIL ) {
+      nodes_[node.next].prev = index;
+    }
+    heads_[node.bucket] = index;
+    occupied_[level] |= uint64_t { 1 } << slot;
+  }
+
+  void unlink( uint32_t index )
+  {
+    Node& node = nodes_[index];
+    if ( node.prev == NIL ) {
+      heads_[node.bucket] = node.next;
+      if ( node.next == NIL ) {
+        occupied_[node.bucket / SLOTS] &= ~( uint64_t { 1 } << ( node.bucket % SLOTS ) );
+      }
+    } else {
+      nodes_[node.prev].next = node.next;
+    }
+    if ( node.next != NIL ) {
+      nodes_[node.next].prev = node.prev;
+    }
+    node.bucket = NIL;
+  }
+
+  void release( uint32_t index )
+  {
+    Node& node = nodes_[index];
+    node.value = T {};
+    ++node.generation;
+    node.next = free_;
+    free_ = index;
+    --size_;
+  }
+
+  //! Refile every timer of one slot; each lands on a lower level (or, if parked, back on a later top slot)
+  void cascade( size_t level, size_t slot )
+  {
+    const size_t bucket = level * SLOTS + slot;
+    uint32_t index = std::exchange( heads_[bucket], NIL );
+    occupied_[level] &= ~( uint64_t { 1 } << slot );
+    while ( index != NIL ) {
+      const uint32_t next = nodes_[index].next;
+      file( index );
+      index = next;
+    }
+  }
+};
@@ -8,6 +8,9 @@ optional<TCPMessage> TCPOverIPv4OverTunFdAdapter::read()
   vector<string> strs( 2 );
   strs.front().resize( IPv4Header::LENGTH );
   _tun.read( strs );
+  if ( strs.empty() ) {
+    return {}; // the TUN device is non-blocking and had nothing to read
+  }
 
   InternetDatagram ip_dgram;
   const vector<string> buffers = { strs.at( 0 ), strs.at( 1 ) };
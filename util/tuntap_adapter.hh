@@ -32,8 +32,11 @@ public:
   //! Attempts to read and parse an IPv4 datagram containing a TCP segment related to the current connection
   std::optional<TCPMessage> read();
 
-  //! Creates an IPv4 datagram from a TCP segment and writes it to the TUN device
-  void write( const TCPMessage& seg ) { _tun.write( serialize( wrap_tcp_in_ip( seg ) ) ); }
+  //! Creates IPv4 datagrams from a TCP segment (segmenting it if needed) and writes them to the TUN device
+  void write( const TCPMessage& seg )
+  {
+    segment_tcp_in_ip( seg, [&]( const InternetDatagram& dgram ) { _tun.write( serialize( dgram ) ); } );
+  }
 
   //! Access the underlying TUN device
   explicit operator TunFD&() { return _tun; }
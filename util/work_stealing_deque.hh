@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+//! \brief Chase-Lev work-stealing deque: the owner thread pushes and pops at the bottom, any thread steals from
+//! the top
+//! \details Follows the C11 formulation of Lê, Pop, Cohen and Zappa Nardelli (PPoPP 2013). The owner's push and
+//! pop touch only `bottom_` (and, for the last element, race stealers with one compare-and-swap on `top_`), so a
+//! worker working through its own tasks shares no cache line with the others. The array grows by doubling when
+//! full; arrays it has outgrown are kept until destruction, since a stealer may still be reading one.
+//! Elements must be trivially copyable (typically pointers), as a stealer may read a slot the owner is
+//! overwriting and then discard the value.
+template<class T>
+class WorkStealingDeque
+{
+  static_assert( std::is_trivially_copyable_v<T> );
+
+  static constexpr size_t CACHE_LINE = 64;
+
+  struct Array
+  {
+    size_t mask;
+    std::unique_ptr<std::atomic<T>[]> slots;
+
+    explicit Array( size_t capacity ) : mask( capacity - 1 ), slots( new std::atomic<T>[capacity] ) {}
+    size_t capacity() const { return mask + 1; }
+    T load( int64_t i ) const { return slots[i & mask].load( std::memory_order_relaxed ); }
+    void store( int64_t i, T value ) { slots[i & mask].store( value, std::memory_order_relaxed ); }
+  };
+
+  alignas( CACHE_LINE ) std::atomic<int64_t> top_ { 0 }; // next element to steal
+  alignas( CACHE_LINE ) std::atomic<int64_t> bottom_ { 0 };  // next slot to push (written by the owner)
+  std::atomic<Array*> array_ { nullptr };
+  std::vector<std::unique_ptr<Array>> arrays_ {}; // the current array and every array outgrown (owner only)
+
+  Array* grow( Array* old, int64_t top, int64_t bottom )
+  {
+    arrays_.push_back( std::make_unique<Array>( old->capacity() * 2 ) );
+    Array* const bigger = arrays_.back().get();
+    for ( int64_t i = top; i < bottom; ++i ) {
+      bigger->store( i, old->load( i ) );
+    }
+    array_.store( bigger, std::memory_order_release );
+    return bigger;
+  }
+
+public:
+  //! \param[in] capacity is the initial capacity (a power of two)
+  explicit WorkStealingDeque( size_t capacity = 256 )
+  {
+    arrays_.push_back( std::make_unique<Array>( capacity ) );
+    array_.store( arrays_.back().get(), std::memory_order_relaxed );
+  }
+
+  WorkStealingDeque( const WorkStealingDeque& ) = delete;
+  WorkStealingDeque& operator=( const WorkStealingDeque& ) = delete;
+
+  //! Owner only
+  void push( T value )
+  {
+    const int64_t bottom = bottom_.load( std::memory_order_relaxed );
+    const int64_t top = top_.load( std::memory_order_acquire );
+    Array* array = array_.load( std::memory_order_relaxed );
+    if ( bottom - top > static_cast<int64_t>( array->capacity() ) - 1 ) {
+      array = grow( array, top, bottom );
+    }
+    array->store( bottom, value );
+    std::atomic_thread_fence( std::memory_order_release );
+    bottom_.store( bottom + 1, std::memory_order_relaxed );
+  }
+
+  //! Owner only: take the most recently pushed element
+  //! \returns std::nullopt if the deque is empty
+  std::optional<T> pop()
+  {
+    const int64_t bottom = bottom_.load( std::memory_order_relaxed ) - 1;
+    Array* const array = array_.load( std::memory_order_relaxed );
+    bottom_.store( bottom, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    int64_t top = top_.load( std::memory_order_relaxed );
+
+    if ( top > bottom ) { // empty
+      bottom_.store( bottom + 1, std::memory_order_relaxed );
+      return std::nullopt;
+    }
+
+    const T value = array->load( bottom );
+    if ( top == bottom ) { // the last element: race the stealers for it
+      const bool won
+        = top_.compare_exchange_strong( top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed );
+      bottom_.store( bottom + 1, std::memory_order_relaxed );
+      if ( not won ) {
+        return std::nullopt;
+      }
+    }
+    return value;
+  }
+
+  //! Any thread: take the least recently pushed element
+  //! \returns std::nullopt if the deque is empty, or if another thread took the element first
+  std::optional<T> steal()
+  {
+    int64_t top = top_.load( std::memory_order_acquire );
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    const int64_t bottom = bottom_.load( std::memory_order_acquire );
+    if ( top >= bottom ) {
+      return std::nullopt;
+    }
+
+    const T value = array_.load( std::memory_order_acquire )->load( top );
+    if ( not top_.compare_exchange_strong( top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) ) {
+      return std::nullopt;
+    }
+    return value;
+  }
+
+  //! Any thread; only a hint while other threads are pushing or taking
+  bool empty() const
+  {
+    return bottom_.load( std::memory_order_relaxed ) <= top_.load( std::memory_order_relaxed );
+  }
+};
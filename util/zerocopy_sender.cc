@@ -0,0 +1,97 @@
+#include "zerocopy_sender.hh"
+
+#include <chrono>
+#include <iostream>
+#include <poll.h>
+
+using namespace std;
+
+ZeroCopySender::ZeroCopySender( TCPSocket& socket, const size_t threshold )
+  : _socket( socket ), _threshold( threshold )
+{
+  _socket.set_zerocopy();
+}
+
+//! \details Freeing a buffer the kernel may still be sending from would corrupt the stream, so if the kernel has
+//! not finished with the held buffers after ten seconds (or the socket fails), they are leaked instead.
+ZeroCopySender::~ZeroCopySender()
+{
+  try {
+    reap();
+    const auto deadline = chrono::steady_clock::now() + chrono::seconds { 10 };
+    while ( not _held.empty() and chrono::steady_clock::now() < deadline ) {
+      pollfd pfd { _socket.fd_num(), 0, 0 }; // the error queue shows up as POLLERR, which is always polled
+      ::poll( &pfd, 1, 100 );
+      reap();
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception waiting for zero-copy completions: " << e.what() << "\n";
+  }
+
+  if ( not _held.empty() ) {
+    cerr << "ZeroCopySender: leaking " << _held.size() << " buffers the kernel has not released\n";
+    static_cast<void>( new deque<Buffer>( move( _held ) ) ); // NOLINT(*-owning-memory)
+  }
+}
+
+void ZeroCopySender::push( string data )
+{
+  if ( data.empty() ) {
+    return;
+  }
+  _bytes_unsent += data.size();
+  _unsent.push_back( { move( data ) } );
+}
+
+void ZeroCopySender::send()
+{
+  while ( not _unsent.empty() and _write_front() > 0 ) {}
+}
+
+size_t ZeroCopySender::_write_front()
+{
+  Buffer& front = _unsent.front();
+  const string_view remaining = string_view { front.data }.substr( front.offset );
+
+  size_t written = 0;
+  optional<size_t> zerocopy_written;
+  if ( remaining.size() >= _threshold and ( zerocopy_written = _socket.write_zerocopy( remaining ) ) ) {
+    written = zerocopy_written.value();
+    if ( written > 0 ) {
+      front.last_write = _next_write++;
+      ++_zerocopy_writes;
+    }
+  } else {
+    written = _socket.try_write( remaining );
+    _plain_writes += written > 0;
+  }
+
+  front.offset += written;
+  _bytes_unsent -= written;
+  if ( front.offset == front.data.size() ) {
+    if ( front.last_write and static_cast<int32_t>( front.last_write.value() - _completed ) >= 0 ) {
+      _held.push_back( move( front ) );
+    }
+    _unsent.pop_front();
+  }
+  return written;
+}
+
+void ZeroCopySender::reap()
+{
+  _completions.clear();
+  _socket.read_zerocopy_completions( _completions );
+
+  for ( const auto& completion : _completions ) {
+    if ( completion.copied ) {
+      _copied_writes += completion.last - completion.first + 1;
+    }
+    if ( static_cast<int32_t>( completion.last + 1 - _completed ) > 0 ) {
+      _completed = completion.last + 1;
+    }
+  }
+
+  while ( not _held.empty() and static_cast<int32_t>( _held.front().last_write.value() - _completed ) < 0 ) {
+    _held.pop_front();
+  }
+}
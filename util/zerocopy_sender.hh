@@ -0,0 +1,83 @@
+#pragma once
+
+#include "socket.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <vector>
+
+//! \brief Sends buffers on a TCPSocket with MSG_ZEROCOPY, keeping each one alive until the kernel is done with it
+//! \details A buffer handed to push() is owned by the sender from then on. send() writes the queued buffers in
+//! order: a buffer with at least `threshold` bytes left to send goes out with TCPSocket::write_zerocopy (pinning
+//! its pages costs more than copying a small buffer), anything smaller with a plain copying write. A buffer sent
+//! by zero-copy is held until reap() sees the completion of the last write from it; TCP completes writes in
+//! order, as their bytes are acknowledged.
+//!
+//! The kernel signals completions by making the socket's error queue readable, which poll reports as an error on
+//! the socket; to have an EventLoop reap them, see EventLoop::set_error_queue_handler. The sender must be the only
+//! user of MSG_ZEROCOPY on its socket, since it numbers the writes itself.
+//!
+//! Its owner should keep reaping, from its event loop, until buffers_held() is zero before destroying the sender
+//! (as bidirectional_stream_copy does). The destructor blocks while it waits out any buffers still held, and
+//! leaks those the kernel has not released after ten seconds; that is a last resort, not a way to shut down.
+class ZeroCopySender
+{
+public:
+  static constexpr size_t kDefaultThreshold = 16384;
+
+  //! Turn on SO_ZEROCOPY for `socket`
+  explicit ZeroCopySender( TCPSocket& socket, size_t threshold = kDefaultThreshold );
+
+  //! \brief Wait (up to ten seconds, blocking) for the kernel to finish with the buffers still held, then leak any
+  //! it has not released
+  ~ZeroCopySender();
+
+  //! Queue `data` to be sent after what is already queued
+  void push( std::string data );
+
+  //! Write as much of the queued data as the socket takes without blocking (or, if it is blocking, all of it)
+  void send();
+
+  //! Release the buffers whose zero-copy writes have completed
+  void reap();
+
+  size_t bytes_unsent() const { return _bytes_unsent; } //!< Queued bytes not yet written to the socket
+  size_t buffers_held() const { return _held.size(); }  //!< Buffers written, awaiting the kernel
+
+  uint64_t zerocopy_writes() const { return _zerocopy_writes; } //!< Writes made with MSG_ZEROCOPY
+  uint64_t copied_writes() const { return _copied_writes; }     //!< ... of which the kernel copied anyway
+  uint64_t plain_writes() const { return _plain_writes; }       //!< Writes made with a copy
+
+  ZeroCopySender( const ZeroCopySender& ) = delete;
+  ZeroCopySender& operator=( const ZeroCopySender& ) = delete;
+  ZeroCopySender( ZeroCopySender&& ) = delete;
+  ZeroCopySender& operator=( ZeroCopySender&& ) = delete;
+
+private:
+  struct Buffer
+  {
+    std::string data;
+    size_t offset {};                      //!< Bytes already written
+    std::optional<uint32_t> last_write {}; //!< Number of the last zero-copy write from `data`, if any
+  };
+
+  TCPSocket& _socket;
+  size_t _threshold;
+
+  std::deque<Buffer> _unsent {};
+  size_t _bytes_unsent {};
+  std::deque<Buffer> _held {};
+  uint32_t _next_write {}; //!< Number the kernel will give the next zero-copy write
+  uint32_t _completed {};  //!< Every zero-copy write numbered below this has completed
+  std::vector<TCPSocket::ZeroCopyCompletion> _completions {};
+
+  uint64_t _zerocopy_writes {};
+  uint64_t _copied_writes {};
+  uint64_t _plain_writes {};
+
+  //! Write from the front buffer once; returns the number of bytes written
+  size_t _write_front();
+};